@@ -36,12 +36,14 @@
   10. BLD_VERBOSE_1                 : No verbose output in the tool. Only prints errors. No INFO or WARNING messages.
   11. BLD_VERBOSE_2                 : Only prints errors and warning. No INFO messages.
     Verbosity is full by default.
+  12. BLD_NO_TRACE                  : Compile out bld::trace (Chrome trace recording of builds).
 */
 
 #pragma once
 
 #include <functional>
 #include <limits>
+#include <memory>
 #ifdef _WIN32
   #define WIN32_LEAN_AND_MEAN
   #define _WINUSER_
@@ -57,18 +59,51 @@
   #include <sys/wait.h>
   #include <unistd.h>
   #include <fcntl.h>
+  #include <signal.h>
+  #include <pthread.h>
+  #include <sched.h>
+  #include <sys/resource.h>
+  #include <sys/stat.h>
+  #include <sys/syscall.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <sys/mman.h>
+  #include <netdb.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <poll.h>
+  #include <dirent.h>
+  #ifdef __linux__
+    #include <sys/inotify.h>
+    #include <sys/ioctl.h>
+    #include <sys/sendfile.h>
+    #include <linux/fs.h>
+    #if __has_include(<linux/io_uring.h>)
+      #include <linux/io_uring.h>
+      #define BLD_HAS_IO_URING
+    #endif
+  #endif
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <condition_variable>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <deque>
+#include <iterator>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <filesystem>
 
@@ -116,7 +151,9 @@ namespace bld
       RUNNING,     // Currently executing
       EXITED,      // Exited normally
       SIGNALLED,   // Terminated by signal (Unix only)
-      WAIT_ERROR   // Error during wait operation
+      WAIT_ERROR,  // Error during wait operation
+      TIMED_OUT,   // Killed after its deadline passed
+      CANCELLED    // Killed by bld::cancel()
     };
 
     // Single process handle
@@ -127,6 +164,10 @@ namespace bld
       State state   = State::INIT_ERROR;
       int exit_code = 0;
       std::string label{""};
+      std::chrono::steady_clock::time_point started{};   // Used for Proc_usage::wall_ms
+      std::chrono::steady_clock::time_point deadline{};  // Terminate after this point, {} = never
+      std::chrono::milliseconds kill_grace{2000};        // SIGTERM -> SIGKILL delay once terminated
+      bool own_group = false;                            // Child leads its own process group (Unix)
 
     #ifndef _WIN32
       int signal = 0;
@@ -138,7 +179,7 @@ namespace bld
       // Constructors
       Proc() = default;
 
-      explicit Proc(pid_t p) : p_id(p)
+      explicit Proc(pid_t p) : p_id(p), started(std::chrono::steady_clock::now())
       {
         if (p > 0)
         {
@@ -150,6 +191,7 @@ namespace bld
     #ifdef _WIN32
       Proc(HANDLE proc_handle, HANDLE thread_handle, pid_t pid) : pid(pid), process_handle(proc_handle), thread_handle(thread_handle)
       {
+        started = std::chrono::steady_clock::now();
         if (proc_handle != nullptr)
         {
           ok = true;
@@ -168,19 +210,48 @@ namespace bld
 
       // State queries
       bool is_running() const { return ok && state == State::RUNNING; }
-      bool has_exited() const { return state == State::EXITED || state == State::SIGNALLED; }
+      bool has_exited() const
+      {
+        return state == State::EXITED || state == State::SIGNALLED || state == State::TIMED_OUT || state == State::CANCELLED;
+      }
       bool succeeded() const { return state == State::EXITED && exit_code == 0; }
       bool is_valid() const { return ok; }
     };
 
+    // Resources used by a process, filled from wait4() when it is reaped (wall time only on Windows)
+    struct Proc_usage
+    {
+      double wall_ms  = 0;  // Spawn to reap
+      double user_ms  = 0;  // User CPU time
+      double sys_ms   = 0;  // System CPU time
+      long max_rss_kb = 0;  // Peak resident set size
+      long in_blocks  = 0;  // Filesystem input operations (512-byte blocks)
+      long out_blocks = 0;  // Filesystem output operations (512-byte blocks)
+
+      // Accumulate: times and I/O add up, max_rss_kb keeps the peak
+      Proc_usage &operator+=(const Proc_usage &o)
+      {
+        wall_ms += o.wall_ms;
+        user_ms += o.user_ms;
+        sys_ms += o.sys_ms;
+        max_rss_kb = std::max(max_rss_kb, o.max_rss_kb);
+        in_blocks += o.in_blocks;
+        out_blocks += o.out_blocks;
+        return *this;
+      }
+    };
+
     // Process info after exit
     struct Exit_status
     {
-      bool normal;
-      int exit_code;
+      bool normal = false;
+      int exit_code = 0;
     #ifndef _WIN32
-      int signal;
+      int signal = 0;
     #endif
+      Proc_usage usage{};
+      bool timed_out = false;  // Killed because its deadline passed
+      bool cancelled = false;  // Killed by bld::cancel()
 
       operator bool() const { return normal && exit_code == 0; }
       bool operator!() const { return !normal || exit_code != 0; }
@@ -197,6 +268,7 @@ namespace bld
     #ifndef _WIN32
       int signal;
     #endif
+      Proc_usage usage{};  // Valid once exited
 
       operator bool() const { return normal && exit_code == 0; }
       bool operator!() const { return !normal || exit_code != 0; }
@@ -208,6 +280,7 @@ namespace bld
       size_t completed;                        // Number of successfully completed commands/procs
       std::vector<size_t> failed_indices;      // Indices of commands/procs that failed
       std::vector<Exit_status> exit_statuses;  // Exit statuses of procs/commands in order.
+      Proc_usage total_usage;                  // Sum over all procs/commands, peak RSS of the largest one
 
       Par_exec_res() : completed(0) {}
     };
@@ -220,15 +293,23 @@ namespace bld
     const Fd INVALID_FD = -1;
   #endif
 
+  /* Source of child stdin data: called repeatedly, returns the next chunk.
+   * Returned view only has to stay valid until the next call. Empty view means end of input.
+   * Generators of all children share one writer thread, so they should return promptly instead of blocking.
+   */
+  using Stdin_generator = std::function<std::string_view()>;
+
   // Redirection configuration
   struct Redirect
   {
     Fd stdin_fd  = INVALID_FD;  // Redirect stdin from this fd
     Fd stdout_fd = INVALID_FD;  // Redirect stdout to this fd
     Fd stderr_fd = INVALID_FD;  // Redirect stderr to this fd
+    Stdin_generator stdin_gen;  // Feed stdin from this generator through a pipe (takes precedence over stdin_fd)
 
     Redirect() = default;
     Redirect(Fd in, Fd out, Fd err) : stdin_fd(in), stdout_fd(out), stderr_fd(err) {}
+    Redirect(Stdin_generator gen, Fd out, Fd err) : stdout_fd(out), stderr_fd(err), stdin_gen(std::move(gen)) {}
     Redirect(const std::string& in = "", const std::string& out = "", const std::string& err = "");
     Redirect(const Redirect&) = delete;
     Redirect& operator=(const Redirect&) = delete;
@@ -236,6 +317,19 @@ namespace bld
     static Redirect in(const std::string &_path)  { return Redirect(_path, "", ""); }
     static Redirect out(const std::string &_path) { return Redirect("", _path, ""); }
     static Redirect err(const std::string &_path) { return Redirect("", "", _path); }
+
+    /* @brief: Feed child stdin from an in-memory buffer, no temp file involved.
+     * @param data: Bytes to write, must stay alive until the process is waited on.
+     */
+    static Redirect in_buffer(std::string_view data, Fd out = INVALID_FD, Fd err = INVALID_FD)
+    {
+      return Redirect([data]() mutable { return std::exchange(data, std::string_view{}); }, out, err);
+    }
+    // Feed child stdin from chunks produced by `gen`, see Stdin_generator.
+    static Redirect in_generator(Stdin_generator gen, Fd out = INVALID_FD, Fd err = INVALID_FD)
+    {
+      return Redirect(std::move(gen), out, err);
+    }
     ~Redirect();
   };
 
@@ -276,10 +370,124 @@ namespace bld
     }
   }  // namespace logger
 
+  /* Chrome trace event recording, for chrome://tracing or ui.perfetto.dev.
+   * While a trace is running, Dep_graph::build_parallel/build_changed, execute_threads and wait_procs record one
+   * slice per job on a lane per worker, plus their own phases (graph prep, cycle check, stat pass, cache lookup,
+   * waiting for a job slot). Events go to per thread buffers and are only formatted when the trace is written.
+   * Define BLD_NO_TRACE to compile all of it out.
+   */
+  namespace trace
+  {
+#ifndef BLD_NO_TRACE
+    /* @brief: Start recording, a running trace is written first
+     * @param path: JSON file written by stop(), or at exit if stop() is never called
+     */
+    bool start(const std::string &path);
+
+    // Write the events recorded since start() and stop recording
+    bool stop();
+
+    // Whether a trace is being recorded, for work only needed by the trace
+    bool enabled();
+
+    // Name the calling thread's lane
+    void name_thread(const std::string &name);
+
+    /* @brief: Record a slice that was not timed by a Span, e.g. a child process
+     * @param lane: Put it on this named lane instead of the calling thread's
+     */
+    void complete(const std::string &name, const char *category, std::chrono::steady_clock::time_point begin,
+                  std::chrono::steady_clock::time_point end, const std::string &lane = "");
+
+    // Slice from construction to destruction on the calling thread's lane. Nothing is kept when no trace runs.
+    class Span
+    {
+    public:
+      explicit Span(std::string_view name, const char *category = "bld");
+      ~Span() { end(); }
+      Span(const Span &) = delete;
+      Span &operator=(const Span &) = delete;
+
+      // Shown with the slice. Check `if (span)` before computing an expensive value.
+      void arg(std::string_view key, std::string_view value);
+      explicit operator bool() const { return recording; }
+
+      // Close the slice before the end of the scope
+      void end();
+
+    private:
+      bool recording = false;
+      const char *category;
+      std::string name;
+      std::string args;
+      std::chrono::steady_clock::time_point begin;
+    };
+#else
+    inline bool start(const std::string &) { return false; }
+    inline bool stop() { return false; }
+    inline bool enabled() { return false; }
+    inline void name_thread(const std::string &) {}
+    inline void complete(const std::string &, const char *, std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point,
+                         const std::string & = "")
+    {
+    }
+
+    class Span
+    {
+    public:
+      explicit Span(std::string_view, const char * = "bld") {}
+      void arg(std::string_view, std::string_view) {}
+      explicit operator bool() const { return false; }
+      void end() {}
+    };
+#endif
+  }  // namespace trace
+
+  // Resource controls applied in the child between fork and exec (Linux, ignored elsewhere)
+  struct Proc_limits
+  {
+    struct Rlimit
+    {
+      int resource;   // RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE...
+      uint64_t soft;
+      uint64_t hard;
+    };
+
+    std::vector<int> cpu_affinity;  // CPUs the child may run on, empty = inherit
+    int nice = 0;                   // Added to the inherited nice value, 0 = unchanged
+    std::vector<Rlimit> rlimits;    // setrlimit() calls in order
+
+    // cgroup v2: a leaf is created under `cgroup_parent` for each child and removed after it is reaped.
+    // The parent must be a delegated cgroup (writable, memory/cpu enabled in cgroup.subtree_control).
+    std::string cgroup_parent;  // e.g. "/sys/fs/cgroup/user.slice/user-1000.slice/user@1000.service/bld"
+    std::string memory_max;     // Written to memory.max, e.g. "4G"
+    std::string cpu_max;        // Written to cpu.max, e.g. "200000 100000" for two CPUs
+
+    Proc_limits &pin(std::vector<int> cpus)           { cpu_affinity = std::move(cpus); return *this; }
+    Proc_limits &niceness(int n)                      { nice = n;                       return *this; }
+    Proc_limits &rlimit(int res, uint64_t soft, uint64_t hard) { rlimits.push_back({res, soft, hard}); return *this; }
+    Proc_limits &rlimit(int res, uint64_t value)      { return rlimit(res, value, value); }
+    Proc_limits &cgroup(std::string parent, std::string mem_max = "", std::string cpu = "")
+    {
+      cgroup_parent = std::move(parent);
+      memory_max = std::move(mem_max);
+      cpu_max = std::move(cpu);
+      return *this;
+    }
+
+    bool empty() const { return cpu_affinity.empty() && nice == 0 && rlimits.empty() && cgroup_parent.empty(); }
+  };
+
   // Struct to hold command parts
   struct Command
   {
     std::vector<std::string> parts;  // > parts of the command
+    Proc_limits limits;              // > resource controls for the spawned process
+    std::chrono::milliseconds timeout{0};        // > terminate the process group after this long, 0 = no limit
+    std::chrono::milliseconds kill_grace{2000};  // > wait this long after SIGTERM before SIGKILL
+    std::unordered_map<std::string, std::string> env;  // > environment overrides for the child, the rest is inherited
+    std::vector<std::string> unset_env;                // > variables removed from the child's environment
+    std::string cwd;                                   // > working directory of the child, empty = ours
 
     Command() : parts{} {}
     // @tparam args ( variadic template ): Command parts
@@ -414,6 +622,30 @@ namespace bld
     void parse_file_list(const std::string &value);
   };
 
+  // Response file (@file) policy for one tool
+  struct Rsp_policy
+  {
+    bool enabled       = true;  // Tool understands response files
+    size_t threshold   = 0;     // Switch once argv bytes exceed this, 0 = once argv and environment pass half of ARG_MAX
+    std::string prefix = "@";   // Argument prefix naming the response file
+  };
+
+  /* @brief: Set response file policy for a tool
+   * @param tool: Executable file name, e.g. "g++" or "ar". Versioned and target prefixed names
+   *   ("g++-13", "x86_64-linux-gnu-ar") fall back to the plain name.
+   * @param policy: Policy to use, set enabled = false to opt a tool out
+   * @description: gcc, g++, cc, c++, clang, clang++, ld, ld.bfd, ld.gold, ld.lld, mold, ar, gcc-ar and llvm-ar
+   *   are enabled by default. When argv of a command for an enabled tool passes the threshold, the arguments are
+   *   written to a temporary response file and the tool is run as `tool @file`. The file is removed once the
+   *   process is reaped.
+   */
+  void set_rsp_policy(const std::string &tool, const Rsp_policy &policy);
+
+  /* @brief: Get response file policy for a tool
+   * @return: Policy, enabled = false if the tool is unknown
+   */
+  Rsp_policy get_rsp_policy(const std::string &tool);
+
   void handle_config_command(const std::vector<std::string>& args, const std::string& program_name);
   void handle_args(int argc, char* argv[]);
   /* @brief: Convert command-line arguments to vector of strings
@@ -437,6 +669,19 @@ namespace bld
    */
   Exit_status wait_proc(Proc proc);
 
+  /* @brief: Wait for the process with a time limit
+   * @param proc: Process to wait for, state becomes EXITED, SIGNALLED or TIMED_OUT
+   * @param timeout: Time limit, tighter of this and proc.deadline wins. 0 = only proc.deadline
+   * @description: On timeout the process group gets SIGTERM, then SIGKILL after proc.kill_grace, and is reaped.
+   */
+  Exit_status wait_proc(Proc &proc, std::chrono::milliseconds timeout);
+
+  /* @brief: Cancel a running process
+   * @param proc: Process to cancel, state becomes CANCELLED
+   * @description: SIGTERM to its process group, SIGKILL after proc.kill_grace, then reaps it.
+   */
+  Exit_status cancel(Proc &proc);
+
   /* @breif: Clean up a process after completed
    * @param proc: Takes a Proc to cleanup.
    * @description: Closes handle and sets other values in windows and sets pid = -1 in linux.
@@ -453,10 +698,12 @@ namespace bld
   /*
    * @brief: Waits on multiple async processes
    * @params pids (vector<pid_t>): process ids to wait on
-   * @param sleep_ms (int): Time to sleep to avoid busy looping.
+   * @param show_progress (bool): Print make-style progress lines.
+   * @param timeout: Deadline for the whole batch, 0 = none. Per-process deadlines apply as well.
    * @return Exec_par_result: process ids that failed
    */
-  Par_exec_res wait_procs(std::vector<bld::Proc> procs, bool show_progress = true);
+  Par_exec_res wait_procs(std::vector<bld::Proc> procs, bool show_progress = true,
+                          std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
 
   /* @brief: Execute the command
    * @param command ( Command ): Command to execute, must be a valid process command and not shell command
@@ -487,9 +734,26 @@ namespace bld
   /* @brief: like execute_redirect but without wait.
    * @param Command: command which will be executed with redirected output
    * @redirect: File descriptors to redirect outputs to.
+   * @description: If redirect.stdin_gen is set, stdin is a pipe fed by bld's shared stdin writer thread
+   *   until the generator ends or the process is reaped (wait_proc, wait_procs, try_wait_nb).
    */
   Proc execute_async_redirect(const Command& command, const Redirect& redirect);
 
+  /* @brief: Start a pipeline `stages[0] | stages[1] | ...` without a shell
+   * @param stages: Commands in pipeline order, stdout of each one feeds stdin of the next
+   * @param redirect: stdin (or stdin_gen) of the first stage, stdout of the last stage and stderr of all stages.
+   *   The descriptors are duplicated, `redirect` keeps ownership.
+   * @return: One Proc per stage. Stages after one that failed to start are invalid Procs.
+   * @description: Pipes are created close-on-exec, so pipelines can be started from parallel workers.
+   */
+  std::vector<Proc> execute_pipeline_async(const std::vector<Command> &stages, const Redirect &redirect = Redirect(INVALID_FD, INVALID_FD, INVALID_FD));
+
+  /* @brief: Run a pipeline and wait for every stage
+   * @return: Per stage exit statuses, failed_indices lists every stage that failed (like `set -o pipefail`)
+   * @description: Waits on each stage by pid, never reaps other children, so it is safe inside execute_threads workers.
+   */
+  Par_exec_res execute_pipeline(const std::vector<Command> &stages, const Redirect &redirect = Redirect(INVALID_FD, INVALID_FD, INVALID_FD));
+
   /* @brief: Open a file descriptor to write to
    * @param: Path to the file
    * @return: File descriptor opened
@@ -515,10 +779,92 @@ namespace bld
    * @param cmds: Vector of commands to execute
    * @param threads: Number of parallel threads (default: hardware concurrency - 1). Change if you want.
    * @param strict: If true, stop all threads if an error occurs even in one command.
+   * @param timeout: Deadline for the whole batch, 0 = none. Commands not started in time fail as timed out.
    * @return: Exec_par_result
    */
   Par_exec_res execute_threads(const std::vector<bld::Command> &cmds, size_t threads = (std::thread::hardware_concurrency() - 1),
-                                       bool strict = true);
+                                       bool strict = true, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+  /* @brief: GNU make jobserver client and server
+   * @description: When MAKEFLAGS advertises a jobserver (--jobserver-auth=fifo:PATH or R,W, also the older
+   *   --jobserver-fds=R,W), bld joins it, so a bld run under `make -jN` or ninja shares the parent's job slots.
+   *   Otherwise execute_threads and Dep_graph::build_parallel serve a fifo jobserver for the duration of the call
+   *   and pass it to their children in MAKEFLAGS, so nested make, ninja and bld children draw from the same budget.
+   *   Overlapping calls share one served jobserver, it is removed when the last of them stops.
+   *   Like make, every process owns one implicit slot and only reads tokens for additional jobs.
+   *   Not supported on Windows, acquire() always succeeds there.
+   */
+  class Jobserver
+  {
+  public:
+    // A held job slot, given back on destruction or release()
+    class Token
+    {
+    public:
+      Token() = default;
+      Token(Token &&other) noexcept;
+      Token &operator=(Token &&other) noexcept;
+      Token(const Token &) = delete;
+      Token &operator=(const Token &) = delete;
+      ~Token() { release(); }
+
+      void release();
+      explicit operator bool() const { return held; }
+
+    private:
+      friend class Jobserver;
+      Jobserver *owner = nullptr;  // nullptr when no jobserver is active
+      char byte = '+';             // Token byte, written back unchanged
+      bool implicit = false;       // The process' own slot, never read from the jobserver
+      bool held = false;
+    };
+
+    static Jobserver &get();
+
+    // Connected to a jobserver, either a parent's or our own
+    bool active() const { return read_fd.load() != -1; }
+    // Serving our own jobserver
+    bool is_server() const { return serving; }
+
+    /* @brief: Block until a job slot is free
+     * @return: Held token, returned immediately when no jobserver is active
+     */
+    Token acquire();
+
+    /* @brief: Serve a fifo jobserver with `jobs` slots (our implicit slot included), for children started meanwhile
+     * @description: Calls nest: while we serve already, the running jobserver is shared (its slot count stays)
+     *   and every successful serve() needs its own stop(). Our environment is left alone, children get the
+     *   jobserver through MAKEFLAGS in the environment they are started with.
+     * @return: false if we joined a parent's jobserver or the fifo could not be created
+     */
+    bool serve(size_t jobs);
+
+    // Undo one serve(). The last one removes the fifo, all tokens must be released by then.
+    void stop();
+
+    // MAKEFLAGS for children while we serve, empty otherwise
+    std::string child_makeflags();
+
+  private:
+    Jobserver();
+    ~Jobserver();
+    Jobserver(const Jobserver &) = delete;
+    Jobserver &operator=(const Jobserver &) = delete;
+
+    bool join(const std::string &auth);
+    void disconnect();
+
+    std::atomic<int> read_fd{-1};
+    std::atomic<int> write_fd{-1};
+    int own_fd   = -1;        // Descriptor we opened ourselves, inherited pipe fds are left alone
+    int wake[2]  = {-1, -1};  // Wakes acquire() when the implicit slot is released
+    std::atomic<bool> implicit_free{true};
+    bool serving = false;
+    size_t serve_count = 0;   // serve() calls not stopped yet
+    std::string fifo_path;
+    std::string makeflags;    // Handed to children while serving
+    std::mutex mutex;
+  };
 
   /* @description: Print system metadata:
    *  1. Operating System
@@ -658,13 +1004,52 @@ namespace bld
      */
     bool read_file(const std::string &path, std::string &content);
 
-    /* @brief: Write string content to a file
+    /* @brief: Write string content to a file, in place (use write_file_atomic to replace it atomically)
      * @param path: Path to the file
      * @param content: Content to write
      * @return: true if successful, false otherwise
      */
     bool write_entire_file(const std::string &path, const std::string &content);
 
+    // Collects durable writes and makes them all durable with one syncfs per filesystem, instead of fsync per file.
+    class Sync_batch
+    {
+    public:
+      Sync_batch() = default;
+      ~Sync_batch() { commit(); }
+      Sync_batch(const Sync_batch &) = delete;
+      Sync_batch &operator=(const Sync_batch &) = delete;
+
+      // Remember the filesystem of `dir`, called by write_file_atomic
+      void add(const std::string &dir);
+
+      /* @brief: Flush everything added so far to disk
+       * @return: false if a filesystem failed to sync
+       */
+      bool commit();
+
+    private:
+      std::mutex mutex;
+      std::unordered_map<unsigned long long, int> fds;  // st_dev -> open directory on it
+    };
+
+    struct Write_options
+    {
+      bool if_changed = false;       // Same content already there: leave the file and its mtime alone
+      bool durable = false;          // On disk before returning (fsync of file and directory)
+      Sync_batch *batch = nullptr;   // With durable: leave the syncing to this batch
+      unsigned mode = 0;             // Permission bits, 0 = keep the old file's (or 0666 & ~umask for a new one)
+    };
+
+    /* @brief: Replace `path` with `content` so readers and crashes only ever see the old or the new file
+     * @description: Written to an unnamed O_TMPFILE in the same directory (or a temporary name where that is
+     *   unsupported), linked under a temporary name and renamed over `path`. A symlink is followed, the file
+     *   it points to is replaced. Written in place instead (not atomic) when `path` is not a regular file, has
+     *   other hard links or another owner we cannot hand the new file to, or when the directory refuses the temporary.
+     * @return: true if successful, false otherwise
+     */
+    bool write_file_atomic(const std::string &path, std::string_view content, const Write_options &opts = {});
+
     /* @brief: Append string content to a file
      * @param path: Path to the file
      * @param content: Content to append
@@ -679,6 +1064,98 @@ namespace bld
      */
     bool read_lines(const std::string &path, std::vector<std::string> &lines);
 
+    // Read-only view of a whole file, memory mapped where possible. Move-only, unmapped on destruction.
+    class Mapped_file
+    {
+    public:
+      Mapped_file() = default;
+      explicit Mapped_file(const std::string &path) { open(path); }
+      ~Mapped_file() { close(); }
+      Mapped_file(Mapped_file &&other) noexcept { *this = std::move(other); }
+      Mapped_file &operator=(Mapped_file &&other) noexcept;
+      Mapped_file(const Mapped_file &) = delete;
+      Mapped_file &operator=(const Mapped_file &) = delete;
+
+      /* @brief: Map `path`, replacing what was open before. Pipes and /proc files are read into memory instead.
+       * @return: false if the file cannot be opened
+       */
+      bool open(const std::string &path);
+      void close();
+
+      bool is_open() const { return opened; }
+      explicit operator bool() const { return opened; }
+      // Valid until close(). The file must not be truncated meanwhile (SIGBUS).
+      std::string_view view() const { return {ptr, len}; }
+      const char *data() const { return ptr; }
+      size_t size() const { return len; }
+
+    private:
+      const char *ptr = nullptr;
+      size_t len = 0;
+      bool opened = false;
+      bool mapped = false;
+      std::string fallback;  // Contents when the file could not be mapped
+    };
+
+    /* @brief: Lazy range over the lines of `text` as string_views into it, split like std::getline:
+     *   no trailing '\n', a final line without newline is yielded, nothing after a final '\n'
+     */
+    class Lines
+    {
+    public:
+      class iterator
+      {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view *;
+        using reference = const std::string_view &;
+
+        iterator() = default;
+        iterator(std::string_view rest) : rest(rest) { next(); }
+        reference operator*() const { return line; }
+        pointer operator->() const { return &line; }
+        iterator &operator++()
+        {
+          next();
+          return *this;
+        }
+        iterator operator++(int)
+        {
+          iterator old = *this;
+          next();
+          return old;
+        }
+        bool operator==(const iterator &o) const { return done == o.done && (done || line.data() == o.line.data()); }
+        bool operator!=(const iterator &o) const { return !(*this == o); }
+
+      private:
+        std::string_view rest, line;
+        bool done = true;
+
+        void next()
+        {
+          done = rest.data() == nullptr || rest.empty();
+          if (done)
+            return;
+          size_t nl = rest.find('\n');
+          line = rest.substr(0, nl);
+          rest = nl == std::string_view::npos ? std::string_view(rest.data() + rest.size(), 0) : rest.substr(nl + 1);
+        }
+      };
+
+      explicit Lines(std::string_view text) : text(text) {}
+      iterator begin() const { return iterator(text); }
+      iterator end() const { return iterator(); }
+
+    private:
+      std::string_view text;
+    };
+
+    // for (std::string_view line : bld::fs::lines(file.view())), no allocation per line
+    inline Lines lines(std::string_view text) { return Lines(text); }
+
     /* @brief: Replace text in file
      * @param path: Path to the file
      * @param from: Text to replace
@@ -695,6 +1172,50 @@ namespace bld
      */
     bool copy_file(const std::string &from, const std::string &to, bool overwrite = false);
 
+    // How copy_file_fast() moved the bytes
+    enum class Copy_method
+    {
+      NONE,             // Failed
+      SKIPPED,          // Destination already had the same content
+      HARDLINK,         // Copy_options::hardlink
+      REFLINK,          // FICLONE, shares the data blocks (btrfs, xfs, ...)
+      COPY_FILE_RANGE,  // In kernel copy, server side on NFS/SMB
+      SENDFILE,         // In kernel copy
+      READ_WRITE        // Plain userspace copy
+    };
+
+    struct Copy_options
+    {
+      bool overwrite = true;       // Replace existing destinations
+      bool skip_unchanged = true;  // Leave a destination alone when size and content already match
+      bool hardlink = false;       // Hard link instead of copying, destination shares the source's inode
+      size_t threads = 0;          // copy_tree workers, 0 = hardware concurrency
+    };
+
+    struct Copy_result
+    {
+      size_t copied = 0;
+      size_t skipped = 0;
+      uintmax_t bytes = 0;                   // Bytes of the copied files
+      std::vector<std::string> failed;       // Source paths that could not be copied
+      explicit operator bool() const { return failed.empty(); }
+    };
+
+    /* @brief: Copy a file the fastest way the filesystem allows: reflink, copy_file_range, sendfile, then read/write
+     * @description: The destination is written next to its final name and renamed into place, so it is never seen
+     *   half written and a running executable can be replaced. Permission bits are kept.
+     * @param method: Set to how the bytes were moved
+     * @return: true if the destination holds the source's content
+     */
+    bool copy_file_fast(const std::string &from, const std::string &to, const Copy_options &opts = {}, Copy_method *method = nullptr);
+
+    /* @brief: Copy a directory tree with copy_file_fast() on several threads. Symlinks are copied as symlinks.
+     * @param from: Source directory
+     * @param to: Destination directory, created if needed
+     * @return: Counts and the files that failed
+     */
+    Copy_result copy_tree(const std::string &from, const std::string &to, const Copy_options &opts = {});
+
     /* @brief: Move/Rename a file
      * @param from: Source path
      * @param to: Destination path
@@ -734,7 +1255,7 @@ namespace bld
     template <typename... Paths, typename = std::enable_if_t<(std::is_convertible_v<Paths, std::string> && ...)>>
     bool create_dirs_if_not_exists(const Paths &...paths);
 
-    /* @brief: Remove directory and all its contents if it exists
+    /* @brief: Remove directory and all its contents if it exists, through remove_tree()
      * @param path: Path to remove
      * @return: true if successful, false otherwise
      */
@@ -744,6 +1265,43 @@ namespace bld
     template <typename... Paths, typename = std::enable_if_t<(std::is_convertible_v<Paths, std::string> && ...)>>
     void remove(const Paths &...paths);
 
+    // Outcome of a batch operation, item by item
+    struct Batch_result
+    {
+      size_t done = 0;                                              // Items that succeeded or were already in place
+      std::vector<std::pair<std::string, std::error_code>> failed;  // Path and reason of every item that did not
+      explicit operator bool() const { return failed.empty(); }
+    };
+
+    /* @brief: Remove many files, symlinks and empty directories at once
+     * @description: On Linux the unlinks are submitted to io_uring, elsewhere (or when io_uring is unavailable)
+     *   they run on a pool of threads. Paths that don't exist count as done.
+     * @param use_io_uring: false forces the thread pool
+     */
+    Batch_result remove_batch(const std::vector<std::string> &paths, bool use_io_uring = true);
+
+    /* @brief: Create many directories and their parents at once
+     * @description: Shared parents are created once, level by level, every level in one io_uring batch on Linux
+     *   or on a pool of threads. Directories that already exist count as done.
+     * @param use_io_uring: false forces the thread pool
+     */
+    Batch_result create_dirs_batch(const std::vector<std::string> &paths, bool use_io_uring = true);
+
+    /* @brief: copy_file_fast() many {from, to} pairs on `opts.threads` threads, missing destination directories are created
+     * @return: Failed items are reported by source path
+     */
+    Batch_result copy_batch(const std::vector<std::pair<std::string, std::string>> &pairs, const Copy_options &opts = {});
+
+    /* @brief: Remove a directory tree with several threads
+     * @description: Every directory is listed once, its files are unlinked relative to it and its subdirectories
+     *   are handed to other threads; a directory is removed by whichever thread finishes its last child.
+     *   Threads are only added as the number of entries seen grows, so a small tree is removed on the calling thread.
+     *   Symlinks are removed, never followed. A directory is left alone when something below it could not be removed.
+     * @param threads: 0 = hardware concurrency
+     * @return: Every file and directory removed, and the ones that could not be
+     */
+    Batch_result remove_tree(const std::string &path, size_t threads = 0);
+
     /* @brief: Get list of all files in directory
      * @param path: Directory path
      * @param recursive = true: Whether to include files in subdirectories
@@ -795,6 +1353,316 @@ namespace bld
     inline bool walk_directory(const std::string & path, Walk_func cb, std::size_t depth = std::numeric_limits<std::size_t>::max());
     inline bool walk_directory(const std::string & path, Walk_func cb, void* arg);
     inline bool walk_directory(const std::string & path, Walk_func cb, std::size_t depth, void * arg);
+
+    struct Walk_options
+    {
+      std::size_t depth = std::numeric_limits<std::size_t>::max();
+      std::size_t threads = 0;  // 0: one per hardware thread
+      void *args = nullptr;
+      // Ignore files (gitignore syntax) read in every directory from the root down, e.g. {".gitignore", ".bldignore"}.
+      // Ignored entries are not reported and ignored directories are not entered. `.git` is always skipped then.
+      std::vector<std::string> ignore_files;
+    };
+
+    /* @brief: walk_directory with options, on the calling thread
+     * @param path: Root directory
+     * @param cb: Callback called for every entry that isn't ignored
+     * @param opts: Depth limit, ignore files and the `args` passed to the callback (`threads` is not used)
+     */
+    bool walk_directory(const std::string &path, Walk_func cb, const Walk_options &opts);
+
+    /* @brief: Walk a directory tree on several threads
+     * @description: Subdirectories are spread over the threads by work stealing. Entry types come from getdents64
+     *   d_type, so only symlinks need a stat, and subdirectories are opened with openat relative to their parent.
+     *   `cb` runs concurrently on all threads and must be thread safe, the order of entries is unspecified.
+     *   Walk_act::Ignore prunes a directory, Walk_act::Stop (or returning false) ends the walk on every thread.
+     *   Elsewhere than Linux this walks on the calling thread.
+     * @param path: Root directory
+     * @param cb: Callback called for every entry
+     * @param opts: Depth limit, thread count and the `args` passed to the callback
+     * @return: false if the root could not be opened or the callback failed
+     */
+    bool walk_directory_parallel(const std::string &path, Walk_func cb, const Walk_options &opts = {});
+
+    struct Entry
+    {
+      std::string path;
+      Path_type type;
+      std::size_t level{0};
+    };
+
+    /* @brief: Lazy listing of a directory or a directory tree
+     * @description: Entries are read one directory at a time as the range is iterated (getdents64 on Linux), so
+     *   the first results come right away and breaking out of the loop stops the walk. Symlinked directories are
+     *   reported but not followed. It is an input range: iterate it once, and don't move it while iterating.
+     */
+    class Entries
+    {
+    public:
+      using Filter = std::function<bool(const Entry &)>;
+
+      class iterator
+      {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry *;
+        using reference = const Entry &;
+
+        iterator() = default;
+        explicit iterator(Entries *owner) : owner(owner) {}
+        reference operator*() const { return owner->current; }
+        pointer operator->() const { return &owner->current; }
+        iterator &operator++()
+        {
+          if (!owner->next())
+            owner = nullptr;
+          return *this;
+        }
+        void operator++(int) { ++*this; }
+        bool operator==(const iterator &o) const { return owner == o.owner; }
+        bool operator!=(const iterator &o) const { return owner != o.owner; }
+
+      private:
+        Entries *owner = nullptr;
+      };
+
+      /* @param path: Directory to list
+       * @param recursive: Whether to descend into subdirectories
+       * @param filter: Entries it rejects are not returned (their subdirectories are still listed)
+       */
+      Entries(const std::string &path, bool recursive = false, Filter filter = {});
+      Entries(Entries &&) noexcept;
+      Entries &operator=(Entries &&) noexcept;
+      ~Entries();
+
+      iterator begin();
+      iterator end() { return {}; }
+
+      // Don't descend into the directory that was just returned
+      void skip_children();
+
+      // false if `path` could not be opened
+      bool ok() const;
+
+    private:
+      struct State;
+      std::unique_ptr<State> state;
+      Entry current;
+      bool started = false;
+      bool done = false;
+
+      bool next();
+    };
+
+    // Lazy versions of list_files_in_dir, list_directories, get_all_files_with_name and get_all_files_with_extensions
+    Entries files(const std::string &path, bool recursive = false);
+    Entries directories(const std::string &path, bool recursive = false);
+    Entries files_with_name(const std::string &dir, const std::string &name, bool recursive = false);
+    Entries files_with_extensions(const std::string &path, const std::vector<std::string> &extensions, bool recursive = false,
+                                  bool case_insensitive = false);
+
+    /* @brief: Compiled set of glob patterns, matched in a single walk
+     * @description: Patterns are relative to the working directory (or absolute) and use '/' as separator.
+     *   `*`, `?` and `[a-z]` match within a path segment, `**` matches any number of segments and `{a,b}` expands
+     *   to alternatives (nesting allowed). Patterns starting with '!' exclude: a matching file is dropped and a
+     *   matching directory is not entered. As in the shell, wildcards don't match names starting with '.' unless
+     *   the pattern segment does.
+     *   The walk starts at the literal directory shared by the include patterns and only enters directories
+     *   where some pattern can still match. Directory listings are cached for the process, keyed by the
+     *   directory's mtime, so globbing an unchanged tree again only stats the directories.
+     */
+    class Glob
+    {
+    public:
+      explicit Glob(const std::vector<std::string> &patterns);
+
+      // Whether the file `path` is matched by an include pattern and by no exclude pattern
+      bool match(std::string_view path) const;
+
+      // Matching files, sorted
+      std::vector<std::string> files() const;
+
+    private:
+      struct Segment
+      {
+        enum class Kind : uint8_t { Literal, Suffix, Wild, Globstar };
+        Kind kind;
+        std::string text;
+        bool matches(std::string_view name) const;
+      };
+
+      struct Pattern
+      {
+        std::vector<Segment> segs;
+        bool exclude;
+      };
+
+      using States = std::vector<std::pair<uint32_t, uint32_t>>;  // (pattern, segment)
+
+      std::vector<Pattern> patterns;
+      std::vector<std::vector<std::string>> roots;  // literal leading directories shared by the relative, absolute includes
+
+      void close_over(States &states) const;
+      States step(const States &states, std::string_view name) const;
+      bool accepts(const States &states, bool exclude) const;
+      bool can_descend(const States &states) const;
+      void walk(const std::string &dir, const States &states, std::vector<std::string> &out) const;
+    };
+
+    // bld::fs::glob("src/**/*.{cpp,cc}", "!src/gen/**")
+    std::vector<std::string> glob(const std::vector<std::string> &patterns);
+    template <typename... Patterns, typename = std::enable_if_t<(std::is_convertible_v<Patterns, std::string> && ...)>>
+    std::vector<std::string> glob(const Patterns &...patterns)
+    {
+      return glob(std::vector<std::string>{std::string(patterns)...});
+    }
+
+    struct Stat_result
+    {
+      bool exists{false};
+      std::filesystem::file_time_type mtime{};
+      uint64_t size{0};
+    };
+
+    /* @brief: Stat many paths at once
+     * @description: On Linux the statx calls are submitted to io_uring in batches, so a network file system
+     *   answers many of them per round trip. Where io_uring is missing or blocked (old kernel, seccomp,
+     *   kernel.io_uring_disabled) a pool of threads makes blocking statx calls instead.
+     * @param paths: Paths to stat, symlinks are followed
+     * @param use_io_uring: false forces the thread pool
+     * @return: One result per path, in order
+     */
+    std::vector<Stat_result> stat_batch(const std::vector<std::string> &paths, bool use_io_uring = true);
+
+    struct Merkle_options
+    {
+      /* Skip the files of a directory whose own mtime (and inode) did not change, only its subdirectories are
+       * stat'ed. A directory's mtime moves when entries are created, removed or renamed, not when a file is
+       * rewritten in place (`>>`, editors that don't save through a rename, tools writing into an existing file),
+       * so such edits are missed in this mode. Use it when sources are saved atomically or together with a file
+       * watcher. Off: every file is stat'ed, unchanged directories are still not re-read or re-hashed.
+       */
+      bool trust_dir_mtime = false;
+      std::vector<std::string> ignore_files;  // as Walk_options::ignore_files, e.g. to leave build/ out
+    };
+
+    /* @brief: Persistent Merkle tree of a source tree, for a cheap "is anything dirty?" check
+     * @description: Every directory keeps its mtime, its listing and the size/mtime/inode of its files, and
+     *   hashes them together with the hashes of its subdirectories. update() only re-reads directories whose
+     *   mtime changed and only re-hashes the directories on the path to a change, then saves the tree to
+     *   `state_file`. Content is not hashed, a file counts as changed when its metadata does.
+     */
+    class Merkle_tree
+    {
+    public:
+      struct Stats
+      {
+        std::size_t dirs_stated = 0;
+        std::size_t dirs_read = 0;
+        std::size_t files_stated = 0;
+      };
+
+      Merkle_tree(std::string root, std::string state_file, Merkle_options opts = {});
+
+      /* @brief: Rescan the tree and save it
+       * @return: true if anything changed since the saved state (always on the first scan)
+       */
+      bool update();
+
+      // Root hash after the last update(), 64 hex digits
+      const std::string &hash() const { return root_hash; }
+
+      // Directories (relative to the root, "" for the root) whose files or entries changed in the last update()
+      const std::vector<std::string> &changed() const { return changed_dirs; }
+
+      const Stats &stats() const { return last_stats; }
+
+    private:
+      struct File
+      {
+        std::string name;
+        bool dir;
+        int64_t size, mtime;
+        uint64_t ino;
+      };
+
+      struct Node
+      {
+        int64_t mtime = -1;
+        uint64_t ino = 0;
+        std::string hash;
+        std::vector<File> entries;  // sorted by name, subdirectories included
+      };
+
+      std::string root, state_file;
+      Merkle_options opts;
+      std::unordered_map<std::string, Node> nodes;
+      std::string root_hash;
+      std::vector<std::string> changed_dirs;
+      Stats last_stats;
+      bool loaded = false;
+
+      bool load();
+      bool save() const;
+    };
+
+    /* @brief: Recursive file watcher on inotify (Linux only)
+     * @description: Files are watched through their directory and filtered by name, so editors that save by
+     *   renaming a temporary file over the original are seen. Directories are watched recursively, including
+     *   subdirectories created later. When the kernel queue overflows, the watches are re-scanned and
+     *   overflowed() reports that events were lost.
+     */
+    class Watcher
+    {
+    public:
+      Watcher();
+      ~Watcher();
+      Watcher(const Watcher &) = delete;
+      Watcher &operator=(const Watcher &) = delete;
+
+      /* @brief: Watch a file or a directory
+       * @param path: File or directory. Reported paths are `path` joined with the changed entry's name.
+       * @param recursive: For directories, watch every subdirectory as well
+       * @return: false if the watch could not be registered
+       */
+      bool add(const std::string &path, bool recursive = true);
+
+      /* @brief: Wait for changes, coalescing a burst of events into one result
+       * @param changed: Set to the changed paths, without duplicates
+       * @param debounce: The burst ends once no event arrived for this long
+       * @param timeout: Give up after this long without a relevant event, negative = wait forever
+       * @return: false on timeout or error
+       */
+      bool wait(std::vector<std::string> &changed, std::chrono::milliseconds debounce = std::chrono::milliseconds(50),
+                std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+      // Append queued events to `changed` without blocking. Returns false if there was nothing relevant.
+      bool read_events(std::vector<std::string> &changed);
+
+      // True once after events were lost (queue overflow, watched directory moved away). Treat everything as changed then.
+      bool overflowed() { return std::exchange(lost, false); }
+
+      // Descriptor to poll() for readability, -1 when unsupported
+      int fd() const { return inotify_fd; }
+
+    private:
+      struct Dir
+      {
+        std::string path;                      // Spelling used for reported paths
+        bool all = false;                      // Report every entry, not just `names`
+        bool recursive = false;                // Also watch subdirectories created later
+        std::unordered_set<std::string> names;  // Entries of interest when !all
+      };
+
+      bool add_dir(const std::string &path, bool all, bool recursive, const std::string &name, std::vector<std::string> *found = nullptr);
+
+      int inotify_fd = -1;
+      std::unordered_map<int, std::vector<Dir>> dirs;  // Watch descriptor -> spellings of that directory
+      std::vector<std::pair<std::string, bool>> roots;  // Everything passed to add(), for re-scans
+      bool lost = false;
+    };
     }  // namespace fs
 
   namespace env
@@ -855,24 +1723,295 @@ namespace bld
     std::string replace_all(const std::string &str, const std::string &from, const std::string &to);
   }  // namespace str
 
-  struct Dep
+  namespace hash
   {
-    std::string target;                     // Target/output file
-    std::vector<std::string> dependencies;  // Input files/dependencies
-    bld::Command command;                   // Command to build the target
-    bool is_phony{false};                   // Whether this is a phony target
-
-    // Default constructor
-    Dep() = default;
+    /* @brief: SHA-256 of `data`
+     * @return: 64 lowercase hex digits
+     */
+    std::string sha256(std::string_view data);
 
-    // Constructor for non-phony targets
-    Dep(std::string target, std::vector<std::string> dependencies = {}, bld::Command command = {});
+    /* @brief: SHA-256 of a file's contents
+     * @param digest: Set to 64 lowercase hex digits
+     * @return: false if the file could not be read
+     */
+    bool sha256_file(const std::string &path, std::string &digest);
+  }  // namespace hash
 
-    // Constructor for phony targets
-    Dep(std::string target, std::vector<std::string> dependencies, bool is_phony);
+  // One unit of work handed to an Executor: a command plus the files it reads and writes.
+  struct Action
+  {
+    Command command;
+    std::vector<std::string> inputs;   // Files the command reads
+    std::vector<std::string> outputs;  // Files the command writes
+  };
 
-    // Implicit conversion from initializer list for better usability
-    Dep(std::string target, std::initializer_list<std::string> deps, bld::Command command = {});
+  // Runs actions for Dep_graph. run() is called from every build thread at once.
+  class Executor
+  {
+  public:
+    virtual ~Executor() = default;
+    virtual Exit_status run(const Action &action) = 0;
+  };
+
+  // Default executor: fork/exec on this machine, same as bld::execute.
+  class Local_executor : public Executor
+  {
+  public:
+    Exit_status run(const Action &action) override { return execute(action.command); }
+  };
+
+  /* @brief: Executor shipping actions to worker processes over Unix sockets
+   * @description: Every action is sent with its argv, env and cwd, plus the SHA-256 digests of its inputs.
+   *   The worker asks for the contents it has not cached yet and materializes the inputs in a fresh sandbox
+   *   directory. It runs the command there and sends back the exit status, the combined stdout/stderr and the
+   *   outputs, which are written back locally. Only relative paths are shipped. Absolute ones (system headers,
+   *   compilers) must exist on the worker. Every file an action reads has to be listed in Action::inputs.
+   *   Outputs and cwd must stay below the build root, the worker refuses anything that would leave its sandbox.
+   *   Linux/Unix only.
+   */
+  class Worker_executor : public Executor
+  {
+  public:
+    /* @param workers: Number of worker processes to start
+     * @param worker_command: Worker to exec, it gets the socket as fd 3 and should call bld::serve_worker(3).
+     *   Empty = the bundled worker: this binary re-executed through /proc/self/exe, which serves before main()
+     *   runs. Elsewhere it is a fork of this process, create the executor before starting any thread there.
+     */
+    explicit Worker_executor(size_t workers, const Command &worker_command = {});
+    ~Worker_executor() override;
+    Worker_executor(const Worker_executor &) = delete;
+    Worker_executor &operator=(const Worker_executor &) = delete;
+
+    Exit_status run(const Action &action) override;
+
+    // Workers still connected
+    size_t size() const;
+
+  private:
+    struct Conn
+    {
+      int fd = -1;
+      bld::pid worker = 0;
+      bool busy = false;
+    };
+    std::vector<Conn> conns;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+  };
+
+  /* @brief: Worker side of Worker_executor: serve actions on `fd` until the executor goes away
+   * @param fd: Connected socket, fd 3 in a worker started through worker_command
+   * @param root: Directory for the content cache and sandboxes, empty = a fresh temporary directory
+   * @return: 0 when the executor closed the connection, 1 on protocol or I/O errors
+   */
+  int serve_worker(int fd, const std::string &root = "");
+
+  /* @brief: HTTP/1.1 client for a remote build cache (GET/PUT /ac/<key> and /cas/<digest>, as served by
+   *   bazel-remote, nginx with WebDAV or bld::Cache_server)
+   * @description: Connections are kept alive and reused. upload() queues work for a background thread, the
+   *   destructor waits for it. Plain http only, put a TLS proxy in front for anything beyond a trusted network.
+   */
+  class Remote_cache
+  {
+  public:
+    /* @param url: http://host[:port][/prefix]
+     * @param connections: Idle connections kept open, also the number of prefetch threads of an Artifact_cache
+     */
+    explicit Remote_cache(const std::string &url, size_t connections = 4);
+    ~Remote_cache();
+    Remote_cache(const Remote_cache &) = delete;
+    Remote_cache &operator=(const Remote_cache &) = delete;
+
+    // URL was understood
+    bool ok() const { return !host.empty(); }
+    size_t connections() const { return max_idle; }
+
+    /* @brief: Fetch `kind`/`hash`, kind is "ac" or "cas"
+     * @return: false on a miss or error
+     */
+    bool get(const std::string &kind, const std::string &hash, std::string &body);
+
+    // Store `body` under `kind`/`hash` and wait for the server
+    bool put(const std::string &kind, const std::string &hash, const std::string &body);
+
+    /* @brief: Queue the contents of `file` for a background PUT. The files must not change until then.
+     * @param blobs: (digest, file) pairs PUT to cas/ first. `file` is only uploaded if all of them were stored.
+     */
+    void upload(const std::string &kind, const std::string &hash, const std::string &file,
+                std::vector<std::pair<std::string, std::string>> blobs = {});
+
+    // Wait until every queued upload is done
+    void flush();
+
+    std::chrono::milliseconds timeout{10000};  // Connect/send/receive limit of one request
+
+  private:
+    struct Conn
+    {
+      int fd = -1;
+      std::string buf;  // Bytes received past the last response
+    };
+    struct Upload
+    {
+      std::string kind, hash, file;
+      std::vector<std::pair<std::string, std::string>> blobs;  // (digest, file) stored before `file`
+    };
+
+    std::string host, port, prefix;
+    size_t max_idle;
+    std::vector<Conn> idle;
+    std::mutex conn_mutex;
+
+    std::deque<Upload> uploads;
+    std::thread uploader;
+    size_t uploading = 0;
+    bool stopping = false;
+    std::mutex upload_mutex;
+    std::condition_variable upload_cv;
+
+    bool request(const std::string &method, const std::string &path, const std::string &body, int &status, std::string &response);
+    void upload_loop();
+  };
+
+  /* @brief: Minimal HTTP cache server for the Remote_cache protocol, on a background thread
+   * @description: Stores under `dir` in the Artifact_cache layout, so the directory can double as a local cache.
+   *   CAS uploads are checked against their digest. Meant for tests and small trusted setups.
+   */
+  class Cache_server
+  {
+  public:
+    /* @param dir: Storage directory
+     * @param port: TCP port, 0 = any free port (see port())
+     * @param host: Address to bind
+     */
+    explicit Cache_server(std::string dir, uint16_t port = 0, const std::string &host = "127.0.0.1");
+    ~Cache_server();
+    Cache_server(const Cache_server &) = delete;
+    Cache_server &operator=(const Cache_server &) = delete;
+
+    bool ok() const { return listen_fd != -1; }
+    uint16_t port() const { return bound_port; }
+    std::string url() const;
+
+    // Close the listening socket and all connections
+    void stop();
+
+    size_t max_body = size_t(1) << 30;  // Larger uploads are answered with 413
+
+  private:
+    struct Client
+    {
+      int fd;
+      std::thread thread;
+      std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    std::string root, address;
+    int listen_fd = -1;
+    int wake[2] = {-1, -1};
+    uint16_t bound_port = 0;
+    std::thread acceptor;
+    std::vector<Client> clients;
+    std::mutex mutex;
+
+    void accept_loop();
+    void serve(int fd);
+  };
+
+  /* @brief: Content-addressed cache of action outputs, shared safely by concurrent bld processes
+   * @description: The key of an action is a SHA-256 over its argv, env overrides, unset variables, cwd and the
+   *   path and content of every input. Output contents live in `dir`/cas/, the output list of each key in
+   *   `dir`/ac/. Everything is written to a temporary and renamed into place, so readers only ever see complete
+   *   entries. Entries carry a checksum and blobs are hashed when they enter the cache. A restore checks their size
+   *   (and digest with set_verify), a corrupt entry is a miss.
+   */
+  class Artifact_cache
+  {
+  public:
+    /* @param dir: Cache directory, created if needed
+     * @param hardlink: Restore by hard link when reflinks are unavailable. Faster than a copy, but restored
+     *   outputs share the read-only cache blob: they are mode 0444 whatever was recorded and must not be modified
+     *   in place. Executable outputs are always copied.
+     */
+    explicit Artifact_cache(std::string dir, bool hardlink = false);
+
+    /* @brief: Re-hash every blob on restore
+     * @description: Blobs are verified when they enter the cache (store and remote fetch), a restore only checks
+     *   that they exist with the recorded size. Turn this on to also compare digests, e.g. on unreliable storage.
+     */
+    void set_verify(bool v) { verify = v; }
+
+    /* @brief: Cache key of `action`
+     * @return: false if an input could not be read
+     */
+    bool key(const Action &action, std::string &key) const;
+
+    /* @brief: Restore the outputs recorded under `key`
+     * @return: true on a hit, all outputs restored
+     */
+    bool restore(const std::string &key, const std::vector<std::string> &outputs);
+
+    /* @brief: Record the current contents of `outputs` under `key`
+     * @return: false if an output is missing or the cache could not be written
+     */
+    bool store(const std::string &key, const std::vector<std::string> &outputs);
+
+    /* @brief: Back the cache with a remote one: misses are looked up there, stores are uploaded in the background
+     * @param r: Remote to use, nullptr = local only
+     */
+    void set_remote(std::shared_ptr<Remote_cache> r) { remote = std::move(r); }
+
+    /* @brief: Start fetching the remote entries of `actions` on background threads
+     * @description: Dep_graph calls this with every target that becomes ready, so downloads overlap the running
+     *   commands. Actions whose outputs all exist already are skipped. No-op without a remote.
+     */
+    void prefetch(std::vector<Action> actions);
+
+    ~Artifact_cache();
+
+    const std::string &dir() const { return root; }
+    size_t hits() const { return n_hits; }
+    size_t misses() const { return n_misses; }
+
+  private:
+    std::string root;
+    bool hardlink;
+    bool verify = false;
+    std::atomic<size_t> n_hits{0}, n_misses{0};
+
+    std::shared_ptr<Remote_cache> remote;
+    std::deque<Action> pending;               // Waiting for a prefetch thread
+    std::unordered_set<std::string> fetching;  // Keys being downloaded
+    std::vector<std::thread> fetchers;
+    bool stopping = false;
+    std::mutex fetch_mutex;
+    std::condition_variable fetch_cv;
+
+    std::string blob_path(const std::string &digest) const;
+    std::string entry_path(const std::string &key) const;
+    bool fetch(const std::string &key);
+    void fetch_loop();
+  };
+
+  struct Dep
+  {
+    std::string target;                     // Target/output file
+    std::vector<std::string> dependencies;  // Input files/dependencies
+    bld::Command command;                   // Command to build the target
+    bool is_phony{false};                   // Whether this is a phony target
+    bool cacheable{false};                  // Restore the target from the graph's Artifact_cache when possible
+
+    // Default constructor
+    Dep() = default;
+
+    // Constructor for non-phony targets
+    Dep(std::string target, std::vector<std::string> dependencies = {}, bld::Command command = {});
+
+    // Constructor for phony targets
+    Dep(std::string target, std::vector<std::string> dependencies, bool is_phony);
+
+    // Implicit conversion from initializer list for better usability
+    Dep(std::string target, std::initializer_list<std::string> deps, bld::Command command = {});
 
     // Copy constructor
     Dep(const Dep &other);
@@ -901,7 +2040,33 @@ namespace bld
       Node(const Dep &d) : dep(d) {}
     };
     std::unordered_map<std::string, std::unique_ptr<Node>> nodes;
+    std::unordered_map<std::string, std::vector<std::string>> dependents;  // Normalized input -> targets that list it (reverse edges)
+    std::unordered_map<std::string, std::vector<std::string>> spellings;   // Normalized path -> how the graph spells it
     std::unordered_set<std::string> checked_sources;
+    std::shared_ptr<Executor> executor;  // nullptr = local fork/exec
+    std::shared_ptr<Artifact_cache> cache;
+
+    // Per target state of one parallel build
+    struct BuildState
+    {
+      int pending_dependencies = 0;     // Dependencies in the same build not done yet
+      std::vector<std::string> parents;  // Targets in the same build that depend on this one
+    };
+
+    std::unordered_map<std::string, Proc_usage> usage_log;  // Last run of each target
+    std::string usage_file;                                  // Where usage_log persists, empty = memory only
+    bool usage_dirty{false};
+    mutable std::mutex usage_mutex;
+
+    struct File_stat
+    {
+      bool exists{false};
+      std::filesystem::file_time_type mtime{};
+    };
+    std::unordered_map<std::string, File_stat> stat_cache;  // Used when stats_cached, or for one build after prefetch_stats
+    std::atomic<bool> stats_cached{false};  // Written under stat_mutex, read by every build thread
+    std::atomic<bool> stats_prefetched{false};
+    std::mutex stat_mutex;
 
 public:
     /* @brief Add a dependency to the graph.
@@ -951,7 +2116,108 @@ public:
     bool build_parallel(const std::string &target, size_t thread_count = std::thread::hardware_concurrency());
     bool build_all_parallel(size_t thread_count = std::thread::hardware_concurrency());
 
+    /* @brief Run actions through `exec` instead of forking locally, e.g. a Worker_executor.
+     * @param exec Executor to use, nullptr = local fork/exec.
+     */
+    void set_executor(std::shared_ptr<Executor> exec) { executor = std::move(exec); }
+
+    /* @brief Look up cacheable targets (Dep::cacheable) in `c` before running their command, and store them after.
+     * @param c Cache to use, nullptr = no caching.
+     */
+    void set_cache(std::shared_ptr<Artifact_cache> c) { cache = std::move(c); }
+
+    /* @brief Rebuild only what depends on `changed`, e.g. from fs::Watcher or `git diff --name-only`.
+     * @param changed Changed files. "./a.c", "a.c" and "src/../a.c" all match the same graph entry.
+     * @param thread_count Number of worker threads.
+     * @return true If every affected target was rebuilt.
+     * @description: Walks reverse edges from the changed files and rebuilds that cone only, dependencies first.
+     *   Cost is proportional to the number of dependents, nothing outside the cone is stat'ed. Targets outside
+     *   the cone are assumed up to date, so run a full build first.
+     */
+    bool build_changed(const std::vector<std::string> &changed, size_t thread_count = std::thread::hardware_concurrency());
+
+    /* @brief Persist per-target resource usage across runs.
+     * @param path File holding usage of previous runs, loaded now and rewritten after every build.
+     * @return false if the file exists but could not be read.
+     */
+    bool track_usage(const std::string &path);
+
+    /* @brief Resource usage of the last run of a target.
+     * @param target The target to look up.
+     * @param out Filled with the usage if found.
+     * @return false If the target never ran (in this process or a tracked file).
+     */
+    bool get_usage(const std::string &target, Proc_usage &out) const;
+
+    /* @brief Usage of all targets that ran, e.g. to find the TUs that eat the most CPU or memory. */
+    std::unordered_map<std::string, Proc_usage> get_all_usage() const;
+
+    /* @brief Keep file stats between builds instead of re-reading them every time.
+     * @param enable Turn the cache on or off, turning it off drops it.
+     * @description: Whoever enables it must call invalidate() for files changed behind the graph's back.
+     *   Targets are invalidated automatically after their command runs.
+     */
+    void cache_stats(bool enable);
+
+    // Drop the cached stat of `path` (as spelled in the graph).
+    void invalidate(const std::string &path);
+
+    // Drop all cached stats.
+    void invalidate_all();
+
+    /* @brief Hot reload: build `target`, then rebuild it whenever its inputs change.
+     * @param target Target to keep up to date.
+     * @param thread_count Threads used by each build_parallel.
+     * @param debounce Changes are collected until no event arrived for this long, then one build runs.
+     * @param stop Optional flag checked between builds, the loop returns true once it is set.
+     * @return false if nothing could be watched.
+     * @description: Watches Config::hot_reload_files if set, otherwise the sources `target` depends on. The stat cache is
+     *   kept on and only changed files are re-checked. Only targets `target` depends on are rebuilt.
+     */
+    bool watch(const std::string &target, size_t thread_count = std::thread::hardware_concurrency(),
+               std::chrono::milliseconds debounce = std::chrono::milliseconds(50), const std::atomic<bool> *stop = nullptr);
+
+    /* @brief Run as a resident build daemon listening on a Unix socket (Linux only).
+     * @param socket_path Socket to listen on, e.g. "build/bld.sock". A stale socket file is replaced.
+     * @return false if the daemon could not start (another one is running, socket error), true once stopped.
+     * @description: Keeps the graph, its stat cache and an inotify watch on every directory holding a graph
+     *   file resident, so a no-op build costs no stat calls. Clients (bld::daemon_build) hand their
+     *   stdin/stdout/stderr to the daemon, which uses them while building, so output goes straight to the
+     *   client's terminal. Requests are served one at a time. Stop it with bld::stop_daemon.
+     */
+    bool serve_daemon(const std::string &socket_path);
+
 private:
+    // Run the command of `node` through the executor.
+    Exit_status run_action(const Node *node);
+
+    /* @brief Run the commands of a prepared subgraph on worker threads, dependencies first.
+     * @param build_map Targets to run with their pending dependency counts and parents.
+     * @param force Run every command instead of asking needs_rebuild.
+     */
+    bool run_build_map(std::unordered_map<std::string, BuildState> &build_map, size_t thread_count, bool force);
+
+    // build_changed with the cone cut down to `within`, nullptr = whole graph.
+    bool build_changed(const std::vector<std::string> &changed, size_t thread_count, const std::unordered_set<std::string> *within);
+
+    // `target` and every target and source it transitively depends on.
+    std::unordered_set<std::string> dependency_closure(const std::string &target) const;
+
+    // Stat `path`, through stat_cache when enabled.
+    File_stat stat_file(const std::string &path);
+
+    /* @brief Stat every target and dependency of `build_map` in one batch (fs::stat_batch) before scheduling.
+     * @description: The results stay in stat_cache until the end of the build. Targets are invalidated after their
+     *   command runs, as with cache_stats, so only files changed by commands without being their target are missed.
+     */
+    void prefetch_stats(const std::unordered_map<std::string, BuildState> &build_map);
+
+    // Remember what building `target` cost.
+    void record_usage(const std::string &target, const Proc_usage &usage);
+
+    // Write usage_log to usage_file if tracking is on and anything changed.
+    void save_usage();
+
     /* @brief Build a node in the graph.
      * @param target The name of the target to build.
      * @return true If the build was successful.
@@ -983,6 +2249,16 @@ private:
     void process_completed_target(const std::string &target, std::queue<std::string> &ready_targets, std::mutex &queue_mutex,
                                   std::condition_variable &cv);
   };
+
+  /* @brief Build `target` in the daemon started by Dep_graph::serve_daemon on `socket_path`.
+   * @param exit_code Set to 0 if the build succeeded, 1 otherwise.
+   * @param threads Build threads, 0 = hardware concurrency.
+   * @return false if no daemon is listening, build locally in that case.
+   */
+  bool daemon_build(const std::string &socket_path, const std::string &target, int &exit_code, size_t threads = 0);
+
+  // Ask the daemon on `socket_path` to exit. Returns false if none is listening.
+  bool stop_daemon(const std::string &socket_path);
 }  // namespace bld
 
 #ifdef B_LDR_IMPLEMENTATION
@@ -1002,6 +2278,17 @@ private:
 #include <sstream>
 #include <utility>
 
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <crt_externs.h>  // For `_NSGetEnviron()`
+#define ENVIRON (*_NSGetEnviron())
+#elif defined(_WIN32)
+#include <windows.h>
+#define ENVIRON nullptr  // Not used in Windows implementation
+#else
+extern char **environ;  // Standard for Linux
+#define ENVIRON environ
+#endif
+
 void bld::internal_log(bld::Log_type type, const std::string &msg)
 {
 #ifdef BLD_NO_LOGGING
@@ -1096,6 +2383,244 @@ void bld::log(bld::Log_type type, const std::string &msg)
     }
 }
 
+#ifndef BLD_NO_TRACE
+namespace
+{
+  struct _bld_trace_event
+  {
+    char phase;  // 'X' slice, 'M' lane name
+    uint32_t lane;
+    const char *category;
+    std::string name;
+    std::string args;  // Rendered "key":"value" pairs
+    int64_t begin_ns;
+    int64_t dur_ns;
+  };
+
+  // One per thread and trace, so recording only takes an uncontended lock
+  struct _bld_trace_buffer
+  {
+    std::mutex mutex;
+    std::vector<_bld_trace_event> events;
+    uint64_t session = 0;
+    uint32_t lane = 0;
+  };
+
+  struct _bld_trace_state
+  {
+    std::atomic<bool> active{false};
+    std::atomic<uint64_t> session{0};
+    std::mutex mutex;
+    std::string path;
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<std::shared_ptr<_bld_trace_buffer>> buffers;
+    std::unordered_map<std::string, uint32_t> named_lanes;
+    uint32_t next_lane = 1;
+  };
+
+  _bld_trace_state &_bld_trace()
+  {
+    static _bld_trace_state state;
+    return state;
+  }
+
+  _bld_trace_buffer &_bld_trace_local()
+  {
+    thread_local std::shared_ptr<_bld_trace_buffer> buffer;
+    _bld_trace_state &st = _bld_trace();
+    uint64_t session = st.session.load(std::memory_order_acquire);
+    if (!buffer || buffer->session != session)
+    {
+      buffer = std::make_shared<_bld_trace_buffer>();
+      buffer->session = session;
+      std::lock_guard<std::mutex> lock(st.mutex);
+      buffer->lane = st.next_lane++;
+      st.buffers.push_back(buffer);
+    }
+    return *buffer;
+  }
+
+  void _bld_trace_record(_bld_trace_event event)
+  {
+    _bld_trace_buffer &buffer = _bld_trace_local();
+    if (event.lane == 0)
+      event.lane = buffer.lane;
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(std::move(event));
+  }
+
+  int64_t _bld_trace_ns(std::chrono::steady_clock::time_point t)
+  {
+    return std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(t - _bld_trace().epoch).count());
+  }
+
+  void _bld_json_escape(std::string &out, std::string_view s)
+  {
+    for (char c : s)
+    {
+      if (c == '"' || c == '\\')
+        out += '\\', out += c;
+      else if (static_cast<unsigned char>(c) < 0x20)
+      {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      }
+      else
+        out += c;
+    }
+  }
+}  // anonymous namespace
+
+bool bld::trace::start(const std::string &path)
+{
+  _bld_trace_state &st = _bld_trace();
+  if (st.active)
+    stop();
+
+  // Flush a trace nobody stopped. Registered after the state was constructed, so it runs before it is destroyed,
+  // which a flush from the state's own destructor could not rely on for the other statics stop() uses.
+  static std::once_flag at_exit;
+  std::call_once(at_exit, [] { std::atexit([] { bld::trace::stop(); }); });
+
+  std::lock_guard<std::mutex> lock(st.mutex);
+  st.path = path;
+  st.epoch = std::chrono::steady_clock::now();
+  st.buffers.clear();
+  st.named_lanes.clear();
+  st.next_lane = 1;
+  st.session.fetch_add(1, std::memory_order_release);  // Threads start new buffers
+  st.active = true;
+  return true;
+}
+
+bool bld::trace::stop()
+{
+  _bld_trace_state &st = _bld_trace();
+  if (!st.active.exchange(false))
+    return false;
+
+  std::vector<std::shared_ptr<_bld_trace_buffer>> buffers;
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(st.mutex);
+    buffers.swap(st.buffers);
+    path = st.path;
+  }
+
+#ifndef _WIN32
+  const std::string pid = std::to_string(::getpid());
+#else
+  const std::string pid = std::to_string(::GetCurrentProcessId());
+#endif
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  size_t count = 0;
+  char num[64];
+  for (const auto &buffer : buffers)
+  {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    for (const auto &e : buffer->events)
+    {
+      out += count++ ? ",\n{\"name\":\"" : "{\"name\":\"";
+      _bld_json_escape(out, e.phase == 'M' ? "thread_name" : e.name);
+      if (e.phase == 'X')
+      {
+        out += "\",\"cat\":\"";
+        out += e.category;
+        std::snprintf(num, sizeof(num), "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", e.begin_ns / 1e3, e.dur_ns / 1e3);
+        out += num;
+      }
+      else
+        out += "\",\"ph\":\"M\"";
+      out += ",\"pid\":" + pid + ",\"tid\":" + std::to_string(e.lane);
+      if (e.phase == 'M')
+      {
+        out += ",\"args\":{\"name\":\"";
+        _bld_json_escape(out, e.name);
+        out += "\"}";
+      }
+      else if (!e.args.empty())
+        out += ",\"args\":{" + e.args + "}";
+      out += '}';
+    }
+  }
+  out += "\n]}\n";
+
+  if (!bld::fs::write_file_atomic(path, out))
+    return false;
+  bld::internal_log(bld::Log_type::INFO, "Trace with " + std::to_string(count) + " events written to " + path);
+  return true;
+}
+
+bool bld::trace::enabled() { return _bld_trace().active.load(std::memory_order_relaxed); }
+
+void bld::trace::name_thread(const std::string &name)
+{
+  if (enabled())
+    _bld_trace_record({'M', 0, "", name, {}, 0, 0});
+}
+
+void bld::trace::complete(const std::string &name, const char *category, std::chrono::steady_clock::time_point begin,
+                          std::chrono::steady_clock::time_point end, const std::string &lane)
+{
+  if (!enabled())
+    return;
+
+  uint32_t lane_id = 0;
+  if (!lane.empty())
+  {
+    _bld_trace_state &st = _bld_trace();
+    bool added = false;
+    {
+      std::lock_guard<std::mutex> lock(st.mutex);
+      auto [it, inserted] = st.named_lanes.try_emplace(lane, 0);
+      if (inserted)
+        it->second = st.next_lane++;
+      lane_id = it->second;
+      added = inserted;
+    }
+    if (added)
+      _bld_trace_record({'M', lane_id, "", lane, {}, 0, 0});
+  }
+  int64_t b = _bld_trace_ns(begin);
+  _bld_trace_record({'X', lane_id, category, name, {}, b, std::max<int64_t>(0, _bld_trace_ns(end) - b)});
+}
+
+bld::trace::Span::Span(std::string_view name, const char *category) : category(category)
+{
+  if (!enabled())
+    return;
+  recording = true;
+  this->name = name;
+  begin = std::chrono::steady_clock::now();
+}
+
+void bld::trace::Span::end()
+{
+  if (!recording)
+    return;
+  recording = false;
+  if (!enabled())
+    return;
+  auto now = std::chrono::steady_clock::now();
+  int64_t b = _bld_trace_ns(begin);
+  _bld_trace_record({'X', 0, category, std::move(name), std::move(args), b, _bld_trace_ns(now) - b});
+}
+
+void bld::trace::Span::arg(std::string_view key, std::string_view value)
+{
+  if (!recording)
+    return;
+  if (!args.empty())
+    args += ',';
+  args += '"';
+  _bld_json_escape(args, key);
+  args += "\":\"";
+  _bld_json_escape(args, value);
+  args += '"';
+}
+#endif
+
 // Get the full command as a single string
 std::string bld::Command::get_command_string() const
 {
@@ -1141,6 +2666,59 @@ void bld::Command::add_parts(Args... args)
   (parts.emplace_back(args), ...);
 }
 
+namespace
+{
+  std::mutex &_bld_rsp_mutex()
+  {
+    static std::mutex m;
+    return m;
+  }
+
+  std::unordered_map<std::string, bld::Rsp_policy> &_bld_rsp_policies()
+  {
+    static std::unordered_map<std::string, bld::Rsp_policy> policies = [] {
+      std::unordered_map<std::string, bld::Rsp_policy> p;
+      for (const char *tool : {"gcc", "g++", "cc", "c++", "clang", "clang++", "ld", "ld.bfd", "ld.gold", "ld.lld", "mold", "ar",
+                               "gcc-ar", "llvm-ar"})
+        p[tool] = bld::Rsp_policy{};
+      return p;
+    }();
+    return policies;
+  }
+}  // anonymous namespace
+
+void bld::set_rsp_policy(const std::string &tool, const Rsp_policy &policy)
+{
+  std::lock_guard<std::mutex> lock(_bld_rsp_mutex());
+  _bld_rsp_policies()[tool] = policy;
+}
+
+bld::Rsp_policy bld::get_rsp_policy(const std::string &tool)
+{
+  std::string name = std::filesystem::path(tool).filename().string();
+
+  // "g++", then "g++-13" -> "g++", then "x86_64-linux-gnu-g++" -> "g++"
+  std::vector<std::string> candidates = {name};
+  size_t dash = name.find_last_of('-');
+  if (dash != std::string::npos && dash + 1 < name.size() && name.find_first_not_of("0123456789.", dash + 1) == std::string::npos)
+    name = name.substr(0, dash);
+  candidates.push_back(name);
+  dash = name.find_last_of('-');
+  if (dash != std::string::npos)
+    candidates.push_back(name.substr(dash + 1));
+
+  std::lock_guard<std::mutex> lock(_bld_rsp_mutex());
+  for (const auto &c : candidates)
+  {
+    auto it = _bld_rsp_policies().find(c);
+    if (it != _bld_rsp_policies().end())
+      return it->second;
+  }
+  Rsp_policy none;
+  none.enabled = false;
+  return none;
+}
+
 bool bld::validate_command(const bld::Command &command)
 {
   bld::internal_log(bld::Log_type::WARNING, "Do you want to execute " + command.get_print_string() + "in shell");
@@ -1150,2945 +2728,9303 @@ bool bld::validate_command(const bld::Command &command)
   return (response == "y" || response == "Y");
 }
 
-bld::Exit_status bld::wait_proc(bld::Proc proc)
+namespace
 {
-  bld::Exit_status status{};
-
-  if (!proc.is_valid())
+  // Resources owned by a running child that must be released once it has been reaped.
+  struct _bld_child_res
   {
-    bld::internal_log(Log_type::ERR, "Invalid process");
-    return status;  // normal=false by default
-  }
+    bool feeds_stdin = false;  // Registered with _bld_stdin_writer for Redirect::stdin_gen
+    std::string rsp_file;      // Response file written for this child
+    std::string cgroup_leaf;   // cgroup v2 leaf created for this child
+    int group_slot = -1;       // Slot in _bld_groups while the child leads a process group
+  };
 
-#ifdef _WIN32
-  DWORD wait_result = WaitForSingleObject(proc.process_handle, INFINITE);
-  if (wait_result != WAIT_OBJECT_0)
+  std::mutex &_bld_children_mutex()
   {
-    bld::log(Log_type::ERR, "WaitForSingleObject failed. Error: " + std::to_string(GetLastError()));
-    return status;
+    static std::mutex m;
+    return m;
   }
 
-  DWORD exit_code = 0;
-  if (!GetExitCodeProcess(proc.process_handle, &exit_code))
+  std::unordered_map<bld::pid, _bld_child_res> &_bld_children()
   {
-    bld::log(Log_type::ERR, "Failed to get exit code. Error: " + std::to_string(GetLastError()));
-    return status;
+    static std::unordered_map<bld::pid, _bld_child_res> children;
+    return children;
   }
 
-  status.normal = true;
-  status.exit_code = static_cast<int>(exit_code);
-
-  if (exit_code != 0)
-    bld::log(Log_type::ERR, "Process exited with code: " + std::to_string(exit_code));
-
-#else
-  int wait_status;
-  if (waitpid(proc.p_id, &wait_status, 0) == -1)
-  {
-    bld::internal_log(Log_type::ERR, "waitpid failed: " + std::string(strerror(errno)));
-    return status;
+#ifndef _WIN32
+  bld::Proc_usage _bld_usage(const struct rusage &ru, std::chrono::steady_clock::time_point started)
+  {
+    auto ms = [](const timeval &tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+    bld::Proc_usage u;
+    if (started != std::chrono::steady_clock::time_point{})
+      u.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    u.user_ms = ms(ru.ru_utime);
+    u.sys_ms = ms(ru.ru_stime);
+    u.max_rss_kb = ru.ru_maxrss;
+    u.in_blocks = ru.ru_inblock;
+    u.out_blocks = ru.ru_oublock;
+    return u;
   }
+#endif
 
-  if (WIFEXITED(wait_status))
-  {
-    status.normal = true;
-    status.exit_code = WEXITSTATUS(wait_status);
+#ifndef _WIN32
+  // Process groups of live children, read from the interrupt handler so it has to be a plain array. 0 = free slot.
+  constexpr size_t _BLD_MAX_GROUPS = 4096;
+  std::atomic<pid_t> _bld_groups[_BLD_MAX_GROUPS];
 
-    if (status.exit_code != 0)
-      bld::internal_log(Log_type::ERR, "Process exited with code: " + std::to_string(status.exit_code));
-  }
-  else if (WIFSIGNALED(wait_status))
+  // SIGINT/SIGTERM: children run in their own process groups and no longer see the terminal's signal,
+  // so tear every group down (TERM, short grace, KILL) and die with the original signal.
+  void _bld_on_interrupt(int sig)
   {
-    status.signal = WTERMSIG(wait_status);
-    bld::internal_log(Log_type::ERR, "Process terminated by signal: " + std::to_string(status.signal));
-  }
-#endif
+    for (auto &g : _bld_groups)
+      if (pid_t p = g.load(std::memory_order_relaxed); p > 0)
+        ::killpg(p, SIGTERM);
 
-  return status;
-}
+    struct timespec grace = {0, 20 * 1000 * 1000};
+    nanosleep(&grace, nullptr);
 
-namespace
-{
-  // "[NNN%]" — always 6 chars wide, right-justified percentage.
-  inline std::string _bld_pct(size_t done, size_t total)
+    for (auto &g : _bld_groups)
+      if (pid_t p = g.load(std::memory_order_relaxed); p > 0)
+        ::killpg(p, SIGKILL);
+
+    ::signal(sig, SIG_DFL);
+    ::raise(sig);
+  }
+
+  // Only takes over signals that still have the default disposition, a user handler wins.
+  void _bld_install_interrupt_handler()
   {
-    int pct = (total > 0) ? static_cast<int>(100.0 * done / total) : 100;
-    char buf[16];
-    std::snprintf(buf, sizeof(buf), "[%3d%%]", pct);
-    return {buf};
+    static std::once_flag once;
+    std::call_once(once, [] {
+      for (int sig : {SIGINT, SIGTERM})
+      {
+        struct sigaction old{};
+        if (sigaction(sig, nullptr, &old) == 0 && old.sa_handler == SIG_DFL)
+        {
+          struct sigaction sa{};
+          sa.sa_handler = _bld_on_interrupt;
+          sigemptyset(&sa.sa_mask);
+          sigaction(sig, &sa, nullptr);
+        }
+      }
+    });
   }
 
-  // Emit one make-style line to stderr.
-  // `sig` is only meaningful (non-zero) on Unix when a signal killed the process.
-  inline void _bld_emit(size_t done, size_t total, bool success, const std::string &label, int exit_code = 0, int sig = 0)
+  int _bld_track_group(pid_t pgid)
   {
-#ifdef BLD_NO_LOGGING
-    (void)done;
-    (void)total;
-    (void)success;
-    (void)label;
-    (void)exit_code;
-    (void)sig;
-    return;
+    _bld_install_interrupt_handler();
+    for (size_t i = 0; i < _BLD_MAX_GROUPS; ++i)
+    {
+      pid_t expected = 0;
+      if (_bld_groups[i].compare_exchange_strong(expected, pgid))
+        return static_cast<int>(i);
+    }
+    bld::internal_log(bld::Log_type::WARNING, "Too many live process groups, " + std::to_string(pgid) + " will not be killed on interrupt.");
+    return -1;
+  }
 #endif
 
-#ifdef BLD_USE_COLORS
-    const char *c_pct = "\x1b[38;2;130;170;255m";    // light blue
-    const char *c_ok = "\x1b[38;2;80;250;123m";      // mint green
-    const char *c_fail = "\x1b[38;2;255;85;85m";     // red
-    const char *c_label = "\x1b[38;2;220;220;220m";  // light grey
-    const char *c_dim = "\x1b[38;2;110;110;110m";    // dim grey
-    const char *c_reset = "\x1b[0m";
-#else
-    const char *c_pct = "";
-    const char *c_ok = "";
-    const char *c_fail = "";
-    const char *c_label = "";
-    const char *c_dim = "";
-    const char *c_reset = "";
-#endif
+#ifndef _WIN32
+  /* Writes the generated stdin of every child from one thread: the pipes are non-blocking and poll()ed together,
+   * so a child that reads slowly (or never) only holds up its own input. SIGPIPE is blocked on that thread,
+   * a child exiting without draining stdin shows up as EPIPE instead of killing the build.
+   * Generators run on that thread and should not block, a slow one delays the other children's input.
+   */
+  class _bld_stdin_writer
+  {
+    struct Feed
+    {
+      int fd;
+      bld::Stdin_generator gen;
+      std::string_view pending{};
+      bool cancelled = false;
+      std::mutex mutex;  // Held while the generator runs, so cancel() returning means it won't be called again
+    };
 
-    // "[NNN%]  Done    'label'"  or  "[NNN%]  FAILED  'label'  (exit N)"
-    std::cerr << c_pct << _bld_pct(done, total) << c_reset << "  " << (success ? c_ok : c_fail) << (success ? "Done  " : "FAILED")
-              << c_reset << "  " << c_label << label << c_reset;
+    std::mutex mutex;  // Guards `feeds` only, never held while a generator runs
+    std::unordered_map<bld::pid, std::shared_ptr<Feed>> feeds;
+    int wake[2] = {-1, -1};
 
-    if (!success)
+    // Write what the pipe takes, false once the input is finished or the reader went away
+    static bool pump(Feed &feed)
     {
-      std::cerr << "  " << c_dim;
-      if (sig != 0)
-        std::cerr << "(signal " << sig << ")";
-      else
-        std::cerr << "(exit " << exit_code << ")";
-      std::cerr << c_reset;
+      for (;;)
+      {
+        if (feed.pending.empty() && (feed.pending = feed.gen()).empty())
+          return false;
+        ssize_t n = ::write(feed.fd, feed.pending.data(), feed.pending.size());
+        if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+          if (errno != EPIPE)
+            bld::internal_log(bld::Log_type::ERR, "Failed to write child stdin: " + std::string(strerror(errno)));
+          return false;
+        }
+        feed.pending.remove_prefix(static_cast<size_t>(n));
+      }
     }
 
-    std::cerr << "\n";
-    std::cerr.flush();
-  }
-
-  // Opening line printed before the loop.
-  inline void _bld_emit_start(size_t total)
-  {
-#ifdef BLD_NO_LOGGING
-    (void)total;
-    return;
-#endif
-#ifdef BLD_USE_COLORS
-    const char *c_pct = "\x1b[38;2;130;170;255m";
-    const char *c_dim = "\x1b[38;2;110;110;110m";
-    const char *c_reset = "\x1b[0m";
-#else
-    const char *c_pct = "";
-    const char *c_dim = "";
-    const char *c_reset = "";
-#endif
-    std::cerr << c_pct << "[  0%]" << c_reset << "  " << c_dim << "Waiting for " << total << " process" << (total == 1 ? "" : "es") << "..."
-              << c_reset << "\n";
-    std::cerr.flush();
-  }
-
-}  // anonymous namespace
+    void run()
+    {
+      sigset_t set;
+      sigemptyset(&set);
+      sigaddset(&set, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+      std::vector<struct pollfd> fds;
+      std::vector<std::pair<bld::pid, std::shared_ptr<Feed>>> owners;
+      for (;;)
+      {
+        fds.assign(1, {wake[0], POLLIN, 0});
+        owners.clear();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for (const auto &[p, feed] : feeds)
+          {
+            fds.push_back({feed->fd, POLLOUT, 0});
+            owners.emplace_back(p, feed);
+          }
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0)
+          continue;  // EINTR
 
-bld::Par_exec_res bld::wait_procs(std::vector<bld::Proc> procs, bool show_progress)
-{
-  Par_exec_res result;
-  const size_t total = procs.size();
-  result.exit_statuses.resize(total);
+        char drain[64];
+        if (fds[0].revents & POLLIN)
+          while (::read(wake[0], drain, sizeof(drain)) > 0) {}
 
-  if (total == 0)
-    return result;
+        for (size_t i = 1; i < fds.size(); ++i)
+        {
+          if (fds[i].revents == 0)
+            continue;
+          auto &[p, feed] = owners[i - 1];
+          {
+            std::lock_guard<std::mutex> feed_lock(feed->mutex);
+            if (feed->cancelled || pump(*feed))
+              continue;  // Cancelled while we polled, or more to write later
+            feed->cancelled = true;
+            ::close(feed->fd);
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          if (auto it = feeds.find(p); it != feeds.end() && it->second == feed)
+            feeds.erase(it);
+        }
+      }
+    }
 
-  // Display label for slot i: use proc.label if set, else "process N".
-  auto get_label = [&](size_t i) -> std::string
-  { return procs[i].label.empty() ? "process " + std::to_string(i) : "'" + procs[i].label + "'"; };
+  public:
+    // Never destroyed: the thread is detached and may still be in poll() while the process exits
+    static _bld_stdin_writer &get()
+    {
+      static _bld_stdin_writer *writer = new _bld_stdin_writer;
+      return *writer;
+    }
 
-  if (show_progress)
-    _bld_emit_start(total);
+    // Takes ownership of `fd`, the write end of the child's stdin pipe
+    void add(bld::pid p, int fd, bld::Stdin_generator gen)
+    {
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (wake[0] == -1)
+      {
+        if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) == -1)
+        {
+          bld::internal_log(bld::Log_type::ERR, "Failed to start the stdin writer: " + std::string(strerror(errno)));
+          wake[0] = wake[1] = -1;
+          ::close(fd);
+          return;
+        }
+        std::thread(&_bld_stdin_writer::run, this).detach();
+      }
+      auto feed = std::make_shared<Feed>();
+      feed->fd = fd;
+      feed->gen = std::move(gen);
+      feeds[p] = std::move(feed);
+      ssize_t ignored = ::write(wake[1], "", 1);
+      (void)ignored;
+    }
 
-  size_t done_count = 0;
+    // Drop what is left of `p`'s input, its generator is not called anymore once this returns
+    void cancel(bld::pid p)
+    {
+      std::shared_ptr<Feed> feed;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = feeds.find(p);
+        if (it == feeds.end())
+          return;
+        feed = std::move(it->second);
+        feeds.erase(it);
+      }
+      // Waits for this child's generator at most, never for another one
+      std::lock_guard<std::mutex> feed_lock(feed->mutex);
+      if (!feed->cancelled)
+        ::close(feed->fd);
+      feed->cancelled = true;
+    }
+  };
+#endif
 
+  // Call after the child is reaped. Stops feeding its stdin and drops whatever else it held.
+  void _bld_release_child(bld::pid p)
+  {
+    _bld_child_res res;
+    {
+      std::lock_guard<std::mutex> lock(_bld_children_mutex());
+      auto it = _bld_children().find(p);
+      if (it == _bld_children().end())
+        return;
+      res = std::move(it->second);
+      _bld_children().erase(it);
+    }
 #ifndef _WIN32
-  std::unordered_map<pid_t, size_t> pid_to_idx;
-  pid_to_idx.reserve(total);
-  size_t active = 0;
+    if (res.group_slot >= 0)
+      _bld_groups[res.group_slot].store(0);
+#endif
+#ifndef _WIN32
+    if (res.feeds_stdin)
+      _bld_stdin_writer::get().cancel(p);
+#endif
+    if (!res.rsp_file.empty())
+      ::unlink(res.rsp_file.c_str());
+#ifndef _WIN32
+    if (!res.cgroup_leaf.empty() && ::rmdir(res.cgroup_leaf.c_str()) == -1)
+      bld::internal_log(bld::Log_type::WARNING, "Failed to remove cgroup " + res.cgroup_leaf + ": " + std::string(strerror(errno)));
+#endif
+  }
 
-  for (size_t i = 0; i < total; ++i)
+#ifndef _WIN32
+  // Quote one argument the way GCC/binutils read response files: backslash escapes the next character.
+  void _bld_rsp_quote(std::string &out, const std::string &arg)
   {
-    if (!procs[i].is_valid())
+    if (arg.empty())
     {
-      result.exit_statuses[i] = Exit_status{false, -1, 0};
-      result.failed_indices.push_back(i);
-      if (show_progress)
-        _bld_emit(++done_count, total, false, get_label(i), -1);
-      continue;
+      out += "\"\"";
+      return;
+    }
+    for (char c : arg)
+    {
+      if (std::isspace(static_cast<unsigned char>(c)) || c == '\\' || c == '"' || c == '\'')
+        out += '\\';
+      out += c;
     }
-    pid_to_idx[procs[i].p_id] = i;
-    ++active;
   }
+#endif
 
-  while (active > 0)
+  /* Environment for a child: ours with Command::env applied and Command::unset_env removed, plus the MAKEFLAGS
+   * of a jobserver we serve (the command's own MAKEFLAGS wins). Empty when nothing changes.
+   */
+  std::vector<std::string> _bld_child_env(const bld::Command &command)
   {
-    int raw = 0;
-    pid_t pid = ::waitpid(-1, &raw, 0);
+    std::vector<std::string> out;
+    auto unset = [&](const std::string &key) {
+      return std::find(command.unset_env.begin(), command.unset_env.end(), key) != command.unset_env.end();
+    };
+    std::string makeflags = command.env.count("MAKEFLAGS") || unset("MAKEFLAGS") ? "" : bld::Jobserver::get().child_makeflags();
+    if (command.env.empty() && command.unset_env.empty() && makeflags.empty())
+      return out;
 
-    if (pid == -1)
+    auto keep = [&](std::string_view entry)
     {
-      if (errno == EINTR)
-        continue;
-      if (errno == ECHILD)
-        break;
-      bld::internal_log(Log_type::ERR, "waitpid(-1): " + std::string(strerror(errno)));
-      break;
+      std::string key(entry.substr(0, entry.find('=', 1)));  // Windows has "=C:=C:\" style entries
+      return !command.env.count(key) && !unset(key) && (makeflags.empty() || key != "MAKEFLAGS");
+    };
+
+#ifdef _WIN32
+    if (LPCH block = GetEnvironmentStringsA())
+    {
+      for (LPCH e = block; *e; e += std::strlen(e) + 1)
+        if (keep(e))
+          out.emplace_back(e);
+      FreeEnvironmentStringsA(block);
     }
+#else
+    for (char **e = ENVIRON; *e; ++e)
+      if (keep(*e))
+        out.emplace_back(*e);
+#endif
+    for (const auto &[key, value] : command.env) out.push_back(key + "=" + value);
+    if (!makeflags.empty())
+      out.push_back("MAKEFLAGS=" + makeflags);
+    return out;
+  }
 
-    auto it = pid_to_idx.find(pid);
-    if (it == pid_to_idx.end())
+  // Arguments ready for execvp. May point into `rsp_parts` when a response file replaced the real argv.
+  struct _bld_argv
+  {
+    std::vector<char *> args;
+    std::vector<std::string> rsp_parts;
+    std::string rsp_file;
+    std::vector<std::string> env;  // Child environment when Command::env/unset_env are used
+    std::vector<char *> envp;      // Null terminated pointers into `env`, empty = inherit ours
+  };
+
+  // Build argv for `command`, moving the arguments into a response file when the tool supports it and argv is too big for exec.
+  bool _bld_prepare_argv(const bld::Command &command, _bld_argv &out)
+  {
+    out.args = command.to_exec_args();
+#ifndef _WIN32
+    out.env = _bld_child_env(command);
+    if (!out.env.empty())
     {
-      bld::internal_log(Log_type::WARNING, "Reaped unexpected child PID " + std::to_string(pid) + " (not in wait_procs set — ignored).");
-      continue;
+      for (auto &e : out.env) out.envp.push_back(e.data());
+      out.envp.push_back(nullptr);
     }
 
-    const size_t idx = it->second;
-    pid_to_idx.erase(it);
-    --active;
+    size_t argv_bytes = sizeof(char *) * out.args.size();
+    for (const auto &part : command.parts) argv_bytes += part.size() + 1;
 
-    Exit_status es{};
-    int sig_num = 0;
+    static const size_t arg_max = [] {
+      long v = sysconf(_SC_ARG_MAX);
+      return v > 0 ? static_cast<size_t>(v) : static_cast<size_t>(128 * 1024);
+    }();
 
-    if (WIFEXITED(raw))
+    // A tool's own threshold is about its command line, the kernel's ARG_MAX counts argv and envp together
+    bld::Rsp_policy policy = bld::get_rsp_policy(command.parts[0]);
+    if (!policy.enabled || (policy.threshold && argv_bytes <= policy.threshold))
+      return true;
+    if (!policy.threshold)
     {
-      es.normal = true;
-      es.exit_code = WEXITSTATUS(raw);
+      size_t env_bytes = 0;
+      char **env = out.envp.empty() ? ENVIRON : out.envp.data();
+      for (; env && *env; ++env) env_bytes += sizeof(char *) + std::strlen(*env) + 1;
+      if (argv_bytes + env_bytes <= arg_max / 2)
+        return true;
     }
-    else if (WIFSIGNALED(raw))
+
+    std::string content;
+    content.reserve(argv_bytes);
+    for (size_t i = 1; i < command.parts.size(); ++i)
     {
-      sig_num = WTERMSIG(raw);
-      es.signal = sig_num;
+      _bld_rsp_quote(content, command.parts[i]);
+      content += '\n';
     }
 
-    result.exit_statuses[idx] = es;
-    if (es)
-      ++result.completed;
-    else
-      result.failed_indices.push_back(idx);
+    static std::atomic<unsigned> counter{0};
+    std::error_code ec;
+    auto dir = std::filesystem::temp_directory_path(ec);
+    if (ec)
+      dir = "/tmp";
+    out.rsp_file = (dir / ("bld-" + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".rsp")).string();
 
-    cleanup_process(procs[idx]);
+    int fd = ::open(out.rsp_file.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to create response file " + out.rsp_file + ": " + std::string(strerror(errno)));
+      out.rsp_file.clear();
+      return false;
+    }
+    std::string_view rest = content;
+    while (!rest.empty())
+    {
+      ssize_t n = ::write(fd, rest.data(), rest.size());
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+      {
+        bld::internal_log(bld::Log_type::ERR, "Failed to write response file " + out.rsp_file + ": " + std::string(strerror(errno)));
+        ::close(fd);
+        ::unlink(out.rsp_file.c_str());
+        out.rsp_file.clear();
+        return false;
+      }
+      rest.remove_prefix(static_cast<size_t>(n));
+    }
+    ::close(fd);
 
-    if (show_progress)
-      _bld_emit(++done_count, total, bool(es), get_label(idx), es.exit_code, sig_num);
+    out.rsp_parts = {command.parts[0], policy.prefix + out.rsp_file};
+    out.args = {out.rsp_parts[0].data(), out.rsp_parts[1].data(), nullptr};
+#endif
+    return true;
   }
 
-#else  // Windows
-
-  std::vector<HANDLE> active_handles;
-  std::vector<size_t> active_indices;
-  active_handles.reserve(total);
-  active_indices.reserve(total);
+#ifndef _WIN32
+  // Set by Dep_graph::serve_daemon, which ignores SIGPIPE so a vanished client cannot kill it.
+  bool _bld_daemon_sigpipe = false;
 
-  for (size_t i = 0; i < total; ++i)
+  // Child side of Command::cwd and Command::env, then exec. Never returns.
+  [[noreturn]] void _bld_exec_child(const bld::Command &command, _bld_argv &argv)
   {
-    if (!procs[i].is_valid())
+    if (!command.cwd.empty() && ::chdir(command.cwd.c_str()) == -1)
     {
-      result.exit_statuses[i] = Exit_status{false, -1};
-      result.failed_indices.push_back(i);
-      if (show_progress)
-        _bld_emit(++done_count, total, false, get_label(i), -1);
-      continue;
+      bld::internal_log(bld::Log_type::ERR, "Failed to change directory to " + command.cwd + ": " + std::string(strerror(errno)));
+      _exit(EXIT_FAILURE);
     }
-    active_handles.push_back(procs[i].process_handle);
-    active_indices.push_back(i);
+    if (_bld_daemon_sigpipe)
+      signal(SIGPIPE, SIG_DFL);  // Ignored in the daemon only, children get the usual behaviour
+    // Swapping environ (we are single threaded after fork) makes execvp search the child's PATH as well.
+    if (!argv.envp.empty())
+      ENVIRON = argv.envp.data();
+    execvp(argv.args[0], argv.args.data());
+    bld::internal_log(bld::Log_type::ERR, "Failed to exec: " + std::string(strerror(errno)));
+    _exit(EXIT_FAILURE);
   }
+#endif
 
-  while (!active_handles.empty())
+  // Hand ownership of argv resources to the child registry (spawned) or drop them (spawn failed).
+  void _bld_adopt_argv(bld::pid p, _bld_argv &argv, bool spawned)
   {
-    const DWORD batch = static_cast<DWORD>(std::min(active_handles.size(), static_cast<size_t>(MAXIMUM_WAIT_OBJECTS)));
-
-    DWORD wr = ::WaitForMultipleObjects(batch, active_handles.data(), FALSE, INFINITE);
-
-    if (wr == WAIT_FAILED || wr >= WAIT_OBJECT_0 + batch)
+    if (argv.rsp_file.empty())
+      return;
+    if (!spawned)
     {
-      bld::internal_log(Log_type::ERR, "WaitForMultipleObjects: " + std::to_string(GetLastError()));
-      break;
+      std::filesystem::remove(argv.rsp_file);
+      return;
     }
+    std::lock_guard<std::mutex> lock(_bld_children_mutex());
+    _bld_children()[p].rsp_file = std::move(argv.rsp_file);
+  }
 
-    const size_t slot = static_cast<size_t>(wr - WAIT_OBJECT_0);
-    const size_t proc_idx = active_indices[slot];
+  // Parent side of Proc_limits. Everything that allocates or formats happens here so the child only makes syscalls.
+  struct _bld_limits
+  {
+#ifndef _WIN32
+    cpu_set_t cpus;
+    bool has_cpus = false;
+    int cgroup_procs = -1;  // cgroup.procs of the leaf, child writes "0" to join
+    std::string cgroup_leaf;
+#endif
+  };
 
-    Exit_status es{};
-    DWORD exit_code = 0;
-    if (::GetExitCodeProcess(active_handles[slot], &exit_code))
+#ifndef _WIN32
+  bool _bld_write_small_file(const std::string &path, const std::string &value)
+  {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+      return false;
+    bool ok = ::write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    ::close(fd);
+    return ok;
+  }
+#endif
+
+  bool _bld_prepare_limits(const bld::Proc_limits &l, _bld_limits &out)
+  {
+#ifndef _WIN32
+    if (!l.cpu_affinity.empty())
     {
-      es.normal = true;
-      es.exit_code = static_cast<int>(exit_code);
+      CPU_ZERO(&out.cpus);
+      for (int cpu : l.cpu_affinity)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &out.cpus);
+      out.has_cpus = true;
     }
 
-    result.exit_statuses[proc_idx] = es;
-    if (es)
-      ++result.completed;
-    else
-      result.failed_indices.push_back(proc_idx);
-
-    cleanup_process(procs[proc_idx]);
+    if (l.cgroup_parent.empty())
+      return true;
 
-    if (show_progress)
-      _bld_emit(++done_count, total, bool(es), get_label(proc_idx), es.exit_code);
+    // Controllers must be enabled on the parent for the leaf to get memory.max/cpu.max. Harmless if they already are.
+    std::string subtree = l.cgroup_parent + "/cgroup.subtree_control";
+    if (!l.memory_max.empty())
+      _bld_write_small_file(subtree, "+memory");
+    if (!l.cpu_max.empty())
+      _bld_write_small_file(subtree, "+cpu");
 
-    // O(1) removal via swap-with-last.
-    active_handles[slot] = active_handles.back();
-    active_handles.pop_back();
-    active_indices[slot] = active_indices.back();
-    active_indices.pop_back();
-  }
+    static std::atomic<unsigned> counter{0};
+    out.cgroup_leaf = l.cgroup_parent + "/bld-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    if (::mkdir(out.cgroup_leaf.c_str(), 0755) == -1)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to create cgroup " + out.cgroup_leaf + ": " + std::string(strerror(errno)));
+      out.cgroup_leaf.clear();
+      return false;
+    }
 
+    bool ok = true;
+    if (!l.memory_max.empty() && !_bld_write_small_file(out.cgroup_leaf + "/memory.max", l.memory_max))
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to set memory.max on " + out.cgroup_leaf + ": " + std::string(strerror(errno)));
+      ok = false;
+    }
+    if (ok && !l.cpu_max.empty() && !_bld_write_small_file(out.cgroup_leaf + "/cpu.max", l.cpu_max))
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to set cpu.max on " + out.cgroup_leaf + ": " + std::string(strerror(errno)));
+      ok = false;
+    }
+    if (ok && (out.cgroup_procs = ::open((out.cgroup_leaf + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC)) == -1)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to open cgroup.procs of " + out.cgroup_leaf + ": " + std::string(strerror(errno)));
+      ok = false;
+    }
+    if (!ok)
+    {
+      ::rmdir(out.cgroup_leaf.c_str());
+      out.cgroup_leaf.clear();
+    }
+    return ok;
+#else
+    if (!l.empty())
+      bld::internal_log(bld::Log_type::WARNING, "Process limits are not supported on Windows, ignoring them.");
+    (void)out;
+    return true;
 #endif
+  }
 
-  if (show_progress)
+#ifndef _WIN32
+  // Runs in the child right before exec.
+  void _bld_apply_limits(const bld::Proc_limits &l, const _bld_limits &prep)
   {
-    if (result.failed_indices.empty())
+    if (prep.cgroup_procs != -1 && ::write(prep.cgroup_procs, "0", 1) != 1)
     {
-      bld::internal_log(Log_type::INFO, "All " + std::to_string(total) + " processes completed successfully.");
+      bld::internal_log(bld::Log_type::ERR, "Failed to join cgroup: " + std::string(strerror(errno)));
+      _exit(EXIT_FAILURE);
     }
-    else
+    if (prep.has_cpus && sched_setaffinity(0, sizeof(prep.cpus), &prep.cpus) == -1)
     {
-      bld::internal_log(Log_type::WARNING, std::to_string(result.completed) + "/" + std::to_string(total) + " succeeded, " +
-                                               std::to_string(result.failed_indices.size()) + " failed.");
+      bld::internal_log(bld::Log_type::ERR, "Failed to set CPU affinity: " + std::string(strerror(errno)));
+      _exit(EXIT_FAILURE);
+    }
+    if (l.nice != 0)
+    {
+      errno = 0;
+      if (::nice(l.nice) == -1 && errno != 0)
+      {
+        bld::internal_log(bld::Log_type::ERR, "Failed to set nice value: " + std::string(strerror(errno)));
+        _exit(EXIT_FAILURE);
+      }
+    }
+    for (const auto &r : l.rlimits)
+    {
+      struct rlimit rl = {static_cast<rlim_t>(r.soft), static_cast<rlim_t>(r.hard)};
+      if (setrlimit(r.resource, &rl) == -1)
+      {
+        bld::internal_log(bld::Log_type::ERR, "Failed to set rlimit " + std::to_string(r.resource) + ": " + std::string(strerror(errno)));
+        _exit(EXIT_FAILURE);
+      }
     }
   }
+#endif
 
-  return result;
-}
-
-void bld::cleanup_process(bld::Proc &proc)
-{
-#ifdef _WIN32
-  if (proc.thread_handle)
+  // Hand the cgroup leaf to the child registry (spawned) or remove it (spawn failed).
+  void _bld_adopt_limits(bld::pid p, _bld_limits &prep, bool spawned)
   {
-    CloseHandle(proc.thread_handle);
-    proc.thread_handle = nullptr;
-  }
-  if (proc.process_handle)
-  {
-    CloseHandle(proc.process_handle);
-    proc.process_handle = nullptr;
-  }
-  proc.process_id = 0;
+#ifndef _WIN32
+    if (prep.cgroup_procs != -1)
+      ::close(prep.cgroup_procs);
+    prep.cgroup_procs = -1;
+    if (prep.cgroup_leaf.empty())
+      return;
+    if (!spawned)
+    {
+      ::rmdir(prep.cgroup_leaf.c_str());
+      return;
+    }
+    std::lock_guard<std::mutex> lock(_bld_children_mutex());
+    _bld_children()[p].cgroup_leaf = std::move(prep.cgroup_leaf);
 #else
-  proc.p_id = -1;
+    (void)p;
+    (void)prep;
+    (void)spawned;
 #endif
-  proc.state = State::INIT_ERROR;  // Mark as invalid
-  proc.ok = false;
-}
-
-bld::Exit_status bld::execute(const Command &command)
-{
-  bld::internal_log(Log_type::INFO, "Executing: " + command.get_print_string());
-
-  Proc proc = execute_async(command);
-  if (!proc)
-  {
-    Exit_status status{};
-    return status;
   }
 
-  Exit_status status = wait_proc(proc);
-  cleanup_process(proc);
-  return status;
-}
+#ifndef _WIN32
+  // Children get their own process group so a timeout or interrupt can kill everything they spawned.
+  // Exception: a child sharing our terminal for stdin stays in the foreground group, otherwise reading it would stop with SIGTTIN.
+  bool _bld_wants_group(bool stdin_redirected) { return stdin_redirected || !isatty(STDIN_FILENO); }
+
+  // Parent half of setpgid (the child does the same, whichever runs first wins) and registration for the interrupt handler.
+  void _bld_adopt_group(bld::Proc &proc, const bld::Command &command, bool own_group)
+  {
+    proc.own_group = own_group;
+    proc.kill_grace = command.kill_grace;
+    if (command.timeout.count() > 0)
+      proc.deadline = proc.started + command.timeout;
+    if (!own_group)
+      return;
 
-bld::Proc bld::execute_async(const Command &command)
-{
-  if (command.is_empty())
-  {
-    bld::internal_log(Log_type::ERR, "No command to execute.");
-    return Proc{};  // Default constructor gives USER_ERROR
+    setpgid(proc.p_id, proc.p_id);
+    int slot = _bld_track_group(proc.p_id);
+    std::lock_guard<std::mutex> lock(_bld_children_mutex());
+    _bld_children()[proc.p_id].group_slot = slot;
   }
 
-#ifdef _WIN32
-  STARTUPINFOA si = {sizeof(STARTUPINFOA)};
-  PROCESS_INFORMATION pi;
-
-  // Build command string
-  std::string command_str;
-  for (size_t i = 0; i < command.parts.size(); ++i)
+  void _bld_signal_proc(const bld::Proc &p, int sig)
   {
-    if (i > 0)
-      command_str += " ";
-
-    const auto &part = command.parts[i];
-    if (part.find(' ') != std::string::npos)
-      command_str += "\"" + part + "\"";
+    if (p.own_group)
+      ::killpg(p.p_id, sig);
     else
-      command_str += part;
+      ::kill(p.p_id, sig);
   }
 
-  std::vector<char> cmd_buffer(command_str.begin(), command_str.end());
-  cmd_buffer.push_back('\0');
-  if (!CreateProcessA(nullptr, cmd_buffer.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi))
+  // Sleep until one of `pidfds` is readable (a child exited) or `until`. Without pidfds, sleep in short steps.
+  void _bld_sleep_until(std::vector<struct pollfd> &pidfds, std::chrono::steady_clock::time_point until)
   {
-    bld::log(Log_type::ERR, "Failed to create process. Error: " + std::to_string(GetLastError()));
-    Proc proc;
-    proc.res = Proc_result::SYSTEM_ERROR;
-    return proc;
+    auto now = std::chrono::steady_clock::now();
+    if (now >= until)
+      return;
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(until - now).count();
+    if (pidfds.empty())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(std::min<long long>(left, 5)));
+      return;
+    }
+    ::poll(pidfds.data(), pidfds.size(), static_cast<int>(std::min<long long>(left, std::numeric_limits<int>::max())));
   }
 
-  Proc prc(pi.hProcess, pi.hThread, pi.dwProcessId);
-  prc.label = command.get_command_string();
-
-  return prc;
-
-#else
-  auto args = command.to_exec_args();
-  pid_t pid = fork();
-
-  if (pid == -1)
+  int _bld_pidfd(pid_t pid)
   {
-    bld::internal_log(Log_type::ERR, "Failed to fork: " + std::string(strerror(errno)));
-    Proc proc;
-    proc.state = State::INIT_ERROR;
-    return proc;
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    return -1;
+#endif
   }
-  else if (pid == 0)
+
+  // wait4 on `pid` until `until`. Returns the pid once reaped, 0 on timeout, -1 on error.
+  pid_t _bld_wait_until(pid_t pid, int &raw, struct rusage &ru, std::chrono::steady_clock::time_point until)
   {
-    // Child process
-    if (execvp(args[0], args.data()) == -1)
+    pid_t r;
+    if (until == std::chrono::steady_clock::time_point::max())
     {
-      bld::internal_log(Log_type::ERR, "Failed to exec: " + std::string(strerror(errno)));
-      exit(EXIT_FAILURE);
+      while ((r = wait4(pid, &raw, 0, &ru)) == -1 && errno == EINTR) {}
+      return r;
     }
-    bld::internal_log(bld::Log_type::ERR, "Unreachable code after execvp!");
-    std::exit(EXIT_FAILURE);
-  }
 
-  Proc proc(pid);
-  proc.label = command.get_command_string();
+    std::vector<struct pollfd> fds;
+    if (int fd = _bld_pidfd(pid); fd >= 0)
+      fds.push_back({fd, POLLIN, 0});
 
-  return proc;
-#endif
-}
+    while ((r = wait4(pid, &raw, WNOHANG, &ru)) == 0 && std::chrono::steady_clock::now() < until)
+      _bld_sleep_until(fds, until);
 
-bld::Proc bld::execute_async_redirect(const Command &command, const Redirect &redirect)
-{
-  if (command.is_empty())
-  {
-    bld::internal_log(Log_type::ERR, "No command to execute.");
-    return Proc{};
+    for (auto &f : fds) ::close(f.fd);
+    return r;
   }
 
-#ifdef _WIN32
-  STARTUPINFOA si = {sizeof(STARTUPINFOA)};
-  PROCESS_INFORMATION pi;
-
-  // Set up redirection
-  si.dwFlags |= STARTF_USESTDHANDLES;
-  si.hStdInput = redirect.stdin_fd != INVALID_FD ? redirect.stdin_fd : GetStdHandle(STD_INPUT_HANDLE);
-  si.hStdOutput = redirect.stdout_fd != INVALID_FD ? redirect.stdout_fd : GetStdHandle(STD_OUTPUT_HANDLE);
-  si.hStdError = redirect.stderr_fd != INVALID_FD ? redirect.stderr_fd : GetStdHandle(STD_ERROR_HANDLE);
-
-  // Build command string
-  std::string command_str;
-  for (size_t i = 0; i < command.parts.size(); ++i)
+  // Reap `p`. At `deadline` its group gets SIGTERM, then SIGKILL after p.kill_grace. `terminated` tells if that happened.
+  pid_t _bld_reap(const bld::Proc &p, std::chrono::steady_clock::time_point deadline, int &raw, struct rusage &ru, bool &terminated)
   {
-    if (i > 0)
-      command_str += " ";
+    using clock = std::chrono::steady_clock;
+    terminated = false;
+    pid_t r = _bld_wait_until(p.p_id, raw, ru, deadline == clock::time_point{} ? clock::time_point::max() : deadline);
+    if (r != 0)
+      return r;
 
-    const auto &part = command.parts[i];
-    if (part.find(' ') != std::string::npos)
-      command_str += "\"" + part + "\"";
-    else
-      command_str += part;
-  }
+    terminated = true;
+    _bld_signal_proc(p, SIGTERM);
+    if ((r = _bld_wait_until(p.p_id, raw, ru, clock::now() + p.kill_grace)) != 0)
+      return r;
 
-  std::vector<char> cmd_buffer(command_str.begin(), command_str.end());
-  cmd_buffer.push_back('\0');
+    _bld_signal_proc(p, SIGKILL);
+    return _bld_wait_until(p.p_id, raw, ru, clock::time_point::max());
+  }
+#endif
 
-  if (!CreateProcessA(nullptr, cmd_buffer.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi))
+  // Wait for `proc`, killing it at `deadline` ({} = never). Shared by wait_proc, the timed wait_proc and cancel.
+  bld::Exit_status _bld_wait_proc(const bld::Proc &proc, std::chrono::steady_clock::time_point deadline)
   {
-    bld::log(Log_type::ERR, "Failed to create process. Error: " + std::to_string(GetLastError()));
-    Proc proc;
-    proc.res = Proc_result::SYSTEM_ERROR;
-    return proc;
-  }
+    using bld::Log_type;
+    bld::Exit_status status{};
 
-  CloseHandle(pi.hThread);  // We don't need the thread handle
-  Proc proc(pi.hProcess, nullptr, pi.dwProcessId);
-  proc.label = command.get_command_string();
-  return proc;
+    if (!proc.is_valid())
+    {
+      bld::internal_log(Log_type::ERR, "Invalid process");
+      return status;  // normal=false by default
+    }
 
-#else
-  auto args = command.to_exec_args();
-  pid_t pid = fork();
+#ifdef _WIN32
+    DWORD wait_ms = INFINITE;
+    if (deadline != std::chrono::steady_clock::time_point{})
+      wait_ms = static_cast<DWORD>(std::max<long long>(
+          0, std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count()));
 
-  if (pid == -1)
-  {
-    bld::internal_log(Log_type::ERR, "Failed to fork: " + std::string(strerror(errno)));
-    Proc proc;
-    proc.state = State::INIT_ERROR;
-    return proc;
-  }
-  else if (pid == 0)
-  {
-    // Child process - set up redirection
-    if (redirect.stdin_fd != INVALID_FD)
+    DWORD wait_result = WaitForSingleObject(proc.process_handle, wait_ms);
+    if (wait_result == WAIT_TIMEOUT)
     {
-      if (dup2(redirect.stdin_fd, STDIN_FILENO) == -1)
-      {
-        bld::internal_log(Log_type::ERR, "Failed to redirect stdin: " + std::string(strerror(errno)));
-        exit(EXIT_FAILURE);
-      }
+      status.timed_out = true;
+      TerminateProcess(proc.process_handle, 1);
+      wait_result = WaitForSingleObject(proc.process_handle, INFINITE);
     }
-
-    if (redirect.stdout_fd != INVALID_FD)
+    if (wait_result != WAIT_OBJECT_0)
     {
-      if (dup2(redirect.stdout_fd, STDOUT_FILENO) == -1)
-      {
-        bld::internal_log(Log_type::ERR, "Failed to redirect stdout: " + std::string(strerror(errno)));
-        exit(EXIT_FAILURE);
-      }
+      bld::log(Log_type::ERR, "WaitForSingleObject failed. Error: " + std::to_string(GetLastError()));
+      return status;
     }
 
-    if (redirect.stderr_fd != INVALID_FD)
+    DWORD exit_code = 0;
+    if (!GetExitCodeProcess(proc.process_handle, &exit_code))
     {
-      if (dup2(redirect.stderr_fd, STDERR_FILENO) == -1)
-      {
-        bld::internal_log(Log_type::ERR, "Failed to redirect stderr: " + std::string(strerror(errno)));
-        exit(EXIT_FAILURE);
-      }
+      bld::log(Log_type::ERR, "Failed to get exit code. Error: " + std::to_string(GetLastError()));
+      return status;
     }
 
-    // Close redirected FDs in child
-    if (redirect.stdin_fd != INVALID_FD)
-      close(redirect.stdin_fd);
-    if (redirect.stdout_fd != INVALID_FD)
-      close(redirect.stdout_fd);
-    if (redirect.stderr_fd != INVALID_FD)
-      close(redirect.stderr_fd);
+    status.normal = !status.timed_out;
+    status.exit_code = static_cast<int>(exit_code);
+    status.usage.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - proc.started).count();
 
-    // Execute command
-    if (execvp(args[0], args.data()) == -1)
+    if (exit_code != 0)
+      bld::log(Log_type::ERR, "Process exited with code: " + std::to_string(exit_code));
+
+#else
+    int wait_status;
+    struct rusage ru{};
+    bool terminated = false;
+    if (_bld_reap(proc, deadline, wait_status, ru, terminated) == -1)
     {
-      bld::internal_log(Log_type::ERR, "Failed to exec: " + std::string(strerror(errno)));
-      exit(EXIT_FAILURE);
+      bld::internal_log(Log_type::ERR, "waitpid failed: " + std::string(strerror(errno)));
+      return status;
     }
-  }
-
-  // Parent process - close redirected FDs
-  if (redirect.stdin_fd != INVALID_FD)
-    close(redirect.stdin_fd);
-  if (redirect.stdout_fd != INVALID_FD)
-    close(redirect.stdout_fd);
-  if (redirect.stderr_fd != INVALID_FD)
-    close(redirect.stderr_fd);
+    _bld_release_child(proc.p_id);
+    status.usage = _bld_usage(ru, proc.started);
+    status.timed_out = terminated;
 
-  Proc proc(pid);
-  proc.label = command.get_command_string();
-  return proc;
+    if (terminated)
+    {
+      status.signal = WIFSIGNALED(wait_status) ? WTERMSIG(wait_status) : 0;
+      status.exit_code = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 0;
+      bld::internal_log(Log_type::ERR, "Process " + std::to_string(proc.p_id) + " terminated after " +
+                                           std::to_string(static_cast<long long>(status.usage.wall_ms)) + "ms: deadline passed");
+    }
+    else if (WIFEXITED(wait_status))
+    {
+      status.normal = true;
+      status.exit_code = WEXITSTATUS(wait_status);
+
+      if (status.exit_code != 0)
+        bld::internal_log(Log_type::ERR, "Process exited with code: " + std::to_string(status.exit_code));
+    }
+    else if (WIFSIGNALED(wait_status))
+    {
+      status.signal = WTERMSIG(wait_status);
+      bld::internal_log(Log_type::ERR, "Process terminated by signal: " + std::to_string(status.signal));
+    }
 #endif
-}
 
-bld::Exit_status bld::execute_redirect(const Command &command, const Redirect &redirect)
-{
-  bld::internal_log(Log_type::INFO, "Executing with redirection: " + command.get_print_string());
+    return status;
+  }
+}  // anonymous namespace
 
-  Proc proc = execute_async_redirect(command, redirect);
-  if (!proc)
-    return Exit_status{};
+bld::Exit_status bld::wait_proc(bld::Proc proc) { return _bld_wait_proc(proc, proc.deadline); }
 
-  Exit_status status = wait_proc(proc);
-  cleanup_process(proc);
+bld::Exit_status bld::wait_proc(bld::Proc &proc, std::chrono::milliseconds timeout)
+{
+  auto deadline = proc.deadline;
+  if (timeout.count() > 0)
+  {
+    auto limit = std::chrono::steady_clock::now() + timeout;
+    if (deadline == std::chrono::steady_clock::time_point{} || limit < deadline)
+      deadline = limit;
+  }
+
+  Exit_status status = _bld_wait_proc(proc, deadline);
+  if (proc.is_valid())
+  {
+    proc.exit_code = status.exit_code;
+#ifndef _WIN32
+    proc.signal = status.signal;
+#endif
+    proc.state = status.timed_out ? State::TIMED_OUT : status.normal ? State::EXITED : State::SIGNALLED;
+  }
   return status;
 }
 
-// Open a file for reading
-bld::Fd bld::open_for_read(const std::string &path)
+bld::Exit_status bld::cancel(bld::Proc &proc)
 {
-#ifdef _WIN32
-  SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES)};
-  sa.bInheritHandle = TRUE;
-
-  HAND handle = CreateFileA(path.c_str(), GENERIC_READ, 0, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  if (handle == INVALID_HANDLE_VALUE)
-    bld::log(Log_type::ERR, "Failed to open file for reading: " + path);
-  return handle;
-#else
-  int fd = open(path.c_str(), O_RDONLY);
-  if (fd == -1)
-    bld::internal_log(Log_type::ERR, "Failed to open file for reading: " + path + " - " + std::string(strerror(errno)));
-  return fd;
+  // A deadline in the past terminates right away, unless the process already exited on its own.
+  Exit_status status = _bld_wait_proc(proc, std::chrono::steady_clock::now());
+  if (proc.is_valid())
+  {
+    status.cancelled = status.timed_out;
+    status.timed_out = false;
+    proc.exit_code = status.exit_code;
+#ifndef _WIN32
+    proc.signal = status.signal;
 #endif
+    proc.state = status.cancelled ? State::CANCELLED : status.normal ? State::EXITED : State::SIGNALLED;
+  }
+  return status;
 }
 
-// Open a file for writing
-bld::Fd bld::open_for_write(const std::string &path, bool append)
+namespace
 {
-#ifdef _WIN32
-  SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES)};
-  sa.bInheritHandle = TRUE;
-
-  DWORD disposition = append ? OPEN_ALWAYS : CREATE_ALWAYS;
-  HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, &sa, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
-  if (handle == INVALID_HANDLE_VALUE)
+  // "[NNN%]" — always 6 chars wide, right-justified percentage.
+  inline std::string _bld_pct(size_t done, size_t total)
   {
-    bld::log(Log_type::ERR, "Failed to open file for writing: " + path);
-    return INVALID_FD;
+    int pct = (total > 0) ? static_cast<int>(100.0 * done / total) : 100;
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "[%3d%%]", pct);
+    return {buf};
   }
 
-  if (append)
-    SetFilePointer(handle, 0, NULL, FILE_END);
+  // Emit one make-style line to stderr.
+  // `sig` is only meaningful (non-zero) on Unix when a signal killed the process.
+  inline void _bld_emit(size_t done, size_t total, bool success, const std::string &label, int exit_code = 0, int sig = 0)
+  {
+#ifdef BLD_NO_LOGGING
+    (void)done;
+    (void)total;
+    (void)success;
+    (void)label;
+    (void)exit_code;
+    (void)sig;
+    return;
+#endif
 
-  return handle;
+#ifdef BLD_USE_COLORS
+    const char *c_pct = "\x1b[38;2;130;170;255m";    // light blue
+    const char *c_ok = "\x1b[38;2;80;250;123m";      // mint green
+    const char *c_fail = "\x1b[38;2;255;85;85m";     // red
+    const char *c_label = "\x1b[38;2;220;220;220m";  // light grey
+    const char *c_dim = "\x1b[38;2;110;110;110m";    // dim grey
+    const char *c_reset = "\x1b[0m";
 #else
-  int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
-  int fd = open(path.c_str(), flags, 0644);
-  if (fd == -1)
-    bld::internal_log(Log_type::ERR, "Failed to open file for writing: " + path + " - " + std::string(strerror(errno)));
-  return fd;
+    const char *c_pct = "";
+    const char *c_ok = "";
+    const char *c_fail = "";
+    const char *c_label = "";
+    const char *c_dim = "";
+    const char *c_reset = "";
 #endif
-}
 
-bld::Redirect::Redirect(const std::string& _in, const std::string& _out, const std::string& _err)
-{
-  if (_in.empty())
-    this->stdin_fd = bld::INVALID_FD;
-  else
-    this->stdin_fd = bld::open_for_read(_in);
-  if (_out.empty())
-    this->stdout_fd = bld::INVALID_FD;
-  else
-    this->stdout_fd = bld::open_for_write(_out);
-  if (_err.empty())
-    this->stderr_fd = bld::INVALID_FD;
-  else
-    this->stderr_fd = bld::open_for_write(_err);
-}
+    // "[NNN%]  Done    'label'"  or  "[NNN%]  FAILED  'label'  (exit N)"
+    std::cerr << c_pct << _bld_pct(done, total) << c_reset << "  " << (success ? c_ok : c_fail) << (success ? "Done  " : "FAILED")
+              << c_reset << "  " << c_label << label << c_reset;
 
-bld::Redirect::~Redirect()
-{
-  if (this->stdin_fd  != bld::INVALID_FD) bld::close_fd(stdin_fd);
-  if (this->stdout_fd != bld::INVALID_FD) bld::close_fd(stdout_fd);
-  if (this->stderr_fd != bld::INVALID_FD) bld::close_fd(stderr_fd);
-}
+    if (!success)
+    {
+      std::cerr << "  " << c_dim;
+      if (sig != 0)
+        std::cerr << "(signal " << sig << ")";
+      else
+        std::cerr << "(exit " << exit_code << ")";
+      std::cerr << c_reset;
+    }
 
-template <typename... Fds, typename>
-void bld::close_fd(Fds ...fds)
-{
-  (..., (
-  [&]
+    std::cerr << "\n";
+    std::cerr.flush();
+  }
+
+  // Opening line printed before the loop.
+  inline void _bld_emit_start(size_t total)
   {
-    if (fds == INVALID_FD) return;
+#ifdef BLD_NO_LOGGING
+    (void)total;
+    return;
+#endif
+#ifdef BLD_USE_COLORS
+    const char *c_pct = "\x1b[38;2;130;170;255m";
+    const char *c_dim = "\x1b[38;2;110;110;110m";
+    const char *c_reset = "\x1b[0m";
+#else
+    const char *c_pct = "";
+    const char *c_dim = "";
+    const char *c_reset = "";
+#endif
+    std::cerr << c_pct << "[  0%]" << c_reset << "  " << c_dim << "Waiting for " << total << " process" << (total == 1 ? "" : "es") << "..."
+              << c_reset << "\n";
+    std::cerr.flush();
+  }
 
-    #ifdef _WIN32
-      CloseHandle((HANDLE)fds);
-    #else
-      close(fds);
-    #endif
-  }()));
-}
+}  // anonymous namespace
 
-bld::Par_exec_res bld::execute_threads(const std::vector<bld::Command> &cmds, size_t threads, bool strict)
+bld::Par_exec_res bld::wait_procs(std::vector<bld::Proc> procs, bool show_progress, std::chrono::milliseconds timeout)
 {
-  bld::Par_exec_res result;
-  result.exit_statuses.resize(cmds.size());
+  Par_exec_res result;
+  const size_t total = procs.size();
+  result.exit_statuses.resize(total);
 
-  if (cmds.empty())
+  if (total == 0)
     return result;
-  if (threads == 0)
-    threads = 1;
-  if (threads > std::thread::hardware_concurrency())
-    threads = std::thread::hardware_concurrency();
 
-  std::mutex queue_mutex, output_mutex;
-  std::atomic<bool> stop_workers{false};  // Used when strict = true
+  // Display label for slot i: use proc.label if set, else "process N".
+  auto get_label = [&](size_t i) -> std::string
+  { return procs[i].label.empty() ? "process " + std::to_string(i) : "'" + procs[i].label + "'"; };
 
-  // Queue of command indices to process
-  std::queue<size_t> cmd_queue;
-  for (size_t i = 0; i < cmds.size(); ++i) cmd_queue.push(i);
+  // One lane per slot, from the start of the process to its reaping
+  auto trace_proc = [&](size_t i)
+  {
+    if (bld::trace::enabled())
+      bld::trace::complete(procs[i].label.empty() ? "pid " + std::to_string(procs[i].p_id) : procs[i].label, "process", procs[i].started,
+                           std::chrono::steady_clock::now(), "wait_procs " + std::to_string(i));
+  };
 
-  bld::internal_log(bld::Log_type::INFO, "Executing " + std::to_string(cmds.size()) + " commands on " + std::to_string(threads) + " threads...");
+  if (show_progress)
+    _bld_emit_start(total);
 
-  // Worker function
-  auto worker = [&]()
+  size_t done_count = 0;
+
+  using clock = std::chrono::steady_clock;
+  clock::time_point batch_deadline = timeout.count() > 0 ? clock::now() + timeout : clock::time_point::max();
+
+#ifndef _WIN32
+  std::unordered_map<pid_t, size_t> pid_to_idx;
+  pid_to_idx.reserve(total);
+  size_t active = 0;
+
+  // Deadline bookkeeping, only used when some process has a deadline.
+  enum class Kill : uint8_t { None, Term, Killed };
+  std::vector<clock::time_point> next_kill(total, clock::time_point::max());
+  std::vector<Kill> kill_stage(total, Kill::None);
+  std::unordered_map<pid_t, int> pidfds;
+  bool timed = false;
+
+  for (size_t i = 0; i < total; ++i)
   {
-    while (true)
+    if (!procs[i].is_valid())
     {
-      if (strict && stop_workers)
-        return;  // Stop all threads if strict and an error occurs
+      result.exit_statuses[i] = Exit_status{false, -1, 0};
+      result.failed_indices.push_back(i);
+      if (show_progress)
+        _bld_emit(++done_count, total, false, get_label(i), -1);
+      continue;
+    }
+    pid_to_idx[procs[i].p_id] = i;
+    ++active;
 
-      size_t cmd_idx;
-      {
-        std::lock_guard<std::mutex> lock(queue_mutex);
-        if (cmd_queue.empty())
-          return;
-        cmd_idx = cmd_queue.front();
-        cmd_queue.pop();
-      }
+    next_kill[i] = procs[i].deadline == clock::time_point{} ? batch_deadline : std::min(procs[i].deadline, batch_deadline);
+    timed = timed || next_kill[i] != clock::time_point::max();
+  }
 
-      // Run command
-      bld::Exit_status execution_result = execute(cmds[cmd_idx]);
+  if (timed)
+    for (auto &[pid, idx] : pid_to_idx)
+      if (int fd = _bld_pidfd(pid); fd >= 0)
+        pidfds[pid] = fd;
 
-      // Record result
-      result.exit_statuses[cmd_idx] = execution_result;
+  while (active > 0)
+  {
+    int raw = 0;
+    struct rusage ru{};
+    pid_t pid = ::wait4(-1, &raw, timed ? WNOHANG : 0, &ru);
 
-      if (!execution_result.normal)
+    if (pid == 0)
+    {
+      // Nothing exited: escalate overdue processes (TERM, then KILL after kill_grace) and sleep until the next event.
+      auto now = clock::now();
+      auto wake = clock::time_point::max();
+      for (auto &[p, idx] : pid_to_idx)
       {
+        if (kill_stage[idx] != Kill::Killed && now >= next_kill[idx])
         {
-          std::lock_guard<std::mutex> lock(queue_mutex);
-          result.failed_indices.push_back(cmd_idx);
-        }
-
-        if (strict)
-        {
-          stop_workers = true;
-          return;
+          bool term = kill_stage[idx] == Kill::None;
+          _bld_signal_proc(procs[idx], term ? SIGTERM : SIGKILL);
+          kill_stage[idx] = term ? Kill::Term : Kill::Killed;
+          next_kill[idx] = term ? now + procs[idx].kill_grace : clock::time_point::max();
         }
+        wake = std::min(wake, next_kill[idx]);
       }
-      else
-      {
-        {
-          std::lock_guard<std::mutex> lock(queue_mutex);
-          result.completed++;
-        }
 
-        {
-          std::lock_guard<std::mutex> lock(output_mutex);
-          bld::internal_log(bld::Log_type::INFO, "Completed: " + cmds[cmd_idx].get_print_string());
-        }
-      }
+      std::vector<struct pollfd> fds;
+      if (pidfds.size() == pid_to_idx.size())
+        for (auto &[p, fd] : pidfds) fds.push_back({fd, POLLIN, 0});
+      _bld_sleep_until(fds, wake);
+      continue;
     }
-  };
 
-  // Launch worker threads
-  std::vector<std::thread> workers;
-  size_t num_threads = std::min(threads, cmds.size());
-  for (size_t i = 0; i < num_threads; ++i) workers.emplace_back(worker);
+    if (pid == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == ECHILD)
+        break;
+      bld::internal_log(Log_type::ERR, "waitpid(-1): " + std::string(strerror(errno)));
+      break;
+    }
 
-  // Wait for all threads to complete
-  for (auto &t : workers)
-    if (t.joinable())
-      t.join();
+    auto it = pid_to_idx.find(pid);
+    if (it == pid_to_idx.end())
+    {
+      bld::internal_log(Log_type::WARNING, "Reaped unexpected child PID " + std::to_string(pid) + " (not in wait_procs set — ignored).");
+      continue;
+    }
 
-  return result;
-}
+    const size_t idx = it->second;
+    pid_to_idx.erase(it);
+    --active;
+    _bld_release_child(pid);
+    if (auto fd = pidfds.find(pid); fd != pidfds.end())
+    {
+      ::close(fd->second);
+      pidfds.erase(fd);
+    }
 
-void bld::print_metadata()
-{
-  std::cerr << '\n';
-  bld::internal_log(Log_type::INFO, "Printing system metadata...........................................");
+    Exit_status es{};
+    int sig_num = 0;
+    es.usage = _bld_usage(ru, procs[idx].started);
+    es.timed_out = kill_stage[idx] != Kill::None;
 
-  // 1. Get OS information
-  std::string os_name = "Unknown";
-  std::string os_version = "Unknown";
-  std::string arch = "Unknown";
+    if (es.timed_out)
+    {
+      sig_num = WIFSIGNALED(raw) ? WTERMSIG(raw) : 0;
+      es.signal = sig_num;
+      es.exit_code = WIFEXITED(raw) ? WEXITSTATUS(raw) : 0;
+    }
+    else if (WIFEXITED(raw))
+    {
+      es.normal = true;
+      es.exit_code = WEXITSTATUS(raw);
+    }
+    else if (WIFSIGNALED(raw))
+    {
+      sig_num = WTERMSIG(raw);
+      es.signal = sig_num;
+    }
 
-#ifdef _WIN32
-  OSVERSIONINFOEX os_info;
-  ZeroMemory(&os_info, sizeof(OSVERSIONINFOEX));
-  os_info.dwOSVersionInfoSize = sizeof(OSVERSIONINFOEX);
+    result.exit_statuses[idx] = es;
+    result.total_usage += es.usage;
+    if (es)
+      ++result.completed;
+    else
+      result.failed_indices.push_back(idx);
 
-  if (GetVersionEx(reinterpret_cast<OSVERSIONINFO *>(&os_info)))
-  {
-    os_name = "Windows";
-    os_version = std::to_string(os_info.dwMajorVersion) + "." + std::to_string(os_info.dwMinorVersion) + " (Build " +
-                 std::to_string(os_info.dwBuildNumber) + ")";
-  }
+    trace_proc(idx);
+    cleanup_process(procs[idx]);
 
-  // Detect architecture
-  SYSTEM_INFO sys_info;
-  GetNativeSystemInfo(&sys_info);
-  switch (sys_info.wProcessorArchitecture)
-  {
-    case PROCESSOR_ARCHITECTURE_AMD64:
-      arch = "64-bit";
-      break;
-    case PROCESSOR_ARCHITECTURE_INTEL:
-      arch = "32-bit";
-      break;
-    case PROCESSOR_ARCHITECTURE_ARM64:
-      arch = "ARM 64-bit";
-      break;
-    case PROCESSOR_ARCHITECTURE_ARM:
-      arch = "ARM 32-bit";
-      break;
-    default:
-      arch = "Unknown";
-      break;
-  }
-#else
-  struct utsname sys_info;
-  if (uname(&sys_info) == 0)
-  {
-    os_name = sys_info.sysname;
-    os_version = sys_info.release;
-    arch = sys_info.machine;
+    if (show_progress)
+      _bld_emit(++done_count, total, bool(es), get_label(idx), es.exit_code, sig_num);
   }
-#endif
 
-  std::cerr << "    Operating System: " << os_name << " " << os_version << " (" << arch << ")" << std::endl;
+#else  // Windows
 
-  // 2. Compiler information
-  std::cerr << "    Compiler:         ";
-#ifdef __clang__
-  std::cerr << "Clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
-#elif defined(__GNUC__)
-  std::cerr << "GCC " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
-#elif defined(_MSC_VER)
-  std::cerr << "MSVC " << _MSC_VER;
-#else
-  std::cerr << "Unknown Compiler";
-#endif
-  std::cerr << std::endl;
+  std::vector<HANDLE> active_handles;
+  std::vector<size_t> active_indices;
+  active_handles.reserve(total);
+  active_indices.reserve(total);
 
-  internal_log(Log_type::INFO, "...................................................................\n");
-}
+  for (size_t i = 0; i < total; ++i)
+  {
+    if (!procs[i].is_valid())
+    {
+      result.exit_statuses[i] = Exit_status{false, -1};
+      result.failed_indices.push_back(i);
+      if (show_progress)
+        _bld_emit(++done_count, total, false, get_label(i), -1);
+      continue;
+    }
+    active_handles.push_back(procs[i].process_handle);
+    active_indices.push_back(i);
+  }
 
-int bld::get_n_procs(bool physical_cores_only)
-{
-#ifdef _WIN32
-  if (physical_cores_only)
+  while (!active_handles.empty())
   {
-    // Proper Windows physical core count
-    DWORD length = 0;
-    GetLogicalProcessorInformation(nullptr, &length);
-    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
-      return 0;
+    const DWORD batch = static_cast<DWORD>(std::min(active_handles.size(), static_cast<size_t>(MAXIMUM_WAIT_OBJECTS)));
 
-    auto *buffer = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)malloc(length);
-    if (!buffer)
-      return 0;
+    DWORD wait_ms = INFINITE;
+    if (batch_deadline != clock::time_point::max())
+    {
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(batch_deadline - clock::now()).count();
+      wait_ms = left > 0 ? static_cast<DWORD>(left) : 0;
+    }
 
-    if (!GetLogicalProcessorInformation(buffer, &length))
+    DWORD wr = ::WaitForMultipleObjects(batch, active_handles.data(), FALSE, wait_ms);
+
+    if (wr == WAIT_TIMEOUT)
     {
-      free(buffer);
-      return 0;
+      // No graceful stop on Windows: terminate the rest, they are reported as timed out below.
+      for (HANDLE h : active_handles) ::TerminateProcess(h, 1);
+      for (size_t idx : active_indices) procs[idx].state = bld::State::TIMED_OUT;
+      batch_deadline = clock::time_point::max();
+      continue;
     }
 
-    unsigned core_count = 0;
-    DWORD byteOffset = 0;
-    while (byteOffset < length)
+    if (wr == WAIT_FAILED || wr >= WAIT_OBJECT_0 + batch)
     {
-      auto *current = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)((BYTE *)buffer + byteOffset);
-      if (current->Relationship == RelationProcessorCore)
-        core_count++;
-      byteOffset += sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+      bld::internal_log(Log_type::ERR, "WaitForMultipleObjects: " + std::to_string(GetLastError()));
+      break;
     }
 
-    free(buffer);
-    return core_count;
+    const size_t slot = static_cast<size_t>(wr - WAIT_OBJECT_0);
+    const size_t proc_idx = active_indices[slot];
+
+    Exit_status es{};
+    DWORD exit_code = 0;
+    es.timed_out = procs[proc_idx].state == bld::State::TIMED_OUT;
+    if (!es.timed_out && ::GetExitCodeProcess(active_handles[slot], &exit_code))
+    {
+      es.normal = true;
+      es.exit_code = static_cast<int>(exit_code);
+    }
+
+    es.usage.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - procs[proc_idx].started).count();
+    result.exit_statuses[proc_idx] = es;
+    result.total_usage += es.usage;
+    if (es)
+      ++result.completed;
+    else
+      result.failed_indices.push_back(proc_idx);
+
+    trace_proc(proc_idx);
+    cleanup_process(procs[proc_idx]);
+
+    if (show_progress)
+      _bld_emit(++done_count, total, bool(es), get_label(proc_idx), es.exit_code);
+
+    // O(1) removal via swap-with-last.
+    active_handles[slot] = active_handles.back();
+    active_handles.pop_back();
+    active_indices[slot] = active_indices.back();
+    active_indices.pop_back();
   }
-  else
+
+#endif
+
+  if (show_progress)
   {
-    // Logical processors
-    SYSTEM_INFO sysinfo;
-    GetSystemInfo(&sysinfo);
-    return sysinfo.dwNumberOfProcessors;
+    if (result.failed_indices.empty())
+    {
+      bld::internal_log(Log_type::INFO, "All " + std::to_string(total) + " processes completed successfully.");
+    }
+    else
+    {
+      bld::internal_log(Log_type::WARNING, std::to_string(result.completed) + "/" + std::to_string(total) + " succeeded, " +
+                                               std::to_string(result.failed_indices.size()) + " failed.");
+    }
   }
-#else
-  if (physical_cores_only)
+
+  return result;
+}
+
+void bld::cleanup_process(bld::Proc &proc)
+{
+#ifdef _WIN32
+  if (proc.thread_handle)
   {
-    // Physical cores on Unix-like systems
-    return sysconf(_SC_NPROCESSORS_CONF);  // _SC_NPROCESSORS_CONF for physical cores
+    CloseHandle(proc.thread_handle);
+    proc.thread_handle = nullptr;
   }
-  else
+  if (proc.process_handle)
   {
-    // Logical processors on Unix-like systems
-    return sysconf(_SC_NPROCESSORS_ONLN);  // _SC_NPROCESSORS_ONLN for logical processors
+    CloseHandle(proc.process_handle);
+    proc.process_handle = nullptr;
   }
+  proc.process_id = 0;
+#else
+  proc.p_id = -1;
 #endif
-}
-// Execute the shell command with preprocessed parts
-int bld::execute_shell(std::string cmd)
-{
-  std::cout.flush();
-  return std::system(cmd.c_str());
+  proc.state = State::INIT_ERROR;  // Mark as invalid
+  proc.ok = false;
 }
 
-int bld::execute_shell(std::string cmd, bool prompt)
+bld::Exit_status bld::execute(const Command &command)
 {
-  if (prompt)
+  bld::internal_log(Log_type::INFO, "Executing: " + command.get_print_string());
+
+  Proc proc = execute_async(command);
+  if (!proc)
   {
-    if (validate_command(cmd))
-      return execute_shell(cmd);
-    else
-      return -1;
-  }
-  // Execute the shell command using the original execute function
-  return execute_shell(cmd);
+    Exit_status status{};
+    return status;
+  }
+
+  Exit_status status = wait_proc(proc);
+  cleanup_process(proc);
+  return status;
 }
 
-bool bld::read_process_output(const Command &cmd, std::string &output, size_t buffer_size)
+bld::Proc bld::execute_async(const Command &command)
 {
-  if (cmd.is_empty())
+  if (command.is_empty())
   {
     bld::internal_log(Log_type::ERR, "No command to execute.");
-    return false;
+    return Proc{};  // Default constructor gives USER_ERROR
   }
 
-  bld::internal_log(Log_type::INFO, "Executing with output: " + cmd.get_print_string());
-  output.clear();
-
 #ifdef _WIN32
-  // Create an anonymous pipe for output
-  SECURITY_ATTRIBUTES sa;
-  sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-  sa.bInheritHandle = TRUE;
-  sa.lpSecurityDescriptor = NULL;
+  STARTUPINFOA si = {sizeof(STARTUPINFOA)};
+  PROCESS_INFORMATION pi;
 
-  HANDLE read_pipe, write_pipe;
-  if (!CreatePipe(&read_pipe, &write_pipe, &sa, 0))
+  // Build command string
+  std::string command_str;
+  for (size_t i = 0; i < command.parts.size(); ++i)
   {
-    bld::log(Log_type::ERR, "Failed to create pipe: " + std::to_string(GetLastError()));
-    return false;
-  }
+    if (i > 0)
+      command_str += " ";
 
-  // Set up redirection to capture both stdout and stderr
-  Redirect redirect(INVALID_FD, write_pipe, write_pipe);
-  Proc proc = execute_async_redirect(cmd, redirect);
+    const auto &part = command.parts[i];
+    if (part.find(' ') != std::string::npos)
+      command_str += "\"" + part + "\"";
+    else
+      command_str += part;
+  }
 
-  if (!proc)
+  std::vector<char> cmd_buffer(command_str.begin(), command_str.end());
+  cmd_buffer.push_back('\0');
+  // Environment block: "K=V\0...\0\0"
+  std::string env_block;
+  for (const auto &e : _bld_child_env(command)) env_block.append(e).push_back('\0');
+  if (!env_block.empty())
+    env_block.push_back('\0');
+  if (!CreateProcessA(nullptr, cmd_buffer.data(), nullptr, nullptr, FALSE, 0, env_block.empty() ? nullptr : env_block.data(),
+                      command.cwd.empty() ? nullptr : command.cwd.c_str(), &si, &pi))
   {
-    CloseHandle(read_pipe);
-    CloseHandle(write_pipe);
-    return false;
+    bld::log(Log_type::ERR, "Failed to create process. Error: " + std::to_string(GetLastError()));
+    Proc proc;
+    proc.res = Proc_result::SYSTEM_ERROR;
+    return proc;
   }
 
-  // Close write end in parent (child process has its own copy)
-  CloseHandle(write_pipe);
-
-  // Read output from the pipe
-  std::vector<char> buffer(buffer_size);
-  DWORD bytes_read;
-  while (ReadFile(read_pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &bytes_read, NULL) && bytes_read > 0)
-    output.append(buffer.data(), bytes_read);
-
-  CloseHandle(read_pipe);
-
-  Exit_status result = wait_proc(proc);
-  cleanup_process(proc);
+  Proc prc(pi.hProcess, pi.hThread, pi.dwProcessId);
+  prc.label = command.get_command_string();
 
-  return result;  // Uses bool conversion operator
+  return prc;
 
 #else
-  // Create a pipe for output
-  int pipefd[2];
-  if (pipe(pipefd) == -1)
+  _bld_argv argv;
+  if (!_bld_prepare_argv(command, argv))
+    return Proc{};
+  _bld_limits limits;
+  if (!_bld_prepare_limits(command.limits, limits))
   {
-    bld::internal_log(Log_type::ERR, "Failed to create pipe: " + std::string(strerror(errno)));
-    return false;
+    _bld_adopt_argv(-1, argv, false);
+    return Proc{};
   }
+  const bool own_group = _bld_wants_group(false);
+  pid_t pid = fork();
 
-  // Set up redirection to capture both stdout and stderr
-  Redirect redirect(INVALID_FD, pipefd[1], pipefd[1]);
-  Proc proc = execute_async_redirect(cmd, redirect);
-
-  if (!proc)
+  if (pid == -1)
   {
-    close(pipefd[0]);
-    close(pipefd[1]);
-    return false;
+    bld::internal_log(Log_type::ERR, "Failed to fork: " + std::string(strerror(errno)));
+    _bld_adopt_argv(pid, argv, false);
+    _bld_adopt_limits(pid, limits, false);
+    Proc proc;
+    proc.state = State::INIT_ERROR;
+    return proc;
+  }
+  else if (pid == 0)
+  {
+    // Child process
+    if (own_group)
+      setpgid(0, 0);
+    _bld_apply_limits(command.limits, limits);
+    _bld_exec_child(command, argv);
   }
 
-  // Close write end in parent (child process has its own copy)
-  close(pipefd[1]);
-
-  // Read output from the pipe
-  std::vector<char> buffer(buffer_size);
-  ssize_t bytes_read;
-  while ((bytes_read = read(pipefd[0], buffer.data(), buffer.size())) > 0) output.append(buffer.data(), bytes_read);
-
-  close(pipefd[0]);
+  _bld_adopt_argv(pid, argv, true);
+  _bld_adopt_limits(pid, limits, true);
+  Proc proc(pid);
+  proc.label = command.get_command_string();
+  _bld_adopt_group(proc, command, own_group);
 
-  Exit_status result = wait_proc(proc);
-  return result;
+  return proc;
 #endif
 }
 
-bld::Wait_status bld::try_wait_nb(const bld::Proc &proc)
+bld::Proc bld::execute_async_redirect(const Command &command, const Redirect &redirect)
 {
-  bld::Wait_status status{};
-  // Default values: normal=false, exit_code=0, exited=false
-
-  if (!proc.is_valid())
+  if (command.is_empty())
   {
-    bld::internal_log(Log_type::ERR, "Invalid process for non-blocking wait");
-    status.exited = true;
-    status.invalid_proc = true;
-    return status;  // exited=false, so caller knows to skip this process
+    bld::internal_log(Log_type::ERR, "No command to execute.");
+    return Proc{};
   }
 
 #ifdef _WIN32
-  DWORD wait_result = WaitForSingleObject(proc.process_handle, 0);  // 0 = no wait
+  STARTUPINFOA si = {sizeof(STARTUPINFOA)};
+  PROCESS_INFORMATION pi;
 
-  if (wait_result == WAIT_OBJECT_0)
+  if (redirect.stdin_gen)
+    bld::log(Log_type::WARNING, "Generated stdin is not supported on Windows yet, stdin is inherited.");
+
+  // Set up redirection
+  si.dwFlags |= STARTF_USESTDHANDLES;
+  si.hStdInput = redirect.stdin_fd != INVALID_FD ? redirect.stdin_fd : GetStdHandle(STD_INPUT_HANDLE);
+  si.hStdOutput = redirect.stdout_fd != INVALID_FD ? redirect.stdout_fd : GetStdHandle(STD_OUTPUT_HANDLE);
+  si.hStdError = redirect.stderr_fd != INVALID_FD ? redirect.stderr_fd : GetStdHandle(STD_ERROR_HANDLE);
+
+  // Build command string
+  std::string command_str;
+  for (size_t i = 0; i < command.parts.size(); ++i)
   {
-    // Process has terminated
-    status.exited = true;
+    if (i > 0)
+      command_str += " ";
 
-    DWORD exit_code = 0;
-    if (GetExitCodeProcess(proc.process_handle, &exit_code))
-    {
-      status.normal = true;
-      status.exit_code = static_cast<int>(exit_code);
-      if (exit_code != 0)
-        bld::log(Log_type::ERR, "Process exited with code: " + std::to_string(exit_code));
-    }
+    const auto &part = command.parts[i];
+    if (part.find(' ') != std::string::npos)
+      command_str += "\"" + part + "\"";
     else
-    {
-      bld::log(Log_type::ERR, "Failed to get exit code. Error: " + std::to_string(GetLastError()));
-      // status.normal remains false, but exited=true so we know it terminated
-    }
+      command_str += part;
   }
-  else if (wait_result == WAIT_TIMEOUT)
+
+  std::vector<char> cmd_buffer(command_str.begin(), command_str.end());
+  cmd_buffer.push_back('\0');
+
+  // Environment block: "K=V\0...\0\0"
+  std::string env_block;
+  for (const auto &e : _bld_child_env(command)) env_block.append(e).push_back('\0');
+  if (!env_block.empty())
+    env_block.push_back('\0');
+  if (!CreateProcessA(nullptr, cmd_buffer.data(), nullptr, nullptr, TRUE, 0, env_block.empty() ? nullptr : env_block.data(),
+                      command.cwd.empty() ? nullptr : command.cwd.c_str(), &si, &pi))
   {
-    // Process is still running - exited remains false
+    bld::log(Log_type::ERR, "Failed to create process. Error: " + std::to_string(GetLastError()));
+    Proc proc;
+    proc.res = Proc_result::SYSTEM_ERROR;
+    return proc;
   }
-  else
+
+  CloseHandle(pi.hThread);  // We don't need the thread handle
+  Proc proc(pi.hProcess, nullptr, pi.dwProcessId);
+  proc.label = command.get_command_string();
+  return proc;
+
+#else
+  _bld_argv argv;
+  if (!_bld_prepare_argv(command, argv))
+    return Proc{};
+  _bld_limits limits;
+  if (!_bld_prepare_limits(command.limits, limits))
   {
-    // Error occurred
-    bld::log(Log_type::ERR, "WaitForSingleObject failed. Error: " + std::to_string(GetLastError()));
-    // exited remains false, caller will retry or handle as appropriate
+    _bld_adopt_argv(-1, argv, false);
+    return Proc{};
   }
 
-#else
-  int wait_status;
-  pid_t result = waitpid(proc.p_id, &wait_status, WNOHANG);  // WNOHANG = non-blocking
+  // Pipe for generated stdin. Both ends are close-on-exec so concurrent spawns never inherit the write end.
+  int feed[2] = {INVALID_FD, INVALID_FD};
+  if (redirect.stdin_gen && pipe2(feed, O_CLOEXEC) == -1)
+  {
+    bld::internal_log(Log_type::ERR, "Failed to create stdin pipe: " + std::string(strerror(errno)));
+    _bld_adopt_argv(-1, argv, false);
+    _bld_adopt_limits(-1, limits, false);
+    return Proc{};
+  }
+  const Fd stdin_src = redirect.stdin_gen ? feed[0] : redirect.stdin_fd;
+  const bool own_group = _bld_wants_group(stdin_src != INVALID_FD);
 
-  if (result == proc.p_id)
+  pid_t pid = fork();
+
+  if (pid == -1)
   {
-    // Process has terminated
-    status.exited = true;
+    bld::internal_log(Log_type::ERR, "Failed to fork: " + std::string(strerror(errno)));
+    close_fd(feed[0], feed[1]);
+    _bld_adopt_argv(pid, argv, false);
+    _bld_adopt_limits(pid, limits, false);
+    Proc proc;
+    proc.state = State::INIT_ERROR;
+    return proc;
+  }
+  else if (pid == 0)
+  {
+    // Child process - apply limits and set up redirection
+    if (own_group)
+      setpgid(0, 0);
+    _bld_apply_limits(command.limits, limits);
+    if (stdin_src != INVALID_FD)
+    {
+      if (dup2(stdin_src, STDIN_FILENO) == -1)
+      {
+        bld::internal_log(Log_type::ERR, "Failed to redirect stdin: " + std::string(strerror(errno)));
+        exit(EXIT_FAILURE);
+      }
+    }
 
-    if (WIFEXITED(wait_status))
+    if (redirect.stdout_fd != INVALID_FD)
     {
-      status.normal = true;
-      status.exit_code = WEXITSTATUS(wait_status);
-      if (status.exit_code != 0)
-        bld::internal_log(Log_type::ERR, "Process exited with code: " + std::to_string(status.exit_code));
+      if (dup2(redirect.stdout_fd, STDOUT_FILENO) == -1)
+      {
+        bld::internal_log(Log_type::ERR, "Failed to redirect stdout: " + std::string(strerror(errno)));
+        exit(EXIT_FAILURE);
+      }
     }
-    else if (WIFSIGNALED(wait_status))
+
+    if (redirect.stderr_fd != INVALID_FD)
     {
-      status.signal = WTERMSIG(wait_status);
-      bld::internal_log(Log_type::ERR, "Process terminated by signal: " + std::to_string(status.signal));
-      // status.normal remains false
+      if (dup2(redirect.stderr_fd, STDERR_FILENO) == -1)
+      {
+        bld::internal_log(Log_type::ERR, "Failed to redirect stderr: " + std::string(strerror(errno)));
+        exit(EXIT_FAILURE);
+      }
     }
+
+    // Close redirected FDs in child
+    if (redirect.stdin_fd != INVALID_FD)
+      close(redirect.stdin_fd);
+    if (redirect.stdout_fd != INVALID_FD)
+      close(redirect.stdout_fd);
+    if (redirect.stderr_fd != INVALID_FD)
+      close(redirect.stderr_fd);
+
+    // Execute command
+    _bld_exec_child(command, argv);
   }
-  else if (result == 0)
-  {
-    status.exited = false;
-  }
-  else  // result == -1
+
+  // Parent process - close redirected FDs
+  _bld_adopt_argv(pid, argv, true);
+  _bld_adopt_limits(pid, limits, true);
+  if (redirect.stdin_gen)
   {
-    // Error occurred
-    if (errno == ECHILD)
-    {
-      // Process doesn't exist anymore (already reaped)
-      bld::internal_log(Log_type::WARNING, "Process already reaped");
-      status.exited = true;  // Treat as exited
-      status.normal = true;  // Assume successful exit
-    }
-    else
+    close(feed[0]);
     {
-      bld::internal_log(Log_type::ERR, "waitpid failed: " + std::string(strerror(errno)));
-      status.exited = true;
-      status.waitpid_failed = true;
-      // exited remains false, let caller handle retry
+      std::lock_guard<std::mutex> lock(_bld_children_mutex());
+      _bld_children()[pid].feeds_stdin = true;
     }
+    _bld_stdin_writer::get().add(pid, feed[1], redirect.stdin_gen);
   }
-#endif
+  if (redirect.stdin_fd != INVALID_FD)
+    close(redirect.stdin_fd);
+  if (redirect.stdout_fd != INVALID_FD)
+    close(redirect.stdout_fd);
+  if (redirect.stderr_fd != INVALID_FD)
+    close(redirect.stderr_fd);
 
-  return status;
+  Proc proc(pid);
+  proc.label = command.get_command_string();
+  _bld_adopt_group(proc, command, own_group);
+  return proc;
+#endif
 }
 
-bool bld::read_shell_output(const std::string &cmd, std::string &output)
+namespace
 {
+  // Close-on-exec pipe, so concurrent spawns never inherit an end of it.
+  bool _bld_pipe(bld::Fd (&fds)[2])
+  {
 #ifdef _WIN32
-  FILE *pipe = _popen(command.c_str(), "r");
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    if (!CreatePipe(&fds[0], &fds[1], &sa, 0))
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to create pipe: " + std::to_string(GetLastError()));
+      return false;
+    }
 #else
-  FILE *pipe = popen(cmd.c_str(), "r");
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to create pipe: " + std::string(strerror(errno)));
+      return false;
+    }
 #endif
-
-  if (!pipe)
-  {
-    bld::internal_log(Log_type::ERR, "Failed to open pipe for command: " + cmd);
-    return false;
+    return true;
   }
 
-  char buffer[4096];
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) output += buffer;
-
+  // Close-on-exec duplicate of `fd`, INVALID_FD stays INVALID_FD.
+  bld::Fd _bld_dup_fd(bld::Fd fd)
+  {
+    if (fd == bld::INVALID_FD)
+      return fd;
 #ifdef _WIN32
-  int exit_code = _pclose(pipe);
+    HANDLE out = bld::INVALID_FD;
+    if (!DuplicateHandle(GetCurrentProcess(), fd, GetCurrentProcess(), &out, 0, TRUE, DUPLICATE_SAME_ACCESS))
+      bld::internal_log(bld::Log_type::ERR, "Failed to duplicate handle: " + std::to_string(GetLastError()));
+    return out;
 #else
-  int exit_code = pclose(pipe);
+    int out = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (out == -1)
+      bld::internal_log(bld::Log_type::ERR, "Failed to duplicate fd: " + std::string(strerror(errno)));
+    return out;
 #endif
+  }
 
-  // Check if command executed successfully
-  if (exit_code != 0)
+  std::string _bld_pipeline_string(const std::vector<bld::Command> &stages)
   {
-    bld::internal_log(Log_type::ERR, "Command failed with exit code: " + std::to_string(exit_code));
-    return false;
+    std::string out;
+    for (const auto &stage : stages) out += (out.empty() ? "" : " | ") + stage.get_print_string();
+    return out;
   }
+}  // anonymous namespace
 
-  return true;
-}
-
-bool bld::is_executable_outdated(std::string file_name, std::string executable)
+std::vector<bld::Proc> bld::execute_pipeline_async(const std::vector<Command> &stages, const Redirect &redirect)
 {
-  try
+  std::vector<Proc> procs(stages.size());
+  if (stages.empty())
   {
-    // Check if the source file exists
-    if (!std::filesystem::exists(file_name))
+    bld::internal_log(Log_type::ERR, "No commands in pipeline.");
+    return procs;
+  }
+
+  Fd prev_read = INVALID_FD;  // Read end of the pipe feeding the current stage
+  for (size_t i = 0; i < stages.size(); ++i)
+  {
+    const bool first = i == 0, last = i + 1 == stages.size();
+
+    Fd fds[2] = {INVALID_FD, INVALID_FD};
+    if (!last && !_bld_pipe(fds))
     {
-      bld::internal_log(Log_type::ERR, "Source file does not exist: " + file_name);
-      return false;  // Or handle this case differently
+      close_fd(prev_read);  // Or the previous stage blocks on a full pipe nobody reads
+      break;
     }
 
-    // Check if the executable exists
-    if (!std::filesystem::exists(executable))
-      return true;  // Treat as changed if the executable doesn't exist
-
-    // Get last write times
-    auto last_write_time = std::filesystem::last_write_time(file_name);
-    auto last_write_time_exec = std::filesystem::last_write_time(executable);
+    Redirect stage_redirect(first ? _bld_dup_fd(redirect.stdin_fd) : prev_read, last ? _bld_dup_fd(redirect.stdout_fd) : fds[1],
+                            _bld_dup_fd(redirect.stderr_fd));
+    if (first)
+      stage_redirect.stdin_gen = redirect.stdin_gen;
+    prev_read = fds[0];
 
-    // Compare timestamps
-    return last_write_time > last_write_time_exec;
-  }
-  catch (const std::filesystem::filesystem_error &e)
-  {
-    bld::internal_log(Log_type::ERR, "Filesystem error: " + std::string(e.what()));
-    return false;  // Or handle the error differently
-  }
-  catch (const std::exception &e)
-  {
-    bld::internal_log(Log_type::ERR, std::string(e.what()));
-    return false;  // Or handle the error differently
+    procs[i] = execute_async_redirect(stages[i], stage_redirect);
+    if (!procs[i])
+    {
+      // Nothing was handed to a child: stage_redirect closes its ends, earlier stages see EPIPE.
+      close_fd(prev_read);
+      break;
+    }
+    // execute_async_redirect closed the parent copies already
+    stage_redirect.stdin_fd = stage_redirect.stdout_fd = stage_redirect.stderr_fd = INVALID_FD;
   }
+
+  return procs;
 }
 
-void bld::rebuild_yourself_onchange_and_run(const std::string &filename, const std::string &executable, std::string compiler)
+bld::Par_exec_res bld::execute_pipeline(const std::vector<Command> &stages, const Redirect &redirect)
 {
-  namespace fs = std::filesystem;
-  // Convert to filesystem paths
-  fs::path source_path(filename);
-  fs::path exec_path(executable);
-  fs::path backup_path = exec_path.string() + ".old";
+  bld::internal_log(Log_type::INFO, "Executing pipeline: " + _bld_pipeline_string(stages));
 
-  if (!bld::is_executable_outdated(filename, executable))
-    return;  // No rebuild needed
-
-  bld::internal_log(Log_type::INFO, "Build executable not up-to-date. Rebuilding...");
+  std::vector<Proc> procs = execute_pipeline_async(stages, redirect);
+  Par_exec_res result;
+  result.exit_statuses.resize(procs.size());
 
-  // Create backup of existing executable if it exists
-  if (fs::exists(exec_path))
+  for (size_t i = 0; i < procs.size(); ++i)
   {
-    try
-    {
-      if (fs::exists(backup_path))
-        fs::remove(backup_path);  // Remove existing backup
-      fs::rename(exec_path, backup_path);
-      bld::internal_log(Log_type::INFO, "Created backup at: " + backup_path.string());
-    }
-    catch (const fs::filesystem_error &e)
+    Exit_status es{false, -1};
+    if (procs[i])
     {
-      bld::internal_log(Log_type::ERR, "Failed to create backup: " + std::string(e.what()));
-      return;
+      es = wait_proc(procs[i]);
+      cleanup_process(procs[i]);
     }
-  }
 
-  // Detect the compiler if not provided
-  if (compiler.empty())
-  {
-#ifdef __clang__
-    compiler = "clang++";
-#elif defined(__GNUC__)
-    compiler = "g++";
-#elif defined(_MSC_VER)
-    compiler = "cl";  // MSVC
-#else
-    bld::log(Log_type::ERROR, "Unknown compiler. Defaulting to g++.");
-    compiler = "g++";
-#endif
+    result.exit_statuses[i] = es;
+    result.total_usage += es.usage;
+    if (es)
+      ++result.completed;
+    else
+      result.failed_indices.push_back(i);
   }
 
-  // Set up the compile command
-  bld::Command cmd;
-  cmd.parts = {compiler, source_path.string(), "-o", exec_path.string(), "--std=c++23"};
+  return result;
+}
 
-  // Execute the compile command
-  int compile_result = bld::execute(cmd);
-  if (compile_result <= 0)
-  {
-    bld::internal_log(Log_type::ERR, "Compilation failed.");
+bld::Exit_status bld::execute_redirect(const Command &command, const Redirect &redirect)
+{
+  bld::internal_log(Log_type::INFO, "Executing with redirection: " + command.get_print_string());
 
-    // Restore backup if compilation failed and backup exists
-    if (fs::exists(backup_path))
-    {
-      try
-      {
-        fs::remove(exec_path);  // Remove failed compilation output if it exists
-        fs::rename(backup_path, exec_path);
-        bld::internal_log(Log_type::INFO, "Restored previous executable from backup.");
-      }
-      catch (const fs::filesystem_error &e)
-      {
-        bld::internal_log(Log_type::ERR, "Failed to restore backup: " + std::string(e.what()));
-      }
-    }
-    return;
-  }
+  Proc proc = execute_async_redirect(command, redirect);
+  if (!proc)
+    return Exit_status{};
 
-  bld::internal_log(Log_type::INFO, "Compilation successful. Restarting w/o any args for safety...");
+  Exit_status status = wait_proc(proc);
+  cleanup_process(proc);
+  return status;
+}
 
-  // Verify the new executable exists and is executable
-  if (!fs::exists(exec_path))
-  {
-    bld::internal_log(Log_type::ERR, "New executable not found after successful compilation.");
-    return;
-  }
+// Open a file for reading
+bld::Fd bld::open_for_read(const std::string &path)
+{
+#ifdef _WIN32
+  SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES)};
+  sa.bInheritHandle = TRUE;
 
-  // Make sure the new executable has proper permissions
-  try
-  {
-    fs::permissions(exec_path, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec, fs::perm_options::add);
-  }
-  catch (const fs::filesystem_error &e)
-  {
-    bld::internal_log(Log_type::WARNING, "Failed to set executable permissions: " + std::string(e.what()));
-  }
+  HAND handle = CreateFileA(path.c_str(), GENERIC_READ, 0, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+    bld::log(Log_type::ERR, "Failed to open file for reading: " + path);
+  return handle;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    bld::internal_log(Log_type::ERR, "Failed to open file for reading: " + path + " - " + std::string(strerror(errno)));
+  return fd;
+#endif
+}
 
-  // Run the new executable
-  bld::Command restart_cmd;
-  restart_cmd.parts = {exec_path.string()};
+// Open a file for writing
+bld::Fd bld::open_for_write(const std::string &path, bool append)
+{
+#ifdef _WIN32
+  SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES)};
+  sa.bInheritHandle = TRUE;
 
-  int restart_result = bld::execute(restart_cmd);
-  if (restart_result <= 0)
+  DWORD disposition = append ? OPEN_ALWAYS : CREATE_ALWAYS;
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, &sa, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
   {
-    bld::internal_log(Log_type::ERR, "Failed to start new executable.");
-    return;
+    bld::log(Log_type::ERR, "Failed to open file for writing: " + path);
+    return INVALID_FD;
   }
 
-  // Only remove backup after successful restart
-  try
-  {
-    if (fs::exists(backup_path))
-      fs::remove(backup_path);
-  }
-  catch (const fs::filesystem_error &e)
-  {
-    bld::internal_log(Log_type::WARNING, "Failed to remove backup: " + std::string(e.what()));
-  }
+  if (append)
+    SetFilePointer(handle, 0, NULL, FILE_END);
 
-  // Exit the current process after successfully restarting
-  std::exit(EXIT_SUCCESS);
+  return handle;
+#else
+  int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+  int fd = open(path.c_str(), flags, 0644);
+  if (fd == -1)
+    bld::internal_log(Log_type::ERR, "Failed to open file for writing: " + path + " - " + std::string(strerror(errno)));
+  return fd;
+#endif
 }
 
-void bld::rebuild_yourself_onchange(const std::string &filename, const std::string &executable, std::string compiler)
+bld::Redirect::Redirect(const std::string& _in, const std::string& _out, const std::string& _err)
 {
-  if (bld::is_executable_outdated(filename, executable))
-  {
-    bld::internal_log(Log_type::INFO, "Build executable not up-to-date. Rebuilding...");
-    bld::Command cmd = {};
+  if (_in.empty())
+    this->stdin_fd = bld::INVALID_FD;
+  else
+    this->stdin_fd = bld::open_for_read(_in);
+  if (_out.empty())
+    this->stdout_fd = bld::INVALID_FD;
+  else
+    this->stdout_fd = bld::open_for_write(_out);
+  if (_err.empty())
+    this->stderr_fd = bld::INVALID_FD;
+  else
+    this->stderr_fd = bld::open_for_write(_err);
+}
 
-    // Detect the compiler if not provided
-    if (compiler.empty())
-    {
-    #ifdef __clang__
-      compiler = "clang++";
-    #elif defined(__GNUC__)
-      compiler = "g++";
-    #elif defined(_MSC_VER)
-      compiler = "cl";  // MSVC uses 'cl' as the compiler command
+bld::Redirect::~Redirect()
+{
+  if (this->stdin_fd  != bld::INVALID_FD) bld::close_fd(stdin_fd);
+  if (this->stdout_fd != bld::INVALID_FD) bld::close_fd(stdout_fd);
+  if (this->stderr_fd != bld::INVALID_FD) bld::close_fd(stderr_fd);
+}
+
+template <typename... Fds, typename>
+void bld::close_fd(Fds ...fds)
+{
+  (..., (
+  [&]
+  {
+    if (fds == INVALID_FD) return;
+
+    #ifdef _WIN32
+      CloseHandle((HANDLE)fds);
     #else
-      bld::log(Log_type::ERROR, "Unknown compiler. Defaulting to g++.");
-      compiler = "g++";
+      close(fds);
     #endif
+  }()));
+}
+
+bld::Par_exec_res bld::execute_threads(const std::vector<bld::Command> &cmds, size_t threads, bool strict, std::chrono::milliseconds timeout)
+{
+  bld::Par_exec_res result;
+  result.exit_statuses.resize(cmds.size());
+
+  if (cmds.empty())
+    return result;
+  if (threads == 0)
+    threads = 1;
+  if (threads > std::thread::hardware_concurrency())
+    threads = std::thread::hardware_concurrency();
+
+  std::mutex queue_mutex, output_mutex;
+  std::atomic<bool> stop_workers{false};  // Used when strict = true
+
+  using clock = std::chrono::steady_clock;
+  const clock::time_point batch_deadline = timeout.count() > 0 ? clock::now() + timeout : clock::time_point::max();
+
+  // Share job slots with a parent make/ninja/bld, or hand ours to the children
+  auto &jobserver = bld::Jobserver::get();
+  const bool serving = jobserver.serve(threads);
+
+  // Queue of command indices to process
+  std::queue<size_t> cmd_queue;
+  for (size_t i = 0; i < cmds.size(); ++i) cmd_queue.push(i);
+
+  bld::internal_log(bld::Log_type::INFO, "Executing " + std::to_string(cmds.size()) + " commands on " + std::to_string(threads) + " threads...");
+  bld::trace::Span batch_span("execute_threads");
+
+  // Worker function
+  auto worker = [&](size_t index)
+  {
+    bld::trace::name_thread("exec worker " + std::to_string(index));
+    while (true)
+    {
+      if (strict && stop_workers)
+        return;  // Stop all threads if strict and an error occurs
+
+      size_t cmd_idx;
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (cmd_queue.empty())
+          return;
+        cmd_idx = cmd_queue.front();
+        cmd_queue.pop();
+      }
+
+      // Run command, never past the batch deadline. The job's slice starts once it holds a slot.
+      bld::trace::Span slot_span("wait for job slot");
+      bld::Jobserver::Token slot = jobserver.acquire();
+      slot_span.end();
+      bld::trace::Span job_span(cmds[cmd_idx].is_empty() ? std::string_view("<empty>") : std::string_view(cmds[cmd_idx].parts[0]), "job");
+      if (job_span)
+        job_span.arg("command", cmds[cmd_idx].get_print_string());
+      bld::Exit_status execution_result{false, -1};
+      if (batch_deadline == clock::time_point::max())
+        execution_result = execute(cmds[cmd_idx]);
+      else if (auto left = std::chrono::duration_cast<std::chrono::milliseconds>(batch_deadline - clock::now()); left.count() > 0)
+      {
+        bld::Command cmd = cmds[cmd_idx];
+        cmd.timeout = cmd.timeout.count() > 0 ? std::min(cmd.timeout, left) : left;
+        execution_result = execute(cmd);
+      }
+      else
+        execution_result.timed_out = true;
+      slot.release();
+      job_span.end();
+
+      // Record result
+      result.exit_statuses[cmd_idx] = execution_result;
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        result.total_usage += execution_result.usage;
+      }
+
+      if (!execution_result.normal)
+      {
+        {
+          std::lock_guard<std::mutex> lock(queue_mutex);
+          result.failed_indices.push_back(cmd_idx);
+        }
+
+        if (strict)
+        {
+          stop_workers = true;
+          return;
+        }
+      }
+      else
+      {
+        {
+          std::lock_guard<std::mutex> lock(queue_mutex);
+          result.completed++;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(output_mutex);
+          bld::internal_log(bld::Log_type::INFO, "Completed: " + cmds[cmd_idx].get_print_string());
+        }
+      }
     }
+  };
 
-    // Set up the compile command
-    cmd.parts = {compiler, filename, "-o", executable};
+  // Launch worker threads
+  std::vector<std::thread> workers;
+  size_t num_threads = std::min(threads, cmds.size());
+  for (size_t i = 0; i < num_threads; ++i) workers.emplace_back(worker, i);
 
-    // Execute the compile command
-    if (bld::execute(cmd) <= 0)
+  // Wait for all threads to complete
+  for (auto &t : workers)
+    if (t.joinable())
+      t.join();
+
+  if (serving)
+    jobserver.stop();
+  return result;
+}
+
+bld::Jobserver &bld::Jobserver::get()
+{
+  static Jobserver instance;
+  return instance;
+}
+
+bld::Jobserver::Jobserver()
+{
+#ifndef _WIN32
+  if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) == -1)
+  {
+    bld::internal_log(Log_type::ERR, "Failed to create jobserver wake pipe: " + std::string(strerror(errno)));
+    wake[0] = wake[1] = -1;
+    return;
+  }
+
+  // The last --jobserver-auth (or pre 4.2 --jobserver-fds) in MAKEFLAGS wins
+  std::string auth;
+  if (const char *flags = std::getenv("MAKEFLAGS"))
+  {
+    std::istringstream words(flags);
+    for (std::string w; words >> w;)
     {
-      bld::internal_log(Log_type::WARNING, "Failed to rebuild executable.");
-      return;
+      if (w.rfind("--jobserver-auth=", 0) == 0)
+        auth = w.substr(17);
+      else if (w.rfind("--jobserver-fds=", 0) == 0)
+        auth = w.substr(16);
     }
   }
+  if (!auth.empty())
+    join(auth);
+#endif
 }
 
-namespace bld
+bld::Jobserver::~Jobserver()
 {
-  // Static instance getter
-  Config &Config::get()
+#ifndef _WIN32
+  stop();
+  disconnect();
+  close_fd(wake[0], wake[1]);
+#endif
+}
+
+bool bld::Jobserver::join(const std::string &auth)
+{
+#ifndef _WIN32
+  if (auth.rfind("fifo:", 0) == 0)
   {
-    static Config instance;
-    static bool initialized = false;
-    if (!initialized)
+    own_fd = ::open(auth.c_str() + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (own_fd == -1)
     {
-      instance.initialize_builtin_options();
-      initialized = true;
+      bld::internal_log(Log_type::WARNING, "Cannot open jobserver fifo " + auth.substr(5) + ": " + std::string(strerror(errno)));
+      return false;
     }
-    return instance;
+    read_fd = write_fd = own_fd;
+    return true;
   }
 
-  // Define custom config options
-  void Config::add_flag(const std::string &name, const std::string &description)
+  int r = -1, w = -1;
+  if (std::sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 || r < 0 || w < 0)
   {
-    custom_configs[name] = {.default_value = "", .description = description, .is_flag = true};
+    bld::internal_log(Log_type::WARNING, "Unknown jobserver in MAKEFLAGS: " + auth);
+    return false;
   }
-
-  void Config::add_option(const std::string &name, const std::string &default_value, const std::string &description)
+  if (fcntl(r, F_GETFD) == -1 || fcntl(w, F_GETFD) == -1)
   {
-    custom_configs[name] = {.default_value = default_value, .description = description, .is_flag = false};
-    if (!default_value.empty())
-      values[name] = default_value;
+    bld::internal_log(Log_type::WARNING, "Jobserver pipe from MAKEFLAGS is not open (is the recipe marked with '+'?), not using it.");
+    return false;
   }
+  // Read through a non blocking file description of our own, the inherited one is shared with make and may block.
+  own_fd = ::open(("/proc/self/fd/" + std::to_string(r)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  read_fd = own_fd != -1 ? own_fd : r;
+  write_fd = w;
+  return true;
+#else
+  (void)auth;
+  return false;
+#endif
+}
 
-  const std::unordered_map<std::string, Config::CustomConfig> &Config::get_custom_configs() const { return custom_configs; }
+void bld::Jobserver::disconnect()
+{
+#ifndef _WIN32
+  if (own_fd != -1)
+    ::close(own_fd);
+  own_fd = read_fd = write_fd = -1;
+#endif
+}
 
-  // Config_proxy implementation
-  Config::Config_proxy::Config_proxy(const std::string &k, Config *c) : key(k), config(c) {}
+bool bld::Jobserver::serve(size_t jobs)
+{
+#ifndef _WIN32
+  std::lock_guard<std::mutex> lock(mutex);
+  if (serving)
+  {
+    ++serve_count;
+    return true;
+  }
+  if (active() || wake[0] == -1)
+    return false;
+  if (jobs == 0)
+    jobs = 1;
 
-  Config::Config_proxy &Config::Config_proxy::operator=(const std::string &value)
+  static std::atomic<unsigned> counter{0};
+  std::error_code ec;
+  auto dir = std::filesystem::temp_directory_path(ec);
+  if (ec)
+    dir = "/tmp";
+  std::string path = (dir / ("bld-js-" + std::to_string(getpid()) + "-" + std::to_string(counter++))).string();
+
+  if (::mkfifo(path.c_str(), 0600) == -1)
   {
-    config->values[key] = value;
-    config->flags.erase(key);  // Remove from flags if it was there
+    bld::internal_log(Log_type::WARNING, "Failed to create jobserver fifo " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+  int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1)
+  {
+    bld::internal_log(Log_type::WARNING, "Failed to open jobserver fifo " + path + ": " + std::string(strerror(errno)));
+    ::unlink(path.c_str());
+    return false;
+  }
 
-    // Sync to built-in members
-    if (key == "compiler" || key == "c")
-    {
-      config->compiler = value;
-    }
-    else if (key == "target" || key == "t")
-    {
-      config->target = value;
-    }
-    else if (key == "build-dir" || key == "d")
-    {
-      config->build_dir = value;
-    }
-    else if (key == "flags" || key == "f")
+  // One slot is our implicit one, the fifo holds the rest
+  std::string tokens(jobs - 1, '+');
+  for (size_t off = 0; off < tokens.size();)
+  {
+    ssize_t n = ::write(fd, tokens.data() + off, tokens.size() - off);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
     {
-      config->compiler_flags = value;
+      bld::internal_log(Log_type::WARNING, "Failed to fill jobserver fifo: " + std::string(strerror(errno)));
+      break;
     }
-    else if (key == "link" || key == "l")
+    off += static_cast<size_t>(n);
+  }
+
+  const char *old = std::getenv("MAKEFLAGS");
+  makeflags = std::string(old ? old : "") + " -j" + std::to_string(jobs) + " --jobserver-auth=fifo:" + path;
+
+  fifo_path = std::move(path);
+  own_fd = read_fd = write_fd = fd;
+  serving = true;
+  serve_count = 1;
+  return true;
+#else
+  (void)jobs;
+  return false;
+#endif
+}
+
+void bld::Jobserver::stop()
+{
+#ifndef _WIN32
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!serving || --serve_count > 0)
+    return;
+
+  disconnect();
+  ::unlink(fifo_path.c_str());
+  fifo_path.clear();
+  makeflags.clear();
+  serving = false;
+#endif
+}
+
+std::string bld::Jobserver::child_makeflags()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return makeflags;
+}
+
+bld::Jobserver::Token bld::Jobserver::acquire()
+{
+  Token token;
+  token.held = true;
+  if (!active())
+    return token;
+  token.owner = this;
+
+#ifndef _WIN32
+  while (true)
+  {
+    if (implicit_free.exchange(false))
     {
-      config->linker_flags = value;
+      token.implicit = true;
+      return token;
     }
-    else if (key == "threads" || key == "j")
+
+    struct pollfd fds[2] = {{read_fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+    if (::poll(fds, 2, -1) == -1)
     {
-      if (str::is_numeric(value))
-        config->threads = std::max(1, std::stoi(value));
+      if (errno == EINTR)
+        continue;
+      bld::internal_log(Log_type::ERR, "Jobserver poll failed: " + std::string(strerror(errno)));
+      token.owner = nullptr;  // Run unthrottled rather than deadlock
+      return token;
     }
-    else if (key == "pre")
+
+    if (fds[1].revents & POLLIN)
     {
-      config->pre_build = value;
+      char drain[16];
+      while (::read(wake[0], drain, sizeof(drain)) > 0) {}
+      continue;
     }
-    else if (key == "post")
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
     {
-      config->post_build = value;
+      ssize_t n = ::read(read_fd, &token.byte, 1);
+      if (n == 1)
+        return token;
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+      {
+        bld::internal_log(Log_type::ERR, "Jobserver closed, continuing without it.");
+        token.owner = nullptr;
+        return token;
+      }
+      // Someone else got the token first
     }
-
-    return *this;
   }
+#else
+  token.owner = nullptr;
+  return token;
+#endif
+}
 
-  Config::Config_proxy &Config::Config_proxy::operator=(const char *value)
+bld::Jobserver::Token::Token(Token &&other) noexcept
+    : owner(other.owner), byte(other.byte), implicit(other.implicit), held(other.held)
+{
+  other.held = false;
+}
+
+bld::Jobserver::Token &bld::Jobserver::Token::operator=(Token &&other) noexcept
+{
+  if (this != &other)
   {
-    config->values[key] = std::string(value);
-    config->flags.erase(key);
-    return *this;
+    release();
+    owner = other.owner;
+    byte = other.byte;
+    implicit = other.implicit;
+    held = other.held;
+    other.held = false;
   }
+  return *this;
+}
 
-  Config::Config_proxy::operator std::string() const
+void bld::Jobserver::Token::release()
+{
+  if (!held)
+    return;
+  held = false;
+  if (!owner)
+    return;
+
+#ifndef _WIN32
+  if (implicit)
   {
-    auto it = config->values.find(key);
-    if (it != config->values.end())
-      return it->second;
+    owner->implicit_free = true;
+    if (::write(owner->wake[1], "+", 1) == -1) {}  // Full pipe means a wakeup is already pending
+    return;
+  }
+  while (::write(owner->write_fd, &byte, 1) == -1 && errno == EINTR) {}
+#endif
+}
 
-    auto custom_it = config->custom_configs.find(key);
-    if (custom_it != config->custom_configs.end())
-      return custom_it->second.default_value;
+void bld::print_metadata()
+{
+  std::cerr << '\n';
+  bld::internal_log(Log_type::INFO, "Printing system metadata...........................................");
 
-    // Fallback: check if it's a built-in that wasn't synced
-    if (key == "compiler" || key == "c")
-      return config->compiler;
-    if (key == "target" || key == "t")
-      return config->target;
-    if (key == "build-dir" || key == "d")
-      return config->build_dir;
-    if (key == "flags" || key == "f")
-      return config->compiler_flags;
-    if (key == "link" || key == "l")
-      return config->linker_flags;
-    if (key == "threads" || key == "j")
-      return std::to_string(config->threads);
-    if (key == "pre")
-      return config->pre_build;
-    if (key == "post")
-      return config->post_build;
+  // 1. Get OS information
+  std::string os_name = "Unknown";
+  std::string os_version = "Unknown";
+  std::string arch = "Unknown";
 
-    return "";
+#ifdef _WIN32
+  OSVERSIONINFOEX os_info;
+  ZeroMemory(&os_info, sizeof(OSVERSIONINFOEX));
+  os_info.dwOSVersionInfoSize = sizeof(OSVERSIONINFOEX);
+
+  if (GetVersionEx(reinterpret_cast<OSVERSIONINFO *>(&os_info)))
+  {
+    os_name = "Windows";
+    os_version = std::to_string(os_info.dwMajorVersion) + "." + std::to_string(os_info.dwMinorVersion) + " (Build " +
+                 std::to_string(os_info.dwBuildNumber) + ")";
   }
 
-  bool Config::Config_proxy::operator==(const std::string &other) const
+  // Detect architecture
+  SYSTEM_INFO sys_info;
+  GetNativeSystemInfo(&sys_info);
+  switch (sys_info.wProcessorArchitecture)
   {
-    // First check if it's a flag
-    if (config->flags.count(key))
-      return other == "true" || other == "yes" || other == "1" || other.empty();
-    // Then check value
-    auto it = config->values.find(key);
-    return it != config->values.end() && it->second == other;
+    case PROCESSOR_ARCHITECTURE_AMD64:
+      arch = "64-bit";
+      break;
+    case PROCESSOR_ARCHITECTURE_INTEL:
+      arch = "32-bit";
+      break;
+    case PROCESSOR_ARCHITECTURE_ARM64:
+      arch = "ARM 64-bit";
+      break;
+    case PROCESSOR_ARCHITECTURE_ARM:
+      arch = "ARM 32-bit";
+      break;
+    default:
+      arch = "Unknown";
+      break;
+  }
+#else
+  struct utsname sys_info;
+  if (uname(&sys_info) == 0)
+  {
+    os_name = sys_info.sysname;
+    os_version = sys_info.release;
+    arch = sys_info.machine;
   }
+#endif
 
-  bool Config::Config_proxy::operator==(const char *other) const { return *this == std::string(other); }
+  std::cerr << "    Operating System: " << os_name << " " << os_version << " (" << arch << ")" << std::endl;
 
-  Config::Config_proxy::operator bool() const
+  // 2. Compiler information
+  std::cerr << "    Compiler:         ";
+#ifdef __clang__
+  std::cerr << "Clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+  std::cerr << "GCC " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#elif defined(_MSC_VER)
+  std::cerr << "MSVC " << _MSC_VER;
+#else
+  std::cerr << "Unknown Compiler";
+#endif
+  std::cerr << std::endl;
+
+  internal_log(Log_type::INFO, "...................................................................\n");
+}
+
+int bld::get_n_procs(bool physical_cores_only)
+{
+#ifdef _WIN32
+  if (physical_cores_only)
   {
-    if (config->flags.count(key))
-      return true;
+    // Proper Windows physical core count
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+      return 0;
 
-    auto it = config->values.find(key);
-    if (it != config->values.end())
+    auto *buffer = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)malloc(length);
+    if (!buffer)
+      return 0;
+
+    if (!GetLogicalProcessorInformation(buffer, &length))
     {
-      const std::string &value = it->second;
-      return value == "true" || value == "yes" || value == "1" || (!value.empty() && value != "false" && value != "no" && value != "0");
+      free(buffer);
+      return 0;
     }
 
-    // Check built-in boolean flags
-    if (key == "verbose" || key == "v")
-      return config->verbose;
-    if (key == "hot-reload" || key == "hr")
-      return config->hot_reload;
-    if (key == "override-run")
-      return config->override_run;
+    unsigned core_count = 0;
+    DWORD byteOffset = 0;
+    while (byteOffset < length)
+    {
+      auto *current = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)((BYTE *)buffer + byteOffset);
+      if (current->Relationship == RelationProcessorCore)
+        core_count++;
+      byteOffset += sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+    }
 
-    return false;
+    free(buffer);
+    return core_count;
+  }
+  else
+  {
+    // Logical processors
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    return sysinfo.dwNumberOfProcessors;
+  }
+#else
+  if (physical_cores_only)
+  {
+    // Physical cores on Unix-like systems
+    return sysconf(_SC_NPROCESSORS_CONF);  // _SC_NPROCESSORS_CONF for physical cores
   }
+  else
+  {
+    // Logical processors on Unix-like systems
+    return sysconf(_SC_NPROCESSORS_ONLN);  // _SC_NPROCESSORS_ONLN for logical processors
+  }
+#endif
+}
+// Execute the shell command with preprocessed parts
+int bld::execute_shell(std::string cmd)
+{
+  std::cout.flush();
+  return std::system(cmd.c_str());
+}
 
-  bool Config::Config_proxy::exists() const { return config->flags.count(key) || config->values.count(key); }
+int bld::execute_shell(std::string cmd, bool prompt)
+{
+  if (prompt)
+  {
+    if (validate_command(cmd))
+      return execute_shell(cmd);
+    else
+      return -1;
+  }
+  // Execute the shell command using the original execute function
+  return execute_shell(cmd);
+}
 
-  int Config::Config_proxy::as_int() const
+bool bld::read_process_output(const Command &cmd, std::string &output, size_t buffer_size)
+{
+  if (cmd.is_empty())
   {
-    std::string val = *this;
-    if (val.empty() || val.find_first_not_of("0123456789") != std::string::npos)
-      return 0;
-    return std::stoi(val);
+    bld::internal_log(Log_type::ERR, "No command to execute.");
+    return false;
   }
 
-  // Config subscript operators
-  Config::Config_proxy Config::operator[](const std::string &key) { return Config_proxy(key, this); }
+  bld::internal_log(Log_type::INFO, "Executing with output: " + cmd.get_print_string());
+  output.clear();
 
-  const Config::Config_proxy Config::operator[](const std::string &key) const { return Config_proxy(key, const_cast<Config *>(this)); }
+#ifdef _WIN32
+  // Create an anonymous pipe for output
+  SECURITY_ATTRIBUTES sa;
+  sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
 
-  void Config::initialize_builtin_options()
+  HANDLE read_pipe, write_pipe;
+  if (!CreatePipe(&read_pipe, &write_pipe, &sa, 0))
   {
-    // Initialize built-in options as custom configs so they work with []
-    add_option("compiler", compiler, "Compiler to use");
-    add_option("c", compiler, "Compiler to use (short form)");
-    add_option("target", target, "Target executable name");
-    add_option("t", target, "Target executable name (short form)");
-    add_option("build-dir", build_dir, "Build directory");
-    add_option("d", build_dir, "Build directory (short form)");
-    add_option("flags", compiler_flags, "Compiler flags");
-    add_option("f", compiler_flags, "Compiler flags (short form)");
-    add_option("link", linker_flags, "Linker flags");
-    add_option("l", linker_flags, "Linker flags (short form)");
-    add_option("threads", std::to_string(threads), "Number of build threads");
-    add_option("j", std::to_string(threads), "Number of build threads (short form)");
-    add_option("pre", pre_build, "Pre-build command");
-    add_option("post", post_build, "Post-build command");
-
-    // Flags
-    add_flag("verbose", "Enable verbose output");
-    add_flag("v", "Enable verbose output (short form)");
-    add_flag("hot-reload", "Enable hot reload");
-    add_flag("hr", "Enable hot reload (short form)");
-    add_flag("override-run", "Override run behavior");
-    add_flag("help", "Show help");
-    add_flag("h", "Show help (short form)");
+    bld::log(Log_type::ERR, "Failed to create pipe: " + std::to_string(GetLastError()));
+    return false;
   }
-  // Argument parsing
-  void Config::parse_args(const std::vector<std::string> &args)
+
+  // Set up redirection to capture both stdout and stderr
+  Redirect redirect(INVALID_FD, write_pipe, write_pipe);
+  Proc proc = execute_async_redirect(cmd, redirect);
+
+  if (!proc)
   {
-    for (const auto &arg : args)
-    {
-      if (!str::starts_with(arg, "-"))
-        continue;
+    CloseHandle(read_pipe);
+    CloseHandle(write_pipe);
+    return false;
+  }
 
-      auto eq_pos = arg.find('=');
+  // Close write end in parent (child process has its own copy)
+  CloseHandle(write_pipe);
 
-      if (eq_pos == std::string::npos)
+  // Read output from the pipe
+  std::vector<char> buffer(buffer_size);
+  DWORD bytes_read;
+  while (ReadFile(read_pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &bytes_read, NULL) && bytes_read > 0)
+    output.append(buffer.data(), bytes_read);
+
+  CloseHandle(read_pipe);
+
+  Exit_status result = wait_proc(proc);
+  cleanup_process(proc);
+
+  return result;  // Uses bool conversion operator
+
+#else
+  // Create a pipe for output
+  int pipefd[2];
+  if (pipe(pipefd) == -1)
+  {
+    bld::internal_log(Log_type::ERR, "Failed to create pipe: " + std::string(strerror(errno)));
+    return false;
+  }
+
+  // Set up redirection to capture both stdout and stderr
+  Redirect redirect(INVALID_FD, pipefd[1], pipefd[1]);
+  Proc proc = execute_async_redirect(cmd, redirect);
+
+  if (!proc)
+  {
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return false;
+  }
+
+  // Close write end in parent (child process has its own copy)
+  close(pipefd[1]);
+
+  // Read output from the pipe
+  std::vector<char> buffer(buffer_size);
+  ssize_t bytes_read;
+  while ((bytes_read = read(pipefd[0], buffer.data(), buffer.size())) > 0) output.append(buffer.data(), bytes_read);
+
+  close(pipefd[0]);
+
+  Exit_status result = wait_proc(proc);
+  return result;
+#endif
+}
+
+bld::Wait_status bld::try_wait_nb(const bld::Proc &proc)
+{
+  bld::Wait_status status{};
+  // Default values: normal=false, exit_code=0, exited=false
+
+  if (!proc.is_valid())
+  {
+    bld::internal_log(Log_type::ERR, "Invalid process for non-blocking wait");
+    status.exited = true;
+    status.invalid_proc = true;
+    return status;  // exited=false, so caller knows to skip this process
+  }
+
+#ifdef _WIN32
+  DWORD wait_result = WaitForSingleObject(proc.process_handle, 0);  // 0 = no wait
+
+  if (wait_result == WAIT_OBJECT_0)
+  {
+    // Process has terminated
+    status.exited = true;
+
+    DWORD exit_code = 0;
+    if (GetExitCodeProcess(proc.process_handle, &exit_code))
+    {
+      status.normal = true;
+      status.exit_code = static_cast<int>(exit_code);
+      if (exit_code != 0)
+        bld::log(Log_type::ERR, "Process exited with code: " + std::to_string(exit_code));
+    }
+    else
+    {
+      bld::log(Log_type::ERR, "Failed to get exit code. Error: " + std::to_string(GetLastError()));
+      // status.normal remains false, but exited=true so we know it terminated
+    }
+  }
+  else if (wait_result == WAIT_TIMEOUT)
+  {
+    // Process is still running - exited remains false
+  }
+  else
+  {
+    // Error occurred
+    bld::log(Log_type::ERR, "WaitForSingleObject failed. Error: " + std::to_string(GetLastError()));
+    // exited remains false, caller will retry or handle as appropriate
+  }
+
+#else
+  int wait_status;
+  struct rusage ru{};
+  pid_t result = wait4(proc.p_id, &wait_status, WNOHANG, &ru);  // WNOHANG = non-blocking
+
+  if (result == proc.p_id)
+  {
+    // Process has terminated
+    status.exited = true;
+    _bld_release_child(proc.p_id);
+    status.usage = _bld_usage(ru, proc.started);
+
+    if (WIFEXITED(wait_status))
+    {
+      status.normal = true;
+      status.exit_code = WEXITSTATUS(wait_status);
+      if (status.exit_code != 0)
+        bld::internal_log(Log_type::ERR, "Process exited with code: " + std::to_string(status.exit_code));
+    }
+    else if (WIFSIGNALED(wait_status))
+    {
+      status.signal = WTERMSIG(wait_status);
+      bld::internal_log(Log_type::ERR, "Process terminated by signal: " + std::to_string(status.signal));
+      // status.normal remains false
+    }
+  }
+  else if (result == 0)
+  {
+    status.exited = false;
+  }
+  else  // result == -1
+  {
+    // Error occurred
+    if (errno == ECHILD)
+    {
+      // Process doesn't exist anymore (already reaped)
+      bld::internal_log(Log_type::WARNING, "Process already reaped");
+      status.exited = true;  // Treat as exited
+      status.normal = true;  // Assume successful exit
+    }
+    else
+    {
+      bld::internal_log(Log_type::ERR, "waitpid failed: " + std::string(strerror(errno)));
+      status.exited = true;
+      status.waitpid_failed = true;
+      // exited remains false, let caller handle retry
+    }
+  }
+#endif
+
+  return status;
+}
+
+bool bld::read_shell_output(const std::string &cmd, std::string &output)
+{
+#ifdef _WIN32
+  FILE *pipe = _popen(command.c_str(), "r");
+#else
+  FILE *pipe = popen(cmd.c_str(), "r");
+#endif
+
+  if (!pipe)
+  {
+    bld::internal_log(Log_type::ERR, "Failed to open pipe for command: " + cmd);
+    return false;
+  }
+
+  char buffer[4096];
+  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) output += buffer;
+
+#ifdef _WIN32
+  int exit_code = _pclose(pipe);
+#else
+  int exit_code = pclose(pipe);
+#endif
+
+  // Check if command executed successfully
+  if (exit_code != 0)
+  {
+    bld::internal_log(Log_type::ERR, "Command failed with exit code: " + std::to_string(exit_code));
+    return false;
+  }
+
+  return true;
+}
+
+bool bld::is_executable_outdated(std::string file_name, std::string executable)
+{
+  try
+  {
+    // Check if the source file exists
+    if (!std::filesystem::exists(file_name))
+    {
+      bld::internal_log(Log_type::ERR, "Source file does not exist: " + file_name);
+      return false;  // Or handle this case differently
+    }
+
+    // Check if the executable exists
+    if (!std::filesystem::exists(executable))
+      return true;  // Treat as changed if the executable doesn't exist
+
+    // Get last write times
+    auto last_write_time = std::filesystem::last_write_time(file_name);
+    auto last_write_time_exec = std::filesystem::last_write_time(executable);
+
+    // Compare timestamps
+    return last_write_time > last_write_time_exec;
+  }
+  catch (const std::filesystem::filesystem_error &e)
+  {
+    bld::internal_log(Log_type::ERR, "Filesystem error: " + std::string(e.what()));
+    return false;  // Or handle the error differently
+  }
+  catch (const std::exception &e)
+  {
+    bld::internal_log(Log_type::ERR, std::string(e.what()));
+    return false;  // Or handle the error differently
+  }
+}
+
+void bld::rebuild_yourself_onchange_and_run(const std::string &filename, const std::string &executable, std::string compiler)
+{
+  namespace fs = std::filesystem;
+  // Convert to filesystem paths
+  fs::path source_path(filename);
+  fs::path exec_path(executable);
+  fs::path backup_path = exec_path.string() + ".old";
+
+  if (!bld::is_executable_outdated(filename, executable))
+    return;  // No rebuild needed
+
+  bld::internal_log(Log_type::INFO, "Build executable not up-to-date. Rebuilding...");
+
+  // Create backup of existing executable if it exists
+  if (fs::exists(exec_path))
+  {
+    try
+    {
+      if (fs::exists(backup_path))
+        fs::remove(backup_path);  // Remove existing backup
+      fs::rename(exec_path, backup_path);
+      bld::internal_log(Log_type::INFO, "Created backup at: " + backup_path.string());
+    }
+    catch (const fs::filesystem_error &e)
+    {
+      bld::internal_log(Log_type::ERR, "Failed to create backup: " + std::string(e.what()));
+      return;
+    }
+  }
+
+  // Detect the compiler if not provided
+  if (compiler.empty())
+  {
+#ifdef __clang__
+    compiler = "clang++";
+#elif defined(__GNUC__)
+    compiler = "g++";
+#elif defined(_MSC_VER)
+    compiler = "cl";  // MSVC
+#else
+    bld::log(Log_type::ERROR, "Unknown compiler. Defaulting to g++.");
+    compiler = "g++";
+#endif
+  }
+
+  // Set up the compile command
+  bld::Command cmd;
+  cmd.parts = {compiler, source_path.string(), "-o", exec_path.string(), "--std=c++23"};
+
+  // Execute the compile command
+  int compile_result = bld::execute(cmd);
+  if (compile_result <= 0)
+  {
+    bld::internal_log(Log_type::ERR, "Compilation failed.");
+
+    // Restore backup if compilation failed and backup exists
+    if (fs::exists(backup_path))
+    {
+      try
+      {
+        fs::remove(exec_path);  // Remove failed compilation output if it exists
+        fs::rename(backup_path, exec_path);
+        bld::internal_log(Log_type::INFO, "Restored previous executable from backup.");
+      }
+      catch (const fs::filesystem_error &e)
+      {
+        bld::internal_log(Log_type::ERR, "Failed to restore backup: " + std::string(e.what()));
+      }
+    }
+    return;
+  }
+
+  bld::internal_log(Log_type::INFO, "Compilation successful. Restarting w/o any args for safety...");
+
+  // Verify the new executable exists and is executable
+  if (!fs::exists(exec_path))
+  {
+    bld::internal_log(Log_type::ERR, "New executable not found after successful compilation.");
+    return;
+  }
+
+  // Make sure the new executable has proper permissions
+  try
+  {
+    fs::permissions(exec_path, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec, fs::perm_options::add);
+  }
+  catch (const fs::filesystem_error &e)
+  {
+    bld::internal_log(Log_type::WARNING, "Failed to set executable permissions: " + std::string(e.what()));
+  }
+
+  // Run the new executable
+  bld::Command restart_cmd;
+  restart_cmd.parts = {exec_path.string()};
+
+  int restart_result = bld::execute(restart_cmd);
+  if (restart_result <= 0)
+  {
+    bld::internal_log(Log_type::ERR, "Failed to start new executable.");
+    return;
+  }
+
+  // Only remove backup after successful restart
+  try
+  {
+    if (fs::exists(backup_path))
+      fs::remove(backup_path);
+  }
+  catch (const fs::filesystem_error &e)
+  {
+    bld::internal_log(Log_type::WARNING, "Failed to remove backup: " + std::string(e.what()));
+  }
+
+  // Exit the current process after successfully restarting
+  std::exit(EXIT_SUCCESS);
+}
+
+void bld::rebuild_yourself_onchange(const std::string &filename, const std::string &executable, std::string compiler)
+{
+  if (bld::is_executable_outdated(filename, executable))
+  {
+    bld::internal_log(Log_type::INFO, "Build executable not up-to-date. Rebuilding...");
+    bld::Command cmd = {};
+
+    // Detect the compiler if not provided
+    if (compiler.empty())
+    {
+    #ifdef __clang__
+      compiler = "clang++";
+    #elif defined(__GNUC__)
+      compiler = "g++";
+    #elif defined(_MSC_VER)
+      compiler = "cl";  // MSVC uses 'cl' as the compiler command
+    #else
+      bld::log(Log_type::ERROR, "Unknown compiler. Defaulting to g++.");
+      compiler = "g++";
+    #endif
+    }
+
+    // Set up the compile command
+    cmd.parts = {compiler, filename, "-o", executable};
+
+    // Execute the compile command
+    if (bld::execute(cmd) <= 0)
+    {
+      bld::internal_log(Log_type::WARNING, "Failed to rebuild executable.");
+      return;
+    }
+  }
+}
+
+namespace bld
+{
+  // Static instance getter
+  Config &Config::get()
+  {
+    static Config instance;
+    static bool initialized = false;
+    if (!initialized)
+    {
+      instance.initialize_builtin_options();
+      initialized = true;
+    }
+    return instance;
+  }
+
+  // Define custom config options
+  void Config::add_flag(const std::string &name, const std::string &description)
+  {
+    custom_configs[name] = {.default_value = "", .description = description, .is_flag = true};
+  }
+
+  void Config::add_option(const std::string &name, const std::string &default_value, const std::string &description)
+  {
+    custom_configs[name] = {.default_value = default_value, .description = description, .is_flag = false};
+    if (!default_value.empty())
+      values[name] = default_value;
+  }
+
+  const std::unordered_map<std::string, Config::CustomConfig> &Config::get_custom_configs() const { return custom_configs; }
+
+  // Config_proxy implementation
+  Config::Config_proxy::Config_proxy(const std::string &k, Config *c) : key(k), config(c) {}
+
+  Config::Config_proxy &Config::Config_proxy::operator=(const std::string &value)
+  {
+    config->values[key] = value;
+    config->flags.erase(key);  // Remove from flags if it was there
+
+    // Sync to built-in members
+    if (key == "compiler" || key == "c")
+    {
+      config->compiler = value;
+    }
+    else if (key == "target" || key == "t")
+    {
+      config->target = value;
+    }
+    else if (key == "build-dir" || key == "d")
+    {
+      config->build_dir = value;
+    }
+    else if (key == "flags" || key == "f")
+    {
+      config->compiler_flags = value;
+    }
+    else if (key == "link" || key == "l")
+    {
+      config->linker_flags = value;
+    }
+    else if (key == "threads" || key == "j")
+    {
+      if (str::is_numeric(value))
+        config->threads = std::max(1, std::stoi(value));
+    }
+    else if (key == "pre")
+    {
+      config->pre_build = value;
+    }
+    else if (key == "post")
+    {
+      config->post_build = value;
+    }
+
+    return *this;
+  }
+
+  Config::Config_proxy &Config::Config_proxy::operator=(const char *value)
+  {
+    config->values[key] = std::string(value);
+    config->flags.erase(key);
+    return *this;
+  }
+
+  Config::Config_proxy::operator std::string() const
+  {
+    auto it = config->values.find(key);
+    if (it != config->values.end())
+      return it->second;
+
+    auto custom_it = config->custom_configs.find(key);
+    if (custom_it != config->custom_configs.end())
+      return custom_it->second.default_value;
+
+    // Fallback: check if it's a built-in that wasn't synced
+    if (key == "compiler" || key == "c")
+      return config->compiler;
+    if (key == "target" || key == "t")
+      return config->target;
+    if (key == "build-dir" || key == "d")
+      return config->build_dir;
+    if (key == "flags" || key == "f")
+      return config->compiler_flags;
+    if (key == "link" || key == "l")
+      return config->linker_flags;
+    if (key == "threads" || key == "j")
+      return std::to_string(config->threads);
+    if (key == "pre")
+      return config->pre_build;
+    if (key == "post")
+      return config->post_build;
+
+    return "";
+  }
+
+  bool Config::Config_proxy::operator==(const std::string &other) const
+  {
+    // First check if it's a flag
+    if (config->flags.count(key))
+      return other == "true" || other == "yes" || other == "1" || other.empty();
+    // Then check value
+    auto it = config->values.find(key);
+    return it != config->values.end() && it->second == other;
+  }
+
+  bool Config::Config_proxy::operator==(const char *other) const { return *this == std::string(other); }
+
+  Config::Config_proxy::operator bool() const
+  {
+    if (config->flags.count(key))
+      return true;
+
+    auto it = config->values.find(key);
+    if (it != config->values.end())
+    {
+      const std::string &value = it->second;
+      return value == "true" || value == "yes" || value == "1" || (!value.empty() && value != "false" && value != "no" && value != "0");
+    }
+
+    // Check built-in boolean flags
+    if (key == "verbose" || key == "v")
+      return config->verbose;
+    if (key == "hot-reload" || key == "hr")
+      return config->hot_reload;
+    if (key == "override-run")
+      return config->override_run;
+
+    return false;
+  }
+
+  bool Config::Config_proxy::exists() const { return config->flags.count(key) || config->values.count(key); }
+
+  int Config::Config_proxy::as_int() const
+  {
+    std::string val = *this;
+    if (val.empty() || val.find_first_not_of("0123456789") != std::string::npos)
+      return 0;
+    return std::stoi(val);
+  }
+
+  // Config subscript operators
+  Config::Config_proxy Config::operator[](const std::string &key) { return Config_proxy(key, this); }
+
+  const Config::Config_proxy Config::operator[](const std::string &key) const { return Config_proxy(key, const_cast<Config *>(this)); }
+
+  void Config::initialize_builtin_options()
+  {
+    // Initialize built-in options as custom configs so they work with []
+    add_option("compiler", compiler, "Compiler to use");
+    add_option("c", compiler, "Compiler to use (short form)");
+    add_option("target", target, "Target executable name");
+    add_option("t", target, "Target executable name (short form)");
+    add_option("build-dir", build_dir, "Build directory");
+    add_option("d", build_dir, "Build directory (short form)");
+    add_option("flags", compiler_flags, "Compiler flags");
+    add_option("f", compiler_flags, "Compiler flags (short form)");
+    add_option("link", linker_flags, "Linker flags");
+    add_option("l", linker_flags, "Linker flags (short form)");
+    add_option("threads", std::to_string(threads), "Number of build threads");
+    add_option("j", std::to_string(threads), "Number of build threads (short form)");
+    add_option("pre", pre_build, "Pre-build command");
+    add_option("post", post_build, "Post-build command");
+
+    // Flags
+    add_flag("verbose", "Enable verbose output");
+    add_flag("v", "Enable verbose output (short form)");
+    add_flag("hot-reload", "Enable hot reload");
+    add_flag("hr", "Enable hot reload (short form)");
+    add_flag("override-run", "Override run behavior");
+    add_flag("help", "Show help");
+    add_flag("h", "Show help (short form)");
+  }
+  // Argument parsing
+  void Config::parse_args(const std::vector<std::string> &args)
+  {
+    for (const auto &arg : args)
+    {
+      if (!str::starts_with(arg, "-"))
+        continue;
+
+      auto eq_pos = arg.find('=');
+
+      if (eq_pos == std::string::npos)
+      {
+        std::string flag = arg.substr(1);
+        flags.insert(flag);
+        values.erase(flag);  // Remove from values if it was there
+
+        if (flag == "v" || flag == "verbose")
+        {
+          verbose = true;
+          flags.insert("verbose");
+          flags.insert("v");
+        }
+        else if (flag == "hr" || flag == "hot-reload")
+        {
+          hot_reload = true;
+          flags.insert("hot-reload");
+          flags.insert("hr");
+        }
+        else if (flag == "override-run")
+        {
+          override_run = true;
+        }
+        else if (flag == "h" || flag == "help")
+        {
+          // Don't show help automatically, let user handle it
+        }
+      }
+      else
+      {
+        // Key=value pair like -compiler=g++, -test=yes
+        std::string key = arg.substr(1, eq_pos - 1);
+        std::string value = arg.substr(eq_pos + 1);
+
+        values[key] = value;
+        flags.erase(key);  // Remove from flags if it was there
+
+        // Use [] assignment operator which will sync to built-ins automatically
+        (*this)[key] = value;
+      }
+    }
+  }
+
+  // Private helper methods
+  bool Config::is_true(const std::string &value) const { return value == "true" || value == "1" || value == "yes"; }
+
+  bool Config::is_number(const std::string &value) const
+  {
+    return !value.empty() && value.find_first_not_of("0123456789") == std::string::npos;
+  }
+
+  void Config::parse_file_list(const std::string &value)
+  {
+    if (!value.empty())
+    {
+      std::stringstream ss(value);
+      std::string file;
+      hot_reload_files.clear();
+      while (std::getline(ss, file, ','))
+        if (!file.empty())
+          hot_reload_files.push_back(file);
+      hot_reload = true;
+    }
+  }
+
+  // Help and documentation
+  void bld::Config::show_help(bool only_custom) const
+  {
+    // Built-in names registered by initialize_builtin_options()
+    static const std::unordered_set<std::string> builtin_names = {
+        "compiler", "c",    "target",  "t", "build-dir",  "d",  "flags",        "f",    "link", "l", "threads", "j",
+        "pre",      "post", "verbose", "v", "hot-reload", "hr", "override-run", "help", "h"};
+
+    // ── Full built-in reference ──────────────────────────────
+    if (!only_custom)
+    {
+      std::cout << "Usage: <executable> [options]\n\n"
+                << "Flags (no value needed):\n"
+                << "  -flag_name              Set a flag  (e.g. -verbose)\n\n"
+                << "Key=Value pairs:\n"
+                << "  -key=value              Set a config value  (e.g. -compiler=clang++)\n\n"
+                << "Built-in options:\n"
+                << std::left << "  " << std::setw(28) << "-c, -compiler=COMPILER"
+                << "Compiler to use                (default: " << compiler << ")\n"
+                << "  " << std::setw(28) << "-t, -target=TARGET"
+                << "Target executable name         (default: " << target << ")\n"
+                << "  " << std::setw(28) << "-d, -build-dir=DIR"
+                << "Build directory                (default: " << build_dir << ")\n"
+                << "  " << std::setw(28) << "-f, -flags=FLAGS"
+                << "Compiler flags                 (default: " << compiler_flags << ")\n"
+                << "  " << std::setw(28) << "-l, -link=FLAGS"
+                << "Linker flags\n"
+                << "  " << std::setw(28) << "-j, -threads=N"
+                << "Number of build threads        (default: " << threads << ")\n"
+                << "  " << std::setw(28) << "-pre=CMD"
+                << "Pre-build shell command\n"
+                << "  " << std::setw(28) << "-post=CMD"
+                << "Post-build shell command\n"
+                << "  " << std::setw(28) << "-v, -verbose"
+                << "Enable verbose output\n"
+                << "  " << std::setw(28) << "-hr, -hot-reload"
+                << "Enable hot reload\n"
+                << "  " << std::setw(28) << "-override-run"
+                << "Override run behaviour\n"
+                << "  " << std::setw(28) << "-h, -help"
+                << "Show this help\n\n"
+                << "Commands:\n"
+                << "  " << std::setw(28) << "-configure [opts]"
+                << "Parse opts and save to " << BLD_DEFAULT_CONFIG_FILE << "\n"
+                << "  " << std::setw(28) << "-use-config"
+                << "Load config from " << BLD_DEFAULT_CONFIG_FILE << "\n\n";
+    }
+
+    // ── Collect user-defined custom configs (filter out built-ins) ──
+    std::vector<std::pair<std::string, CustomConfig>> user_flags, user_options;
+
+    for (const auto &[name, cfg] : custom_configs)
+    {
+      if (builtin_names.count(name))
+        continue;  // skip anything we registered internally
+      if (cfg.is_flag)
+        user_flags.emplace_back(name, cfg);
+      else
+        user_options.emplace_back(name, cfg);
+    }
+
+    // Sort alphabetically for a stable, readable listing
+    auto by_name = [](const auto &a, const auto &b) { return a.first < b.first; };
+    std::sort(user_flags.begin(), user_flags.end(), by_name);
+    std::sort(user_options.begin(), user_options.end(), by_name);
+
+    if (user_flags.empty() && user_options.empty())
+    {
+      std::cout << (only_custom ? "No custom options defined.\n"
+                                  "  Add some with config.add_flag(name, desc) "
+                                  "or config.add_option(name, default, desc).\n"
+                                : "  (No custom options defined.)\n");
+      return;
+    }
+
+    std::cout << "Custom options:\n";
+
+    if (!user_flags.empty())
+    {
+      std::cout << "\n  Flags:\n";
+      for (const auto &[name, cfg] : user_flags)
+      {
+        std::string col1 = "    -" + name;
+        std::cout << std::left << std::setw(30) << col1;
+        if (!cfg.description.empty())
+          std::cout << "  " << cfg.description;
+        std::cout << "\n";
+      }
+    }
+
+    if (!user_options.empty())
+    {
+      std::cout << "\n  Options:\n";
+      for (const auto &[name, cfg] : user_options)
+      {
+        std::string col1 = "    -" + name + "=VALUE";
+        std::cout << std::left << std::setw(30) << col1;
+        if (!cfg.default_value.empty())
+          std::cout << "  (default: " << std::setw(12) << cfg.default_value << ")";
+        if (!cfg.description.empty())
+          std::cout << "  " << cfg.description;
+        std::cout << "\n";
+      }
+    }
+
+    std::cout << std::flush;
+  }
+
+  void Config::dump() const
+  {
+    std::cout << "=== Config Dump ===\n";
+    std::cout << "Flags:\n";
+    for (const auto &flag : flags) std::cout << "  " << flag << "\n";
+    std::cout << "Values:\n";
+    for (const auto &[key, value] : values) std::cout << "  " << key << " = " << value << "\n";
+    std::cout << "==================\n";
+  }
+
+  // File operations
+  bool Config::load_from_file(const std::string &filename)
+  {
+    std::ifstream file(filename);
+    if (!file.is_open())
+      return false;
+
+    std::vector<std::string> file_args;
+    std::string line;
+    while (std::getline(file, line))
+    {
+      line.erase(0, line.find_first_not_of(" \t"));
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      if (line.find('=') != std::string::npos)
+      {
+        // key=value format
+        if (!str::starts_with(line, "-"))
+          line = "-" + line;
+        file_args.push_back(line);
+      }
+      else
+      {
+        // Simple flag
+        if (!str::starts_with(line, "-"))
+          line = "-" + line;
+        file_args.push_back(line);
+      }
+    }
+
+    parse_args(file_args);
+    return true;
+  }
+
+  bool Config::save_to_file(const std::string &filename) const
+  {
+    std::ofstream file(filename);
+    if (!file.is_open())
+      return false;
+
+    file << "# Build configuration\n";
+
+    // Save built-in options
+    file << "compiler=" << compiler << "\n";
+    file << "target=" << target << "\n";
+    file << "build-dir=" << build_dir << "\n";
+    file << "flags=" << compiler_flags << "\n";
+    file << "threads=" << threads << "\n";
+
+    if (verbose)
+      file << "verbose\n";
+    if (hot_reload)
+      file << "hot-reload\n";
+    if (override_run)
+      file << "override-run\n";
+
+    // Save custom flags
+    for (const auto &flag : flags)
+      if (flag != "verbose" && flag != "hot-reload" && flag != "override-run" && flag != "v" && flag != "hr")
+        file << flag << "\n";
+
+    // Save custom values
+    for (const auto &[key, value] : values)
+    {
+      if (key != "compiler" && key != "target" && key != "build-dir" && key != "flags" && key != "threads" && key != "c" && key != "t" &&
+          key != "d" && key != "f" && key != "j")
+      {
+        file << key << "=" << value << "\n";
+      }
+    }
+
+    return true;
+  }
+
+  // Command handler functions
+  void handle_config_command(const std::vector<std::string> &args, const std::string &program_name)
+  {
+    if (args.size() < 2)
+    {
+      std::cout << "Usage: " << program_name << " config [options]\n";
+      Config::get().show_help();
+      return;
+    }
+
+    std::vector<std::string> config_args(args.begin() + 1, args.end());
+    Config::get().parse_args(config_args);
+  }
+
+  void handle_args(int argc, char *argv[])
+  {
+    std::vector<std::string> args;
+    Config::get().cmd_args.clear();
+
+    for (int i = 0; i < argc; ++i)
+    {
+      args.push_back(argv[i]);
+      Config::get().cmd_args.push_back(argv[i]);
+    }
+
+    if (args.size() <= 1)
+      return;
+
+    std::string command = args[1];
+    if (command == "-configure")
+    {
+      handle_config_command(args, argv[0]);
+      bld::Config::get().save_to_file();
+      internal_log(Log_type::INFO, "Configuration saved.");
+    }
+    if (command == "-use-config")
+    {
+      bld::Config::get().load_from_file();
+      return;
+    }
+    handle_config_command(args, argv[0]);
+    // Users can handle other commands themselves
+  }
+
+}  // namespace bld
+
+bool bld::args_to_vec(int argc, char *argv[], std::vector<std::string> &args)
+{
+  if (argc < 1)
+    return false;
+
+  args.reserve(argc - 1);
+  for (int i = 1; i < argc; i++) args.push_back(argv[i]);
+
+  return true;
+}
+
+int bld::handle_run_command(std::vector<std::string> args)
+{
+#ifdef BLD_USE_CONFIG
+  if (args.size() == 2)
+  {
+    bld::log(bld::Log_type::WARNING, "Command 'run' specified with the executable");
+    bld::log(bld::Log_type::INFO, "Proceeding to run the specified command: " + args[1]);
+    bld::Command cmd(args[1]);
+    return bld::execute(cmd);
+  }
+  else if (args.size() > 2)
+  {
+    bld::log(bld::Log_type::ERR, "Too many arguments for 'run' command. Only executables are supported.");
+    bld::log(bld::Log_type::INFO, "Usage: run <executable>");
+    exit(EXIT_FAILURE);
+  }
+  if (bld::Config::get().target.empty())
+  {
+    bld::log(bld::Log_type::ERR, "No target executable specified in config");
+    exit(1);
+  }
+
+  bld::Command cmd;
+  cmd.parts.push_back(Config::get().target);
+
+  bld::execute(cmd);
+  exit(EXIT_SUCCESS);
+#else
+  if (args.size() < 2)
+  {
+    bld::internal_log(bld::Log_type::ERR,
+             "No target executable specified in config. Config is disabled. Please enable BLD_USE_CONFIG macro to use the Config class.");
+    exit(EXIT_FAILURE);
+  }
+  else if (args.size() == 2)
+  {
+    bld::internal_log(bld::Log_type::WARNING, "Command 'run' specified with the executable");
+    bld::internal_log(bld::Log_type::INFO, "Proceeding to run the specified command: " + args[1]);
+    bld::Command cmd(args[1]);
+    return bld::execute(cmd);
+  }
+  else if (args.size() > 2)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Too many arguments for 'run' command. Only executables are supported.");
+    bld::internal_log(bld::Log_type::INFO, "Usage: run <executable>");
+    exit(EXIT_FAILURE);
+  }
+#endif
+  bld::internal_log(bld::Log_type::ERR, "Should never be reached: " + std::to_string(__LINE__));
+  exit(EXIT_FAILURE);
+}
+
+bool bld::starts_with(const std::string &str, const std::string &prefix)
+{
+  if (prefix.size() > str.size())
+    return false;
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+
+bld::fs::Mapped_file &bld::fs::Mapped_file::operator=(Mapped_file &&other) noexcept
+{
+  if (this == &other)
+    return *this;
+  close();
+  fallback = std::move(other.fallback);
+  ptr = other.mapped ? other.ptr : fallback.data();
+  len = other.len;
+  opened = other.opened;
+  mapped = other.mapped;
+  other.ptr = nullptr;
+  other.len = 0;
+  other.opened = other.mapped = false;
+  return *this;
+}
+
+bool bld::fs::Mapped_file::open(const std::string &path)
+{
+  close();
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    void *p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED)
+    {
+      ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+      ptr = static_cast<const char *>(p);
+      len = static_cast<size_t>(st.st_size);
+      mapped = opened = true;
+      ::close(fd);
+      return true;
+    }
+  }
+
+  // Empty, special (size 0 in /proc, pipes) or unmappable: read it
+  char buf[64 * 1024];
+  ssize_t n;
+  while ((n = ::read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+    if (n > 0)
+      fallback.append(buf, static_cast<size_t>(n));
+  ::close(fd);
+  if (n < 0)
+  {
+    fallback.clear();
+    return false;
+  }
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  fallback.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+#endif
+  ptr = fallback.data();
+  len = fallback.size();
+  opened = true;
+  return true;
+}
+
+void bld::fs::Mapped_file::close()
+{
+#ifndef _WIN32
+  if (mapped)
+    ::munmap(const_cast<char *>(ptr), len);
+#endif
+  fallback.clear();
+  ptr = nullptr;
+  len = 0;
+  opened = mapped = false;
+}
+
+bool bld::fs::read_file(const std::string &path, std::string &content)
+{
+#ifndef _WIN32
+  // read() into a buffer sized by fstat: one copy, like a mapping would need anyway, but a file truncated
+  // underneath us is a short read instead of a SIGBUS. Mapped_file is for callers that keep the mapping.
+  int fd;
+  while ((fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC)) == -1 && errno == EINTR) {}
+  struct stat st;
+  if (fd == -1 || ::fstat(fd, &st) == -1)
+  {
+    int err = errno;
+    if (fd != -1)
+      ::close(fd);
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file: " + path + ": " + std::string(strerror(err)));
+    errno = err;
+    return false;
+  }
+
+  // One spare byte sees EOF without growing the buffer. Special files report size 0 and anything may grow
+  // meanwhile, so keep reading until EOF either way.
+  content.resize(S_ISREG(st.st_mode) && st.st_size > 0 ? static_cast<size_t>(st.st_size) + 1 : 64 * 1024);
+  size_t got = 0;
+  while (true)
+  {
+    if (got == content.size())
+      content.resize(content.size() * 2);
+    ssize_t n = ::read(fd, content.data() + got, content.size() - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      int err = errno;
+      ::close(fd);
+      content.resize(n == 0 ? got : 0);
+      if (n == 0)
+        return true;
+      bld::internal_log(bld::Log_type::ERR, "Failed to read file: " + path + ": " + std::string(strerror(err)));
+      errno = err;
+      return false;
+    }
+    got += static_cast<size_t>(n);
+  }
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file: " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+  content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return true;
+#endif
+}
+
+bool bld::fs::write_entire_file(const std::string &path, const std::string &content)
+{
+  std::ofstream file(path, std::ios::binary);
+
+  if (!file)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file for writing: " + path);
+    return false;
+  }
+
+  file << content;
+  bool success = file.good();
+  file.close();
+  return success;
+}
+
+namespace
+{
+  // Unique name next to `path`, for write-then-rename. Unique across processes and threads.
+  std::string _bld_temp_sibling(const std::string &path)
+  {
+    static std::atomic<unsigned> counter{0};
+#ifdef _WIN32
+    unsigned long self = GetCurrentProcessId();
+#else
+    long self = getpid();
+#endif
+    return path + ".bld-tmp." + std::to_string(self) + "." + std::to_string(counter++);
+  }
+
+#ifndef _WIN32
+  bool _bld_write_all(int fd, std::string_view data)
+  {
+    while (!data.empty())
+    {
+      ssize_t n = ::write(fd, data.data(), data.size());
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data.remove_prefix(static_cast<size_t>(n));
+    }
+    return true;
+  }
+
+  // Truncate and rewrite an existing `path`, for targets a rename would replace (FIFOs, devices, hard links)
+  bool _bld_write_in_place(const std::string &path, std::string_view content, const bld::fs::Write_options &opts)
+  {
+    int fd = ::open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd == -1)
+      return false;
+    struct stat st;
+    bool regular = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    bool ok = _bld_write_all(fd, content) && (!opts.mode || !regular || ::fchmod(fd, opts.mode) == 0) &&
+              (!opts.durable || !regular || ::fsync(fd) == 0);
+    return ::close(fd) == 0 && ok;
+  }
+#endif
+}  // anonymous namespace
+
+bool bld::fs::write_file_atomic(const std::string &path, std::string_view content, const Write_options &opts)
+{
+#ifndef _WIN32
+  std::error_code ec;
+  std::string target = path;
+  struct stat old;
+  const bool exists = ::stat(path.c_str(), &old) == 0;
+  if (exists && std::filesystem::is_symlink(path, ec))
+    target = std::filesystem::canonical(path, ec).string();
+
+  if (opts.if_changed && exists && S_ISREG(old.st_mode) && static_cast<size_t>(old.st_size) == content.size())
+  {
+    Mapped_file current(target);
+    if (current && current.view() == content)
+    {
+      if (opts.mode && (old.st_mode & 07777) != opts.mode)
+        ::chmod(target.c_str(), opts.mode);
+      return true;
+    }
+  }
+
+  // A rename would swap a FIFO or device for a plain file and split hard links
+  if (exists && (!S_ISREG(old.st_mode) || old.st_nlink > 1))
+  {
+    if (_bld_write_in_place(target, content, opts))
+      return true;
+    bld::internal_log(bld::Log_type::ERR, "Failed to write file " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  std::string dir = std::filesystem::path(target).parent_path().string();
+  if (dir.empty())
+    dir = ".";
+  const mode_t mode = opts.mode ? opts.mode : exists ? (old.st_mode & 07777) : 0;
+  const std::string tmp = _bld_temp_sibling(target);
+
+  // Unnamed first: a crash before the link leaves nothing behind. Then a named temporary.
+  // Without a temporary, or when the owner can't be kept, an existing file is rewritten in place.
+  const bool owned = !exists || (old.st_uid == ::geteuid() && old.st_gid == ::getegid());
+  bool written = false, in_place = false;
+  for (int attempt = 0; attempt < 2 && !written; ++attempt)
+  {
+    int fd = -1;
+    bool anonymous = false;
+#ifdef O_TMPFILE
+    if (attempt == 0)
+      anonymous = (fd = ::open(dir.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666)) != -1;
+#endif
+    if (fd == -1)
+    {
+      attempt = 1;
+      fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    }
+    if (fd == -1)
+    {
+      in_place = exists;
+      break;
+    }
+    if (!owned && ::fchown(fd, old.st_uid, old.st_gid) == -1)
+    {
+      ::close(fd);
+      ::unlink(tmp.c_str());
+      in_place = true;
+      break;
+    }
+
+    bool ok = _bld_write_all(fd, content) && (!mode || ::fchmod(fd, mode) == 0) && (!opts.durable || opts.batch || ::fsync(fd) == 0);
+    if (ok && anonymous)
+    {
+      const std::string proc = "/proc/self/fd/" + std::to_string(fd);
+      if (::linkat(AT_FDCWD, proc.c_str(), AT_FDCWD, tmp.c_str(), AT_SYMLINK_FOLLOW) == -1)
+      {
+        ::close(fd);
+        continue;  // No /proc, try again with a named temporary
+      }
+    }
+    written = ::close(fd) == 0 && ok;
+    if (!written)
+      ::unlink(tmp.c_str());
+  }
+
+  if (in_place && _bld_write_in_place(target, content, opts))
+    return true;
+  if (!written || ::rename(tmp.c_str(), target.c_str()) == -1)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to write file " + path + ": " + std::string(strerror(errno)));
+    ::unlink(tmp.c_str());
+    return false;
+  }
+
+  if (opts.durable)
+  {
+    if (opts.batch)
+      opts.batch->add(dir);
+    else if (int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC); dfd != -1)
+    {
+      ::fsync(dfd);  // The rename itself
+      ::close(dfd);
+    }
+  }
+  return true;
+#else
+  if (opts.if_changed)
+  {
+    std::string current;
+    std::ifstream in(path, std::ios::binary);
+    if (in && (current.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()), current == content))
+      return true;
+  }
+  const std::string tmp = _bld_temp_sibling(path);
+  {
+    std::ofstream file(tmp, std::ios::binary);
+    file.write(content.data(), static_cast<std::streamsize>(content.size()));
+    if (!file.flush())
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to open file for writing: " + path);
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to write file " + path + ": " + ec.message());
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+#endif
+}
+
+void bld::fs::Sync_batch::add(const std::string &dir)
+{
+#ifndef _WIN32
+  struct stat st;
+  if (::stat(dir.c_str(), &st) == -1)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (fds.count(st.st_dev))
+    return;
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1)
+    fds[st.st_dev] = fd;
+#else
+  (void)dir;
+#endif
+}
+
+bool bld::fs::Sync_batch::commit()
+{
+  bool ok = true;
+#ifndef _WIN32
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &[dev, fd] : fds)
+  {
+#ifdef __linux__
+    if (::syncfs(fd) == -1)
+    {
+      bld::internal_log(bld::Log_type::ERR, "syncfs failed: " + std::string(strerror(errno)));
+      ok = false;
+    }
+#else
+    ::sync();
+#endif
+    ::close(fd);
+  }
+  fds.clear();
+#endif
+  return ok;
+}
+
+bool bld::fs::append_file(const std::string &path, const std::string &content)
+{
+#ifndef _WIN32
+  // O_APPEND: concurrent appenders never overwrite each other
+  int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if (fd == -1)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file for appending: " + path);
+    return false;
+  }
+  bool success = _bld_write_all(fd, content);
+  return ::close(fd) == 0 && success;
+#else
+  std::ofstream file(path, std::ios::app | std::ios::binary);
+  if (!file)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file for appending: " + path);
+    return false;
+  }
+
+  file << content;
+  bool success = file.good();
+  file.close();
+  return success;
+#endif
+}
+
+bool bld::fs::read_lines(const std::string &path, std::vector<std::string> &lines)
+{
+  Mapped_file file(path);
+  if (!file)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file: " + path);
+    return false;
+  }
+
+  for (std::string_view line : bld::fs::lines(file.view())) lines.emplace_back(line);
+  return true;
+}
+
+bool bld::fs::replace_in_file(const std::string &path, const std::string &from, const std::string &to)
+{
+  std::string content;
+  {
+    Mapped_file file(path);
+    if (!file)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to read file: " + path);
+      return false;
+    }
+    std::string_view src = file.view();
+    if (src.empty())
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to read file or it is empty: " + path);
+      return false;
+    }
+
+    // One pass into a new buffer, the mapping is released before the file is rewritten
+    content.reserve(src.size());
+    size_t pos = 0;
+    for (size_t hit; !from.empty() && (hit = src.find(from, pos)) != std::string_view::npos; pos = hit + from.size())
+      content.append(src, pos, hit - pos).append(to);
+    content.append(src, pos);
+  }
+
+  return bld::fs::write_entire_file(path, content);
+}
+
+namespace
+{
+#ifndef _WIN32
+  // Byte compare two open files of `size` bytes, stopping at the first difference
+  bool _bld_same_content(int a, int b, uintmax_t size)
+  {
+    std::vector<char> x(256 * 1024), y(256 * 1024);
+    for (uintmax_t off = 0; off < size;)
+    {
+      size_t n = static_cast<size_t>(std::min<uintmax_t>(x.size(), size - off));
+      if (::pread(a, x.data(), n, static_cast<off_t>(off)) != static_cast<ssize_t>(n) ||
+          ::pread(b, y.data(), n, static_cast<off_t>(off)) != static_cast<ssize_t>(n) || std::memcmp(x.data(), y.data(), n) != 0)
+        return false;
+      off += n;
+    }
+    return true;
+  }
+
+  /* Move `size` bytes from `in` into the empty file `out`, cheapest mechanism first. Each step falls back to the next
+   * when the kernel or filesystem refuses it, continuing from the current offsets. Size 0 may be a lie (procfs),
+   * so that copies until EOF. A source that ends before `size` bytes is a failed copy, with errno EIO.
+   */
+  bld::fs::Copy_method _bld_copy_fd(int in, int out, uintmax_t size)
+  {
+    using bld::fs::Copy_method;
+#ifdef __linux__
+    if (::ioctl(out, FICLONE, in) == 0)
+      return Copy_method::REFLINK;
+    Copy_method method = size ? Copy_method::COPY_FILE_RANGE : Copy_method::READ_WRITE;
+#else
+    Copy_method method = Copy_method::READ_WRITE;
+#endif
+    constexpr uintmax_t chunk = 1u << 30;
+    std::vector<char> buf;
+    for (uintmax_t done = 0; size == 0 || done < size;)
+    {
+      ssize_t n;
+#ifdef __linux__
+      if (method == Copy_method::COPY_FILE_RANGE)
+      {
+        n = ::copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(std::min(chunk, size - done)), 0);
+        if (n < 0 && errno != EINTR)
+        {
+          method = Copy_method::SENDFILE;  // EXDEV on old kernels, EINVAL/EOPNOTSUPP on some filesystems
+          continue;
+        }
+      }
+      else if (method == Copy_method::SENDFILE)
+      {
+        n = ::sendfile(out, in, nullptr, static_cast<size_t>(std::min(chunk, size - done)));
+        if (n < 0 && errno != EINTR)
+        {
+          method = Copy_method::READ_WRITE;
+          continue;
+        }
+      }
+      else
+#endif
+      {
+        buf.resize(256 * 1024);
+        n = ::read(in, buf.data(), buf.size());
+        for (ssize_t w = 0, off = 0; n > 0 && off < n; off += w)
+          if ((w = ::write(out, buf.data() + off, static_cast<size_t>(n - off))) < 0)
+          {
+            if (errno != EINTR)
+              return Copy_method::NONE;
+            w = 0;
+          }
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return Copy_method::NONE;
+      if (n == 0)
+      {
+        if (size == 0)
+          break;
+        errno = EIO;  // Source shrank while we copied, `out` is incomplete
+        return Copy_method::NONE;
+      }
+      done += static_cast<uintmax_t>(n);
+    }
+    return method;
+  }
+#endif
+
+  /* Copy `src` over `dst` in place with the copy engine. For callers that handle temporaries and permissions themselves.
+   * `reflink_only` fails (and removes `dst`) unless the data blocks can be shared, so the caller can try something else first.
+   */
+  bool _bld_clone_file(const std::string &src, const std::string &dst, bool reflink_only = false)
+  {
+#ifndef _WIN32
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in == -1)
+      return false;
+    int out = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    struct stat st;
+    bool ok = out != -1;
+  #ifdef __linux__
+    if (reflink_only)
+      ok = ok && ::ioctl(out, FICLONE, in) == 0;
+    else
+  #endif
+      ok = ok && !reflink_only && ::fstat(in, &st) == 0 &&
+           _bld_copy_fd(in, out, static_cast<uintmax_t>(st.st_size)) != bld::fs::Copy_method::NONE;
+    if (out != -1 && ::close(out) == -1)
+      ok = false;
+    ::close(in);
+    if (!ok && reflink_only && out != -1)
+      ::unlink(dst.c_str());
+    return ok;
+#else
+    if (reflink_only)
+      return false;
+    std::error_code ec;
+    std::filesystem::copy_file(src, dst, std::filesystem::copy_options::overwrite_existing, ec);
+    return !ec;
+#endif
+  }
+}  // anonymous namespace
+
+bool bld::fs::copy_file(const std::string &from, const std::string &to, bool overwrite)
+{
+  Copy_options opts;
+  opts.overwrite = overwrite;
+  opts.skip_unchanged = false;
+  return copy_file_fast(from, to, opts);
+}
+
+bool bld::fs::copy_file_fast(const std::string &from, const std::string &to, const Copy_options &opts, Copy_method *method)
+{
+  Copy_method m = Copy_method::NONE;
+  if (method)
+    *method = m;
+
+#ifndef _WIN32
+  int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat src;
+  if (in == -1 || ::fstat(in, &src) == -1 || !S_ISREG(src.st_mode))
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to copy file: cannot read " + from + (in == -1 ? ": " + std::string(strerror(errno)) : ""));
+    if (in != -1)
+      ::close(in);
+    return false;
+  }
+
+  struct stat dst;
+  bool exists = ::stat(to.c_str(), &dst) == 0;
+  if (exists && !opts.overwrite)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Destination file already exists: " + to);
+    ::close(in);
+    return false;
+  }
+
+  if (exists && opts.skip_unchanged && S_ISREG(dst.st_mode) && dst.st_size == src.st_size)
+  {
+    bool same = dst.st_dev == src.st_dev && dst.st_ino == src.st_ino;
+    if (!same)
+    {
+      int out = ::open(to.c_str(), O_RDONLY | O_CLOEXEC);
+      same = out != -1 && _bld_same_content(in, out, static_cast<uintmax_t>(src.st_size));
+      if (out != -1)
+        ::close(out);
+    }
+    if (same)
+    {
+      if ((dst.st_mode & 07777) != (src.st_mode & 07777))
+        ::chmod(to.c_str(), src.st_mode & 07777);
+      ::close(in);
+      if (method)
+        *method = Copy_method::SKIPPED;
+      return true;
+    }
+  }
+
+  const std::string tmp = _bld_temp_sibling(to);
+  if (opts.hardlink && ::link(from.c_str(), tmp.c_str()) == 0)
+    m = Copy_method::HARDLINK;
+  else
+  {
+    // Falls through to a copy when linking fails, e.g. across filesystems
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out != -1)
+    {
+      m = _bld_copy_fd(in, out, static_cast<uintmax_t>(src.st_size));
+      if (::fchmod(out, src.st_mode & 07777) == -1 || ::close(out) == -1)
+        m = Copy_method::NONE;
+    }
+  }
+  ::close(in);
+
+  if (m == Copy_method::NONE || ::rename(tmp.c_str(), to.c_str()) == -1)
+  {
+    int err = errno;
+    bld::internal_log(bld::Log_type::ERR, "Failed to copy file " + from + " to " + to + ": " + std::string(strerror(err)));
+    ::unlink(tmp.c_str());
+    errno = err;  // For copy_batch's per item error
+    return false;
+  }
+#else
+  std::error_code ec;
+  if (!opts.overwrite && std::filesystem::exists(to, ec))
+  {
+    bld::internal_log(bld::Log_type::ERR, "Destination file already exists: " + to);
+    return false;
+  }
+  std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+  if (ec)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to copy file: " + ec.message());
+    return false;
+  }
+  m = Copy_method::READ_WRITE;
+#endif
+
+  if (method)
+    *method = m;
+  return true;
+}
+
+bld::fs::Copy_result bld::fs::copy_tree(const std::string &from, const std::string &to, const Copy_options &opts)
+{
+  Copy_result result;
+  std::error_code ec;
+  std::vector<std::pair<std::filesystem::path, std::filesystem::path>> files;
+
+  // Directories and links on this thread, in walk order; file contents afterwards in parallel
+  std::filesystem::create_directories(to, ec);
+  auto it = std::filesystem::recursive_directory_iterator(from, ec);
+  if (ec)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to copy tree " + from + ": " + ec.message());
+    result.failed.push_back(from);
+    return result;
+  }
+  for (; it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+  {
+    const std::filesystem::path dst = std::filesystem::path(to) / it->path().lexically_relative(from);
+    if (it->is_symlink(ec))
+    {
+      std::filesystem::remove(dst, ec);
+      std::filesystem::copy_symlink(it->path(), dst, ec);
+      if (ec)
+        result.failed.push_back(it->path().string());
+      else
+        ++result.copied;
+    }
+    else if (it->is_directory(ec))
+      std::filesystem::create_directories(dst, ec);
+    else if (it->is_regular_file(ec))
+      files.emplace_back(it->path(), dst);
+  }
+
+  size_t threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, files.size());
+  std::atomic<size_t> next{0};
+  std::mutex mutex;
+  auto worker = [&]
+  {
+    Copy_result local;
+    for (size_t i; (i = next++) < files.size();)
+    {
+      Copy_method m;
+      const auto &[src, dst] = files[i];
+      if (!copy_file_fast(src.string(), dst.string(), opts, &m))
+        local.failed.push_back(src.string());
+      else if (m == Copy_method::SKIPPED)
+        ++local.skipped;
+      else
+      {
+        ++local.copied;
+        std::error_code size_ec;
+        local.bytes += std::filesystem::file_size(dst, size_ec);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    result.copied += local.copied;
+    result.skipped += local.skipped;
+    result.bytes += local.bytes;
+    result.failed.insert(result.failed.end(), local.failed.begin(), local.failed.end());
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; ++i) pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool) t.join();
+
+  bld::internal_log(bld::Log_type::INFO, "Copied " + std::to_string(result.copied) + " files (" + std::to_string(result.bytes) + " bytes), " +
+                                             std::to_string(result.skipped) + " unchanged: " + from + " -> " + to);
+  return result;
+}
+
+bool bld::fs::move_file(const std::string &from, const std::string &to)
+{
+  try
+  {
+    std::filesystem::rename(from, to);
+    return true;
+  }
+  catch (const std::filesystem::filesystem_error &e)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to move file: " + std::string(e.what()));
+    return false;
+  }
+}
+
+std::string bld::fs::get_extension(const std::string &path)
+{
+  if (!std::filesystem::exists(path))
+  {
+    bld::internal_log(bld::Log_type::ERR, "File for extension request does not exist: " + path);
+    return "";
+  }
+  std::filesystem::path p(path);
+  return p.extension().string();
+}
+
+std::string bld::fs::get_stem(const std::string &path, bool with_full_path)
+{
+  std::string filename = path;
+  if (!with_full_path)
+    filename = bld::fs::get_file_name(path);
+  auto pos = filename.find_last_of('.');
+  return pos == std::string::npos ? filename : filename.substr(0, pos);
+}
+
+bool bld::fs::create_directory(const std::string &path)
+{
+  try
+  {
+    return std::filesystem::create_directories(path);
+  }
+  catch (const std::filesystem::filesystem_error &e)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to create directory: " + std::string(e.what()));
+    return false;
+  }
+}
+
+bool bld::fs::create_dir_if_not_exists(const std::string &path)
+{
+  if (std::filesystem::exists(path))
+  {
+    bld::internal_log(bld::Log_type::WARNING, "Directory ' " + path + " ' already exists, manage it yourself to not lose data!");
+    return true;
+  }
+
+  try
+  {
+    bool created = std::filesystem::create_directories(path);
+    if (created)
+      bld::internal_log(bld::Log_type::INFO, "Directory created: " + path);
+    else
+      bld::internal_log(bld::Log_type::ERR, "Failed to create directory: " + path);
+    return created;
+  }
+  catch (const std::filesystem::filesystem_error &e)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to create directory: " + std::string(e.what()));
+    return false;
+  }
+}
+
+template <typename... Paths, typename>
+bool bld::fs::create_dirs_if_not_exists(const Paths &...paths)
+{
+  return (... && create_dir_if_not_exists(paths));
+}
+
+template <typename... Paths, typename>
+void bld::fs::remove(const Paths &...paths)
+{
+  (... & std::filesystem::remove(paths));
+}
+
+
+bool bld::fs::remove_dir(const std::string &path)
+{
+  if (!std::filesystem::exists(path))
+  {
+    bld::internal_log(bld::Log_type::INFO, "Directory does not exist: " + path);
+    return true;
+  }
+
+  Batch_result removed = remove_tree(path);
+  if (removed)
+    bld::internal_log(bld::Log_type::INFO, "Directory removed: " + path);
+  else
+  {
+    const auto &[first, ec] = removed.failed.front();
+    std::string more = removed.failed.size() > 1 ? " (and " + std::to_string(removed.failed.size() - 1) + " more)" : "";
+    bld::internal_log(bld::Log_type::ERR, "Failed to remove directory: " + path + ": " + first + ": " + ec.message() + more);
+  }
+  return bool(removed);
+}
+
+std::vector<std::string> bld::fs::list_files_in_dir(const std::string &path, bool recursive)
+{
+  std::vector<std::string> files;
+  auto entries = bld::fs::files(path, recursive);
+  if (!entries.ok())
+    bld::internal_log(bld::Log_type::ERR, "Failed to list files: " + path + ": " + std::strerror(errno));
+  for (const auto &entry : entries)
+    files.push_back(entry.path);
+  return files;
+}
+
+std::vector<std::string> bld::fs::list_directories(const std::string &path, bool recursive)
+{
+  std::vector<std::string> directories;
+  auto entries = bld::fs::directories(path, recursive);
+  if (!entries.ok())
+    bld::internal_log(bld::Log_type::ERR, "Failed to list directories: " + path + ": " + std::strerror(errno));
+  for (const auto &entry : entries)
+    directories.push_back(entry.path);
+  return directories;
+}
+
+std::string bld::fs::get_file_name(std::string full_path)
+{
+  auto path = std::filesystem::path(full_path);
+  return path.filename().string();
+}
+
+std::string bld::fs::strip_file_name(std::string full_path)
+{
+  auto path = std::filesystem::path(full_path);
+  return path.parent_path().string();
+}
+
+std::vector<std::string> bld::fs::get_all_files_with_name(const std::string &dir, const std::string &name, bool recursive)
+{
+  std::vector<std::string> results;
+  auto entries = files_with_name(dir, name, recursive);
+  if (!entries.ok())
+  {
+    bld::internal_log(bld::Log_type::WARNING, "Directory: " + dir + " doesnt exist.");
+    return results;
+  }
+  for (const auto &entry : entries)
+    results.push_back(entry.path);
+  return results;
+}
+
+namespace
+{
+  // Handles both "cpp" and ".cpp", lower cased when matching is case insensitive
+  inline std::vector<std::string> _bld_normalize_extensions(const std::vector<std::string> &extensions, bool case_insensitive)
+  {
+    std::vector<std::string> normalized_extensions;
+    for (const auto &ext : extensions)
+    {
+      if (ext.empty())
+        continue;
+
+      std::string normalized = ext;
+      if (normalized[0] != '.')
+        normalized = "." + normalized;
+      if (case_insensitive)
+        std::transform(normalized.begin(), normalized.end(), normalized.begin(), [](unsigned char c) { return std::tolower(c); });
+
+      normalized_extensions.push_back(normalized);
+    }
+    return normalized_extensions;
+  }
+}  // anonymous namespace
+
+// Alternative version with more robust error handling and logging
+std::vector<std::string> bld::fs::get_all_files_with_extensions(const std::string &path,const std::vector<std::string> &extensions, bool recursive, bool case_insensitive)
+{
+  std::vector<std::string> matching_files;
+
+  // Validate input
+  if (path.empty())
+  {
+    bld::internal_log(Log_type::ERR, "Empty path provided: " + path);
+    return matching_files;
+  }
+
+  if (extensions.empty())
+  {
+    bld::internal_log(Log_type::WARNING, "No extensions provided for path: " + path);
+    return matching_files;
+  }
+
+  // Check if path exists and is a directory
+  std::filesystem::path fs_path(path);
+  std::error_code ec;
+
+  if (!std::filesystem::exists(fs_path, ec))
+  {
+    bld::internal_log(Log_type::ERR, "Path does not exist: " + path);
+    return matching_files;
+  }
+
+  if (ec)
+  {
+    bld::internal_log(Log_type::ERR, "Error checking path existence: " + ec.message());
+    return matching_files;
+  }
+
+  if (!std::filesystem::is_directory(fs_path, ec))
+  {
+    bld::internal_log(Log_type::ERR, "Path is not a directory: " + path);
+    return matching_files;
+  }
+
+  if (ec)
+  {
+    bld::internal_log(Log_type::ERR, "Error checking if path is directory: " + ec.message());
+    return matching_files;
+  }
+
+  if (_bld_normalize_extensions(extensions, case_insensitive).empty())
+  {
+    bld::internal_log(Log_type::WARNING, "No valid extensions after normalization");
+    return matching_files;
+  }
+
+  for (const auto &entry : files_with_extensions(path, extensions, recursive, case_insensitive))
+    matching_files.push_back(entry.path);
+
+  return matching_files;
+}
+
+
+namespace
+{
+  // Length of the bracket expression at p[0] == '[', 0 when it isn't closed
+  inline size_t _bld_class_len(std::string_view p)
+  {
+    size_t i = 1;
+    if (i < p.size() && (p[i] == '!' || p[i] == '^'))
+      ++i;
+    if (i < p.size() && p[i] == ']')
+      ++i;
+    while (i < p.size() && p[i] != ']') ++i;
+    return i < p.size() ? i + 1 : 0;
+  }
+
+  inline bool _bld_class_match(std::string_view cls, char c)
+  {
+    size_t i = 1, end = cls.size() - 1;
+    bool negate = cls[i] == '!' || cls[i] == '^';
+    if (negate)
+      ++i;
+    bool hit = false;
+    for (; i < end; ++i)
+    {
+      if (i + 2 < end && cls[i + 1] == '-')
+      {
+        hit |= c >= cls[i] && c <= cls[i + 2];
+        i += 2;
+      }
+      else
+        hit |= c == cls[i];
+    }
+    return hit != negate;
+  }
+
+  // `*`, `?`, `[...]` and `\` escapes within one path segment
+  inline bool _bld_wild_match(std::string_view p, std::string_view s)
+  {
+    size_t pi = 0, si = 0, star = std::string_view::npos, mark = 0;
+    while (si < s.size())
+    {
+      if (pi < p.size() && p[pi] == '*')
+      {
+        star = pi++;
+        mark = si;
+        continue;
+      }
+
+      size_t len = 1;
+      bool ok = false;
+      if (pi < p.size())
+      {
+        if (p[pi] == '?')
+          ok = true;
+        else if (p[pi] == '[' && (len = _bld_class_len(p.substr(pi))))
+          ok = _bld_class_match(p.substr(pi, len), s[si]);
+        else if (p[pi] == '\\' && pi + 1 < p.size())
+        {
+          len = 2;
+          ok = p[pi + 1] == s[si];
+        }
+        else
+        {
+          len = 1;
+          ok = p[pi] == s[si];
+        }
+      }
+
+      if (ok)
+      {
+        pi += len;
+        ++si;
+      }
+      else if (star != std::string_view::npos)
+      {
+        pi = star + 1;
+        si = ++mark;
+      }
+      else
+        return false;
+    }
+    while (pi < p.size() && p[pi] == '*') ++pi;
+    return pi == p.size();
+  }
+
+  struct _bld_ignore_rule
+  {
+    std::vector<std::string> segs;
+    bool negate = false;
+    bool dir_only = false;
+    bool anchored = false;  // matched against the path below the ignore file's directory, not only the name
+  };
+
+  // Rules from the ignore files of one directory, linked to those of the directories above it
+  struct _bld_ignore_frame
+  {
+    std::shared_ptr<const _bld_ignore_frame> parent;
+    std::size_t base;  // length of the directory's "dir/" prefix in walk paths
+    std::vector<_bld_ignore_rule> rules;
+  };
+
+  // gitignore(5) syntax
+  inline void _bld_parse_ignore(std::string_view text, std::vector<_bld_ignore_rule> &rules)
+  {
+    for (std::string_view line : bld::fs::lines(text))
+    {
+      if (line.ends_with('\r'))
+        line.remove_suffix(1);
+      while (line.ends_with(' ') && !line.ends_with("\\ ")) line.remove_suffix(1);
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      _bld_ignore_rule rule;
+      if (line[0] == '!')
+      {
+        rule.negate = true;
+        line.remove_prefix(1);
+      }
+      else if (line.starts_with("\\#") || line.starts_with("\\!"))
+        line.remove_prefix(1);
+      if (line.ends_with('/'))
+      {
+        rule.dir_only = true;
+        line.remove_suffix(1);
+      }
+      rule.anchored = line.find('/') != std::string_view::npos;
+
+      while (!line.empty())
+      {
+        size_t slash = line.find('/');
+        std::string_view part = line.substr(0, slash);
+        line = slash == std::string_view::npos ? std::string_view() : line.substr(slash + 1);
+        if (!part.empty())
+          rule.segs.emplace_back(part);
+      }
+      if (!rule.segs.empty())
+        rules.push_back(std::move(rule));
+    }
+  }
+
+  // `rel` is '/' separated, `**` matches any number of segments
+  inline bool _bld_ignore_segs(const std::vector<std::string> &segs, size_t i, std::string_view rel)
+  {
+    if (i == segs.size())
+      return rel.empty();
+    if (segs[i] == "**")
+    {
+      if (i + 1 == segs.size())
+        return !rel.empty();
+      for (;;)
+      {
+        if (_bld_ignore_segs(segs, i + 1, rel))
+          return true;
+        size_t slash = rel.find('/');
+        if (slash == std::string_view::npos)
+          return false;
+        rel.remove_prefix(slash + 1);
+      }
+    }
+    if (rel.empty())
+      return false;
+    size_t slash = rel.find('/');
+    if (!_bld_wild_match(segs[i], rel.substr(0, slash)))
+      return false;
+    return _bld_ignore_segs(segs, i + 1, slash == std::string_view::npos ? std::string_view() : rel.substr(slash + 1));
+  }
+
+  // The last matching rule of the deepest ignore file decides. `.git` is always ignored.
+  inline bool _bld_ignored(const _bld_ignore_frame *f, std::string_view path, std::size_t name_off, bool is_dir)
+  {
+    std::string_view name = path.substr(name_off);
+    if (name == ".git")
+      return true;
+    for (; f; f = f->parent.get())
+    {
+      std::string_view rel = path.substr(f->base);
+      for (auto r = f->rules.rbegin(); r != f->rules.rend(); ++r)
+      {
+        if (r->dir_only && !is_dir)
+          continue;
+        if (r->anchored ? _bld_ignore_segs(r->segs, 0, rel) : _bld_wild_match(r->segs[0], name))
+          return !r->negate;
+      }
+    }
+    return false;
+  }
+
+  // Frame for the directory whose walk prefix is `base` long if `read(file, text)` finds any of its ignore files
+  template <typename Read>
+  std::shared_ptr<const _bld_ignore_frame> _bld_ignore_load(std::shared_ptr<const _bld_ignore_frame> parent, std::size_t base,
+                                                            const std::vector<std::string> &files, Read &&read)
+  {
+    std::shared_ptr<_bld_ignore_frame> frame;
+    std::string text;
+    for (const auto &file : files)
+    {
+      text.clear();
+      if (!read(file, text))
+        continue;
+      if (!frame)
+        frame = std::make_shared<_bld_ignore_frame>(_bld_ignore_frame{parent, base, {}});
+      _bld_parse_ignore(text, frame->rules);
+    }
+    if (!frame || frame->rules.empty())
+      return parent;
+    return frame;
+  }
+
+  struct _bld_walk_ctx
+  {
+    const bld::fs::Walk_func &cb;
+    std::size_t max_depth;
+    void *arg;
+    const std::atomic<bool> *stop = nullptr;                  // set by the parallel walker
+    const std::vector<std::string> *ignore_files = nullptr;  // set when ignore files prune the walk
+  };
+}  // anonymous namespace
+
+#ifdef __linux__
+namespace
+{
+  // Layout of the records returned by getdents64(2)
+  struct _bld_dirent64
+  {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+
+  // Name offset in the NUL separated names, d_type
+  using _bld_dent = std::pair<uint32_t, unsigned char>;
+
+  // Reads all the names of one directory, so the fd can be shared or closed before the entries are used
+  inline bool _bld_read_dents(int fd, std::string &names, std::vector<_bld_dent> &ents)
+  {
+    alignas(_bld_dirent64) thread_local char buf[1 << 16];
+    for (;;)
+    {
+      long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return n == 0;
+      for (long off = 0; off < n;)
+      {
+        const auto *d = reinterpret_cast<const _bld_dirent64 *>(buf + off);
+        off += d->d_reclen;
+        if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+          continue;
+        ents.emplace_back(static_cast<uint32_t>(names.size()), d->d_type);
+        names.append(d->d_name);
+        names.push_back('\0');
+      }
+    }
+  }
+
+  // Same answers as classify(), but a stat is only needed for symlinks and file systems without d_type.
+  // `descend` is set for real directories only, symlinked directories are reported but not followed.
+  inline bld::fs::Path_type _bld_dent_type(int dirfd, const char *name, unsigned char d_type, bool &descend)
+  {
+    descend = false;
+    struct stat st;
+    if (d_type == DT_UNKNOWN)
+    {
+      if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return bld::fs::Path_type::Other;
+      d_type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+    }
+    switch (d_type)
+    {
+      case DT_DIR:
+        descend = true;
+        return bld::fs::Path_type::Directory;
+      case DT_REG:
+        return bld::fs::Path_type::File;
+      case DT_LNK:
+        if (fstatat(dirfd, name, &st, 0) != 0)
+          return bld::fs::Path_type::Symlink;
+        if (S_ISDIR(st.st_mode)) return bld::fs::Path_type::Directory;
+        if (S_ISREG(st.st_mode)) return bld::fs::Path_type::File;
+        return bld::fs::Path_type::Symlink;
+      default:
+        return bld::fs::Path_type::Other;
+    }
+  }
+
+  inline bool _bld_read_at(int dirfd, const char *name, std::string &out)
+  {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    char buf[1 << 14];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+      if (n > 0)
+        out.append(buf, n);
+    ::close(fd);
+    return n == 0;
+  }
+
+  /* Report the entries of the open directory `fd` and hand its subdirectories to `descend(path, name_off, level, ignore)`.
+   * `ignore` holds the rules of the ignore files above `dir`, when ignore files are enabled.
+   * Returns 1 to keep walking, 0 on Walk_act::Stop and -1 when the callback failed.
+   */
+  template <typename Descend>
+  int _bld_walk_entries(int fd, const std::string &dir, std::size_t level, std::shared_ptr<const _bld_ignore_frame> ignore,
+                        const _bld_walk_ctx &ctx, Descend &&descend)
+  {
+    std::string names;
+    std::vector<_bld_dent> ents;
+    if (!_bld_read_dents(fd, names, ents))
+      bld::internal_log(bld::Log_type::WARNING, "Error during directory iteration: " + dir + ": " + std::strerror(errno));
+
+    std::string prefix = dir;
+    if (!prefix.empty() && prefix.back() != '/')
+      prefix += '/';
+
+    if (ctx.ignore_files)
+      ignore = _bld_ignore_load(std::move(ignore), prefix.size(), *ctx.ignore_files, [&](const std::string &file, std::string &text) {
+        for (const auto &ent : ents)
+          if (file == names.c_str() + ent.first)
+            return _bld_read_at(fd, file.c_str(), text);
+        return false;
+      });
+
+    for (const auto &[off, d_type] : ents)
+    {
+      if (ctx.stop && ctx.stop->load(std::memory_order_relaxed))
+        return 0;
+
+      const char *name = names.c_str() + off;
+      bool dir_entry = false;
+      bld::fs::Path_type type = _bld_dent_type(fd, name, d_type, dir_entry);
+      std::string path = prefix + name;
+      if (ctx.ignore_files && _bld_ignored(ignore.get(), path, prefix.size(), dir_entry))
+        continue;
+
+      bld::fs::Walk_fn_opt opt{
+        .path = path,
+        .type = type,
+        .level = level,
+        .action = bld::fs::Walk_act::Continue,
+        .args = ctx.arg
+      };
+
+      if (!ctx.cb(opt))
+        return -1;
+      if (opt.action == bld::fs::Walk_act::Stop)
+        return 0;
+      if (dir_entry && opt.action != bld::fs::Walk_act::Ignore && level < ctx.max_depth)
+      {
+        int r = descend(std::move(path), prefix.size(), level + 1, ignore);
+        if (r <= 0)
+          return r;
+      }
+    }
+    return 1;
+  }
+
+  inline int _bld_open_dir(int parent, const char *name)
+  {
+    return openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (parent == AT_FDCWD ? 0 : O_NOFOLLOW));
+  }
+
+  // Depth first, in the same pre-order as recursive_directory_iterator. One fd is open per level.
+  inline int _bld_walk_seq(int fd, const std::string &dir, std::size_t level, std::shared_ptr<const _bld_ignore_frame> ignore,
+                           const _bld_walk_ctx &ctx)
+  {
+    return _bld_walk_entries(fd, dir, level, std::move(ignore), ctx,
+                             [&](std::string path, std::size_t name_off, std::size_t child_level, std::shared_ptr<const _bld_ignore_frame> rules) -> int {
+      int child = _bld_open_dir(fd, path.c_str() + name_off);
+      if (child < 0)
+      {
+        bld::internal_log(bld::Log_type::WARNING, "Could not open directory " + path + ": " + std::strerror(errno));
+        return 1;
+      }
+      int r = _bld_walk_seq(child, path, child_level, std::move(rules), ctx);
+      ::close(child);
+      return r;
+    });
+  }
+
+  // Directory fd shared by the pending jobs of its subdirectories, closed once they have all been opened
+  struct _bld_dir_fd
+  {
+    int fd;
+    explicit _bld_dir_fd(int f) : fd(f) {}
+    ~_bld_dir_fd() { ::close(fd); }
+  };
+
+  struct _bld_walk_job
+  {
+    std::shared_ptr<_bld_dir_fd> parent;  // null for the root
+    std::string path;
+    std::size_t name_off;
+    std::size_t level;
+    std::shared_ptr<const _bld_ignore_frame> ignore;
+  };
+
+  /* Work stealing walker: every thread owns a deque, pushes the directories it finds to the back and pops from
+   * the back (depth first, few open fds), idle threads steal from the front of the others (the biggest subtrees).
+   */
+  class _bld_par_walker
+  {
+    struct Queue
+    {
+      std::mutex m;
+      std::deque<_bld_walk_job> jobs;
+    };
+
+    std::vector<Queue> queues;
+    std::atomic<std::size_t> pending{0};  // pushed and not finished
+    std::atomic<std::size_t> queued{0};   // pushed and not taken
+    std::mutex idle_m;
+    std::condition_variable idle_cv;
+    const _bld_walk_ctx &ctx;
+
+  public:
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+
+    _bld_par_walker(std::size_t threads, const _bld_walk_ctx &c) : queues(threads), ctx(c) {}
+
+    void push(std::size_t self, _bld_walk_job job)
+    {
+      pending.fetch_add(1);
+      {
+        std::lock_guard<std::mutex> lock(queues[self].m);
+        queues[self].jobs.push_back(std::move(job));
+      }
+      queued.fetch_add(1);
+      {
+        std::lock_guard<std::mutex> lock(idle_m);
+      }
+      idle_cv.notify_one();
+    }
+
+    void finish(int r)
+    {
+      if (r < 0)
+        failed = true;
+      if (r <= 0)
+        stop = true;
+      std::lock_guard<std::mutex> lock(idle_m);
+      idle_cv.notify_all();
+    }
+
+    bool pop(std::size_t self, _bld_walk_job &job)
+    {
+      for (std::size_t i = 0; i < queues.size(); ++i)
+      {
+        Queue &q = queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (q.jobs.empty())
+          continue;
+        if (i == 0)
+        {
+          job = std::move(q.jobs.back());
+          q.jobs.pop_back();
+        }
+        else
+        {
+          job = std::move(q.jobs.front());
+          q.jobs.pop_front();
+        }
+        queued.fetch_sub(1);
+        return true;
+      }
+      return false;
+    }
+
+    void run(std::size_t self)
+    {
+      _bld_walk_job job;
+      while (!stop)
+      {
+        if (!pop(self, job))
+        {
+          std::unique_lock<std::mutex> lock(idle_m);
+          idle_cv.wait(lock, [&] { return stop || pending == 0 || queued > 0; });
+          if (pending == 0)
+            return;
+          continue;
+        }
+
+        int fd = _bld_open_dir(job.parent ? job.parent->fd : AT_FDCWD, job.path.c_str() + job.name_off);
+        job.parent.reset();
+        if (fd < 0)
+        {
+          if (job.level == 0)
+            failed = true;
+          else
+            bld::internal_log(bld::Log_type::WARNING, "Could not open directory " + job.path + ": " + std::strerror(errno));
+        }
+        else
+        {
+          auto dir = std::make_shared<_bld_dir_fd>(fd);
+          int r = _bld_walk_entries(fd, job.path, job.level, std::move(job.ignore), ctx,
+                                    [&](std::string path, std::size_t name_off, std::size_t level, std::shared_ptr<const _bld_ignore_frame> rules) -> int {
+                                      push(self, {dir, std::move(path), name_off, level, std::move(rules)});
+                                      return 1;
+                                    });
+          if (r <= 0)
+            finish(r);
+        }
+
+        if (pending.fetch_sub(1) == 1)
+          finish(1);
+      }
+    }
+  };
+}  // anonymous namespace
+
+inline bool walk_directory_impl(const std::string &root, bld::fs::Walk_func cb, std::size_t max_depth, void *arg,
+                                const std::vector<std::string> *ignore_files = nullptr)
+{
+  int fd = _bld_open_dir(AT_FDCWD, root.c_str());
+  if (fd < 0)
+    return false;
+  _bld_walk_ctx ctx{cb, max_depth, arg, nullptr, ignore_files};
+  int r = _bld_walk_seq(fd, root, 0, nullptr, ctx);
+  ::close(fd);
+  return r >= 0;
+}
+
+bool bld::fs::walk_directory(const std::string &path, Walk_func cb, const Walk_options &opts)
+{
+  return walk_directory_impl(path, cb, opts.depth, opts.args, opts.ignore_files.empty() ? nullptr : &opts.ignore_files);
+}
+
+bool bld::fs::walk_directory_parallel(const std::string &path, Walk_func cb, const Walk_options &opts)
+{
+  std::size_t threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+  _bld_walk_ctx ctx{cb, opts.depth, opts.args, nullptr, opts.ignore_files.empty() ? nullptr : &opts.ignore_files};
+  _bld_par_walker walker(threads, ctx);
+  ctx.stop = &walker.stop;
+
+  // The root job opens `path` itself (name_off 0, relative to the cwd), level 0 is the level of its entries
+  walker.push(0, {nullptr, path, 0, 0, nullptr});
+  std::vector<std::thread> pool;
+  for (std::size_t i = 1; i < threads; ++i)
+    pool.emplace_back([&walker, i] { walker.run(i); });
+  walker.run(0);
+  for (auto &t : pool)
+    t.join();
+  return !walker.failed;
+}
+
+#else
+
+inline bld::fs::Path_type classify(const std::filesystem::directory_entry& e)
+{
+    if (e.is_directory()) return bld::fs::Path_type::Directory;
+    if (e.is_regular_file()) return bld::fs::Path_type::File;
+    if (e.is_symlink()) return bld::fs::Path_type::Symlink;
+    return bld::fs::Path_type::Other;
+}
+
+
+inline bool walk_directory_impl(const std::string &root, bld::fs::Walk_func cb, std::size_t max_depth, void *arg)
+{
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  fs::recursive_directory_iterator it(root, ec), end;
+
+  if (ec)
+    return false;
+
+  while (it != end)
+  {
+    const std::size_t level = it.depth();
+
+    if (level > max_depth)
+    {
+      it.disable_recursion_pending();
+      ++it;
+      continue;
+    }
+
+    bld::fs::Walk_fn_opt opt{
+      .path = it->path(),
+      .type = classify(*it),
+      .level = level,
+      .action = bld::fs::Walk_act::Continue,
+      .args = arg
+    };
+
+    // Callback failure propagates
+    if (!cb(opt))
+      return false;
+
+    // Normal early stop (SUCCESS)
+    if (opt.action == bld::fs::Walk_act::Stop)
+      return true;
+
+    // Skip recursion if requested
+    if (opt.action == bld::fs::Walk_act::Ignore && it->is_directory())
+      it.disable_recursion_pending();
+
+    ++it;
+  }
+
+  return true;  // normal completion
+}
+
+namespace
+{
+  // Walk with ignore files, one directory_iterator per level
+  inline int _bld_walk_fs(const std::string &dir, std::size_t level, std::shared_ptr<const _bld_ignore_frame> ignore, const _bld_walk_ctx &ctx)
+  {
+    std::error_code ec;
+    std::string prefix = dir;
+    if (!prefix.empty() && prefix.back() != '/')
+      prefix += '/';
+
+    if (ctx.ignore_files)
+      ignore = _bld_ignore_load(std::move(ignore), prefix.size(), *ctx.ignore_files, [&](const std::string &file, std::string &text) {
+        return std::filesystem::is_regular_file(prefix + file, ec) && bld::fs::read_file(prefix + file, text);
+      });
+
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec))
+    {
+      std::string path = prefix + entry.path().filename().string();
+      bool dir_entry = entry.is_directory() && !entry.is_symlink();
+      if (ctx.ignore_files && _bld_ignored(ignore.get(), path, prefix.size(), dir_entry))
+        continue;
+
+      bld::fs::Walk_fn_opt opt{.path = path, .type = classify(entry), .level = level, .action = bld::fs::Walk_act::Continue, .args = ctx.arg};
+      if (!ctx.cb(opt))
+        return -1;
+      if (opt.action == bld::fs::Walk_act::Stop)
+        return 0;
+      if (dir_entry && opt.action != bld::fs::Walk_act::Ignore && level < ctx.max_depth)
+      {
+        int r = _bld_walk_fs(path, level + 1, ignore, ctx);
+        if (r <= 0)
+          return r;
+      }
+    }
+    return 1;
+  }
+}  // anonymous namespace
+
+bool bld::fs::walk_directory(const std::string &path, Walk_func cb, const Walk_options &opts)
+{
+  if (!std::filesystem::is_directory(path))
+    return false;
+  _bld_walk_ctx ctx{cb, opts.depth, opts.args, nullptr, opts.ignore_files.empty() ? nullptr : &opts.ignore_files};
+  return _bld_walk_fs(path, 0, nullptr, ctx) >= 0;
+}
+
+bool bld::fs::walk_directory_parallel(const std::string &path, Walk_func cb, const Walk_options &opts)
+{
+  // No getdents here, walk on the calling thread
+  return walk_directory(path, cb, opts);
+}
+#endif
+
+#ifdef __linux__
+struct bld::fs::Entries::State
+{
+  struct Frame
+  {
+    int fd;
+    std::string prefix;
+    std::string names;
+    std::vector<std::pair<uint32_t, unsigned char>> ents;
+    std::size_t next = 0;
+    std::size_t level;
+  };
+
+  std::vector<Frame> stack;
+  bool recursive;
+  Filter filter;
+  bool root_ok = false;
+  bool descend = false;  // the last entry returned is a directory to enter
+  uint32_t descend_name = 0;
+
+  void push(int fd, const std::string &dir, std::size_t level)
+  {
+    Frame f{fd, dir, {}, {}, 0, level};
+    if (!f.prefix.empty() && f.prefix.back() != '/')
+      f.prefix += '/';
+    if (!_bld_read_dents(fd, f.names, f.ents))
+      bld::internal_log(bld::Log_type::WARNING, "Error during directory iteration: " + dir + ": " + std::strerror(errno));
+    stack.push_back(std::move(f));
+  }
+
+  ~State()
+  {
+    for (auto &f : stack)
+      ::close(f.fd);
+  }
+};
+
+bld::fs::Entries::Entries(const std::string &path, bool recursive, Filter filter) : state(std::make_unique<State>())
+{
+  state->recursive = recursive;
+  state->filter = std::move(filter);
+  int fd = _bld_open_dir(AT_FDCWD, path.c_str());
+  state->root_ok = fd >= 0;
+  if (fd >= 0)
+    state->push(fd, path, 0);
+}
+
+bool bld::fs::Entries::next()
+{
+  State &s = *state;
+  for (;;)
+  {
+    if (s.descend)
+    {
+      s.descend = false;
+      State::Frame &parent = s.stack.back();
+      int fd = _bld_open_dir(parent.fd, parent.names.c_str() + s.descend_name);
+      if (fd >= 0)
+        s.push(fd, current.path, parent.level + 1);
+      else
+        bld::internal_log(bld::Log_type::WARNING, "Could not open directory " + current.path + ": " + std::strerror(errno));
+    }
+
+    if (s.stack.empty())
+      return false;
+
+    State::Frame &f = s.stack.back();
+    if (f.next == f.ents.size())
+    {
+      ::close(f.fd);
+      s.stack.pop_back();
+      continue;
+    }
+
+    auto [off, d_type] = f.ents[f.next++];
+    const char *name = f.names.c_str() + off;
+    bool dir = false;
+    current.type = _bld_dent_type(f.fd, name, d_type, dir);
+    current.path.assign(f.prefix).append(name);
+    current.level = f.level;
+    s.descend = s.recursive && dir;
+    s.descend_name = off;
+
+    if (!s.filter || s.filter(current))
+      return true;
+  }
+}
+
+void bld::fs::Entries::skip_children() { state->descend = false; }
+
+bool bld::fs::Entries::ok() const { return state->root_ok; }
+
+#else
+struct bld::fs::Entries::State
+{
+  std::filesystem::recursive_directory_iterator it;
+  bool recursive;
+  Filter filter;
+  bool root_ok = false;
+};
+
+bld::fs::Entries::Entries(const std::string &path, bool recursive, Filter filter) : state(std::make_unique<State>())
+{
+  std::error_code ec;
+  state->recursive = recursive;
+  state->filter = std::move(filter);
+  state->it = std::filesystem::recursive_directory_iterator(path, std::filesystem::directory_options::skip_permission_denied, ec);
+  state->root_ok = !ec;
+}
+
+bool bld::fs::Entries::next()
+{
+  State &s = *state;
+  std::error_code ec;
+  if (started)
+    s.it.increment(ec);  // past the entry returned last time
+  for (; s.it != std::filesystem::recursive_directory_iterator(); s.it.increment(ec))
+  {
+    if (!s.recursive)
+      s.it.disable_recursion_pending();
+    current = {s.it->path().string(), classify(*s.it), static_cast<std::size_t>(s.it.depth())};
+    if (!s.filter || s.filter(current))
+      return true;
+  }
+  return false;
+}
+
+void bld::fs::Entries::skip_children() { state->it.disable_recursion_pending(); }
+
+bool bld::fs::Entries::ok() const { return state->root_ok; }
+#endif
+
+bld::fs::Entries::Entries(Entries &&) noexcept = default;
+bld::fs::Entries &bld::fs::Entries::operator=(Entries &&) noexcept = default;
+bld::fs::Entries::~Entries() = default;
+
+bld::fs::Entries::iterator bld::fs::Entries::begin()
+{
+  if (!started)
+  {
+    done = !next();
+    started = true;
+  }
+  return done ? iterator() : iterator(this);
+}
+
+bld::fs::Entries bld::fs::files(const std::string &path, bool recursive)
+{
+  return Entries(path, recursive, [](const Entry &e) { return e.type == Path_type::File; });
+}
+
+bld::fs::Entries bld::fs::directories(const std::string &path, bool recursive)
+{
+  return Entries(path, recursive, [](const Entry &e) { return e.type == Path_type::Directory; });
+}
+
+bld::fs::Entries bld::fs::files_with_name(const std::string &dir, const std::string &name, bool recursive)
+{
+  return Entries(dir, recursive, [name](const Entry &e) {
+    return e.type == Path_type::File && e.path.size() > name.size() && e.path.ends_with(name) &&
+           e.path[e.path.size() - name.size() - 1] == '/';
+  });
+}
+
+bld::fs::Entries bld::fs::files_with_extensions(const std::string &path, const std::vector<std::string> &extensions, bool recursive,
+                                                bool case_insensitive)
+{
+  return Entries(path, recursive, [exts = _bld_normalize_extensions(extensions, case_insensitive), case_insensitive](const Entry &e) {
+    if (e.type != Path_type::File)
+      return false;
+    // Same rule as path::extension(): from the last dot of the file name, but not for dot files
+    size_t slash = e.path.rfind('/');
+    size_t dot = e.path.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot <= slash + 1) || (slash == std::string::npos && dot == 0))
+      return false;
+    std::string ext = e.path.substr(dot);
+    if (case_insensitive)
+      std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return std::find(exts.begin(), exts.end(), ext) != exts.end();
+  });
+}
+
+namespace
+{
+#ifndef _WIN32
+  inline int64_t _bld_mtime_ns(const struct stat &st)
+  {
+  #ifdef __APPLE__
+    return st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+  #else
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  #endif
+  }
+
+  // Now, on the clock file times come from. An mtime equal to it may still move without changing.
+  inline int64_t _bld_file_clock_ns()
+  {
+    struct timespec now;
+  #ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+  #else
+    clock_gettime(CLOCK_REALTIME, &now);
+  #endif
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+  }
+#endif
+
+  // "a{b,c{d,e}}f" -> abf, acdf, acef
+  inline std::vector<std::string> _bld_expand_braces(const std::string &pattern)
+  {
+    size_t open = pattern.find('{');
+    if (open == std::string::npos)
+      return {pattern};
+
+    std::vector<size_t> commas;
+    size_t close = std::string::npos;
+    int depth = 0;
+    for (size_t i = open; i < pattern.size() && close == std::string::npos; ++i)
+    {
+      if (pattern[i] == '{')
+        ++depth;
+      else if (pattern[i] == '}' && --depth == 0)
+        close = i;
+      else if (pattern[i] == ',' && depth == 1)
+        commas.push_back(i);
+    }
+    if (close == std::string::npos)
+      return {pattern};  // unbalanced, taken literally
+
+    std::vector<std::string> out;
+    std::string suffix = pattern.substr(close + 1);
+    size_t start = open + 1;
+    commas.push_back(close);
+    for (size_t comma : commas)
+    {
+      for (auto &tail : _bld_expand_braces(pattern.substr(start, comma - start) + suffix))
+        out.push_back(pattern.substr(0, open) + tail);
+      start = comma + 1;
+    }
+    return out;
+  }
+
+  struct _bld_glob_entry
+  {
+    std::string name;
+    bld::fs::Path_type type;
+    bool descend;  // a real directory, not a symlink to one
+  };
+
+  struct _bld_glob_dir
+  {
+    int64_t mtime = -1;
+    uint64_t dev = 0, ino = 0;
+    std::vector<_bld_glob_entry> ents;
+  };
+
+  // Listing of `dir` ("" is the working directory), reused while the directory's mtime doesn't change
+  inline std::shared_ptr<const _bld_glob_dir> _bld_glob_list(const std::string &dir)
+  {
+    static std::mutex m;
+    static std::unordered_map<std::string, std::shared_ptr<const _bld_glob_dir>> cache;
+    const char *path = dir.empty() ? "." : dir.c_str();
+    auto listing = std::make_shared<_bld_glob_dir>();
+
+#ifndef _WIN32
+    int64_t now = _bld_file_clock_ns();
+    struct stat st;
+    if (::stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+      return nullptr;
+    listing->mtime = _bld_mtime_ns(st);
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      auto it = cache.find(dir);
+      if (it != cache.end() && it->second->mtime == listing->mtime && it->second->dev == listing->dev && it->second->ino == listing->ino)
+        return it->second;
+    }
+#endif
+
+#ifdef __linux__
+    int fd = _bld_open_dir(AT_FDCWD, path);
+    if (fd < 0)
+      return nullptr;
+    std::string names;
+    std::vector<_bld_dent> ents;
+    _bld_read_dents(fd, names, ents);
+    listing->ents.reserve(ents.size());
+    for (const auto &[off, d_type] : ents)
+    {
+      const char *name = names.c_str() + off;
+      bool descend = false;
+      bld::fs::Path_type type = _bld_dent_type(fd, name, d_type, descend);
+      listing->ents.push_back({name, type, descend});
+    }
+    ::close(fd);
+#else
+    std::error_code ec;
+    for (const auto &e : std::filesystem::directory_iterator(path, ec))
+      listing->ents.push_back({e.path().filename().string(), classify(e), e.is_directory() && !e.is_symlink()});
+    if (ec)
+      return nullptr;
+#endif
+
+#ifndef _WIN32
+    // A change in the same clock tick as this read would leave the mtime as it is, so such a listing is not kept
+    if (listing->mtime < now)
+    {
+      std::lock_guard<std::mutex> lock(m);
+      cache[dir] = listing;
+    }
+#endif
+    return listing;
+  }
+}  // anonymous namespace
+
+bool bld::fs::Glob::Segment::matches(std::string_view name) const
+{
+  if (kind == Kind::Literal)
+    return name == text;
+  if (name.empty() || (name[0] == '.' && text[0] != '.'))
+    return false;
+  if (kind == Kind::Suffix)
+    return name.size() >= text.size() - 1 && name.ends_with(std::string_view(text).substr(1));
+  return _bld_wild_match(text, name);
+}
+
+bld::fs::Glob::Glob(const std::vector<std::string> &list)
+{
+  for (const auto &raw : list)
+  {
+    bool exclude = !raw.empty() && raw[0] == '!';
+    for (const auto &expanded : _bld_expand_braces(exclude ? raw.substr(1) : raw))
+    {
+      Pattern p{{}, exclude};
+      std::string_view rest = expanded;
+      if (rest.starts_with('/'))
+        p.segs.push_back({Segment::Kind::Literal, ""});
+
+      while (!rest.empty())
+      {
+        size_t slash = rest.find('/');
+        std::string_view part = rest.substr(0, slash);
+        rest = slash == std::string_view::npos ? std::string_view() : rest.substr(slash + 1);
+        if (part.empty() || part == ".")
+          continue;
+
+        Segment seg{Segment::Kind::Wild, std::string(part)};
+        if (part == "**")
+        {
+          if (!p.segs.empty() && p.segs.back().kind == Segment::Kind::Globstar)
+            continue;
+          seg.kind = Segment::Kind::Globstar;
+        }
+        else if (part.find_first_of("*?[\\") == std::string_view::npos)
+          seg.kind = Segment::Kind::Literal;
+        else if (part[0] == '*' && part.find_first_of("*?[\\", 1) == std::string_view::npos)
+          seg.kind = Segment::Kind::Suffix;
+        p.segs.push_back(std::move(seg));
+      }
+
+      if (!p.segs.empty())
+        patterns.push_back(std::move(p));
+    }
+  }
+
+  // The walks start below the leading literal directories the relative (or absolute) include patterns have in common
+  for (bool absolute : {false, true})
+  {
+    bool first = true;
+    std::vector<std::string> root;
+    for (const auto &p : patterns)
+    {
+      if (p.exclude || absolute != (p.segs[0].kind == Segment::Kind::Literal && p.segs[0].text.empty()))
+        continue;
+      size_t n = 0;
+      while (n + 1 < p.segs.size() && p.segs[n].kind == Segment::Kind::Literal) ++n;
+      if (first)
+      {
+        for (size_t i = 0; i < n; ++i) root.push_back(p.segs[i].text);
+        first = false;
+        continue;
+      }
+      size_t k = 0;
+      while (k < root.size() && k < n && root[k] == p.segs[k].text) ++k;
+      root.resize(k);
+    }
+    if (!first)
+      roots.push_back(std::move(root));
+  }
+}
+
+void bld::fs::Glob::close_over(States &states) const
+{
+  // `**` may match no segment at all
+  for (size_t i = 0; i < states.size(); ++i)
+  {
+    auto [p, s] = states[i];
+    if (s < patterns[p].segs.size() && patterns[p].segs[s].kind == Segment::Kind::Globstar)
+      states.push_back({p, s + 1});
+  }
+  std::sort(states.begin(), states.end());
+  states.erase(std::unique(states.begin(), states.end()), states.end());
+}
+
+bld::fs::Glob::States bld::fs::Glob::step(const States &states, std::string_view name) const
+{
+  States next;
+  for (auto [p, s] : states)
+  {
+    const auto &segs = patterns[p].segs;
+    if (s == segs.size())
+      continue;
+    if (segs[s].kind == Segment::Kind::Globstar)
+    {
+      if (!name.empty() && name[0] != '.')
+        next.push_back({p, s});
+    }
+    else if (segs[s].matches(name))
+      next.push_back({p, s + 1});
+  }
+  close_over(next);
+  return next;
+}
+
+bool bld::fs::Glob::accepts(const States &states, bool exclude) const
+{
+  for (auto [p, s] : states)
+    if (patterns[p].exclude == exclude && s == patterns[p].segs.size())
+      return true;
+  return false;
+}
+
+bool bld::fs::Glob::can_descend(const States &states) const
+{
+  for (auto [p, s] : states)
+    if (!patterns[p].exclude && s < patterns[p].segs.size())
+      return true;
+  return false;
+}
+
+bool bld::fs::Glob::match(std::string_view path) const
+{
+  States states;
+  for (uint32_t p = 0; p < patterns.size(); ++p) states.push_back({p, 0});
+  close_over(states);
+
+  if (path.starts_with('/'))
+    states = step(states, "");
+  while (!path.empty())
+  {
+    size_t slash = path.find('/');
+    std::string_view part = path.substr(0, slash);
+    path = slash == std::string_view::npos ? std::string_view() : path.substr(slash + 1);
+    if (part.empty() || part == ".")
+      continue;
+    states = step(states, part);
+    if (accepts(states, true))
+      return false;  // excluded, or inside an excluded directory
+  }
+  return accepts(states, false);
+}
+
+void bld::fs::Glob::walk(const std::string &dir, const States &states, std::vector<std::string> &out) const
+{
+  auto listing = _bld_glob_list(dir);
+  if (!listing)
+    return;
+
+  for (const auto &e : listing->ents)
+  {
+    States next = step(states, e.name);
+    if (next.empty() || accepts(next, true))
+      continue;
+
+    std::string path = dir.empty() ? e.name : dir.back() == '/' ? dir + e.name : dir + '/' + e.name;
+    if (e.descend)
+    {
+      if (can_descend(next))
+        walk(path, next, out);
+    }
+    else if (e.type == Path_type::File && accepts(next, false))
+      out.push_back(std::move(path));
+  }
+}
+
+std::vector<std::string> bld::fs::Glob::files() const
+{
+  std::vector<std::string> out;
+  for (const auto &root : roots)
+  {
+    States states;
+    for (uint32_t p = 0; p < patterns.size(); ++p) states.push_back({p, 0});
+    close_over(states);
+
+    std::string dir;
+    for (size_t i = 0; i < root.size(); ++i)
+    {
+      states = step(states, root[i]);
+      if (i == 0 && root[i].empty())
+        dir = "/";
+      else
+        dir += (dir.empty() || dir.back() == '/' ? "" : "/") + root[i];
+    }
+
+    if (!accepts(states, true) && can_descend(states))
+      walk(dir, states, out);
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+std::vector<std::string> bld::fs::glob(const std::vector<std::string> &patterns) { return Glob(patterns).files(); }
+
+namespace
+{
+  // Same conversion as std::filesystem::last_write_time, so batched and single stats compare exactly
+  inline std::filesystem::file_time_type _bld_file_time(int64_t sec, int64_t nsec)
+  {
+    auto sys = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::seconds(sec) + std::chrono::nanoseconds(nsec)));
+    return std::chrono::file_clock::from_sys(sys);
+  }
+
+  inline bld::fs::Stat_result _bld_stat_one(const std::string &path)
+  {
+    bld::fs::Stat_result r;
+#ifdef __linux__
+    struct statx stx;
+    if (statx(AT_FDCWD, path.c_str(), 0, STATX_MTIME | STATX_SIZE, &stx) == 0)
+    {
+      r.exists = true;
+      r.mtime = _bld_file_time(stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec);
+      r.size = stx.stx_size;
+    }
+#else
+    std::error_code ec;
+    r.mtime = std::filesystem::last_write_time(path, ec);
+    r.exists = !ec;
+    if (r.exists)
+      r.size = std::filesystem::file_size(path, ec);
+#endif
+    return r;
+  }
+
+  // f(0) .. f(count - 1) on `threads` threads, the calling thread included
+  template <typename F>
+  inline void _bld_parallel_for(size_t count, size_t threads, F &&f)
+  {
+    threads = std::clamp<size_t>(threads, 1, std::max<size_t>(count, 1));
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+      for (size_t i; (i = next.fetch_add(1)) < count;) f(i);
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) pool.emplace_back(work);
+    work();
+    for (auto &t : pool) t.join();
+  }
+
+  // Blocking metadata calls spread over threads, latency bound file systems like NFS benefit from more threads than cores
+  inline size_t _bld_metadata_threads(size_t count) { return std::clamp<size_t>(count / 64, 1, 32); }
+
+  inline void _bld_stat_threads(const std::vector<std::string> &paths, std::vector<bld::fs::Stat_result> &out, const std::vector<size_t> &which)
+  {
+    _bld_parallel_for(which.size(), _bld_metadata_threads(which.size()), [&](size_t i) { out[which[i]] = _bld_stat_one(paths[which[i]]); });
+  }
+
+#ifdef BLD_HAS_IO_URING
+  // Minimal io_uring on raw syscalls, enough to keep `entries` statx requests in flight
+  class _bld_uring
+  {
+    int fd = -1;
+    void *sq_ptr = MAP_FAILED, *cq_ptr = MAP_FAILED;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    unsigned entries = 0;
+
+  public:
+    explicit _bld_uring(unsigned depth)
+    {
+      io_uring_params p{};
+      fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &p));
+      if (fd < 0)
+        return;
+      entries = p.sq_entries;
+      sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+      sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+      if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+      {
+        close_ring();
+        return;
+      }
+      auto at = [](void *base, unsigned off) { return reinterpret_cast<unsigned *>(static_cast<char *>(base) + off); };
+      sq_head = at(sq_ptr, p.sq_off.head);
+      sq_tail = at(sq_ptr, p.sq_off.tail);
+      sq_mask = at(sq_ptr, p.sq_off.ring_mask);
+      sq_array = at(sq_ptr, p.sq_off.array);
+      cq_head = at(cq_ptr, p.cq_off.head);
+      cq_tail = at(cq_ptr, p.cq_off.tail);
+      cq_mask = at(cq_ptr, p.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(cq_ptr) + p.cq_off.cqes);
+    }
+
+    ~_bld_uring() { close_ring(); }
+
+    bool ok() const { return fd >= 0; }
+    unsigned depth() const { return entries; }
+
+    void close_ring()
+    {
+      if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+      if (cq_ptr != MAP_FAILED)
+        munmap(cq_ptr, cq_size);
+      if (sq_ptr != MAP_FAILED)
+        munmap(sq_ptr, sq_size);
+      sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+      cq_ptr = sq_ptr = MAP_FAILED;
+      if (fd >= 0)
+        ::close(fd);
+      fd = -1;
+    }
+
+    // Queue a path based request relative to the working directory, `len`/`off`/`op_flags` as the opcode wants them
+    void prep(uint8_t opcode, const char *path, uint32_t len, uint64_t off, uint32_t op_flags, uint64_t user_data)
+    {
+      unsigned tail = *sq_tail;
+      unsigned index = tail & *sq_mask;
+      io_uring_sqe *sqe = &sqes[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = opcode;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<uint64_t>(path);
+      sqe->len = len;
+      sqe->off = off;
+      sqe->rw_flags = static_cast<int>(op_flags);  // statx_flags, unlink_flags, ... share this union
+      sqe->user_data = user_data;
+      sq_array[index] = index;
+      __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    void prep_statx(const char *path, struct statx *buf, uint64_t user_data)
+    {
+      prep(IORING_OP_STATX, path, STATX_MTIME | STATX_SIZE, reinterpret_cast<uint64_t>(buf), 0, user_data);
+    }
+
+    // Submit up to `count` prepared entries and wait for at least one completion. Returns how many were submitted,
+    // the rest stay queued in the ring for the next call.
+    int enter(unsigned count)
+    {
+      for (;;)
+      {
+        long r = syscall(__NR_io_uring_enter, fd, count, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (r >= 0 || (errno != EINTR && errno != EAGAIN && errno != EBUSY))
+          return static_cast<int>(r);
+        if (errno != EINTR)
+          std::this_thread::yield();
+      }
+    }
+
+    template <typename F>
+    unsigned reap(F &&f)
+    {
+      unsigned head = *cq_head, n = 0;
+      for (; head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE); ++head, ++n)
+      {
+        const io_uring_cqe &cqe = cqes[head & *cq_mask];
+        f(cqe.user_data, cqe.res);
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+      return n;
+    }
+  };
+
+  /* Keep up to ring.depth() of `count` requests in flight. `prep(i, slot)` queues request `i` with user_data `slot`,
+   * `done(i, slot, res)` sees its result. false if io_uring_enter failed (blocked by seccomp, ...). */
+  template <typename Prep, typename Done>
+  inline bool _bld_uring_run(_bld_uring &ring, size_t count, Prep &&prep, Done &&done)
+  {
+    std::vector<size_t> slot_item(ring.depth());
+    std::vector<unsigned> free_slots;
+    for (unsigned i = ring.depth(); i > 0; --i) free_slots.push_back(i - 1);
+
+    size_t next = 0, in_flight = 0;
+    unsigned queued = 0;  // Prepared, not taken by the kernel yet
+    while (next < count || in_flight > 0 || queued > 0)
+    {
+      while (next < count && !free_slots.empty())
+      {
+        unsigned slot = free_slots.back();
+        free_slots.pop_back();
+        slot_item[slot] = next;
+        prep(next++, slot);
+        ++queued;
+      }
+      int submitted = ring.enter(queued);
+      if (submitted < 0)
+        return false;
+      queued -= static_cast<unsigned>(submitted);
+      in_flight += static_cast<unsigned>(submitted);
+      if (queued > 0 && in_flight == 0)
+        std::this_thread::yield();  // Short of resources, nothing to wait for: try the rest again
+
+      in_flight -= ring.reap([&](uint64_t slot, int res) {
+        done(slot_item[slot], static_cast<unsigned>(slot), res);
+        free_slots.push_back(static_cast<unsigned>(slot));
+      });
+    }
+    return true;
+  }
+
+  // false if io_uring could not be used at all, requests it rejected are left in `retry`
+  inline bool _bld_stat_uring(const std::vector<std::string> &paths, std::vector<bld::fs::Stat_result> &out, std::vector<size_t> &retry)
+  {
+    _bld_uring ring(256);
+    if (!ring.ok())
+      return false;
+
+    std::vector<struct statx> bufs(ring.depth());
+    return _bld_uring_run(
+        ring, paths.size(), [&](size_t i, unsigned slot) { ring.prep_statx(paths[i].c_str(), &bufs[slot], slot); },
+        [&](size_t i, unsigned slot, int res) {
+          if (res == 0)
+          {
+            out[i].exists = true;
+            out[i].mtime = _bld_file_time(bufs[slot].stx_mtime.tv_sec, bufs[slot].stx_mtime.tv_nsec);
+            out[i].size = bufs[slot].stx_size;
+          }
+          else if (res == -EINVAL || res == -EOPNOTSUPP || res == -EAGAIN)
+            retry.push_back(i);  // kernel without IORING_OP_STATX
+        });
+  }
+#endif
+}  // anonymous namespace
+
+std::vector<bld::fs::Stat_result> bld::fs::stat_batch(const std::vector<std::string> &paths, bool use_io_uring)
+{
+  std::vector<Stat_result> out(paths.size());
+  std::vector<size_t> rest;
+#ifdef BLD_HAS_IO_URING
+  if (use_io_uring && paths.size() > 1 && _bld_stat_uring(paths, out, rest))
+  {
+    _bld_stat_threads(paths, out, rest);
+    return out;
+  }
+  rest.clear();
+#endif
+  (void)use_io_uring;
+  rest.resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) rest[i] = i;
+  _bld_stat_threads(paths, out, rest);
+  return out;
+}
+
+bld::fs::Merkle_tree::Merkle_tree(std::string root, std::string state_file, Merkle_options opts)
+    : root(std::move(root)), state_file(std::move(state_file)), opts(std::move(opts))
+{
+}
+
+namespace
+{
+  constexpr const char *_bld_merkle_header = "bld-merkle 1\n";
+
+#ifndef _WIN32
+  // name, d_type of every entry of an open directory
+  template <typename F>
+  bool _bld_each_dirent(int fd, F &&f)
+  {
+  #ifdef __linux__
+    std::string names;
+    std::vector<_bld_dent> ents;
+    bool ok = _bld_read_dents(fd, names, ents);
+    for (const auto &[off, d_type] : ents) f(names.c_str() + off, d_type);
+    return ok;
+  #else
+    DIR *d = fdopendir(dup(fd));
+    if (!d)
+      return false;
+    while (struct dirent *e = readdir(d))
+      if (std::strcmp(e->d_name, ".") != 0 && std::strcmp(e->d_name, "..") != 0)
+        f(e->d_name, e->d_type);
+    closedir(d);
+    return true;
+  #endif
+  }
+#endif
+}  // anonymous namespace
+
+bool bld::fs::Merkle_tree::update()
+{
+#ifndef _WIN32
+  if (!loaded)
+  {
+    load();
+    loaded = true;
+  }
+
+  struct Scanner
+  {
+    Merkle_tree &tree;
+    std::unordered_map<std::string, Node> next;
+    std::vector<std::string> changed;
+    Stats stats;
+    int64_t now = _bld_file_clock_ns();
+
+    // Hash of the directory `rel`, opened as `name` under `parent`. Empty when it can't be read.
+    std::string scan(int parent, const char *name, const std::string &rel, std::shared_ptr<const _bld_ignore_frame> ignore)
+    {
+      struct stat st;
+      ++stats.dirs_stated;
+      if (fstatat(parent, name, &st, parent == AT_FDCWD ? 0 : AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode))
+        return {};
+
+      Node node;
+      node.mtime = _bld_mtime_ns(st);
+      node.ino = st.st_ino;
+      auto old_it = tree.nodes.find(rel);
+      Node *old = old_it != tree.nodes.end() ? &old_it->second : nullptr;
+      const bool same_listing = old && old->mtime >= 0 && old->mtime == node.mtime && old->ino == node.ino;
+
+      int fd = -1;
+      auto dir_fd = [&] {
+        if (fd < 0)
+          fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (parent == AT_FDCWD ? 0 : O_NOFOLLOW));
+        return fd;
+      };
+
+      // Unchanged listings are taken over, the old node is not needed after this scan
+      bool entries_changed = !same_listing;
+      if (same_listing)
+        node.entries = std::move(old->entries);
+      else
+      {
+        if (dir_fd() < 0)
+          return {};
+        ++stats.dirs_read;
+        _bld_each_dirent(fd, [&](const char *entry, unsigned char d_type) {
+          struct stat est;
+          if (d_type == DT_UNKNOWN && fstatat(fd, entry, &est, AT_SYMLINK_NOFOLLOW) == 0)
+            d_type = S_ISDIR(est.st_mode) ? DT_DIR : DT_REG;
+          node.entries.push_back({entry, d_type == DT_DIR, 0, 0, 0});
+        });
+        std::sort(node.entries.begin(), node.entries.end(), [](const File &a, const File &b) { return a.name < b.name; });
+        if (node.mtime >= now)
+          node.mtime = -1;  // read in the tick it last changed, read it again next time
+      }
+
+      const std::string prefix = rel.empty() ? "" : rel + "/";
+      const bool ignoring = !tree.opts.ignore_files.empty();
+      if (ignoring)
+        ignore = _bld_ignore_load(std::move(ignore), prefix.size(), tree.opts.ignore_files, [&](const std::string &file, std::string &text) {
+          for (const auto &e : node.entries)
+            if (!e.dir && e.name == file)
+              return bld::fs::read_file(tree.root + "/" + prefix + file, text);
+          return false;
+        });
+
+      const bool trust = same_listing && tree.opts.trust_dir_mtime;
+      std::vector<std::string> child_hashes(node.entries.size());
+      std::vector<bool> skipped(node.entries.size());
+      bool children_changed = false;
+      for (size_t i = 0; i < node.entries.size(); ++i)
+      {
+        File &e = node.entries[i];
+        std::string path = prefix + e.name;
+        if (ignoring && _bld_ignored(ignore.get(), path, prefix.size(), e.dir))
+        {
+          skipped[i] = true;
+          continue;
+        }
+
+        if (e.dir)
+        {
+          auto old_child = tree.nodes.find(path);
+          std::string old_hash = old_child != tree.nodes.end() ? old_child->second.hash : std::string();
+          child_hashes[i] = dir_fd() < 0 ? std::string() : scan(fd, e.name.c_str(), path, ignore);
+          children_changed |= child_hashes[i].empty() || child_hashes[i] != old_hash;
+          continue;
+        }
+
+        if (trust || dir_fd() < 0)
+          continue;
+        struct stat est;
+        File now_stat = e;
+        ++stats.files_stated;
+        if (fstatat(fd, e.name.c_str(), &est, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+          now_stat.size = est.st_size;
+          now_stat.mtime = _bld_mtime_ns(est) < now ? _bld_mtime_ns(est) : -1;  // same tick: report it changed next time
+          now_stat.ino = est.st_ino;
+        }
+        else
+          now_stat.size = now_stat.mtime = -1;
+        entries_changed |= now_stat.size != e.size || now_stat.mtime != e.mtime || now_stat.ino != e.ino;
+        e = std::move(now_stat);
+      }
+      if (fd >= 0)
+        ::close(fd);
+
+      // A re-read listing may still hold the same entries (a file created and removed again)
+      if (!same_listing && old)
+        entries_changed = !std::equal(old->entries.begin(), old->entries.end(), node.entries.begin(), node.entries.end(),
+                                      [](const File &a, const File &b) {
+                                        return a.name == b.name && a.dir == b.dir && a.size == b.size && a.mtime == b.mtime && a.ino == b.ino;
+                                      });
+      if (entries_changed)
+        changed.push_back(rel);
+
+      if (old && !entries_changed && !children_changed)
+        node.hash = std::move(old->hash);
+      else
+      {
+        std::string text;
+        for (size_t i = 0; i < node.entries.size(); ++i)
+        {
+          const File &e = node.entries[i];
+          if (skipped[i])
+            continue;
+          text += std::to_string(e.name.size()) + ':' + e.name;
+          if (e.dir)
+            text += " d " + child_hashes[i] + '\n';
+          else
+            text += " f " + std::to_string(e.size) + ' ' + std::to_string(e.mtime) + ' ' + std::to_string(e.ino) + '\n';
+        }
+        node.hash = bld::hash::sha256(text);
+      }
+
+      std::string hash = node.hash;
+      next[rel] = std::move(node);
+      return hash;
+    }
+  };
+
+  Scanner scanner{*this, {}, {}, {}};
+  std::string hash = scanner.scan(AT_FDCWD, root.c_str(), "", nullptr);
+  if (hash.empty())
+  {
+    bld::internal_log(Log_type::ERR, "Failed to scan " + root + ": " + std::strerror(errno));
+    return true;
+  }
+
+  bool dirty = hash != root_hash;
+  root_hash = std::move(hash);
+  nodes = std::move(scanner.next);
+  changed_dirs = std::move(scanner.changed);
+  last_stats = scanner.stats;
+  if ((dirty || last_stats.dirs_read > 0) && !save())
+    bld::internal_log(Log_type::WARNING, "Failed to save " + state_file);
+  return dirty;
+#else
+  bld::internal_log(Log_type::ERR, "Merkle trees are not supported on Windows.");
+  return true;
+#endif
+}
+
+bool bld::fs::Merkle_tree::save() const
+{
+  std::string out = _bld_merkle_header;
+  for (const auto &[rel, node] : nodes)
+  {
+    out += "d " + std::to_string(node.mtime) + ' ' + std::to_string(node.ino) + ' ' + node.hash + ' ' + std::to_string(rel.size()) + ':' +
+           rel + '\n';
+    for (const auto &e : node.entries)
+      out += "e " + std::to_string(e.dir) + ' ' + std::to_string(e.size) + ' ' + std::to_string(e.mtime) + ' ' + std::to_string(e.ino) +
+             ' ' + std::to_string(e.name.size()) + ':' + e.name + '\n';
+  }
+
+  std::error_code ec;
+  std::filesystem::path parent = std::filesystem::path(state_file).parent_path();
+  if (!parent.empty())
+    std::filesystem::create_directories(parent, ec);
+  return write_file_atomic(state_file, out);
+}
+
+bool bld::fs::Merkle_tree::load()
+{
+  Mapped_file file(state_file);
+  std::string_view in = file.view();
+  if (!file.is_open() || !in.starts_with(_bld_merkle_header))
+    return false;
+  in.remove_prefix(std::strlen(_bld_merkle_header));
+
+  auto number = [&](auto &value) {
+    auto [end, ec] = std::from_chars(in.data(), in.data() + in.size(), value);
+    if (ec != std::errc() || end == in.data() + in.size() || *end != ' ')
+      return false;
+    in.remove_prefix(end - in.data() + 1);
+    return true;
+  };
+  auto counted = [&](std::string &value) {
+    size_t len = 0;
+    auto [end, ec] = std::from_chars(in.data(), in.data() + in.size(), len);
+    size_t at = end - in.data() + 1;
+    if (ec != std::errc() || end == in.data() + in.size() || *end != ':' || at + len >= in.size() || in[at + len] != '\n')
+      return false;
+    value.assign(in.substr(at, len));
+    in.remove_prefix(at + len + 1);
+    return true;
+  };
+
+  Node *node = nullptr;
+  std::string rel;
+  while (!in.empty())
+  {
+    bool ok = in.size() > 2 && in[1] == ' ';
+    char kind = in[0];
+    in.remove_prefix(2);
+    if (ok && kind == 'd')
+    {
+      Node n;
+      ok = number(n.mtime) && number(n.ino) && in.size() > 65 && in[64] == ' ';
+      if (ok)
+      {
+        n.hash.assign(in.substr(0, 64));
+        in.remove_prefix(65);
+        ok = counted(rel);
+      }
+      if (ok)
+        node = &(nodes[rel] = std::move(n));
+    }
+    else if (ok && kind == 'e' && node)
+    {
+      File e;
+      int dir = 0;
+      ok = number(dir) && number(e.size) && number(e.mtime) && number(e.ino) && counted(e.name);
+      e.dir = dir != 0;
+      if (ok)
+        node->entries.push_back(std::move(e));
+    }
+    else
+      ok = false;
+
+    if (!ok)
+    {
+      bld::internal_log(Log_type::WARNING, "Ignoring corrupt " + state_file);
+      nodes.clear();
+      return false;
+    }
+  }
+
+  if (auto it = nodes.find(""); it != nodes.end())
+    root_hash = it->second.hash;
+  return true;
+}
+
+namespace
+{
+  inline std::error_code _bld_errno(int err) { return std::error_code(err, std::generic_category()); }
+
+  // A file or symlink, a missing path is not an error. `dir` is set when `path` may be a directory instead.
+  inline std::error_code _bld_unlink_one(const std::string &path, bool &dir)
+  {
+#ifndef _WIN32
+    dir = false;
+    if (::unlink(path.c_str()) == 0 || errno == ENOENT)
+      return {};
+    dir = errno == EISDIR || errno == EPERM;  // Linux says EISDIR for directories, POSIX allows EPERM
+    return _bld_errno(errno);
+#else
+    std::error_code ec;
+    dir = std::filesystem::is_directory(std::filesystem::symlink_status(path, ec));
+    if (!dir)
+      std::filesystem::remove(path, ec);
+    return dir ? std::error_code() : ec;
+#endif
+  }
+
+  // An empty directory that failed to unlink with `unlink_error`, which is kept if it was no directory after all
+  inline std::error_code _bld_rmdir_one(const std::string &path, std::error_code unlink_error)
+  {
+#ifndef _WIN32
+    if (::rmdir(path.c_str()) == 0 || errno == ENOENT)
+      return {};
+    return errno == ENOTDIR ? unlink_error : _bld_errno(errno);
+#else
+    (void)unlink_error;
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    return ec;
+#endif
+  }
+
+  inline std::error_code _bld_remove_one(const std::string &path)
+  {
+    bool dir;
+    std::error_code ec = _bld_unlink_one(path, dir);
+    return dir ? _bld_rmdir_one(path, ec) : ec;
+  }
+
+  /* Remove `paths[which]` on threads: everything that is not a directory first, then the directories one depth at a
+   * time, deepest first, so a directory listed together with its contents is empty by the time its rmdir runs. */
+  inline void _bld_remove_threads(const std::vector<std::string> &paths, const std::vector<size_t> &which, std::vector<std::error_code> &errors)
+  {
+    std::vector<char> is_dir(which.size());
+    _bld_parallel_for(which.size(), _bld_metadata_threads(which.size()), [&](size_t i) {
+      bool dir;
+      errors[which[i]] = _bld_unlink_one(paths[which[i]], dir);
+      is_dir[i] = dir;
+    });
+
+    std::vector<std::pair<size_t, size_t>> dirs;  // Component count, index
+    for (size_t i = 0; i < which.size(); ++i)
+      if (is_dir[i])
+      {
+        auto normal = std::filesystem::path(paths[which[i]]).lexically_normal();
+        dirs.emplace_back(static_cast<size_t>(std::distance(normal.begin(), normal.end())), which[i]);
+      }
+    std::sort(dirs.begin(), dirs.end(), std::greater<>());
+    for (size_t begin = 0, end; begin < dirs.size(); begin = end)
+    {
+      for (end = begin; end < dirs.size() && dirs[end].first == dirs[begin].first;) ++end;
+      _bld_parallel_for(end - begin, _bld_metadata_threads(end - begin), [&](size_t i) {
+        size_t k = dirs[begin + i].second;
+        errors[k] = _bld_rmdir_one(paths[k], errors[k]);
+      });
+    }
+  }
+
+  inline std::error_code _bld_mkdirs_one(const std::string &path)
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(path, ec);
+    return ec;
+  }
+
+  inline bld::fs::Batch_result _bld_batch_result(const std::vector<std::string> &paths, const std::vector<std::error_code> &errors)
+  {
+    bld::fs::Batch_result result;
+    for (size_t i = 0; i < paths.size(); ++i)
+      if (errors[i])
+        result.failed.emplace_back(paths[i], errors[i]);
+      else
+        ++result.done;
+    return result;
+  }
+
+#if defined(BLD_HAS_IO_URING) && defined(IORING_SETUP_SUBMIT_ALL)  // Headers older than 5.18 may lack UNLINKAT/MKDIRAT
+  #define BLD_HAS_IO_URING_FS_OPS
+
+  // Run one request per path, `retry` gets the ones io_uring rejected or that need another syscall
+  template <typename Prep, typename Done>
+  inline bool _bld_batch_uring(const std::vector<std::string> &paths, std::vector<std::error_code> &errors, std::vector<size_t> &retry,
+                               Prep &&prep, Done &&ok)
+  {
+    _bld_uring ring(256);
+    if (!ring.ok())
+      return false;
+    return _bld_uring_run(
+        ring, paths.size(), [&](size_t i, unsigned slot) { prep(ring, paths[i].c_str(), slot); },
+        [&](size_t i, unsigned, int res) {
+          if (ok(res))
+            errors[i].clear();
+          else if (res == -EINVAL || res == -EOPNOTSUPP || res == -EAGAIN || res == -EISDIR || res == -EPERM)
+            retry.push_back(i);  // Unknown opcode, or a directory for unlinkat
+          else
+            errors[i] = _bld_errno(-res);
+        });
+  }
+#endif
+
+#ifndef _WIN32
+  struct _bld_rm_dir
+  {
+    std::string path;
+    std::shared_ptr<_bld_rm_dir> parent;
+    std::atomic<size_t> pending{1};    // Its own listing plus the subdirectories not removed yet
+    std::atomic<bool> blocked{false};  // Something below could not be removed, so neither can this
+  };
+
+  class _bld_rm_tree
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::shared_ptr<_bld_rm_dir>> queue;  // LIFO keeps the number of open subtrees small
+    size_t busy = 0;
+    std::atomic<size_t> done{0}, seen{0};
+    bld::fs::Batch_result &result;
+    std::vector<std::thread> pool;  // Only touched by the calling thread
+    size_t max_threads = 1;
+
+    void fail(const std::string &path, int err)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      result.failed.emplace_back(path, _bld_errno(err));
+    }
+
+    void push(std::shared_ptr<_bld_rm_dir> dir)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(dir));
+      }
+      cv.notify_one();
+    }
+
+    // Remove `dir` and then its parents once their last child is gone
+    void finish(std::shared_ptr<_bld_rm_dir> dir)
+    {
+      for (; dir && --dir->pending == 0; dir = dir->parent)
+      {
+        if (!dir->blocked && (::rmdir(dir->path.c_str()) == 0 || errno == ENOENT))
+        {
+          ++done;
+          continue;
+        }
+        if (!dir->blocked)
+          fail(dir->path, errno);
+        if (dir->parent)
+          dir->parent->blocked = true;
+      }
+    }
+
+    void scan(const std::shared_ptr<_bld_rm_dir> &dir)
+    {
+      int fd = ::open(dir->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      bool listed = fd >= 0 && _bld_each_dirent(fd, [&](const char *name, unsigned char d_type) {
+        ++seen;
+        struct stat st;
+        if (d_type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+          d_type = DT_DIR;
+        if (d_type == DT_DIR)
+        {
+          auto child = std::make_shared<_bld_rm_dir>();
+          child->path = dir->path + "/" + name;
+          child->parent = dir;
+          ++dir->pending;
+          push(std::move(child));
+        }
+        else if (unlinkat(fd, name, 0) == 0 || errno == ENOENT)
+          ++done;
+        else
+        {
+          fail(dir->path + "/" + name, errno);
+          dir->blocked = true;
+        }
+      });
+      if (!listed)
+      {
+        fail(dir->path, errno);
+        dir->blocked = true;
+      }
+      if (fd >= 0)
+        ::close(fd);
+      finish(dir);
+    }
+
+    void work(bool caller)
+    {
+      for (;;)
+      {
+        std::shared_ptr<_bld_rm_dir> dir;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&] { return !queue.empty() || busy == 0; });
+          if (queue.empty())
+            return;
+          dir = std::move(queue.back());
+          queue.pop_back();
+          ++busy;
+        }
+        scan(dir);
+        // Small trees are done before a thread would have started, add helpers as the tree turns out bigger
+        for (size_t want = std::min(max_threads, _bld_metadata_threads(seen)); caller && pool.size() + 1 < want;)
+          pool.emplace_back([this] { work(false); });
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0 && queue.empty())
+          cv.notify_all();
+      }
+    }
+
+  public:
+    explicit _bld_rm_tree(bld::fs::Batch_result &result) : result(result) {}
+
+    void run(const std::string &root, size_t threads)
+    {
+      auto top = std::make_shared<_bld_rm_dir>();
+      top->path = root;
+      queue.push_back(std::move(top));
+      max_threads = threads;
+      work(true);
+      for (auto &t : pool) t.join();
+      result.done = done;
+    }
+  };
+#endif
+}  // anonymous namespace
+
+bld::fs::Batch_result bld::fs::remove_batch(const std::vector<std::string> &paths, bool use_io_uring)
+{
+  std::vector<std::error_code> errors(paths.size());
+  std::vector<size_t> rest;
+#ifdef BLD_HAS_IO_URING_FS_OPS
+  if (use_io_uring && paths.size() > 1 &&
+      _bld_batch_uring(
+          paths, errors, rest, [](_bld_uring &ring, const char *path, unsigned slot) { ring.prep(IORING_OP_UNLINKAT, path, 0, 0, 0, slot); },
+          [](int res) { return res == 0 || res == -ENOENT; }))
+  {
+    _bld_remove_threads(paths, rest, errors);  // Directories, or everything if UNLINKAT is unknown
+    return _bld_batch_result(paths, errors);
+  }
+  rest.clear();
+#endif
+  (void)use_io_uring;
+  rest.resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) rest[i] = i;
+  _bld_remove_threads(paths, rest, errors);
+  return _bld_batch_result(paths, errors);
+}
+
+bld::fs::Batch_result bld::fs::create_dirs_batch(const std::vector<std::string> &paths, bool use_io_uring)
+{
+  std::vector<std::error_code> errors(paths.size());
+#ifdef BLD_HAS_IO_URING_FS_OPS
+  if (use_io_uring && paths.size() > 1)
+  {
+    // Every distinct directory on the way, grouped by depth so parents exist before their children are made
+    std::vector<std::vector<std::string>> levels;
+    std::vector<std::string> keys(paths.size());
+    std::unordered_set<std::string> seen;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      std::filesystem::path prefix;
+      size_t depth = 0;
+      for (const auto &part : std::filesystem::path(paths[i]).lexically_normal())
+      {
+        prefix /= part;
+        if (part.empty() || part == "." || part == ".." || !prefix.has_relative_path())
+          continue;
+        keys[i] = prefix.string();
+        if (levels.size() <= depth)
+          levels.emplace_back();
+        if (seen.insert(keys[i]).second)
+          levels[depth].push_back(keys[i]);
+        ++depth;
+      }
+    }
+
+    bool ring_ok = true;
+    std::unordered_set<std::string> created;
+    std::vector<std::error_code> level_errors;
+    std::vector<size_t> rest;
+    for (const auto &level : levels)
+    {
+      level_errors.assign(level.size(), _bld_errno(EAGAIN));
+      rest.clear();
+      ring_ok = _bld_batch_uring(
+          level, level_errors, rest, [](_bld_uring &ring, const char *path, unsigned slot) { ring.prep(IORING_OP_MKDIRAT, path, 0777, 0, 0, slot); },
+          [](int res) { return res == 0; });
+      if (!ring_ok)
+        break;
+      for (size_t i = 0; i < level.size(); ++i)
+        if (!level_errors[i])
+          created.insert(level[i]);
+    }
+
+    // Anything not made here (already there, a file in the way, rejected by io_uring) gets create_directories' verdict
+    if (ring_ok)
+    {
+      std::vector<size_t> check;
+      for (size_t i = 0; i < paths.size(); ++i)
+        if (!created.count(keys[i]))
+          check.push_back(i);
+      _bld_parallel_for(check.size(), _bld_metadata_threads(check.size()), [&](size_t i) { errors[check[i]] = _bld_mkdirs_one(paths[check[i]]); });
+      return _bld_batch_result(paths, errors);
+    }
+  }
+#endif
+  (void)use_io_uring;
+  _bld_parallel_for(paths.size(), _bld_metadata_threads(paths.size()), [&](size_t i) { errors[i] = _bld_mkdirs_one(paths[i]); });
+  return _bld_batch_result(paths, errors);
+}
+
+bld::fs::Batch_result bld::fs::copy_batch(const std::vector<std::pair<std::string, std::string>> &pairs, const Copy_options &opts)
+{
+  std::vector<std::string> parents;
+  std::unordered_set<std::string> seen;
+  for (const auto &[from, to] : pairs)
+  {
+    std::string parent = std::filesystem::path(to).parent_path().string();
+    if (!parent.empty() && seen.insert(parent).second)
+      parents.push_back(parent);
+  }
+  create_dirs_batch(parents);  // A parent that could not be made fails its copies below
+
+  std::vector<std::string> sources(pairs.size());
+  std::vector<std::error_code> errors(pairs.size());
+  size_t threads = opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+  _bld_parallel_for(pairs.size(), threads, [&](size_t i) {
+    sources[i] = pairs[i].first;
+    errno = 0;
+    if (!copy_file_fast(pairs[i].first, pairs[i].second, opts))
+      errors[i] = _bld_errno(errno ? errno : EIO);
+  });
+  return _bld_batch_result(sources, errors);
+}
+
+bld::fs::Batch_result bld::fs::remove_tree(const std::string &path, size_t threads)
+{
+  Batch_result result;
+#ifndef _WIN32
+  struct stat st;
+  if (::lstat(path.c_str(), &st) != 0)
+  {
+    if (errno != ENOENT)
+      result.failed.emplace_back(path, _bld_errno(errno));
+    return result;
+  }
+  if (!S_ISDIR(st.st_mode))
+  {
+    std::error_code ec = _bld_remove_one(path);
+    if (ec)
+      result.failed.emplace_back(path, ec);
+    else
+      result.done = 1;
+    return result;
+  }
+  _bld_rm_tree(result).run(path, threads ? threads : std::max(1u, std::thread::hardware_concurrency()));
+#else
+  (void)threads;
+  std::error_code ec;
+  std::uintmax_t removed = std::filesystem::remove_all(path, ec);
+  if (ec)
+    result.failed.emplace_back(path, ec);
+  else
+    result.done = static_cast<size_t>(removed);
+#endif
+  return result;
+}
+
+#ifdef __linux__
+  #define BLD_WATCH_MASK                                                                                                       \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | \
+     IN_ONLYDIR)
+#endif
+
+bld::fs::Watcher::Watcher()
+{
+#ifdef __linux__
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd == -1)
+    bld::internal_log(bld::Log_type::ERR, "inotify_init1 failed: " + std::string(strerror(errno)));
+#endif
+}
+
+bld::fs::Watcher::~Watcher()
+{
+#ifdef __linux__
+  if (inotify_fd != -1)
+    ::close(inotify_fd);
+#endif
+}
+
+bool bld::fs::Watcher::add_dir(const std::string &path, bool all, bool recursive, const std::string &name, std::vector<std::string> *found)
+{
+#ifdef __linux__
+  int wd = inotify_add_watch(inotify_fd, path.empty() ? "." : path.c_str(), BLD_WATCH_MASK);
+  if (wd == -1)
+    return false;
+
+  auto &spellings = dirs[wd];
+  auto it = std::find_if(spellings.begin(), spellings.end(), [&](const Dir &d) { return d.path == path; });
+  if (it == spellings.end())
+  {
+    spellings.push_back(Dir{path, false, false, {}});
+    it = spellings.end() - 1;
+  }
+  it->all = it->all || all;
+  it->recursive = it->recursive || recursive;
+  if (!name.empty())
+    it->names.insert(name);
+  if (!recursive)
+    return true;
+
+  // Subdirectories. `found` collects files that already exist in a directory that appeared after we started watching.
+  std::error_code ec;
+  std::vector<std::string> subdirs;
+  for (auto entry = std::filesystem::directory_iterator(path.empty() ? "." : path, std::filesystem::directory_options::skip_permission_denied, ec);
+       !ec && entry != std::filesystem::directory_iterator(); entry.increment(ec))
+  {
+    std::string child = path.empty() ? entry->path().filename().string() : path + "/" + entry->path().filename().string();
+    if (entry->is_directory(ec) && !entry->is_symlink(ec))
+      subdirs.push_back(child);
+    else if (found)
+      found->push_back(child);
+  }
+  for (const auto &sub : subdirs)
+  {
+    if (found)
+      found->push_back(sub);
+    add_dir(sub, true, true, "", found);
+  }
+  return true;
+#else
+  (void)path, (void)all, (void)recursive, (void)name, (void)found;
+  return false;
+#endif
+}
+
+bool bld::fs::Watcher::add(const std::string &path, bool recursive)
+{
+#ifdef __linux__
+  if (inotify_fd == -1)
+    return false;
+
+  std::error_code ec;
+  bool ok;
+  if (std::filesystem::is_directory(path, ec))
+    ok = add_dir(path, true, recursive, "");
+  else
+  {
+    // A file may not exist yet, its directory has to.
+    std::filesystem::path p(path);
+    ok = add_dir(p.parent_path().string(), false, false, p.filename().string());
+  }
+  if (!ok)
+  {
+    bld::internal_log(bld::Log_type::WARNING, "Failed to watch " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+  roots.emplace_back(path, recursive);
+  return true;
+#else
+  bld::internal_log(bld::Log_type::ERR, "File watching is only supported on Linux, cannot watch " + path);
+  return false;
+#endif
+}
+
+bool bld::fs::Watcher::read_events(std::vector<std::string> &changed)
+{
+#ifdef __linux__
+  const size_t before = changed.size();
+  std::vector<std::pair<std::string, bool>> new_dirs;  // Created/moved in directories of recursive watches
+  bool overflow = false;
+
+  alignas(struct inotify_event) char buf[64 * 1024];
+  ssize_t n;
+  while ((n = ::read(inotify_fd, buf, sizeof(buf))) > 0)
+  {
+    for (char *p = buf; p < buf + n;)
+    {
+      auto *ev = reinterpret_cast<struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW)
       {
-        std::string flag = arg.substr(1);
-        flags.insert(flag);
-        values.erase(flag);  // Remove from values if it was there
+        overflow = true;
+        continue;
+      }
+      auto it = dirs.find(ev->wd);
+      if (it == dirs.end())
+        continue;
+      if (ev->mask & IN_IGNORED)
+      {
+        dirs.erase(it);
+        continue;
+      }
+
+      for (const auto &d : it->second)
+      {
+        if (ev->len == 0)  // The directory itself was deleted or moved, what happened inside is unknown
+        {
+          changed.push_back(d.path.empty() ? "." : d.path);
+          lost = true;
+          continue;
+        }
+        std::string name = ev->name;
+        if (!d.all && !d.names.count(name))
+          continue;
+        std::string full = d.path.empty() ? name : d.path + "/" + name;
+        changed.push_back(full);
+        if (d.recursive && (ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+          new_dirs.emplace_back(full, true);
+      }
+    }
+  }
+
+  for (const auto &[dir, rec] : new_dirs) add_dir(dir, true, rec, "", &changed);
+
+  if (overflow)
+  {
+    // Events are gone: pick up directories created meanwhile and let the caller assume everything changed.
+    lost = true;
+    auto old_roots = std::move(roots);
+    roots.clear();
+    for (const auto &[path, rec] : old_roots) add(path, rec);
+  }
+
+  // Keep the first occurrence of each path
+  std::unordered_set<std::string> seen(changed.begin(), changed.begin() + before);
+  size_t out = before;
+  for (size_t i = before; i < changed.size(); ++i)
+    if (seen.insert(changed[i]).second)
+    {
+      if (out != i)
+        changed[out] = std::move(changed[i]);  // Never onto itself, that could leave the path empty
+      ++out;
+    }
+  changed.resize(out);
+  return changed.size() > before || overflow;
+#else
+  (void)changed;
+  return false;
+#endif
+}
+
+bool bld::fs::Watcher::wait(std::vector<std::string> &changed, std::chrono::milliseconds debounce, std::chrono::milliseconds timeout)
+{
+  changed.clear();
+#ifdef __linux__
+  if (inotify_fd == -1)
+    return false;
+
+  using clock = std::chrono::steady_clock;
+  const auto until = timeout.count() < 0 ? clock::time_point::max() : clock::now() + timeout;
+
+  // First relevant event
+  bool got = false;
+  while (!got)
+  {
+    int wait_ms = -1;
+    if (until != clock::time_point::max())
+    {
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(until - clock::now()).count();
+      if (left <= 0)
+        return false;
+      wait_ms = static_cast<int>(left);
+    }
+    struct pollfd pfd = {inotify_fd, POLLIN, 0};
+    int r = ::poll(&pfd, 1, wait_ms);
+    if (r == -1 && errno != EINTR)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Watcher poll failed: " + std::string(strerror(errno)));
+      return false;
+    }
+    if (r > 0)
+      got = read_events(changed);
+  }
+
+  // Rest of the burst: editors and code generators touch several files in a row. Capped so a busy tree still builds.
+  const auto cap = clock::now() + std::max(debounce * 20, std::chrono::milliseconds(1000));
+  struct pollfd pfd = {inotify_fd, POLLIN, 0};
+  while (clock::now() < cap && ::poll(&pfd, 1, static_cast<int>(debounce.count())) > 0) read_events(changed);
+  return true;
+#else
+  (void)debounce;
+  (void)timeout;
+  return false;
+#endif
+}
+
+inline bool bld::fs::walk_directory( const std::string& path, bld::fs::Walk_func cb, std::size_t depth) { return walk_directory_impl(path, cb, depth, nullptr); }
+inline bool bld::fs::walk_directory( const std::string& path, bld::fs::Walk_func cb, void* arg) { return walk_directory_impl( path, cb, std::numeric_limits<std::size_t>::max(), arg); }
+inline bool bld::fs::walk_directory( const std::string& path, bld::fs::Walk_func cb, std::size_t depth, void* arg) { return walk_directory_impl(path, cb, depth, arg); }
+
+std::string bld::env::get(const std::string &key)
+{
+#ifdef _WIN32
+  char buffer[32767];  // Maximum size for environment variables on Windows
+  DWORD size = GetEnvironmentVariableA(key.c_str(), buffer, sizeof(buffer));
+  return size > 0 ? std::string(buffer, size) : "";
+#else
+  const char *value = std::getenv(key.c_str());
+  return value ? std::string(value) : "";
+#endif
+}
+
+bool bld::env::set(const std::string &key, const std::string &value)
+{
+#ifdef _WIN32
+  return SetEnvironmentVariableA(key.c_str(), value.c_str()) != 0;
+#else
+  return setenv(key.c_str(), value.c_str(), 1) == 0;
+#endif
+}
+
+bool bld::env::exists(const std::string &key)
+{
+#ifdef _WIN32
+  return GetEnvironmentVariableA(key.c_str(), nullptr, 0) > 0;
+#else
+  return std::getenv(key.c_str()) != nullptr;
+#endif
+}
+
+bool bld::env::unset(const std::string &key)
+{
+#ifdef _WIN32
+  return SetEnvironmentVariableA(key.c_str(), nullptr) != 0;
+#else
+  return unsetenv(key.c_str()) == 0;
+#endif
+}
+
+std::unordered_map<std::string, std::string> bld::env::get_all()
+{
+  std::unordered_map<std::string, std::string> env_vars;
+
+#if defined(_WIN32)
+  // Windows uses `GetEnvironmentStrings()` to retrieve environment variables
+  LPWCH env_block = GetEnvironmentStringsW();
+  if (!env_block)
+    return env_vars;
+
+  LPWCH env = env_block;
+  while (*env)
+  {
+    std::wstring entry(env);
+    size_t pos = entry.find(L'=');
+    if (pos != std::wstring::npos)
+    {
+      std::string key(entry.begin(), entry.begin() + pos);
+      std::string value(entry.begin() + pos + 1, entry.end());
+      env_vars[key] = value;
+    }
+    env += entry.size() + 1;  // Move to next environment variable
+  }
+  FreeEnvironmentStringsW(env_block);
+
+#else
+  // Linux, macOS, FreeBSD: Use `environ`
+  for (char **env = ENVIRON; *env; ++env)
+  {
+    std::string entry(*env);
+    size_t pos = entry.find('=');
+    if (pos != std::string::npos)
+      env_vars[entry.substr(0, pos)] = entry.substr(pos + 1);
+  }
+#endif
+  return env_vars;
+}
+
+bld::Dep::Dep(std::string target, std::vector<std::string> dependencies, bld::Command command)
+    : target(std::move(target)), dependencies(std::move(dependencies)), command(std::move(command))
+{
+}
+
+// Constructor for phony targets
+bld::Dep::Dep(std::string target, std::vector<std::string> dependencies, bool is_phony)
+    : target(std::move(target)), dependencies(std::move(dependencies)), is_phony(is_phony)
+{
+}
+
+// Implicit conversion from initializer list for better usability
+bld::Dep::Dep(std::string target, std::initializer_list<std::string> deps, bld::Command command)
+    : target(std::move(target)), dependencies(deps), command(std::move(command))
+{
+}
+
+// Copy constructor
+bld::Dep::Dep(const Dep &other)
+    : target(other.target), dependencies(other.dependencies), command(other.command), is_phony(other.is_phony), cacheable(other.cacheable)
+{
+}
+
+// Move constructor
+bld::Dep::Dep(Dep &&other) noexcept
+    : target(std::move(other.target)),
+      dependencies(std::move(other.dependencies)),
+      command(std::move(other.command)),
+      is_phony(other.is_phony),
+      cacheable(other.cacheable)
+{
+}
+
+// Copy assignment
+bld::Dep &bld::Dep::operator=(const Dep &other)
+{
+  if (this != &other)
+  {
+    target = other.target;
+    dependencies = other.dependencies;
+    command = other.command;
+    is_phony = other.is_phony;
+    cacheable = other.cacheable;
+  }
+  return *this;
+}
+
+// Move assignment
+bld::Dep &bld::Dep::operator=(Dep &&other) noexcept
+{
+  if (this != &other)
+  {
+    target = std::move(other.target);
+    dependencies = std::move(other.dependencies);
+    command = std::move(other.command);
+    is_phony = other.is_phony;
+    cacheable = other.cacheable;
+  }
+  return *this;
+}
+
+namespace
+{
+  // Reverse edges are keyed by this, so "./src/a.c" in the graph matches "src/a.c" from `git diff --name-only`
+  std::string _bld_graph_key(const std::string &path) { return std::filesystem::path(path).lexically_normal().generic_string(); }
+}  // anonymous namespace
+
+void bld::Dep_graph::add_dep(const bld::Dep &dep)
+{
+  // Replacing a target drops its old reverse edges
+  if (auto old = nodes.find(dep.target); old != nodes.end())
+    for (const auto &d : old->second->dependencies)
+    {
+      auto &list = dependents[_bld_graph_key(d)];
+      list.erase(std::remove(list.begin(), list.end(), dep.target), list.end());
+    }
+  auto spell = [&](const std::string &path, const std::string &key) {
+    auto &list = spellings[key];
+    if (std::find(list.begin(), list.end(), path) == list.end())
+      list.push_back(path);
+  };
+  spell(dep.target, _bld_graph_key(dep.target));
+  for (const auto &d : dep.dependencies)
+  {
+    std::string key = _bld_graph_key(d);
+    spell(d, key);
+    dependents[key].push_back(dep.target);
+  }
+
+  // We create a node and save it to map with key "File"
+  auto node = std::make_unique<Node>(dep);
+  node->dependencies = dep.dependencies;
+  nodes[dep.target] = std::move(node);
+}
+
+void bld::Dep_graph::add_phony(const std::string &target, const std::vector<std::string> &deps)
+{
+  Dep phony_dep;
+  phony_dep.target = target;
+  phony_dep.dependencies = deps;
+  phony_dep.is_phony = true;
+  add_dep(phony_dep);
+}
+
+bool bld::Dep_graph::needs_rebuild(const Node *node)
+{
+  if (node->dep.is_phony)
+    return true;
+
+  File_stat target_stat = stat_file(node->dep.target);
+  if (!target_stat.exists)
+    return true;
+
+  auto target_time = target_stat.mtime;
+
+  for (const auto &dep_name : node->dep.dependencies)
+  {
+    auto it = nodes.find(dep_name);
+    if (it != nodes.end())
+    {
+      if (it->second->dep.is_phony)
+        return true;
+    }
+
+    File_stat dep_stat = stat_file(dep_name);
+    if (!dep_stat.exists)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Dependency missing: " + dep_name + " for target " + node->dep.target);
+      return true;
+    }
+
+    if (dep_stat.mtime > target_time)
+      return true;
+  }
+  return false;
+}
+
+bool bld::Dep_graph::build(const std::string &target)
+{
+  std::unordered_set<std::string> visited, in_progress;
+  if (detect_cycle(target, visited, in_progress))
+  {
+    bld::internal_log(bld::Log_type::ERR, "Circular dependency detected for target: " + target);
+    return false;
+  }
+  checked_sources.clear();
+  bool ok = build_node(target);
+  save_usage();
+  return ok;
+}
 
-        if (flag == "v" || flag == "verbose")
-        {
-          verbose = true;
-          flags.insert("verbose");
-          flags.insert("v");
-        }
-        else if (flag == "hr" || flag == "hot-reload")
-        {
-          hot_reload = true;
-          flags.insert("hot-reload");
-          flags.insert("hr");
-        }
-        else if (flag == "override-run")
-        {
-          override_run = true;
-        }
-        else if (flag == "h" || flag == "help")
-        {
-          // Don't show help automatically, let user handle it
-        }
-      }
-      else
-      {
-        // Key=value pair like -compiler=g++, -test=yes
-        std::string key = arg.substr(1, eq_pos - 1);
-        std::string value = arg.substr(eq_pos + 1);
+bool bld::Dep_graph::build(const Dep &dep)
+{
+  add_dep(dep);
+  return build(dep.target);
+}
 
-        values[key] = value;
-        flags.erase(key);  // Remove from flags if it was there
+bool bld::Dep_graph::build_all()
+{
+  bool success = true;
+  for (const auto &node : nodes)
+    if (!build(node.first))
+      success = false;
+  return success;
+}
 
-        // Use [] assignment operator which will sync to built-ins automatically
-        (*this)[key] = value;
+bool bld::Dep_graph::F_build_all()
+{
+  checked_sources.clear();
+  bool success = true;
+  for (const auto &node : nodes)
+    if (!build(node.first))
+      success = false;
+  return success;
+}
+
+bool bld::Dep_graph::build_node(const std::string &target)
+{
+  auto it = nodes.find(target);
+  if (it == nodes.end())
+  {
+    if (std::filesystem::exists(target))
+    {
+      if (checked_sources.find(target) == checked_sources.end())
+      {
+        bld::internal_log(bld::Log_type::INFO, "Using existing source file: " + target);
+        checked_sources.insert(target);
       }
+      return true;
     }
+    bld::internal_log(bld::Log_type::ERR, "Target not found: " + target);
+    return false;
   }
 
-  // Private helper methods
-  bool Config::is_true(const std::string &value) const { return value == "true" || value == "1" || value == "yes"; }
+  Node *node = it->second.get();
+  if (node->checked)  // Skip if we've already checked this node
+    return true;
 
-  bool Config::is_number(const std::string &value) const
+  // First build all dependencies
+  for (const auto &dep : node->dependencies)
+    if (!build_node(dep))
+      return false;
+
+  // Check if we need to rebuild
+  if (!needs_rebuild(node))
   {
-    return !value.empty() && value.find_first_not_of("0123456789") == std::string::npos;
+    bld::internal_log(bld::Log_type::INFO, "Target up to date: " + target);
+    node->checked = true;
+    return true;
   }
 
-  void Config::parse_file_list(const std::string &value)
+  // Execute build command if not phony
+  if (!node->dep.is_phony && !node->dep.command.is_empty())
   {
-    if (!value.empty())
+    bld::internal_log(bld::Log_type::INFO, "Building target: " + target);
+    Exit_status es = run_action(node);
+    record_usage(target, es.usage);
+    invalidate(target);
+    if (!es)
     {
-      std::stringstream ss(value);
-      std::string file;
-      hot_reload_files.clear();
-      while (std::getline(ss, file, ','))
-        if (!file.empty())
-          hot_reload_files.push_back(file);
-      hot_reload = true;
+      bld::internal_log(bld::Log_type::ERR, "Failed to build target: " + target);
+      return false;
     }
   }
+  else if (node->dep.is_phony)
+    bld::internal_log(bld::Log_type::INFO, "Phony target: " + target);
+  else
+    bld::internal_log(bld::Log_type::WARNING, "No command for target: " + target);
 
-  // Help and documentation
-  void bld::Config::show_help(bool only_custom) const
+  node->checked = true;
+  return true;
+}
+
+bld::Exit_status bld::Dep_graph::run_action(const Node *node)
+{
+  Action action{node->dep.command, node->dep.dependencies, {node->dep.target}};
+  std::string key;
+  bld::trace::Span lookup_span("cache lookup");
+  bool restored = cache && node->dep.cacheable && cache->key(action, key) && cache->restore(key, action.outputs);
+  lookup_span.end();
+  if (restored)
   {
-    // Built-in names registered by initialize_builtin_options()
-    static const std::unordered_set<std::string> builtin_names = {
-        "compiler", "c",    "target",  "t", "build-dir",  "d",  "flags",        "f",    "link", "l", "threads", "j",
-        "pre",      "post", "verbose", "v", "hot-reload", "hr", "override-run", "help", "h"};
+    bld::internal_log(bld::Log_type::INFO, "Restored from cache: " + node->dep.target);
+    Exit_status es{true, 0};
+    return es;
+  }
 
-    // ── Full built-in reference ──────────────────────────────
-    if (!only_custom)
-    {
-      std::cout << "Usage: <executable> [options]\n\n"
-                << "Flags (no value needed):\n"
-                << "  -flag_name              Set a flag  (e.g. -verbose)\n\n"
-                << "Key=Value pairs:\n"
-                << "  -key=value              Set a config value  (e.g. -compiler=clang++)\n\n"
-                << "Built-in options:\n"
-                << std::left << "  " << std::setw(28) << "-c, -compiler=COMPILER"
-                << "Compiler to use                (default: " << compiler << ")\n"
-                << "  " << std::setw(28) << "-t, -target=TARGET"
-                << "Target executable name         (default: " << target << ")\n"
-                << "  " << std::setw(28) << "-d, -build-dir=DIR"
-                << "Build directory                (default: " << build_dir << ")\n"
-                << "  " << std::setw(28) << "-f, -flags=FLAGS"
-                << "Compiler flags                 (default: " << compiler_flags << ")\n"
-                << "  " << std::setw(28) << "-l, -link=FLAGS"
-                << "Linker flags\n"
-                << "  " << std::setw(28) << "-j, -threads=N"
-                << "Number of build threads        (default: " << threads << ")\n"
-                << "  " << std::setw(28) << "-pre=CMD"
-                << "Pre-build shell command\n"
-                << "  " << std::setw(28) << "-post=CMD"
-                << "Post-build shell command\n"
-                << "  " << std::setw(28) << "-v, -verbose"
-                << "Enable verbose output\n"
-                << "  " << std::setw(28) << "-hr, -hot-reload"
-                << "Enable hot reload\n"
-                << "  " << std::setw(28) << "-override-run"
-                << "Override run behaviour\n"
-                << "  " << std::setw(28) << "-h, -help"
-                << "Show this help\n\n"
-                << "Commands:\n"
-                << "  " << std::setw(28) << "-configure [opts]"
-                << "Parse opts and save to " << BLD_DEFAULT_CONFIG_FILE << "\n"
-                << "  " << std::setw(28) << "-use-config"
-                << "Load config from " << BLD_DEFAULT_CONFIG_FILE << "\n\n";
-    }
+  Exit_status es = executor ? executor->run(action) : execute(action.command);
+  if (es && !key.empty())
+  {
+    bld::trace::Span store_span("cache store");
+    cache->store(key, action.outputs);
+  }
+  return es;
+}
 
-    // ── Collect user-defined custom configs (filter out built-ins) ──
-    std::vector<std::pair<std::string, CustomConfig>> user_flags, user_options;
+bool bld::Dep_graph::detect_cycle(const std::string &target, std::unordered_set<std::string> &visited,
+                                  std::unordered_set<std::string> &in_progress)
+{
+  if (in_progress.find(target) != in_progress.end())
+    return true;  // Cycle detected
 
-    for (const auto &[name, cfg] : custom_configs)
-    {
-      if (builtin_names.count(name))
-        continue;  // skip anything we registered internally
-      if (cfg.is_flag)
-        user_flags.emplace_back(name, cfg);
-      else
-        user_options.emplace_back(name, cfg);
-    }
+  if (visited.find(target) != visited.end())
+    return false;  // Already processed
 
-    // Sort alphabetically for a stable, readable listing
-    auto by_name = [](const auto &a, const auto &b) { return a.first < b.first; };
-    std::sort(user_flags.begin(), user_flags.end(), by_name);
-    std::sort(user_options.begin(), user_options.end(), by_name);
+  auto it = nodes.find(target);
+  if (it == nodes.end())
+    return false;  // Target doesn't exist
 
-    if (user_flags.empty() && user_options.empty())
-    {
-      std::cout << (only_custom ? "No custom options defined.\n"
-                                  "  Add some with config.add_flag(name, desc) "
-                                  "or config.add_option(name, default, desc).\n"
-                                : "  (No custom options defined.)\n");
-      return;
-    }
+  in_progress.insert(target);
 
-    std::cout << "Custom options:\n";
+  for (const auto &dep : it->second->dependencies)
+    if (detect_cycle(dep, visited, in_progress))
+      return true;
 
-    if (!user_flags.empty())
-    {
-      std::cout << "\n  Flags:\n";
-      for (const auto &[name, cfg] : user_flags)
-      {
-        std::string col1 = "    -" + name;
-        std::cout << std::left << std::setw(30) << col1;
-        if (!cfg.description.empty())
-          std::cout << "  " << cfg.description;
-        std::cout << "\n";
-      }
-    }
+  in_progress.erase(target);
+  visited.insert(target);
+  return false;
+}
 
-    if (!user_options.empty())
-    {
-      std::cout << "\n  Options:\n";
-      for (const auto &[name, cfg] : user_options)
-      {
-        std::string col1 = "    -" + name + "=VALUE";
-        std::cout << std::left << std::setw(30) << col1;
-        if (!cfg.default_value.empty())
-          std::cout << "  (default: " << std::setw(12) << cfg.default_value << ")";
-        if (!cfg.description.empty())
-          std::cout << "  " << cfg.description;
-        std::cout << "\n";
+bool bld::Dep_graph::build_parallel(const std::string &root_target, size_t thread_count)
+{
+  bld::trace::Span build_span("build_parallel");
+  build_span.arg("target", root_target);
+
+  // 1. Cycle Detection (Global check before starting)
+  std::unordered_set<std::string> visited_cycle, in_progress_cycle;
+  bld::trace::Span cycle_span("cycle check");
+  if (detect_cycle(root_target, visited_cycle, in_progress_cycle))
+  {
+    bld::internal_log(bld::Log_type::ERR, "Circular dependency detected for target: " + root_target);
+    return false;
+  }
+  cycle_span.end();
+
+  // 2. Build Topology (Subgraph Analysis)
+  // We create a local map of build states for the relevant subgraph.
+  // This avoids processing the entire graph if we only want to build a specific target.
+  std::unordered_map<std::string, BuildState> build_map;
+  bld::trace::Span prep_span("graph prep");
+
+  // Helper to populate build_map using DFS
+  std::function<void(const std::string&)> prepare_topology = 
+    [&](const std::string& current) {
+      if (build_map.find(current) != build_map.end()) return; // Already visited
+      
+      // Ensure node exists in graph (if it's a source file, we ignore it in the map)
+      auto it = nodes.find(current);
+      if (it == nodes.end()) return; 
+
+      // Initialize entry
+      build_map[current]; 
+
+      for (const auto& dep : it->second->dependencies) {
+        // Recurse first to build the graph bottom-up
+        prepare_topology(dep);
+
+        // If the dependency is also a managed Node (not just a source file)
+        if (nodes.count(dep)) {
+            build_map[current].pending_dependencies++;
+            build_map[dep].parents.push_back(current);
+        }
       }
-    }
+  };
 
-    std::cout << std::flush;
-  }
+  prepare_topology(root_target);
+  prep_span.end();
 
-  void Config::dump() const
-  {
-    std::cout << "=== Config Dump ===\n";
-    std::cout << "Flags:\n";
-    for (const auto &flag : flags) std::cout << "  " << flag << "\n";
-    std::cout << "Values:\n";
-    for (const auto &[key, value] : values) std::cout << "  " << key << " = " << value << "\n";
-    std::cout << "==================\n";
-  }
+  // 3. Run it
+  bool ok = run_build_map(build_map, thread_count, false);
+  save_usage();
+  return ok;
+}
 
-  // File operations
-  bool Config::load_from_file(const std::string &filename)
-  {
-    std::ifstream file(filename);
-    if (!file.is_open())
-      return false;
+bool bld::Dep_graph::build_changed(const std::vector<std::string> &changed, size_t thread_count)
+{
+  return build_changed(changed, thread_count, nullptr);
+}
 
-    std::vector<std::string> file_args;
-    std::string line;
-    while (std::getline(file, line))
-    {
-      line.erase(0, line.find_first_not_of(" \t"));
-      if (line.empty() || line[0] == '#')
-        continue;
+std::unordered_set<std::string> bld::Dep_graph::dependency_closure(const std::string &target) const
+{
+  std::unordered_set<std::string> closure;
+  std::vector<std::string> stack{target};
+  while (!stack.empty())
+  {
+    std::string current = std::move(stack.back());
+    stack.pop_back();
+    if (!closure.insert(current).second)
+      continue;
+    if (auto it = nodes.find(current); it != nodes.end())
+      stack.insert(stack.end(), it->second->dep.dependencies.begin(), it->second->dep.dependencies.end());
+  }
+  return closure;
+}
 
-      if (line.find('=') != std::string::npos)
-      {
-        // key=value format
-        if (!str::starts_with(line, "-"))
-          line = "-" + line;
-        file_args.push_back(line);
-      }
-      else
+bool bld::Dep_graph::build_changed(const std::vector<std::string> &changed, size_t thread_count, const std::unordered_set<std::string> *within)
+{
+  bld::trace::Span build_span("build_changed");
+  bld::trace::Span prep_span("graph prep");
+
+  // 1. The cone: everything reachable from the changed files over reverse edges. Nothing else is looked at.
+  //    A dependent outside `within` cannot lead back into it, so the walk stops there.
+  //    Paths are compared normalized, however the caller or the graph spell them.
+  std::unordered_map<std::string, std::string> cone;  // Normalized -> target
+  std::vector<std::string> stack;
+  for (const auto &path : changed)
+  {
+    std::string key = _bld_graph_key(path);
+    invalidate(path);
+    if (auto it = spellings.find(key); it != spellings.end())
+      for (const auto &spelled : it->second)
       {
-        // Simple flag
-        if (!str::starts_with(line, "-"))
-          line = "-" + line;
-        file_args.push_back(line);
+        invalidate(spelled);
+        if (nodes.count(spelled))
+          stack.push_back(spelled);  // A target changed or vanished behind our back
       }
-    }
+    if (auto it = dependents.find(key); it != dependents.end())
+      stack.insert(stack.end(), it->second.begin(), it->second.end());
+  }
+  while (!stack.empty())
+  {
+    std::string current = std::move(stack.back());
+    stack.pop_back();
+    if (within && !within->count(current))
+      continue;
+    std::string key = _bld_graph_key(current);
+    if (!cone.emplace(key, current).second)
+      continue;
+    if (auto it = dependents.find(key); it != dependents.end())
+      stack.insert(stack.end(), it->second.begin(), it->second.end());
+  }
 
-    parse_args(file_args);
+  if (cone.empty())
+  {
+    bld::internal_log(bld::Log_type::INFO, "No target depends on the changed files.");
     return true;
   }
 
-  bool Config::save_to_file(const std::string &filename) const
+  // 2. Edges inside the cone only, targets outside of it are taken as up to date.
+  std::unordered_map<std::string, BuildState> build_map;
+  for (const auto &[key, target] : cone)
   {
-    std::ofstream file(filename);
-    if (!file.is_open())
-      return false;
+    build_map[target];
+    for (const auto &dep : nodes[target]->dependencies)
+      if (auto it = cone.find(_bld_graph_key(dep)); it != cone.end())
+      {
+        build_map[target].pending_dependencies++;
+        build_map[it->second].parents.push_back(target);
+      }
+  }
 
-    file << "# Build configuration\n";
+  prep_span.end();
 
-    // Save built-in options
-    file << "compiler=" << compiler << "\n";
-    file << "target=" << target << "\n";
-    file << "build-dir=" << build_dir << "\n";
-    file << "flags=" << compiler_flags << "\n";
-    file << "threads=" << threads << "\n";
+  // 3. Every target in the cone has a changed input, rebuild without asking needs_rebuild.
+  bld::internal_log(bld::Log_type::INFO, std::to_string(changed.size()) + " changed files affect " + std::to_string(cone.size()) + " targets.");
+  bool ok = run_build_map(build_map, thread_count, true);
+  save_usage();
+  return ok;
+}
 
-    if (verbose)
-      file << "verbose\n";
-    if (hot_reload)
-      file << "hot-reload\n";
-    if (override_run)
-      file << "override-run\n";
+bool bld::Dep_graph::run_build_map(std::unordered_map<std::string, BuildState> &build_map, size_t thread_count, bool force)
+{
+  // 1. Thread Count Validation
+  size_t hw_conc = std::thread::hardware_concurrency();
+  if (thread_count > hw_conc && hw_conc > 0) thread_count = hw_conc;
+  if (thread_count == 0) thread_count = 1;
 
-    // Save custom flags
-    for (const auto &flag : flags)
-      if (flag != "verbose" && flag != "hot-reload" && flag != "override-run" && flag != "v" && flag != "hr")
-        file << flag << "\n";
+  bld::internal_log(bld::Log_type::INFO, "Starting parallel build with " + std::to_string(thread_count) + " threads.");
 
-    // Save custom values
-    for (const auto &[key, value] : values)
-    {
-      if (key != "compiler" && key != "target" && key != "build-dir" && key != "flags" && key != "threads" && key != "c" && key != "t" &&
-          key != "d" && key != "f" && key != "j")
-      {
-        file << key << "=" << value << "\n";
-      }
-    }
+  // Every timestamp needs_rebuild will ask for, collected before the first job starts
+  if (!force)
+  {
+    bld::trace::Span stat_span("stat pass");
+    prefetch_stats(build_map);
+  }
 
-    return true;
+  // 2. Initialize Ready Queue
+  // Add all nodes with 0 pending dependencies (leaves in the dependency tree)
+  std::queue<std::string> ready_queue;
+  std::vector<std::string> ready;
+  for (auto& [name, state] : build_map) {
+      if (state.pending_dependencies == 0) {
+          ready_queue.push(name);
+          ready.push_back(name);
+      }
   }
 
-  // Command handler functions
-  void handle_config_command(const std::vector<std::string> &args, const std::string &program_name)
-  {
-    if (args.size() < 2)
-    {
-      std::cout << "Usage: " << program_name << " config [options]\n";
-      Config::get().show_help();
-      return;
-    }
+  // Let the artifact cache download what just became ready while the workers are busy
+  auto prefetch = [&](const std::vector<std::string> &names) {
+      if (!cache || names.empty()) return;
+      std::vector<Action> actions;
+      for (const auto &name : names) {
+          auto it = nodes.find(name);
+          if (it != nodes.end() && it->second->dep.cacheable && !it->second->dep.is_phony && !it->second->dep.command.is_empty())
+              actions.push_back(Action{it->second->dep.command, it->second->dep.dependencies, {it->second->dep.target}});
+      }
+      cache->prefetch(std::move(actions));
+  };
+  prefetch(ready);
 
-    std::vector<std::string> config_args(args.begin() + 1, args.end());
-    Config::get().parse_args(config_args);
-  }
+  // Share job slots with a parent make/ninja/bld, or hand ours to the children
+  auto &jobserver = bld::Jobserver::get();
+  const bool serving = jobserver.serve(thread_count);
 
-  void handle_args(int argc, char *argv[])
-  {
-    std::vector<std::string> args;
-    Config::get().cmd_args.clear();
+  // 3. Worker Synchronization Primitives
+  std::mutex queue_mutex;
+  std::condition_variable cv;
+  std::atomic<bool> build_failed{false};
+  std::atomic<int> active_workers{0};
+  
+  // Total tasks to track completion
+  size_t total_tasks_remaining = build_map.size();
 
-    for (int i = 0; i < argc; ++i)
-    {
-      args.push_back(argv[i]);
-      Config::get().cmd_args.push_back(argv[i]);
-    }
+  // 4. The Worker Function
+  auto worker = [&](size_t index) {
+    bld::trace::name_thread("build worker " + std::to_string(index));
+    while (true) {
+      std::string current_target;
+      
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        
+        // Wait until there is work, or failure, or nobody is left who could produce work
+        cv.wait(lock, [&] {
+             return !ready_queue.empty() || build_failed || active_workers == 0;
+        });
 
-    if (args.size() <= 1)
-      return;
+        if (build_failed) return;
+        
+        // If queue is empty here, it means we woke up because everything is done
+        if (ready_queue.empty()) return;
 
-    std::string command = args[1];
-    if (command == "-configure")
-    {
-      handle_config_command(args, argv[0]);
-      bld::Config::get().save_to_file();
-      internal_log(Log_type::INFO, "Configuration saved.");
-    }
-    if (command == "-use-config")
-    {
-      bld::Config::get().load_from_file();
-      return;
-    }
-    handle_config_command(args, argv[0]);
-    // Users can handle other commands themselves
-  }
+        current_target = ready_queue.front();
+        ready_queue.pop();
+        active_workers++;
+      }
 
-}  // namespace bld
+      // Processing Step
+      Node* node = nodes[current_target].get();
+      bool success = true;
+      bld::trace::Span job_span(current_target, "target");
 
-bool bld::args_to_vec(int argc, char *argv[], std::vector<std::string> &args)
-{
-  if (argc < 1)
-    return false;
+      try {
+          // Double-check rebuild logic now that dependencies are guaranteed ready
+          if (force || needs_rebuild(node)) {
+             if (node->dep.is_phony) {
+                 bld::internal_log(bld::Log_type::INFO, "Processing phony target: " + current_target);
+             } else if (!node->dep.command.is_empty()) {
+                 {
+                    // Minimal lock for logging to prevent garbled output
+                    // (Assuming internal_log isn't thread-safe, otherwise remove lock)
+                     bld::internal_log(bld::Log_type::INFO, "Building: " + current_target);
+                 }
+                 
+                 bld::trace::Span slot_span("wait for job slot");
+                 Jobserver::Token slot = jobserver.acquire();
+                 slot_span.end();
+                 Exit_status es = run_action(node);
+                 slot.release();
+                 record_usage(current_target, es.usage);
+                 invalidate(node->dep.target);
+                 if (!es) {
+                     bld::internal_log(bld::Log_type::ERR, "Build failed for: " + current_target);
+                     success = false;
+                 }
+             }
+          } else {
+             // Optional: Log up-to-date
+             // bld::internal_log(bld::Log_type::INFO, "Up-to-date: " + current_target);
+          }
+      } catch (const std::exception& e) {
+          bld::internal_log(bld::Log_type::ERR, "Exception building " + current_target + ": " + e.what());
+          success = false;
+      }
+      job_span.end();
 
-  args.reserve(argc - 1);
-  for (int i = 1; i < argc; i++) args.push_back(argv[i]);
+      // Completion Handling
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        active_workers--;
+        
+        if (!success) {
+            build_failed = true;
+            cv.notify_all(); // Wake everyone to exit
+            return;
+        }
 
-  return true;
-}
+        total_tasks_remaining--;
 
-int bld::handle_run_command(std::vector<std::string> args)
-{
-#ifdef BLD_USE_CONFIG
-  if (args.size() == 2)
-  {
-    bld::log(bld::Log_type::WARNING, "Command 'run' specified with the executable");
-    bld::log(bld::Log_type::INFO, "Proceeding to run the specified command: " + args[1]);
-    bld::Command cmd(args[1]);
-    return bld::execute(cmd);
-  }
-  else if (args.size() > 2)
-  {
-    bld::log(bld::Log_type::ERR, "Too many arguments for 'run' command. Only executables are supported.");
-    bld::log(bld::Log_type::INFO, "Usage: run <executable>");
-    exit(EXIT_FAILURE);
+        // Notify parents (Dependents)
+        // Since we are using a local map, we don't need to scan 'nodes'
+        auto& state = build_map[current_target];
+        std::vector<std::string> now_ready;
+        for (const auto& parent_name : state.parents) {
+            build_map[parent_name].pending_dependencies--;
+            if (build_map[parent_name].pending_dependencies == 0) {
+                ready_queue.push(parent_name);
+                now_ready.push_back(parent_name);
+            }
+        }
+        prefetch(now_ready);
+        
+        // Notify other threads that new work might be available or we are done
+        cv.notify_all();
+      }
+    }
+  };
+
+  // 5. Spawn and Join
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; ++i) {
+      threads.emplace_back(worker, i);
   }
-  if (bld::Config::get().target.empty())
-  {
-    bld::log(bld::Log_type::ERR, "No target executable specified in config");
-    exit(1);
+
+  for (auto& t : threads) {
+      if (t.joinable()) t.join();
   }
 
-  bld::Command cmd;
-  cmd.parts.push_back(Config::get().target);
+  if (serving) jobserver.stop();
 
-  bld::execute(cmd);
-  exit(EXIT_SUCCESS);
-#else
-  if (args.size() < 2)
-  {
-    bld::internal_log(bld::Log_type::ERR,
-             "No target executable specified in config. Config is disabled. Please enable BLD_USE_CONFIG macro to use the Config class.");
-    exit(EXIT_FAILURE);
-  }
-  else if (args.size() == 2)
-  {
-    bld::internal_log(bld::Log_type::WARNING, "Command 'run' specified with the executable");
-    bld::internal_log(bld::Log_type::INFO, "Proceeding to run the specified command: " + args[1]);
-    bld::Command cmd(args[1]);
-    return bld::execute(cmd);
-  }
-  else if (args.size() > 2)
+  if (stats_prefetched)
   {
-    bld::internal_log(bld::Log_type::ERR, "Too many arguments for 'run' command. Only executables are supported.");
-    bld::internal_log(bld::Log_type::INFO, "Usage: run <executable>");
-    exit(EXIT_FAILURE);
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    if (!stats_cached)
+      stat_cache.clear();
+    stats_prefetched = false;
   }
-#endif
-  bld::internal_log(bld::Log_type::ERR, "Should never be reached: " + std::to_string(__LINE__));
-  exit(EXIT_FAILURE);
-}
 
-bool bld::starts_with(const std::string &str, const std::string &prefix)
-{
-  if (prefix.size() > str.size())
+  // Work left with nothing running means the remaining targets wait on each other
+  if (!build_failed && total_tasks_remaining > 0)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Circular dependency among " + std::to_string(total_tasks_remaining) + " targets, they were not built.");
     return false;
-  return str.compare(0, prefix.size(), prefix) == 0;
+  }
+  return !build_failed;
 }
 
-
-bool bld::fs::read_file(const std::string &path, std::string &content)
+bool bld::Dep_graph::prepare_build_graph(const std::string &target, std::queue<std::string> &ready_targets)
 {
-  if (!std::filesystem::exists(path))
+  auto it = nodes.find(target);
+  if (it == nodes.end())
   {
-    bld::internal_log(bld::Log_type::ERR, "File does not exist: " + path);
+    if (std::filesystem::exists(target))
+    {
+      if (checked_sources.find(target) == checked_sources.end())
+      {
+        bld::internal_log(bld::Log_type::INFO, "Using existing source file: " + target);
+        checked_sources.insert(target);
+      }
+      return true;
+    }
+    bld::internal_log(bld::Log_type::ERR, "Target not found: " + target);
     return false;
   }
 
-  std::ifstream file(path, std::ios::binary);
+  auto node = it->second.get();
+  if (node->visited)
+    return true;
+  node->visited = true;
 
-  if (!file)
+  // Process dependencies
+  for (const auto &dep : node->dependencies)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to open file: " + path);
-    return false;
+    if (!prepare_build_graph(dep, ready_targets))
+      return false;
+
+    // Only track node dependencies that actually need rebuilding
+    if (nodes.find(dep) != nodes.end() && needs_rebuild(nodes[dep].get()))
+      node->waiting_on.push_back(dep);
   }
 
-  content = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
-  file.close();
+  // Only add to ready queue if NEEDS rebuild and dependencies are met
+  if (node->waiting_on.empty() && needs_rebuild(node))
+    ready_targets.push(target);
+
   return true;
 }
 
-bool bld::fs::write_entire_file(const std::string &path, const std::string &content)
+void bld::Dep_graph::process_completed_target(const std::string &target, std::queue<std::string> &ready_targets, std::mutex &queue_mutex,
+                                              std::condition_variable &cv)
 {
-  std::ofstream file(path, std::ios::binary);
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  nodes[target]->checked = true;
+  nodes[target]->in_progress = false;
 
-  if (!file)
+  // Find all nodes that were waiting on this target
+  for (const auto &node_pair : nodes)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to open file for writing: " + path);
-    return false;
-  }
+    auto &node = node_pair.second;
+    if (!node->checked && !node->in_progress)
+    {
+      auto &waiting = node->waiting_on;
+      waiting.erase(std::remove(waiting.begin(), waiting.end(), target), waiting.end());
 
-  file << content;
-  bool success = file.good();
-  file.close();
-  return success;
+      // If no more dependencies, add to ready queue
+      if (waiting.empty())
+        ready_targets.push(node_pair.first);
+    }
+  }
 }
 
-bool bld::fs::append_file(const std::string &path, const std::string &content)
+bool bld::Dep_graph::build_all_parallel(size_t thread_count)
 {
-  std::ofstream file(path, std::ios::app | std::ios::binary);
-  if (!file)
+  std::vector<std::string> root_targets;
+  // Identify nodes that are not dependencies of any other node, spelled exactly as build_parallel matches them
+  std::unordered_set<std::string> listed;
+  for (const auto &node : nodes) listed.insert(node.second->dependencies.begin(), node.second->dependencies.end());
+  for (const auto &node : nodes)
+    if (!listed.count(node.first))
+      root_targets.push_back(node.first);
+
+  if (root_targets.empty() && !nodes.empty()) {
+      // Edge case: Disconnected cycles or weird graph, pick arbitrary or fail
+      // For now, let's just pick the first one to try and unblock
+      root_targets.push_back(nodes.begin()->first);
+  }
+
+  // Create a temporary master phony target
+  std::string master = "__master_parallel_root__";
+  add_phony(master, root_targets);
+  
+  bool result = build_parallel(master, thread_count);
+
+  nodes.erase(master);
+  spellings.erase(_bld_graph_key(master));
+  for (const auto &root : root_targets)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to open file for appending: " + path);
-    return false;
+    auto &list = dependents[_bld_graph_key(root)];
+    list.erase(std::remove(list.begin(), list.end(), master), list.end());
   }
+  return result;
+}
 
-  file << content;
-  bool success = file.good();
-  file.close();
-  return success;
+void bld::Dep_graph::record_usage(const std::string &target, const Proc_usage &usage)
+{
+  std::lock_guard<std::mutex> lock(usage_mutex);
+  usage_log[target] = usage;
+  usage_dirty = true;
 }
 
-bool bld::fs::read_lines(const std::string &path, std::vector<std::string> &lines)
+bool bld::Dep_graph::track_usage(const std::string &path)
 {
-  std::ifstream file(path);
-  if (!file)
+  std::lock_guard<std::mutex> lock(usage_mutex);
+  usage_file = path;
+  if (!std::filesystem::exists(path))
+    return true;
+
+  std::ifstream in(path);
+  if (!in)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to open file: " + path);
+    bld::internal_log(bld::Log_type::ERR, "Failed to open usage file: " + path);
     return false;
   }
 
+  // One target per line: target \t wall_ms \t user_ms \t sys_ms \t max_rss_kb \t in_blocks \t out_blocks
   std::string line;
-  while (std::getline(file, line)) lines.push_back(line);
-
+  while (std::getline(in, line))
+  {
+    auto fields = bld::str::chop_by_delimiter(line, "\t");
+    if (fields.size() != 7)
+      continue;
+    try
+    {
+      Proc_usage u;
+      u.wall_ms = std::stod(fields[1]);
+      u.user_ms = std::stod(fields[2]);
+      u.sys_ms = std::stod(fields[3]);
+      u.max_rss_kb = std::stol(fields[4]);
+      u.in_blocks = std::stol(fields[5]);
+      u.out_blocks = std::stol(fields[6]);
+      usage_log.emplace(fields[0], u);  // Runs of this process win over stale entries
+    }
+    catch (const std::exception &)
+    {
+      bld::internal_log(bld::Log_type::WARNING, "Skipping malformed usage entry: " + line);
+    }
+  }
   return true;
 }
 
-bool bld::fs::replace_in_file(const std::string &path, const std::string &from, const std::string &to)
+bool bld::Dep_graph::get_usage(const std::string &target, Proc_usage &out) const
 {
-  std::string content = "";
-  if (!bld::fs::read_file(path, content))
-  {
-    bld::internal_log(bld::Log_type::ERR, "Failed to read file: " + path);
+  std::lock_guard<std::mutex> lock(usage_mutex);
+  auto it = usage_log.find(target);
+  if (it == usage_log.end())
     return false;
-  }
-  if (content.empty())
-  {
-    bld::internal_log(bld::Log_type::ERR, "Failed to read file or it is empty: " + path);
-    return false;
-  }
-  size_t pos = 0;
-  while ((pos = content.find(from, pos)) != std::string::npos)
-  {
-    content.replace(pos, from.length(), to);
-    pos += to.length();
-  }
+  out = it->second;
+  return true;
+}
 
-  return bld::fs::write_entire_file(path, content);
+std::unordered_map<std::string, bld::Proc_usage> bld::Dep_graph::get_all_usage() const
+{
+  std::lock_guard<std::mutex> lock(usage_mutex);
+  return usage_log;
 }
 
-bool bld::fs::copy_file(const std::string &from, const std::string &to, bool overwrite)
+void bld::Dep_graph::save_usage()
 {
-  try
-  {
-    if (!overwrite && std::filesystem::exists(to))
-    {
-      bld::internal_log(bld::Log_type::ERR, "Destination file already exists: " + to);
-      return false;
-    }
-    std::filesystem::copy_file(from, to,
-                               overwrite ? std::filesystem::copy_options::overwrite_existing : std::filesystem::copy_options::none);
-    return true;
-  }
-  catch (const std::filesystem::filesystem_error &e)
-  {
-    bld::internal_log(bld::Log_type::ERR, "Failed to copy file: " + std::string(e.what()));
-    return false;
-  }
+  std::lock_guard<std::mutex> lock(usage_mutex);
+  if (usage_file.empty() || !usage_dirty)
+    return;
+
+  std::ostringstream out;
+  for (const auto &[target, u] : usage_log)
+    out << target << '\t' << u.wall_ms << '\t' << u.user_ms << '\t' << u.sys_ms << '\t' << u.max_rss_kb << '\t' << u.in_blocks << '\t'
+        << u.out_blocks << '\n';
+
+  if (bld::fs::write_entire_file(usage_file, out.str()))
+    usage_dirty = false;
 }
 
-bool bld::fs::move_file(const std::string &from, const std::string &to)
+bld::Dep_graph::File_stat bld::Dep_graph::stat_file(const std::string &path)
 {
-  try
+  if (stats_cached || stats_prefetched)
   {
-    std::filesystem::rename(from, to);
-    return true;
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    auto it = stat_cache.find(path);
+    if (it != stat_cache.end())
+      return it->second;
   }
-  catch (const std::filesystem::filesystem_error &e)
+
+  bld::fs::Stat_result r = _bld_stat_one(path);
+  File_stat st{r.exists, r.mtime};
+
+  if (stats_cached)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to move file: " + std::string(e.what()));
-    return false;
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    stat_cache[path] = st;
   }
+  return st;
 }
 
-std::string bld::fs::get_extension(const std::string &path)
+void bld::Dep_graph::prefetch_stats(const std::unordered_map<std::string, BuildState> &build_map)
 {
-  if (!std::filesystem::exists(path))
+  std::vector<std::string> paths;
   {
-    bld::internal_log(bld::Log_type::ERR, "File for extension request does not exist: " + path);
-    return "";
+    std::unordered_set<std::string> seen;
+    std::lock_guard<std::mutex> lock(stat_mutex);
+    auto want = [&](const std::string &path) {
+      if (!stat_cache.count(path) && seen.insert(path).second)
+        paths.push_back(path);
+    };
+    for (const auto &entry : build_map)
+    {
+      const Dep &dep = nodes[entry.first]->dep;
+      if (dep.is_phony)
+        continue;  // needs_rebuild doesn't stat anything for these
+      want(dep.target);
+      for (const auto &d : dep.dependencies) want(d);
+    }
   }
-  std::filesystem::path p(path);
-  return p.extension().string();
+
+  std::vector<bld::fs::Stat_result> results = bld::fs::stat_batch(paths);
+  std::lock_guard<std::mutex> lock(stat_mutex);
+  for (size_t i = 0; i < paths.size(); ++i) stat_cache.emplace(paths[i], File_stat{results[i].exists, results[i].mtime});
+  stats_prefetched = true;
 }
 
-std::string bld::fs::get_stem(const std::string &path, bool with_full_path)
+void bld::Dep_graph::cache_stats(bool enable)
 {
-  std::string filename = path;
-  if (!with_full_path)
-    filename = bld::fs::get_file_name(path);
-  auto pos = filename.find_last_of('.');
-  return pos == std::string::npos ? filename : filename.substr(0, pos);
+  std::lock_guard<std::mutex> lock(stat_mutex);
+  stats_cached = enable;
+  stat_cache.clear();
 }
 
-bool bld::fs::create_directory(const std::string &path)
+void bld::Dep_graph::invalidate(const std::string &path)
 {
-  try
-  {
-    return std::filesystem::create_directories(path);
-  }
-  catch (const std::filesystem::filesystem_error &e)
-  {
-    bld::internal_log(bld::Log_type::ERR, "Failed to create directory: " + std::string(e.what()));
-    return false;
-  }
+  std::lock_guard<std::mutex> lock(stat_mutex);
+  stat_cache.erase(path);
 }
 
-bool bld::fs::create_dir_if_not_exists(const std::string &path)
+void bld::Dep_graph::invalidate_all()
 {
-  if (std::filesystem::exists(path))
+  std::lock_guard<std::mutex> lock(stat_mutex);
+  stat_cache.clear();
+}
+
+namespace
+{
+#ifndef _WIN32
+  bool _bld_socket_addr(const std::string &path, struct sockaddr_un &addr)
   {
-    bld::internal_log(bld::Log_type::WARNING, "Directory ' " + path + " ' already exists, manage it yourself to not lose data!");
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+      bld::internal_log(bld::Log_type::ERR, "Socket path too long: " + path);
+      return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
     return true;
   }
 
-  try
+  // Connected socket to `path`, -1 if nobody listens there.
+  int _bld_daemon_connect(const std::string &path)
   {
-    bool created = std::filesystem::create_directories(path);
-    if (created)
-      bld::internal_log(bld::Log_type::INFO, "Directory created: " + path);
-    else
-      bld::internal_log(bld::Log_type::ERR, "Failed to create directory: " + path);
-    return created;
+    struct sockaddr_un addr;
+    if (!_bld_socket_addr(path, addr))
+      return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+      return -1;
+    if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1)
+    {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
   }
-  catch (const std::filesystem::filesystem_error &e)
+
+  // Daemon request: one line of text, optionally with our stdin/stdout/stderr attached (SCM_RIGHTS).
+  bool _bld_daemon_send(int sock, const std::string &msg, bool with_stdio)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to create directory: " + std::string(e.what()));
-    return false;
-  }
-}
+    struct iovec iov = {const_cast<char *>(msg.data()), msg.size()};
+    struct msghdr mh = {};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
 
-template <typename... Paths, typename>
-bool bld::fs::create_dirs_if_not_exists(const Paths &...paths)
-{
-  return (... && create_dir_if_not_exists(paths));
-}
+    alignas(struct cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    if (with_stdio)
+    {
+      const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+      mh.msg_control = control;
+      mh.msg_controllen = sizeof(control);
+      struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SCM_RIGHTS;
+      cm->cmsg_len = CMSG_LEN(sizeof(fds));
+      std::memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    }
+    return ::sendmsg(sock, &mh, MSG_NOSIGNAL) == static_cast<ssize_t>(msg.size());
+  }
 
-template <typename... Paths, typename>
-void bld::fs::remove(const Paths &...paths)
-{
-  (... & std::filesystem::remove(paths));
-}
+  // Receive a request line and up to 3 descriptors. Missing descriptors are -1.
+  bool _bld_daemon_recv(int sock, std::string &msg, int (&fds)[3])
+  {
+    fds[0] = fds[1] = fds[2] = -1;
+    char buf[4096];
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr mh = {};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    alignas(struct cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
 
+    ssize_t n;
+    while ((n = ::recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {}
+    if (n <= 0)
+      return false;
+    msg.assign(buf, static_cast<size_t>(n));
 
-bool bld::fs::remove_dir(const std::string &path)
-{
-  if (!std::filesystem::exists(path))
-  {
-    bld::internal_log(bld::Log_type::INFO, "Directory does not exist: " + path);
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+      if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+      {
+        size_t count = std::min<size_t>(3, (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        std::memcpy(fds, CMSG_DATA(cm), count * sizeof(int));
+      }
     return true;
   }
+#endif
+}  // anonymous namespace
 
-  try
+bool bld::Dep_graph::serve_daemon(const std::string &socket_path)
+{
+#ifdef __linux__
+  if (int probe = _bld_daemon_connect(socket_path); probe != -1)
   {
-    std::uintmax_t removed_count = std::filesystem::remove_all(path);
-    if (removed_count > 0)
-      bld::internal_log(bld::Log_type::INFO, "Directory removed: " + path);
-    else
-      bld::internal_log(bld::Log_type::ERR, "Failed to remove directory: " + path);
-    return removed_count > 0;
+    ::close(probe);
+    bld::internal_log(bld::Log_type::ERR, "A daemon is already listening on " + socket_path);
+    return false;
   }
-  catch (const std::filesystem::filesystem_error &e)
+  ::unlink(socket_path.c_str());  // Stale socket of a daemon that died
+
+  struct sockaddr_un addr;
+  if (!_bld_socket_addr(socket_path, addr))
+    return false;
+  int listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1 || ::bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 || ::listen(listen_fd, 16) == -1)
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to remove directory: " + std::string(e.what()));
+    bld::internal_log(bld::Log_type::ERR, "Failed to listen on " + socket_path + ": " + std::string(strerror(errno)));
+    if (listen_fd != -1)
+      ::close(listen_fd);
     return false;
   }
-}
 
-std::vector<std::string> bld::fs::list_files_in_dir(const std::string &path, bool recursive)
-{
+  // Watch every file the graph knows. Files that cannot be watched are never trusted from the cache.
+  bld::fs::Watcher watcher;
   std::vector<std::string> files;
-  try
+  for (const auto &[name, node] : nodes)
+  {
+    files.push_back(node->dep.target);
+    for (const auto &d : node->dep.dependencies) files.push_back(d);
+  }
+  std::vector<std::string> unwatched;
+  for (const auto &f : files)
+    if (!watcher.add(f, false))
+      unwatched.push_back(f);
+
+  auto drain_events = [&]()
   {
-    if (recursive)
+    std::vector<std::string> changed;
+    watcher.read_events(changed);
+    if (watcher.overflowed())
+      invalidate_all();
+    for (const auto &c : changed) invalidate(c);
+  };
+
+  // Children must not inherit an ignored SIGPIPE, see _bld_exec_child.
+  _bld_daemon_sigpipe = true;
+  auto old_sigpipe = signal(SIGPIPE, SIG_IGN);
+  cache_stats(true);
+  bld::internal_log(bld::Log_type::INFO, "Build daemon listening on " + socket_path + " (" + std::to_string(nodes.size()) + " targets)");
+
+  bool running = true;
+  while (running)
+  {
+    struct pollfd pfds[2] = {{listen_fd, POLLIN, 0}, {watcher.fd(), POLLIN, 0}};
+    if (::poll(pfds, watcher.fd() == -1 ? 1 : 2, -1) == -1)
     {
-      for (const auto &entry : std::filesystem::recursive_directory_iterator(path))
-        if (entry.is_regular_file())
-          files.push_back(entry.path().string());
+      if (errno == EINTR)
+        continue;
+      bld::internal_log(bld::Log_type::ERR, "Daemon poll failed: " + std::string(strerror(errno)));
+      break;
     }
-    else
+    drain_events();
+    if (!(pfds[0].revents & POLLIN))
+      continue;
+
+    int client = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1)
+      continue;
+
+    std::string msg;
+    int fds[3];
+    if (!_bld_daemon_recv(client, msg, fds))
     {
-      for (const auto &entry : std::filesystem::directory_iterator(path))
-        if (entry.is_regular_file())
-          files.push_back(entry.path().string());
+      ::close(client);
+      continue;
     }
-  }
-  catch (const std::filesystem::filesystem_error &e)
-  {
-    bld::internal_log(bld::Log_type::ERR, "Failed to list files: " + std::string(e.what()));
-  }
-  return files;
-}
 
-std::vector<std::string> bld::fs::list_directories(const std::string &path, bool recursive)
-{
-  std::vector<std::string> directories;
-  try
-  {
-    if (recursive)
+    std::istringstream req(msg);
+    std::string verb, target;
+    size_t threads = 0;
+    req >> verb;
+    if (verb == "stop")
     {
-      for (const auto &entry : std::filesystem::recursive_directory_iterator(path))
-        if (entry.is_directory())
-          directories.push_back(entry.path().string());
+      running = false;
+      int32_t code = 0;
+      (void)!::write(client, &code, sizeof(code));
+    }
+    else if (verb == "build" && (req >> threads) && std::getline(req >> std::ws, target) && fds[1] != -1)
+    {
+      // Events queued before the request are applied before any stat is trusted.
+      drain_events();
+      for (const auto &f : unwatched) invalidate(f);
+      for (auto &[name, node] : nodes) node->checked = false;
+
+      // Borrow the client's stdio for the duration of the build: logs and children write to its terminal.
+      std::cout.flush();
+      std::cerr.flush();
+      int saved[3] = {::dup(STDIN_FILENO), ::dup(STDOUT_FILENO), ::dup(STDERR_FILENO)};
+      for (int i = 0; i < 3; ++i)
+        if (fds[i] != -1)
+          ::dup2(fds[i], i);
+
+      bool ok = build_parallel(target, threads ? threads : std::thread::hardware_concurrency());
+
+      std::cout.flush();
+      std::cerr.flush();
+      for (int i = 0; i < 3; ++i)
+      {
+        if (saved[i] != -1)
+          ::dup2(saved[i], i);
+        close_fd(saved[i]);
+      }
+
+      int32_t code = ok ? 0 : 1;
+      (void)!::write(client, &code, sizeof(code));
     }
     else
     {
-      for (const auto &entry : std::filesystem::directory_iterator(path))
-        if (entry.is_directory())
-          directories.push_back(entry.path().string());
+      int32_t code = 2;
+      (void)!::write(client, &code, sizeof(code));
     }
+
+    close_fd(fds[0], fds[1], fds[2]);
+    ::close(client);
   }
-  catch (const std::filesystem::filesystem_error &e)
+
+  cache_stats(false);
+  signal(SIGPIPE, old_sigpipe);
+  _bld_daemon_sigpipe = false;
+  ::close(listen_fd);
+  ::unlink(socket_path.c_str());
+  bld::internal_log(bld::Log_type::INFO, "Build daemon on " + socket_path + " stopped.");
+  return true;
+#else
+  bld::internal_log(bld::Log_type::ERR, "Build daemon is only supported on Linux.");
+  (void)socket_path;
+  return false;
+#endif
+}
+
+bool bld::Dep_graph::watch(const std::string &target, size_t thread_count, std::chrono::milliseconds debounce, const std::atomic<bool> *stop)
+{
+  bld::fs::Watcher watcher;
+  const auto &reload_files = bld::Config::get().hot_reload_files;
+  const auto scope = dependency_closure(target);  // Changes elsewhere in the graph are not our business
+  size_t watched = 0;
+  if (!reload_files.empty())
   {
-    bld::internal_log(bld::Log_type::ERR, "Failed to list directories: " + std::string(e.what()));
+    for (const auto &f : reload_files) watched += watcher.add(f) ? 1 : 0;
   }
-  return directories;
+  else
+  {
+    // Sources only: targets change because we build them, watching them would trigger a second, empty build.
+    for (const auto &path : scope)
+      if (!nodes.count(path))
+        watched += watcher.add(path, false) ? 1 : 0;
+  }
+  if (watched == 0)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Nothing to watch for target: " + target);
+    return false;
+  }
+
+  cache_stats(true);
+  bld::internal_log(bld::Log_type::INFO, "Watching " + std::to_string(watched) + " paths for " + target + ".");
+  bool ok = build_parallel(target, thread_count);
+
+  std::vector<std::string> changed;
+  while (!(stop && *stop))
+  {
+    // With a stop flag, wake up regularly to check it.
+    if (!watcher.wait(changed, debounce, stop ? std::chrono::milliseconds(200) : std::chrono::milliseconds(-1)))
+      continue;
+
+    // The exact change set is known unless events were lost, custom files are watched or the last build left stale targets.
+    bool exact = !watcher.overflowed() && reload_files.empty() && ok;
+    if (!exact)
+      invalidate_all();
+
+    std::string what = changed.empty() ? "watched files" : changed.front();
+    if (changed.size() > 1)
+      what += " and " + std::to_string(changed.size() - 1) + " more";
+    bld::internal_log(bld::Log_type::INFO, "Changed: " + what + ", rebuilding " + target);
+
+    bld::time::stamp start;
+    ok = exact ? build_changed(changed, thread_count, &scope) : build_parallel(target, thread_count);
+    auto ms = bld::time::since<double, std::chrono::milliseconds>(start);
+    bld::internal_log(ok ? bld::Log_type::INFO : bld::Log_type::ERR,
+                      std::string(ok ? "Rebuilt " : "Rebuild failed: ") + target + " in " + std::to_string(static_cast<long long>(ms)) + "ms");
+  }
+
+  cache_stats(false);
+  return true;
 }
 
-std::string bld::fs::get_file_name(std::string full_path)
+bool bld::daemon_build(const std::string &socket_path, const std::string &target, int &exit_code, size_t threads)
 {
-  auto path = std::filesystem::path(full_path);
-  return path.filename().string();
+#ifndef _WIN32
+  int sock = _bld_daemon_connect(socket_path);
+  if (sock == -1)
+    return false;
+
+  exit_code = 1;
+  if (!_bld_daemon_send(sock, "build " + std::to_string(threads) + " " + target, true))
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to send build request to daemon: " + std::string(strerror(errno)));
+    ::close(sock);
+    return true;
+  }
+
+  int32_t code = 1;
+  ssize_t n;
+  while ((n = ::read(sock, &code, sizeof(code))) == -1 && errno == EINTR) {}
+  ::close(sock);
+  if (n != sizeof(code))
+  {
+    bld::internal_log(bld::Log_type::ERR, "Build daemon hung up during the build.");
+    return true;
+  }
+  exit_code = code;
+  return true;
+#else
+  (void)socket_path;
+  (void)target;
+  (void)exit_code;
+  (void)threads;
+  return false;
+#endif
 }
 
-std::string bld::fs::strip_file_name(std::string full_path)
+bool bld::stop_daemon(const std::string &socket_path)
 {
-  auto path = std::filesystem::path(full_path);
-  return path.parent_path().string();
+#ifndef _WIN32
+  int sock = _bld_daemon_connect(socket_path);
+  if (sock == -1)
+    return false;
+  bool ok = _bld_daemon_send(sock, "stop", false);
+  int32_t code;
+  while (ok && ::read(sock, &code, sizeof(code)) == -1 && errno == EINTR) {}
+  ::close(sock);
+  return ok;
+#else
+  (void)socket_path;
+  return false;
+#endif
 }
 
-std::vector<std::string> bld::fs::get_all_files_with_name(const std::string &dir, const std::string &name, bool recursive)
+namespace
 {
-  namespace fs = std::filesystem;
-  std::vector<std::string> results;
-
-  try
+  // Streaming SHA-256 (FIPS 180-4)
+  struct _bld_sha256
   {
-    if (!fs::exists(dir) || !fs::is_directory(dir))
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block[64];
+    size_t used = 0;
+    uint64_t total = 0;
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const unsigned char *p)
     {
-      bld::internal_log(bld::Log_type::WARNING, "Directory: " + dir + " doesnt exist.");
-      return results;
+      static const uint32_t k[64] = {
+          0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+          0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa,
+          0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+          0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+          0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+          0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+      uint32_t w[64];
+      for (int i = 0; i < 16; ++i)
+        w[i] = uint32_t(p[4 * i]) << 24 | uint32_t(p[4 * i + 1]) << 16 | uint32_t(p[4 * i + 2]) << 8 | uint32_t(p[4 * i + 3]);
+      for (int i = 16; i < 64; ++i)
+      {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+      for (int i = 0; i < 64; ++i)
+      {
+        uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+      }
+      h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e, h[5] += f, h[6] += g, h[7] += hh;
     }
-    if (recursive)
+
+    void update(const void *data, size_t n)
     {
-      for (const auto &entry : fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied))
+      auto p = static_cast<const unsigned char *>(data);
+      total += n;
+      while (n > 0)
       {
-        try
-        {
-          if (entry.is_regular_file() && entry.path().filename() == name)
-            results.push_back(entry.path().string());
-        }
-        catch (const fs::filesystem_error &e)
+        size_t take = std::min(n, sizeof(block) - used);
+        std::memcpy(block + used, p, take);
+        used += take, p += take, n -= take;
+        if (used == sizeof(block))
         {
-          bld::internal_log(bld::Log_type::WARNING, "Filesystem error: " + std::string(e.what()));
-          bld::internal_log(bld::Log_type::INFO, "Skipping previous file");
-          continue;
+          compress(block);
+          used = 0;
         }
       }
     }
-    else
+
+    std::string hex()
     {
-      for (const auto &entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied))
+      uint64_t bits = total * 8;
+      unsigned char pad = 0x80;
+      update(&pad, 1);
+      pad = 0;
+      while (used != 56) update(&pad, 1);
+      unsigned char len[8];
+      for (int i = 0; i < 8; ++i) len[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+      update(len, 8);
+
+      static const char digits[] = "0123456789abcdef";
+      std::string out(64, '0');
+      for (int i = 0; i < 32; ++i)
       {
-        try
-        {
-          if (entry.is_regular_file() && entry.path().filename() == name)
-            results.push_back(entry.path().string());
-        }
-        catch (const fs::filesystem_error &e)
-        {
-          bld::internal_log(bld::Log_type::WARNING, "Filesystem error: " + std::string(e.what()));
-          bld::internal_log(bld::Log_type::INFO, "Skipping previous file");
-          continue;
-        }
+        unsigned char byte = static_cast<unsigned char>(h[i / 4] >> (24 - 8 * (i % 4)));
+        out[2 * i] = digits[byte >> 4];
+        out[2 * i + 1] = digits[byte & 15];
       }
+      return out;
     }
-  }
-  catch (const fs::filesystem_error &e)
-  {
-    bld::internal_log(bld::Log_type::WARNING, "Filesystem error: " + std::string(e.what()));
-  }
+  };
+}  // anonymous namespace
 
-  return results;
+std::string bld::hash::sha256(std::string_view data)
+{
+  _bld_sha256 ctx;
+  ctx.update(data.data(), data.size());
+  return ctx.hex();
 }
-// Alternative version with more robust error handling and logging
-std::vector<std::string> bld::fs::get_all_files_with_extensions(const std::string &path,const std::vector<std::string> &extensions, bool recursive, bool case_insensitive)
+
+bool bld::hash::sha256_file(const std::string &path, std::string &digest)
 {
-  std::vector<std::string> matching_files;
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    bld::internal_log(bld::Log_type::ERR, "Failed to open file for hashing: " + path);
+    return false;
+  }
 
-  // Validate input
-  if (path.empty())
+  _bld_sha256 ctx;
+  char buf[64 * 1024];
+  while (file.read(buf, sizeof(buf)) || file.gcount() > 0) ctx.update(buf, static_cast<size_t>(file.gcount()));
+  if (file.bad())
   {
-    bld::internal_log(Log_type::ERR, "Empty path provided: " + path);
-    return matching_files;
+    bld::internal_log(bld::Log_type::ERR, "Failed to read file for hashing: " + path);
+    return false;
   }
+  digest = ctx.hex();
+  return true;
+}
 
-  if (extensions.empty())
+namespace
+{
+  // Atomically replace `path` with `content`, creating its directory. `mode` 0 = default permissions.
+  bool _bld_publish(const std::string &path, const std::string &content, unsigned mode = 0)
   {
-    bld::internal_log(Log_type::WARNING, "No extensions provided for path: " + path);
-    return matching_files;
+    std::error_code ec;
+    auto parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+      std::filesystem::create_directories(parent, ec);
+    bld::fs::Write_options opts;
+    opts.mode = mode;
+    return bld::fs::write_file_atomic(path, content, opts);
   }
 
-  // Check if path exists and is a directory
-  std::filesystem::path fs_path(path);
-  std::error_code ec;
+#ifndef _WIN32
+  // Worker protocol: every message is a u64 length followed by the body. Bodies start with a tag byte.
+  //   'A' action  executor -> worker  argv, env, unset_env, cwd, timeout, inputs (path, digest, executable), outputs
+  //   'N' need    worker -> executor  digests missing from the worker's cache
+  //   'B' blobs   executor -> worker  contents of the needed digests, same order
+  //   'R' result  worker -> executor  normal, exit code, signal, timed out, log, outputs (path, present, content)
+  struct _bld_wire_writer
+  {
+    std::string buf;
 
-  if (!std::filesystem::exists(fs_path, ec))
+    explicit _bld_wire_writer(char tag) { buf.push_back(tag); }
+    void u64(uint64_t v)
+    {
+      for (int i = 0; i < 8; ++i) buf.push_back(static_cast<char>(v >> (8 * i)));
+    }
+    void str(std::string_view s)
+    {
+      u64(s.size());
+      buf.append(s);
+    }
+  };
+
+  struct _bld_wire_reader
   {
-    bld::internal_log(Log_type::ERR, "Path does not exist: " + path);
-    return matching_files;
-  }
+    std::string_view data;
+    bool ok = true;
 
-  if (ec)
+    uint64_t u64()
+    {
+      if (data.size() < 8)
+      {
+        ok = false;
+        return 0;
+      }
+      uint64_t v = 0;
+      for (int i = 0; i < 8; ++i) v |= uint64_t(static_cast<unsigned char>(data[i])) << (8 * i);
+      data.remove_prefix(8);
+      return v;
+    }
+    std::string str()
+    {
+      uint64_t n = u64();
+      if (!ok || n > data.size())
+      {
+        ok = false;
+        return {};
+      }
+      std::string s(data.substr(0, n));
+      data.remove_prefix(n);
+      return s;
+    }
+    // Element count of a list, bounded by what is left so a corrupt count cannot allocate gigabytes
+    size_t count()
+    {
+      uint64_t n = u64();
+      if (n > data.size())
+        ok = false;
+      return ok ? static_cast<size_t>(n) : 0;
+    }
+  };
+
+  // Send all of `data` on a socket, a vanished peer is an error rather than SIGPIPE
+  bool _bld_send_all(int fd, std::string_view data)
   {
-    bld::internal_log(Log_type::ERR, "Error checking path existence: " + ec.message());
-    return matching_files;
+    while (!data.empty())
+    {
+      ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      data.remove_prefix(static_cast<size_t>(n));
+    }
+    return true;
   }
 
-  if (!std::filesystem::is_directory(fs_path, ec))
+  bool _bld_wire_send(int fd, const _bld_wire_writer &msg)
   {
-    bld::internal_log(Log_type::ERR, "Path is not a directory: " + path);
-    return matching_files;
+    std::string frame;
+    frame.reserve(8 + msg.buf.size());
+    for (int i = 0; i < 8; ++i) frame.push_back(static_cast<char>(uint64_t(msg.buf.size()) >> (8 * i)));
+    frame += msg.buf;
+    return _bld_send_all(fd, frame);
   }
 
-  if (ec)
+  bool _bld_read_full(int fd, char *buf, size_t n, size_t &got)
   {
-    bld::internal_log(Log_type::ERR, "Error checking if path is directory: " + ec.message());
-    return matching_files;
+    got = 0;
+    while (got < n)
+    {
+      ssize_t r = ::read(fd, buf + got, n - got);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        return false;
+      got += static_cast<size_t>(r);
+    }
+    return true;
   }
 
-  // Normalize extensions - handle both "cpp" and ".cpp" formats
-  std::vector<std::string> normalized_extensions;
-  for (const auto &ext : extensions)
+  // 1 = message read, 0 = peer closed between messages, -1 = error
+  int _bld_wire_recv(int fd, std::string &msg, char expect)
   {
-    if (ext.empty())
-      continue;
-
-    std::string normalized = ext;
-
-    // Ensure extension starts with '.' - handle both "cpp" and ".cpp"
-    if (normalized[0] != '.')
-      normalized = "." + normalized;
-
-    // Apply case transformation if case_insensitive is true
-    if (case_insensitive)
-      std::transform(normalized.begin(), normalized.end(), normalized.begin(), [](unsigned char c) { return std::tolower(c); });
-
-    normalized_extensions.push_back(normalized);
+    char header[8];
+    size_t got;
+    if (!_bld_read_full(fd, header, sizeof(header), got))
+      return got == 0 ? 0 : -1;
+    uint64_t size = 0;
+    for (int i = 0; i < 8; ++i) size |= uint64_t(static_cast<unsigned char>(header[i])) << (8 * i);
+    if (size == 0 || size > (uint64_t(1) << 36))
+      return -1;
+    msg.resize(size);
+    if (!_bld_read_full(fd, msg.data(), size, got))
+      return -1;
+    return msg[0] == expect || expect == 0 ? 1 : -1;
   }
 
-  if (normalized_extensions.empty())
+  // Relative path that stays below its root, the only kind shipped to workers.
+  bool _bld_sandboxed_path(const std::string &path)
   {
-    bld::internal_log(Log_type::WARNING, "No valid extensions after normalization");
-    return matching_files;
+    std::filesystem::path p(path);
+    if (path.empty() || p.is_absolute() || p.has_root_name())
+      return false;
+    for (const auto &part : p.lexically_normal())
+      if (part == "..")
+        return false;
+    return true;
   }
 
-  // Process files
-  auto process_entry = [&](const std::filesystem::directory_entry &entry)
+  // Run one 'A' message inside `sandbox`, materializing inputs from `cas`. Fills the 'R' reply.
+  bool _bld_worker_run(int fd, _bld_wire_reader &in, const std::string &cas, const std::string &sandbox, _bld_wire_writer &reply)
   {
-    std::error_code entry_ec;
-
-    if (!entry.is_regular_file(entry_ec))
-      return;
+    bld::Command cmd;
+    for (size_t i = 0, n = in.count(); i < n && in.ok; ++i) cmd.parts.push_back(in.str());
+    for (size_t i = 0, n = in.count(); i < n && in.ok; ++i)
+    {
+      std::string key = in.str();
+      cmd.env[key] = in.str();
+    }
+    for (size_t i = 0, n = in.count(); i < n && in.ok; ++i) cmd.unset_env.push_back(in.str());
+    std::string cwd = in.str();
+    cmd.timeout = std::chrono::milliseconds(in.u64());
 
-    if (entry_ec)
-      return;  // Skip this entry if we can't determine its type
+    struct Input
+    {
+      std::string path, digest;
+      bool executable;
+    };
+    std::vector<Input> inputs(in.count());
+    for (auto &input : inputs)
+    {
+      input.path = in.str();
+      input.digest = in.str();
+      input.executable = in.u64() != 0;
+    }
+    std::vector<std::string> outputs(in.count());
+    for (auto &output : outputs) output = in.str();
+    if (!in.ok || cmd.parts.empty())
+      return false;
 
-    std::string file_ext = entry.path().extension().string();
+    // Everything is joined onto the sandbox below, nothing may point out of it
+    if (!cwd.empty() && !_bld_sandboxed_path(cwd))
+    {
+      bld::internal_log(bld::Log_type::ERR, "Worker rejected an action with a cwd outside its sandbox: " + cwd);
+      return false;
+    }
+    for (const auto &input : inputs)
+      if (!_bld_sandboxed_path(input.path))
+        return false;
+    for (const auto &output : outputs)
+      if (!_bld_sandboxed_path(output))
+        return false;
 
-    // Apply case transformation to file extension if case_insensitive is true
-    std::string comparison_ext = file_ext;
-    if (case_insensitive)
-      std::transform(comparison_ext.begin(), comparison_ext.end(), comparison_ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    // Ask for what the cache is missing, once per digest
+    std::vector<std::string> missing;
+    std::unordered_set<std::string> asked;
+    for (const auto &input : inputs)
+    {
+      if (input.digest.size() != 64 || input.digest.find_first_not_of("0123456789abcdef") != std::string::npos)
+        return false;
+      if (!std::filesystem::exists(cas + "/" + input.digest) && asked.insert(input.digest).second)
+        missing.push_back(input.digest);
+    }
+    if (!missing.empty())
+    {
+      _bld_wire_writer need('N');
+      need.u64(missing.size());
+      for (const auto &d : missing) need.str(d);
+      std::string msg;
+      if (!_bld_wire_send(fd, need) || _bld_wire_recv(fd, msg, 'B') != 1)
+        return false;
+      _bld_wire_reader blobs{std::string_view(msg).substr(1)};
+      if (blobs.count() != missing.size())
+        return false;
+      for (const auto &d : missing)
+      {
+        std::string content = blobs.str();
+        if (!blobs.ok || bld::hash::sha256(content) != d)
+        {
+          bld::internal_log(bld::Log_type::ERR, "Worker received a corrupt blob for " + d);
+          return false;
+        }
+        std::string path = cas + "/" + d;
+        if (!_bld_publish(path, content, 0444))  // Shared by hard links, nobody may write through one
+          return false;
+      }
+    }
 
-    for (const auto &target_ext : normalized_extensions)
+    std::error_code ec;
+    for (const auto &input : inputs)
     {
-      if (comparison_ext == target_ext)
+      std::string dst = sandbox + "/" + input.path;
+      std::filesystem::create_directories(std::filesystem::path(dst).parent_path(), ec);
+      std::string src = cas + "/" + input.digest;
+      if (input.executable || ::link(src.c_str(), dst.c_str()) == -1)
       {
-        matching_files.push_back(entry.path().string());
-        break;
+        if (!_bld_clone_file(src, dst))
+        {
+          bld::internal_log(bld::Log_type::ERR, "Failed to materialize input " + input.path + ": " + std::string(strerror(errno)));
+          return false;
+        }
+        ::chmod(dst.c_str(), input.executable ? 0755 : 0644);
       }
     }
-  };
+    for (const auto &output : outputs) std::filesystem::create_directories(std::filesystem::path(sandbox + "/" + output).parent_path(), ec);
 
-  // Iterate through directory
-  if (recursive)
-  {
-    for (const auto &entry :
-         std::filesystem::recursive_directory_iterator(fs_path, std::filesystem::directory_options::skip_permission_denied, ec))
+    cmd.cwd = cwd.empty() ? sandbox : sandbox + "/" + cwd;
+
+    // stdout and stderr share one pipe so the log keeps the interleaving the user would have seen
+    bld::Fd fds[2];
+    if (!_bld_pipe(fds))
+      return false;
+    bld::Exit_status es{false, -1, 0};
+    std::string log;
     {
-      if (ec)
+      bld::Redirect redirect(bld::INVALID_FD, fds[1], _bld_dup_fd(fds[1]));
+      bld::Proc proc = bld::execute_async_redirect(cmd, redirect);
+      if (proc)
       {
-        bld::internal_log(Log_type::WARNING, "Error during recursive iteration: " + ec.message());
-        ec.clear();  // Clear error and continue
-        continue;
+        redirect.stdin_fd = redirect.stdout_fd = redirect.stderr_fd = bld::INVALID_FD;
+        std::thread reader([&log, rd = fds[0]] {
+          char buf[16 * 1024];
+          ssize_t n;
+          while ((n = ::read(rd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+            if (n > 0)
+              log.append(buf, static_cast<size_t>(n));
+        });
+        es = bld::wait_proc(proc);
+        bld::cleanup_process(proc);
+        reader.join();
       }
-      process_entry(entry);
+      ::close(fds[0]);
     }
-  }
-  else
-  {
-    for (const auto &entry : std::filesystem::directory_iterator(fs_path, ec))
+
+    reply.u64(es.normal);
+    reply.u64(static_cast<uint64_t>(static_cast<int64_t>(es.exit_code)));
+    reply.u64(static_cast<uint64_t>(static_cast<int64_t>(es.signal)));
+    reply.u64(es.timed_out);
+    reply.str(log);
+    reply.u64(outputs.size());
+    for (const auto &output : outputs)
     {
-      if (ec)
+      std::string content;
+      std::string path = sandbox + "/" + output;
+      bool present = std::filesystem::is_regular_file(path, ec);
+      if (present)
       {
-        bld::internal_log(Log_type::WARNING, "Error during directory iteration: " + ec.message());
-        break;
+        std::ifstream file(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
       }
-      process_entry(entry);
+      reply.str(output);
+      reply.u64(present);
+      reply.u64(present && ::access(path.c_str(), X_OK) == 0);
+      reply.str(content);
     }
+    return true;
   }
+#endif
+}  // anonymous namespace
 
-  return matching_files;
-}
-
-
-inline bld::fs::Path_type classify(const std::filesystem::directory_entry& e)
-{
-    if (e.is_directory()) return bld::fs::Path_type::Directory;
-    if (e.is_regular_file()) return bld::fs::Path_type::File;
-    if (e.is_symlink()) return bld::fs::Path_type::Symlink;
-    return bld::fs::Path_type::Other;
-}
-
-
-inline bool walk_directory_impl(const std::string &root, bld::fs::Walk_func cb, std::size_t max_depth, void *arg)
+int bld::serve_worker(int fd, const std::string &root)
 {
-  namespace fs = std::filesystem;
+#ifndef _WIN32
+  std::string dir = root;
+  if (dir.empty())
+  {
+    std::error_code ec;
+    auto tmp = std::filesystem::temp_directory_path(ec);
+    std::string templ = ((ec ? std::filesystem::path("/tmp") : tmp) / "bld-worker-XXXXXX").string();
+    if (!::mkdtemp(templ.data()))
+    {
+      bld::internal_log(Log_type::ERR, "Failed to create worker directory: " + std::string(strerror(errno)));
+      return 1;
+    }
+    dir = templ;
+  }
+  const std::string cas = dir + "/cas";
   std::error_code ec;
-  fs::recursive_directory_iterator it(root, ec), end;
-
-  if (ec)
-    return false;
+  std::filesystem::create_directories(cas, ec);
 
-  while (it != end)
+  int ret = 0;
+  for (size_t n = 0;; ++n)
   {
-    const std::size_t level = it.depth();
-
-    if (level > max_depth)
+    std::string msg;
+    int r = _bld_wire_recv(fd, msg, 'A');
+    if (r != 1)
     {
-      it.disable_recursion_pending();
-      ++it;
-      continue;
+      ret = r == 0 ? 0 : 1;
+      break;
     }
 
-    bld::fs::Walk_fn_opt opt{
-      .path = it->path(),
-      .type = classify(*it),
-      .level = level,
-      .action = bld::fs::Walk_act::Continue,
-      .args = arg
-    };
-
-    // Callback failure propagates
-    if (!cb(opt))
-      return false;
-
-    // Normal early stop (SUCCESS)
-    if (opt.action == bld::fs::Walk_act::Stop)
-      return true;
-
-    // Skip recursion if requested
-    if (opt.action == bld::fs::Walk_act::Ignore && it->is_directory())
-      it.disable_recursion_pending();
-
-    ++it;
+    const std::string sandbox = dir + "/run-" + std::to_string(n);
+    std::filesystem::create_directories(sandbox, ec);
+    _bld_wire_reader in{std::string_view(msg).substr(1)};
+    _bld_wire_writer reply('R');
+    bool ok = _bld_worker_run(fd, in, cas, sandbox, reply);
+    std::filesystem::remove_all(sandbox, ec);
+    if (!ok || !_bld_wire_send(fd, reply))
+    {
+      bld::internal_log(Log_type::ERR, "Worker protocol error, dropping the connection");
+      ret = 1;
+      break;
+    }
   }
 
-  return true;  // normal completion
-}
-
-inline bool bld::fs::walk_directory( const std::string& path, bld::fs::Walk_func cb, std::size_t depth) { return walk_directory_impl(path, cb, depth, nullptr); }
-inline bool bld::fs::walk_directory( const std::string& path, bld::fs::Walk_func cb, void* arg) { return walk_directory_impl( path, cb, std::numeric_limits<std::size_t>::max(), arg); }
-inline bool bld::fs::walk_directory( const std::string& path, bld::fs::Walk_func cb, std::size_t depth, void* arg) { return walk_directory_impl(path, cb, depth, arg); }
-
-std::string bld::env::get(const std::string &key)
-{
-#ifdef _WIN32
-  char buffer[32767];  // Maximum size for environment variables on Windows
-  DWORD size = GetEnvironmentVariableA(key.c_str(), buffer, sizeof(buffer));
-  return size > 0 ? std::string(buffer, size) : "";
+  ::close(fd);
+  if (root.empty())
+    std::filesystem::remove_all(dir, ec);
+  return ret;
 #else
-  const char *value = std::getenv(key.c_str());
-  return value ? std::string(value) : "";
+  (void)fd;
+  (void)root;
+  bld::internal_log(Log_type::ERR, "Workers are not supported on Windows.");
+  return 1;
 #endif
 }
 
-bool bld::env::set(const std::string &key, const std::string &value)
+#ifdef __linux__
+namespace
 {
-#ifdef _WIN32
-  return SetEnvironmentVariableA(key.c_str(), value.c_str()) != 0;
-#else
-  return setenv(key.c_str(), value.c_str(), 1) == 0;
+  // The bundled worker is this binary re-executed with BLD_WORKER_FD set: it serves before main() runs, so the
+  // program itself needs no flag handling, and nothing a build script does at startup happens in the worker.
+  const int _bld_worker_entry = [] {
+    const char *fd = ::getenv("BLD_WORKER_FD");
+    if (!fd)
+      return 0;
+    int sock = std::atoi(fd);
+    ::unsetenv("BLD_WORKER_FD");  // Commands run by the worker are not workers
+    _exit(bld::serve_worker(sock));
+  }();
+}  // anonymous namespace
 #endif
-}
 
-bool bld::env::exists(const std::string &key)
+bld::Worker_executor::Worker_executor(size_t workers, const Command &worker_command)
 {
-#ifdef _WIN32
-  return GetEnvironmentVariableA(key.c_str(), nullptr, 0) > 0;
+#ifndef _WIN32
+#ifdef __linux__
+  // A plain fork would serve from a copy of a possibly multithreaded process, where another thread may have
+  // held the allocator or a logger lock at fork time. Start a fresh image of this binary instead.
+  Command command = worker_command;
+  if (command.is_empty())
+  {
+    command = Command("/proc/self/exe");
+    command.env["BLD_WORKER_FD"] = "3";
+  }
 #else
-  return std::getenv(key.c_str()) != nullptr;
+  const Command &command = worker_command;
 #endif
-}
+  _bld_argv argv;
+  if (!command.is_empty() && !_bld_prepare_argv(command, argv))
+    return;
 
-bool bld::env::unset(const std::string &key)
-{
-#ifdef _WIN32
-  return SetEnvironmentVariableA(key.c_str(), nullptr) != 0;
+  for (size_t i = 0; i < workers; ++i)
+  {
+    int sv[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+      bld::internal_log(Log_type::ERR, "Failed to create worker socket: " + std::string(strerror(errno)));
+      break;
+    }
+
+    bld::pid p = fork();
+    if (p == -1)
+    {
+      bld::internal_log(Log_type::ERR, "Failed to fork worker: " + std::string(strerror(errno)));
+      ::close(sv[0]);
+      ::close(sv[1]);
+      break;
+    }
+    if (p == 0)
+    {
+      // Sockets of earlier workers must not stay open here, they would never see EOF
+      for (const auto &c : conns) ::close(c.fd);
+      ::close(sv[0]);
+      if (command.is_empty())
+        _exit(serve_worker(sv[1]));  // Not Linux: no way to re-execute ourselves reliably
+      if (sv[1] == 3)
+        fcntl(3, F_SETFD, 0);
+      else if (::dup2(sv[1], 3) == -1)
+        _exit(EXIT_FAILURE);
+      _bld_exec_child(command, argv);
+    }
+
+    ::close(sv[1]);
+    Conn c;
+    c.fd = sv[0];
+    c.worker = p;
+    conns.push_back(c);
+  }
+  bld::internal_log(Log_type::INFO, "Started " + std::to_string(conns.size()) + " workers");
 #else
-  return unsetenv(key.c_str()) == 0;
+  (void)workers;
+  (void)worker_command;
+  bld::internal_log(Log_type::ERR, "Workers are not supported on Windows.");
 #endif
 }
 
-#if defined(__APPLE__) || defined(__FreeBSD__)
-#include <crt_externs.h>  // For `_NSGetEnviron()`
-#define ENVIRON (*_NSGetEnviron())
-#elif defined(_WIN32)
-#include <windows.h>
-#define ENVIRON nullptr  // Not used in Windows implementation
-#else
-extern char **environ;  // Standard for Linux
-#define ENVIRON environ
+bld::Worker_executor::~Worker_executor()
+{
+#ifndef _WIN32
+  for (auto &c : conns)
+  {
+    if (c.fd != -1)
+      ::close(c.fd);
+    if (c.worker > 0)
+      while (::waitpid(c.worker, nullptr, 0) == -1 && errno == EINTR) {}
+  }
 #endif
+}
 
-std::unordered_map<std::string, std::string> bld::env::get_all()
+size_t bld::Worker_executor::size() const
 {
-  std::unordered_map<std::string, std::string> env_vars;
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::count_if(conns.begin(), conns.end(), [](const Conn &c) { return c.fd != -1; });
+}
 
-#if defined(_WIN32)
-  // Windows uses `GetEnvironmentStrings()` to retrieve environment variables
-  LPWCH env_block = GetEnvironmentStringsW();
-  if (!env_block)
-    return env_vars;
+bld::Exit_status bld::Worker_executor::run(const Action &action)
+{
+  Exit_status es{false, -1};
+#ifndef _WIN32
+  auto started = std::chrono::steady_clock::now();
 
-  LPWCH env = env_block;
-  while (*env)
+  // Digest the inputs before taking a worker, hashing is the slow part
+  struct Input
   {
-    std::wstring entry(env);
-    size_t pos = entry.find(L'=');
-    if (pos != std::wstring::npos)
+    std::string path, digest;
+    bool executable;
+  };
+  std::vector<Input> inputs;
+  std::error_code ec;
+  for (const auto &path : action.inputs)
+  {
+    if (!_bld_sandboxed_path(path) || !std::filesystem::is_regular_file(path, ec))
+      continue;  // Absolute paths must exist on the worker, phony names are not files
+    Input input{std::filesystem::path(path).lexically_normal().string(), "", ::access(path.c_str(), X_OK) == 0};
+    if (!bld::hash::sha256_file(path, input.digest))
+      return es;
+    inputs.push_back(std::move(input));
+  }
+  for (const auto &output : action.outputs)
+    if (!_bld_sandboxed_path(output))
     {
-      std::string key(entry.begin(), entry.begin() + pos);
-      std::string value(entry.begin() + pos + 1, entry.end());
-      env_vars[key] = value;
+      bld::internal_log(Log_type::ERR, "Worker outputs must be relative paths below the build root: " + output);
+      return es;
     }
-    env += entry.size() + 1;  // Move to next environment variable
+  if (!action.command.cwd.empty() && !_bld_sandboxed_path(action.command.cwd))
+  {
+    bld::internal_log(Log_type::ERR, "Worker cwd must be a relative path below the build root: " + action.command.cwd);
+    return es;
   }
-  FreeEnvironmentStringsW(env_block);
 
-#else
-  // Linux, macOS, FreeBSD: Use `environ`
-  for (char **env = ENVIRON; *env; ++env)
+  _bld_wire_writer msg('A');
+  msg.u64(action.command.parts.size());
+  for (const auto &part : action.command.parts) msg.str(part);
+  msg.u64(action.command.env.size());
+  for (const auto &[key, value] : action.command.env)
   {
-    std::string entry(*env);
-    size_t pos = entry.find('=');
-    if (pos != std::string::npos)
-      env_vars[entry.substr(0, pos)] = entry.substr(pos + 1);
+    msg.str(key);
+    msg.str(value);
   }
-#endif
-  return env_vars;
-}
-
-bld::Dep::Dep(std::string target, std::vector<std::string> dependencies, bld::Command command)
-    : target(std::move(target)), dependencies(std::move(dependencies)), command(std::move(command))
-{
-}
-
-// Constructor for phony targets
-bld::Dep::Dep(std::string target, std::vector<std::string> dependencies, bool is_phony)
-    : target(std::move(target)), dependencies(std::move(dependencies)), is_phony(is_phony)
-{
-}
+  msg.u64(action.command.unset_env.size());
+  for (const auto &name : action.command.unset_env) msg.str(name);
+  msg.str(action.command.cwd);
+  msg.u64(static_cast<uint64_t>(action.command.timeout.count()));
+  msg.u64(inputs.size());
+  for (const auto &input : inputs)
+  {
+    msg.str(input.path);
+    msg.str(input.digest);
+    msg.u64(input.executable);
+  }
+  msg.u64(action.outputs.size());
+  for (const auto &output : action.outputs) msg.str(output);
 
-// Implicit conversion from initializer list for better usability
-bld::Dep::Dep(std::string target, std::initializer_list<std::string> deps, bld::Command command)
-    : target(std::move(target)), dependencies(deps), command(std::move(command))
-{
-}
+  // Take an idle worker
+  Conn *conn = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] {
+      bool alive = false;
+      for (auto &c : conns)
+      {
+        alive |= c.fd != -1;
+        if (c.fd != -1 && !c.busy)
+        {
+          conn = &c;
+          return true;
+        }
+      }
+      return !alive;
+    });
+    if (!conn)
+    {
+      bld::internal_log(Log_type::ERR, "No workers left to run: " + action.command.get_print_string());
+      return es;
+    }
+    conn->busy = true;
+  }
 
-// Copy constructor
-bld::Dep::Dep(const Dep &other) : target(other.target), dependencies(other.dependencies), command(other.command), is_phony(other.is_phony)
-{
-}
+  std::string reply;
+  bool ok = _bld_wire_send(conn->fd, msg);
+  int r = ok ? _bld_wire_recv(conn->fd, reply, 0) : -1;
+  if (r == 1 && reply[0] == 'N')
+  {
+    _bld_wire_reader need{std::string_view(reply).substr(1)};
+    std::unordered_map<std::string, const std::string *> by_digest;
+    for (const auto &input : inputs) by_digest.emplace(input.digest, &input.path);
 
-// Move constructor
-bld::Dep::Dep(Dep &&other) noexcept
-    : target(std::move(other.target)),
-      dependencies(std::move(other.dependencies)),
-      command(std::move(other.command)),
-      is_phony(other.is_phony)
-{
-}
+    _bld_wire_writer blobs('B');
+    size_t n = need.count();
+    blobs.u64(n);
+    for (size_t i = 0; i < n && need.ok; ++i)
+    {
+      auto it = by_digest.find(need.str());
+      std::string content;
+      if (it == by_digest.end() || !bld::fs::read_file(*it->second, content))
+        need.ok = false;
+      blobs.str(content);
+    }
+    ok = need.ok && _bld_wire_send(conn->fd, blobs);
+    r = ok ? _bld_wire_recv(conn->fd, reply, 'R') : -1;
+  }
 
-// Copy assignment
-bld::Dep &bld::Dep::operator=(const Dep &other)
-{
-  if (this != &other)
+  _bld_wire_reader in{std::string_view(reply).substr(r == 1 ? 1 : reply.size())};
+  if (r == 1 && reply[0] == 'R')
   {
-    target = other.target;
-    dependencies = other.dependencies;
-    command = other.command;
-    is_phony = other.is_phony;
+    es.normal = in.u64() != 0;
+    es.exit_code = static_cast<int>(static_cast<int64_t>(in.u64()));
+    es.signal = static_cast<int>(static_cast<int64_t>(in.u64()));
+    es.timed_out = in.u64() != 0;
+    std::string log = in.str();
+    if (!log.empty())
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::fwrite(log.data(), 1, log.size(), stdout);
+      std::fflush(stdout);
+    }
+    for (size_t i = 0, n = in.count(); i < n && in.ok; ++i)
+    {
+      std::string path = in.str();
+      bool present = in.u64() != 0, executable = in.u64() != 0;
+      std::string content = in.str();
+      if (in.ok && present && std::find(action.outputs.begin(), action.outputs.end(), path) != action.outputs.end() &&
+          !_bld_publish(path, content, executable ? 0755 : 0644))
+        es.normal = false;
+    }
   }
-  return *this;
-}
 
-// Move assignment
-bld::Dep &bld::Dep::operator=(Dep &&other) noexcept
-{
-  if (this != &other)
+  std::lock_guard<std::mutex> lock(mutex);
+  if (r != 1 || !in.ok)
   {
-    target = std::move(other.target);
-    dependencies = std::move(other.dependencies);
-    command = std::move(other.command);
-    is_phony = other.is_phony;
+    bld::internal_log(Log_type::ERR, "Lost worker " + std::to_string(conn->worker) + " while running: " + action.command.get_print_string());
+    ::close(conn->fd);
+    conn->fd = -1;
+    es = Exit_status{false, -1, 0};
   }
-  return *this;
+  conn->busy = false;
+  cv.notify_all();
+  es.usage.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+#else
+  (void)action;
+  bld::internal_log(Log_type::ERR, "Workers are not supported on Windows.");
+#endif
+  return es;
 }
 
-void bld::Dep_graph::add_dep(const bld::Dep &dep)
+namespace
 {
-  // We create a node and save it to map with key "File"
-  auto node = std::make_unique<Node>(dep);
-  node->dependencies = dep.dependencies;
-  nodes[dep.target] = std::move(node);
-}
+  // Entry in ac/: header, one "<perms> <digest> <size> <length>:<path>" line per output, then "sum <sha256 of everything above>".
+  constexpr const char *_bld_ac_header = "bld-ac 2\n";
 
-void bld::Dep_graph::add_phony(const std::string &target, const std::vector<std::string> &deps)
+  struct _bld_ac_record
+  {
+    unsigned perms;
+    std::string digest, path;
+    uintmax_t size;
+  };
+
+  // Verify the checksum of an entry and split it into records. `why` stays empty for a valid entry.
+  std::vector<_bld_ac_record> _bld_ac_parse(const std::string &entry, std::string &why)
+  {
+    std::vector<_bld_ac_record> records;
+    size_t sum_at = entry.rfind("sum ");
+    if (!bld::starts_with(entry, _bld_ac_header))
+    {
+      why = "unknown format";
+      return records;
+    }
+    if (sum_at == std::string::npos ||
+        bld::str::trim(entry.substr(sum_at + 4)) != bld::hash::sha256(std::string_view(entry).substr(0, sum_at)))
+    {
+      why = "checksum mismatch";
+      return records;
+    }
+
+    const size_t header = std::strlen(_bld_ac_header);
+    std::istringstream in(entry.substr(header, sum_at - header));
+    _bld_ac_record r;
+    size_t len;
+    char colon;
+    while (in >> std::oct >> r.perms >> r.digest >> std::dec >> r.size >> len >> colon)
+    {
+      r.path.resize(len);
+      if (colon != ':' || r.digest.size() != 64 || !in.read(r.path.data(), static_cast<std::streamsize>(len)))
+      {
+        why = "bad record";
+        return {};
+      }
+      records.push_back(r);
+    }
+    return records;
+  }
+}  // anonymous namespace
+
+bld::Artifact_cache::Artifact_cache(std::string dir, bool hardlink) : root(std::move(dir)), hardlink(hardlink)
 {
-  Dep phony_dep;
-  phony_dep.target = target;
-  phony_dep.dependencies = deps;
-  phony_dep.is_phony = true;
-  add_dep(phony_dep);
+  std::error_code ec;
+  std::filesystem::create_directories(root + "/cas", ec);
+  std::filesystem::create_directories(root + "/ac", ec);
+  if (ec)
+    bld::internal_log(Log_type::ERR, "Failed to create artifact cache " + root + ": " + ec.message());
 }
 
-bool bld::Dep_graph::needs_rebuild(const Node *node)
+bld::Artifact_cache::~Artifact_cache()
 {
-  if (node->dep.is_phony)
-    return true;
+  {
+    std::lock_guard<std::mutex> lock(fetch_mutex);
+    stopping = true;
+  }
+  fetch_cv.notify_all();
+  for (auto &t : fetchers) t.join();
+}
 
-  if (!std::filesystem::exists(node->dep.target))
-    return true;
+void bld::Artifact_cache::prefetch(std::vector<Action> actions)
+{
+  if (!remote || actions.empty())
+    return;
 
-  auto target_time = std::filesystem::last_write_time(node->dep.target);
+  std::lock_guard<std::mutex> lock(fetch_mutex);
+  for (auto &action : actions) pending.push_back(std::move(action));
+  while (fetchers.size() < std::max<size_t>(1, remote->connections())) fetchers.emplace_back([this] { fetch_loop(); });
+  fetch_cv.notify_all();
+}
 
-  for (const auto &dep_name : node->dep.dependencies)
+void bld::Artifact_cache::fetch_loop()
+{
+  while (true)
   {
-    auto it = nodes.find(dep_name);
-    if (it != nodes.end())
+    Action action;
     {
-      if (it->second->dep.is_phony)
-        return true;
+      std::unique_lock<std::mutex> lock(fetch_mutex);
+      fetch_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+      if (stopping)
+        return;
+      action = std::move(pending.front());
+      pending.pop_front();
     }
 
-    if (!std::filesystem::exists(dep_name))
+    std::error_code ec;
+    if (std::all_of(action.outputs.begin(), action.outputs.end(), [&](const std::string &o) { return std::filesystem::exists(o, ec); }))
+      continue;  // Probably up to date, not worth a download
+    std::string k;
+    if (!key(action, k))
+      continue;
     {
-      bld::internal_log(bld::Log_type::ERR, "Dependency missing: " + dep_name + " for target " + node->dep.target);
-      return true;
+      std::lock_guard<std::mutex> lock(fetch_mutex);
+      if (!fetching.insert(k).second)
+        continue;
     }
-
-    if (std::filesystem::last_write_time(dep_name) > target_time)
-      return true;
+    fetch(k);
+    {
+      std::lock_guard<std::mutex> lock(fetch_mutex);
+      fetching.erase(k);
+    }
+    fetch_cv.notify_all();
   }
-  return false;
 }
 
-bool bld::Dep_graph::build(const std::string &target)
+// Pull `key` and its blobs from the remote into the local cache. Blobs first, so the entry never points at nothing.
+bool bld::Artifact_cache::fetch(const std::string &key)
 {
-  std::unordered_set<std::string> visited, in_progress;
-  if (detect_cycle(target, visited, in_progress))
+  std::error_code ec;
+  if (std::filesystem::exists(entry_path(key), ec))
+    return true;
+
+  std::string entry, why;
+  if (!remote->get("ac", key, entry))
+    return false;
+  std::vector<_bld_ac_record> records = _bld_ac_parse(entry, why);
+  if (!why.empty())
   {
-    bld::internal_log(bld::Log_type::ERR, "Circular dependency detected for target: " + target);
+    bld::internal_log(Log_type::WARNING, "Ignoring remote cache entry " + key + ": " + why);
     return false;
   }
-  checked_sources.clear();
-  return build_node(target);
-}
 
-bool bld::Dep_graph::build(const Dep &dep)
-{
-  add_dep(dep);
-  return build(dep.target);
+  for (const auto &rec : records)
+  {
+    if (std::filesystem::exists(blob_path(rec.digest), ec))
+      continue;
+    std::string blob;
+    if (!remote->get("cas", rec.digest, blob))
+      return false;
+    if (bld::hash::sha256(blob) != rec.digest)
+    {
+      bld::internal_log(Log_type::WARNING, "Remote cache returned a damaged blob " + rec.digest);
+      return false;
+    }
+    if (!_bld_publish(blob_path(rec.digest), blob, 0444))
+      return false;
+  }
+  return _bld_publish(entry_path(key), entry);
 }
 
-bool bld::Dep_graph::build_all()
-{
-  bool success = true;
-  for (const auto &node : nodes)
-    if (!build(node.first))
-      success = false;
-  return success;
-}
+std::string bld::Artifact_cache::blob_path(const std::string &digest) const { return root + "/cas/" + digest.substr(0, 2) + "/" + digest; }
 
-bool bld::Dep_graph::F_build_all()
+std::string bld::Artifact_cache::entry_path(const std::string &key) const { return root + "/ac/" + key.substr(0, 2) + "/" + key; }
+
+bool bld::Artifact_cache::key(const Action &action, std::string &key) const
 {
-  checked_sources.clear();
-  bool success = true;
-  for (const auto &node : nodes)
-    if (!build(node.first))
-      success = false;
-  return success;
+  // Length prefixed fields, so no two different actions serialize the same
+  std::string text = _bld_ac_header;
+  auto field = [&text](std::string_view s) { text.append(std::to_string(s.size())).append(":").append(s); };
+  auto list = [&](std::vector<std::string> v)
+  {
+    std::sort(v.begin(), v.end());
+    text += std::to_string(v.size()) + "\n";
+    for (const auto &e : v) field(e);
+  };
+
+  text += "argv " + std::to_string(action.command.parts.size()) + "\n";
+  for (const auto &part : action.command.parts) field(part);
+  std::vector<std::string> env;
+  for (const auto &[k, v] : action.command.env) env.push_back(k + "=" + v);
+  text += "\nenv ";
+  list(std::move(env));
+  text += "\nunset ";
+  list(action.command.unset_env);
+  text += "\ncwd ";
+  field(action.command.cwd);
+  text += "\noutputs ";
+  for (const auto &output : action.outputs) field(output);
+
+  text += "\ninputs\n";
+  std::error_code ec;
+  for (const auto &input : action.inputs)
+  {
+    field(input);
+    std::string digest = "absent";
+    if (std::filesystem::is_regular_file(input, ec))
+    {
+      if (!bld::hash::sha256_file(input, digest))
+        return false;
+    }
+    else if (std::filesystem::exists(input, ec))
+      digest = "not-a-file";
+    text += " " + digest + "\n";
+  }
+
+  key = bld::hash::sha256(text);
+  return true;
 }
 
-bool bld::Dep_graph::build_node(const std::string &target)
+bool bld::Artifact_cache::restore(const std::string &key, const std::vector<std::string> &outputs)
 {
-  auto it = nodes.find(target);
-  if (it == nodes.end())
+  std::error_code ec;
+  if (remote && !std::filesystem::exists(entry_path(key), ec))
   {
-    if (std::filesystem::exists(target))
+    // A prefetch thread may be downloading it right now
     {
-      if (checked_sources.find(target) == checked_sources.end())
-      {
-        bld::internal_log(bld::Log_type::INFO, "Using existing source file: " + target);
-        checked_sources.insert(target);
-      }
-      return true;
+      std::unique_lock<std::mutex> lock(fetch_mutex);
+      fetch_cv.wait(lock, [&] { return !fetching.count(key); });
     }
-    bld::internal_log(bld::Log_type::ERR, "Target not found: " + target);
+    fetch(key);
+  }
+
+  std::string entry;
+  std::ifstream file(entry_path(key), std::ios::binary);
+  if (!file)
+  {
+    ++n_misses;
     return false;
   }
+  entry.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
 
-  Node *node = it->second.get();
-  if (node->checked)  // Skip if we've already checked this node
-    return true;
+  auto corrupt = [&](const std::string &why)
+  {
+    bld::internal_log(Log_type::WARNING, "Dropping corrupt cache entry " + key + ": " + why);
+    std::error_code ec;
+    std::filesystem::remove(entry_path(key), ec);
+    ++n_misses;
+    return false;
+  };
 
-  // First build all dependencies
-  for (const auto &dep : node->dependencies)
-    if (!build_node(dep))
-      return false;
+  std::string why;
+  std::vector<_bld_ac_record> records = _bld_ac_parse(entry, why);
+  if (!why.empty())
+    return corrupt(why);
+  if (records.size() != outputs.size())
+    return corrupt("output list changed");
 
-  // Check if we need to rebuild
-  if (!needs_rebuild(node))
+  for (const auto &rec : records)
   {
-    bld::internal_log(bld::Log_type::INFO, "Target up to date: " + target);
-    node->checked = true;
-    return true;
+    if (std::find(outputs.begin(), outputs.end(), rec.path) == outputs.end())
+      return corrupt("output list changed");
+
+    // Blobs were hashed on the way in. A truncated one would poison every restore, so the size is always checked.
+    std::string blob = blob_path(rec.digest), digest;
+    uintmax_t size = std::filesystem::file_size(blob, ec);
+    if (ec || (verify && !bld::hash::sha256_file(blob, digest)))
+    {
+      ++n_misses;
+      return false;
+    }
+    if (size != rec.size || (verify && digest != rec.digest))
+    {
+      std::filesystem::remove(blob, ec);
+      return corrupt("blob " + rec.digest + " damaged");
+    }
   }
 
-  // Execute build command if not phony
-  if (!node->dep.is_phony && !node->dep.command.is_empty())
+  for (const auto &rec : records)
   {
-    bld::internal_log(bld::Log_type::INFO, "Building target: " + target);
-    if (execute(node->dep.command) <= 0)
+    auto parent = std::filesystem::path(rec.path).parent_path();
+    if (!parent.empty())
+      std::filesystem::create_directories(parent, ec);
+
+    // Reflink, then hard link if allowed, then a real copy. A link shares the blob's inode and so its 0444 mode,
+    // executables are copied instead so they keep their exec bits.
+    const std::string blob = blob_path(rec.digest), tmp = _bld_temp_sibling(rec.path);
+    bool copied = _bld_clone_file(blob, tmp, true), copied_data = copied;
+    if (!copied && hardlink && (rec.perms & 0111) == 0)
     {
-      bld::internal_log(bld::Log_type::ERR, "Failed to build target: " + target);
+      std::filesystem::create_hard_link(blob, tmp, ec);
+      copied = !ec;
+    }
+    if (!copied)
+      copied = copied_data = _bld_clone_file(blob, tmp);
+    if (copied_data)
+      std::filesystem::permissions(tmp, static_cast<std::filesystem::perms>(rec.perms), ec);
+    if (!copied)
+    {
+      bld::internal_log(Log_type::ERR, "Failed to restore " + rec.path + " from the cache");
+      std::filesystem::remove(tmp, ec);
+      ++n_misses;
+      return false;
+    }
+    std::filesystem::rename(tmp, rec.path, ec);
+    if (ec)
+    {
+      bld::internal_log(Log_type::ERR, "Failed to restore " + rec.path + ": " + ec.message());
+      std::filesystem::remove(tmp, ec);
+      ++n_misses;
       return false;
     }
+    // A link keeps the blob's old mtime, so the next needs_rebuild() would ask for it again. Copies are fresh already.
+    if (!copied_data)
+    {
+#ifndef _WIN32
+      ::utimensat(AT_FDCWD, rec.path.c_str(), nullptr, 0);  // Kernel clock, comparable with the inputs' mtimes
+#else
+      std::filesystem::last_write_time(rec.path, std::filesystem::file_time_type::clock::now(), ec);
+#endif
+    }
   }
-  else if (node->dep.is_phony)
-    bld::internal_log(bld::Log_type::INFO, "Phony target: " + target);
-  else
-    bld::internal_log(bld::Log_type::WARNING, "No command for target: " + target);
 
-  node->checked = true;
+  ++n_hits;
   return true;
 }
 
-bool bld::Dep_graph::detect_cycle(const std::string &target, std::unordered_set<std::string> &visited,
-                                  std::unordered_set<std::string> &in_progress)
+bool bld::Artifact_cache::store(const std::string &key, const std::vector<std::string> &outputs)
 {
-  if (in_progress.find(target) != in_progress.end())
-    return true;  // Cycle detected
-
-  if (visited.find(target) != visited.end())
-    return false;  // Already processed
+  std::string entry = _bld_ac_header;
+  std::vector<std::string> blobs;
+  std::error_code ec;
+  for (const auto &output : outputs)
+  {
+    std::string digest;
+    if (!std::filesystem::is_regular_file(output, ec) || !bld::hash::sha256_file(output, digest))
+    {
+      bld::internal_log(Log_type::WARNING, "Not caching, output missing: " + output);
+      return false;
+    }
+    unsigned perms = static_cast<unsigned>(std::filesystem::status(output, ec).permissions() & std::filesystem::perms::mask);
 
-  auto it = nodes.find(target);
-  if (it == nodes.end())
-    return false;  // Target doesn't exist
+    const std::string blob = blob_path(digest);
+    blobs.push_back(digest);
+    if (!std::filesystem::exists(blob, ec))
+    {
+      // Same content, same name: racing writers all rename identical files into place
+      std::filesystem::create_directories(std::filesystem::path(blob).parent_path(), ec);
+      const std::string tmp = _bld_temp_sibling(blob);
+      if (!_bld_clone_file(output, tmp))
+      {
+        bld::internal_log(Log_type::ERR, "Failed to store " + output + " in the cache");
+        std::filesystem::remove(tmp, ec);
+        return false;
+      }
+      // Restores trust the blob from here on. The output may have been rewritten since it was hashed.
+      std::string copied;
+      if (!bld::hash::sha256_file(tmp, copied) || copied != digest)
+      {
+        bld::internal_log(Log_type::WARNING, "Not caching, output changed while it was stored: " + output);
+        std::filesystem::remove(tmp, ec);
+        return false;
+      }
+      std::filesystem::permissions(tmp, std::filesystem::perms::owner_read | std::filesystem::perms::group_read | std::filesystem::perms::others_read,
+                                   ec);
+      std::filesystem::rename(tmp, blob, ec);
+      if (ec)
+      {
+        std::filesystem::remove(tmp, ec);
+        return false;
+      }
+    }
 
-  in_progress.insert(target);
+    char mode[16];
+    std::snprintf(mode, sizeof(mode), "%o", perms);
+    uintmax_t size = std::filesystem::file_size(blob, ec);
+    if (ec)
+      return false;
+    entry += std::string(mode) + " " + digest + " " + std::to_string(size) + " " + std::to_string(output.size()) + ":" + output + "\n";
+  }
+  entry += "sum " + bld::hash::sha256(entry) + "\n";
 
-  for (const auto &dep : it->second->dependencies)
-    if (detect_cycle(dep, visited, in_progress))
-      return true;
+  if (!_bld_publish(entry_path(key), entry))
+    return false;
 
-  in_progress.erase(target);
-  visited.insert(target);
-  return false;
+  // The entry goes up only after all of its blobs were stored
+  if (remote)
+  {
+    std::vector<std::pair<std::string, std::string>> files;
+    for (const auto &digest : blobs) files.emplace_back(digest, blob_path(digest));
+    remote->upload("ac", key, entry_path(key), std::move(files));
+  }
+  return true;
 }
 
-struct BuildState
-{
-    int pending_dependencies = 0;
-    std::vector<std::string> parents;
-};
-
-bool bld::Dep_graph::build_parallel(const std::string &root_target, size_t thread_count)
+namespace
 {
-  // 1. Thread Count Validation
-  size_t hw_conc = std::thread::hardware_concurrency();
-  if (thread_count > hw_conc && hw_conc > 0) thread_count = hw_conc;
-  if (thread_count == 0) thread_count = 1;
-
-  // 2. Cycle Detection (Global check before starting)
-  std::unordered_set<std::string> visited_cycle, in_progress_cycle;
-  if (detect_cycle(root_target, visited_cycle, in_progress_cycle))
+#ifndef _WIN32
+  // One HTTP/1.1 message. Header names are lower case.
+  struct _bld_http_msg
   {
-    bld::internal_log(bld::Log_type::ERR, "Circular dependency detected for target: " + root_target);
-    return false;
-  }
-
-  bld::internal_log(bld::Log_type::INFO, "Starting parallel build with " + std::to_string(thread_count) + " threads.");
-
-  // 3. Build Topology (Subgraph Analysis)
-  // We create a local map of build states for the relevant subgraph.
-  // This avoids processing the entire graph if we only want to build a specific target.
-  std::unordered_map<std::string, BuildState> build_map;
-  std::vector<std::string> topological_queue_init;
-  
-  // Helper to populate build_map using DFS
-  std::function<void(const std::string&)> prepare_topology = 
-    [&](const std::string& current) {
-      if (build_map.find(current) != build_map.end()) return; // Already visited
-      
-      // Ensure node exists in graph (if it's a source file, we ignore it in the map)
-      auto it = nodes.find(current);
-      if (it == nodes.end()) return; 
-
-      // Initialize entry
-      build_map[current]; 
-
-      for (const auto& dep : it->second->dependencies) {
-        // Recurse first to build the graph bottom-up
-        prepare_topology(dep);
-
-        // If the dependency is also a managed Node (not just a source file)
-        if (nodes.count(dep)) {
-            build_map[current].pending_dependencies++;
-            build_map[dep].parents.push_back(current);
-        }
-      }
+    std::string start;
+    std::unordered_map<std::string, std::string> headers;
+    std::string body;
+    bool until_close = false;  // Body ran to the end of the connection, it cannot be reused
   };
 
-  prepare_topology(root_target);
-
-  // 4. Initialize Ready Queue
-  // Add all nodes with 0 pending dependencies (leaves in the dependency tree)
-  std::queue<std::string> ready_queue;
-  for (auto& [name, state] : build_map) {
-      if (state.pending_dependencies == 0) {
-          ready_queue.push(name);
-      }
+  // Receive until `buf` holds at least `n` bytes
+  bool _bld_http_fill(int fd, std::string &buf, size_t n)
+  {
+    char tmp[64 * 1024];
+    while (buf.size() < n)
+    {
+      ssize_t r = ::recv(fd, tmp, sizeof(tmp), 0);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        return false;
+      buf.append(tmp, static_cast<size_t>(r));
+    }
+    return true;
   }
 
-  // 5. Worker Synchronization Primitives
-  std::mutex queue_mutex;
-  std::condition_variable cv;
-  std::atomic<bool> build_failed{false};
-  std::atomic<int> active_workers{0};
-  
-  // Total tasks to track completion
-  size_t total_tasks_remaining = build_map.size();
-
-  // 6. The Worker Function
-  auto worker = [&]() {
-    while (true) {
-      std::string current_target;
-      
-      {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        
-        // Wait until there is work, or failure, or all tasks are done
-        cv.wait(lock, [&] {
-             return !ready_queue.empty() || build_failed || (active_workers == 0 && total_tasks_remaining == 0);
-        });
+  // Cut the next CRLF terminated line off `buf`
+  bool _bld_http_line(int fd, std::string &buf, std::string &line)
+  {
+    size_t end;
+    while ((end = buf.find("\r\n")) == std::string::npos)
+      if (buf.size() > 64 * 1024 || !_bld_http_fill(fd, buf, buf.size() + 1))
+        return false;
+    line = buf.substr(0, end);
+    buf.erase(0, end + 2);
+    return true;
+  }
 
-        if (build_failed) return;
-        
-        // If queue is empty here, it means we woke up because everything is done
-        if (ready_queue.empty()) return;
+  /* Read one message. `buf` carries bytes received past the previous message of a keep-alive connection.
+   * 1 = message read, 0 = connection closed before a new message, -1 = error, -2 = body larger than `max_body`
+   */
+  int _bld_http_read(int fd, std::string &buf, _bld_http_msg &msg, bool response, size_t max_body = SIZE_MAX)
+  {
+    size_t end;
+    while ((end = buf.find("\r\n\r\n")) == std::string::npos)
+    {
+      size_t had = buf.size();
+      if (had > 64 * 1024)
+        return -1;
+      if (!_bld_http_fill(fd, buf, had + 1))
+        return had == 0 ? 0 : -1;
+    }
 
-        current_target = ready_queue.front();
-        ready_queue.pop();
-        active_workers++;
-      }
+    std::istringstream head(buf.substr(0, end + 2));
+    buf.erase(0, end + 4);
+    std::getline(head, msg.start);
+    msg.start = bld::str::trim(msg.start);
+    for (std::string line; std::getline(head, line);)
+    {
+      size_t colon = line.find(':');
+      if (colon == std::string::npos)
+        continue;
+      std::string name = line.substr(0, colon);
+      std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+      msg.headers[name] = bld::str::trim(line.substr(colon + 1));
+    }
 
-      // Processing Step
-      Node* node = nodes[current_target].get();
-      bool success = true;
+    if (response)
+    {
+      int status = std::atoi(msg.start.c_str() + std::min(msg.start.size(), msg.start.find(' ') + 1));
+      if (status / 100 == 1 || status == 204 || status == 304)
+        return 1;
+    }
 
-      try {
-          // Double-check rebuild logic now that dependencies are guaranteed ready
-          if (needs_rebuild(node)) {
-             if (node->dep.is_phony) {
-                 bld::internal_log(bld::Log_type::INFO, "Processing phony target: " + current_target);
-             } else if (!node->dep.command.is_empty()) {
-                 {
-                    // Minimal lock for logging to prevent garbled output
-                    // (Assuming internal_log isn't thread-safe, otherwise remove lock)
-                     bld::internal_log(bld::Log_type::INFO, "Building: " + current_target);
-                 }
-                 
-                 if (execute(node->dep.command) <= 0) {
-                     bld::internal_log(bld::Log_type::ERR, "Build failed for: " + current_target);
-                     success = false;
-                 }
-             }
-          } else {
-             // Optional: Log up-to-date
-             // bld::internal_log(bld::Log_type::INFO, "Up-to-date: " + current_target);
-          }
-      } catch (const std::exception& e) {
-          bld::internal_log(bld::Log_type::ERR, "Exception building " + current_target + ": " + e.what());
-          success = false;
+    auto te = msg.headers.find("transfer-encoding");
+    auto cl = msg.headers.find("content-length");
+    if (te != msg.headers.end() && te->second.find("chunked") != std::string::npos)
+    {
+      std::string line;
+      while (true)
+      {
+        if (!_bld_http_line(fd, buf, line))
+          return -1;
+        size_t n = std::strtoull(line.c_str(), nullptr, 16);
+        if (n == 0)
+          break;
+        if (n > max_body - msg.body.size())
+          return -2;
+        if (!_bld_http_fill(fd, buf, n + 2))
+          return -1;
+        msg.body.append(buf, 0, n);
+        buf.erase(0, n + 2);
       }
+      do  // Trailers up to the empty line
+        if (!_bld_http_line(fd, buf, line))
+          return -1;
+      while (!line.empty());
+    }
+    else if (cl != msg.headers.end())
+    {
+      size_t n = std::strtoull(cl->second.c_str(), nullptr, 10);
+      if (n > max_body)
+        return -2;  // Before allocating any of it
+      if (!_bld_http_fill(fd, buf, n))
+        return -1;
+      msg.body = buf.substr(0, n);
+      buf.erase(0, n);
+    }
+    else if (response)
+    {
+      char tmp[64 * 1024];
+      ssize_t r;
+      while ((r = ::recv(fd, tmp, sizeof(tmp), 0)) > 0 || (r < 0 && errno == EINTR))
+        if (r > 0)
+          buf.append(tmp, static_cast<size_t>(r));
+      msg.body = std::move(buf);
+      buf.clear();
+      msg.until_close = true;
+    }
+    return 1;
+  }
 
-      // Completion Handling
-      {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        active_workers--;
-        
-        if (!success) {
-            build_failed = true;
-            cv.notify_all(); // Wake everyone to exit
-            return;
-        }
+  void _bld_socket_timeout(int fd, std::chrono::milliseconds timeout)
+  {
+    struct timeval tv;
+    tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
 
-        total_tasks_remaining--;
+  int _bld_tcp_connect(const std::string &host, const std::string &port, std::chrono::milliseconds timeout)
+  {
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (int err = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &res); err != 0)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to resolve " + host + ": " + gai_strerror(err));
+      return -1;
+    }
 
-        // Notify parents (Dependents)
-        // Since we are using a local map, we don't need to scan 'nodes'
-        auto& state = build_map[current_target];
-        for (const auto& parent_name : state.parents) {
-            build_map[parent_name].pending_dependencies--;
-            if (build_map[parent_name].pending_dependencies == 0) {
-                ready_queue.push(parent_name);
-            }
-        }
-        
-        // Notify other threads that new work might be available or we are done
-        cv.notify_all();
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd == -1; ai = ai->ai_next)
+    {
+      fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if (fd == -1)
+        continue;
+      _bld_socket_timeout(fd, timeout);  // Also bounds connect() on Linux
+      if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+      {
+        ::close(fd);
+        fd = -1;
       }
     }
-  };
+    ::freeaddrinfo(res);
+    if (fd == -1)
+    {
+      bld::internal_log(bld::Log_type::ERR, "Failed to connect to " + host + ":" + port + ": " + std::string(strerror(errno)));
+      return -1;
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // Small requests, don't wait for ACKs
+    return fd;
+  }
 
-  // 7. Spawn and Join
-  std::vector<std::thread> threads;
-  for (size_t i = 0; i < thread_count; ++i) {
-      threads.emplace_back(worker);
+  // Hex digest of reasonable length, the only names the cache server accepts
+  bool _bld_cache_name(const std::string &s)
+  {
+    return !s.empty() && s.size() <= 128 && s.find_first_not_of("0123456789abcdef") == std::string::npos;
   }
+#endif
+}  // anonymous namespace
 
-  for (auto& t : threads) {
-      if (t.joinable()) t.join();
+bld::Remote_cache::Remote_cache(const std::string &url, size_t connections) : max_idle(connections)
+{
+  const std::string scheme = "http://";
+  if (!bld::starts_with(url, scheme))
+  {
+    bld::internal_log(Log_type::ERR, "Remote cache needs an http:// URL: " + url);
+    return;
   }
+  std::string rest = url.substr(scheme.size());
+  size_t slash = rest.find('/');
+  std::string authority = rest.substr(0, slash);
+  prefix = slash == std::string::npos ? "" : rest.substr(slash);
+  while (!prefix.empty() && prefix.back() == '/') prefix.pop_back();
 
-  return !build_failed;
+  size_t colon = authority.rfind(':');
+  if (colon != std::string::npos && authority.find(']', colon) == std::string::npos)
+  {
+    port = authority.substr(colon + 1);
+    authority.resize(colon);
+  }
+  else
+    port = "80";
+  if (authority.size() > 2 && authority.front() == '[' && authority.back() == ']')
+    authority = authority.substr(1, authority.size() - 2);
+  host = authority;
 }
 
-bool bld::Dep_graph::prepare_build_graph(const std::string &target, std::queue<std::string> &ready_targets)
+bld::Remote_cache::~Remote_cache()
 {
-  auto it = nodes.find(target);
-  if (it == nodes.end())
+  flush();
   {
-    if (std::filesystem::exists(target))
+    std::lock_guard<std::mutex> lock(upload_mutex);
+    stopping = true;
+  }
+  upload_cv.notify_all();
+  if (uploader.joinable())
+    uploader.join();
+#ifndef _WIN32
+  for (auto &c : idle) ::close(c.fd);
+#endif
+}
+
+bool bld::Remote_cache::request(const std::string &method, const std::string &path, const std::string &body, int &status,
+                                std::string &response)
+{
+#ifndef _WIN32
+  // An IPv6 literal needs its brackets back, or the port would read as part of the address
+  const std::string authority = host.find(':') != std::string::npos ? "[" + host + "]:" + port : host + ":" + port;
+  std::string req = method + " " + prefix + path + " HTTP/1.1\r\nHost: " + authority + "\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\n\r\n";
+
+  // A reused connection may have been closed by the server meanwhile, retry those once on a fresh one
+  for (int attempt = 0; attempt < 2; ++attempt)
+  {
+    Conn c;
+    bool reused = false;
     {
-      if (checked_sources.find(target) == checked_sources.end())
+      std::lock_guard<std::mutex> lock(conn_mutex);
+      if (attempt == 0 && !idle.empty())
       {
-        bld::internal_log(bld::Log_type::INFO, "Using existing source file: " + target);
-        checked_sources.insert(target);
+        c = std::move(idle.back());
+        idle.pop_back();
+        reused = true;
       }
-      return true;
     }
-    bld::internal_log(bld::Log_type::ERR, "Target not found: " + target);
-    return false;
-  }
+    if (!reused && (c.fd = _bld_tcp_connect(host, port, timeout)) == -1)
+      return false;
 
-  auto node = it->second.get();
-  if (node->visited)
+    _bld_http_msg msg;
+    bool sent = _bld_send_all(c.fd, req) && _bld_send_all(c.fd, body);
+    if (!sent || _bld_http_read(c.fd, c.buf, msg, true) != 1)
+    {
+      ::close(c.fd);
+      if (reused)
+        continue;
+      bld::internal_log(Log_type::ERR, "Remote cache request failed: " + method + " " + prefix + path);
+      return false;
+    }
+
+    status = std::atoi(msg.start.c_str() + std::min(msg.start.size(), msg.start.find(' ') + 1));
+    response = std::move(msg.body);
+
+    auto conn = msg.headers.find("connection");
+    bool keep = !msg.until_close && (conn == msg.headers.end() || conn->second != "close") && !bld::starts_with(msg.start, "HTTP/1.0");
+    std::lock_guard<std::mutex> lock(conn_mutex);
+    if (keep && idle.size() < max_idle)
+      idle.push_back(std::move(c));
+    else
+      ::close(c.fd);
     return true;
-  node->visited = true;
+  }
+  return false;
+#else
+  (void)method, (void)path, (void)body, (void)status, (void)response;
+  bld::internal_log(Log_type::ERR, "Remote cache is not supported on Windows.");
+  return false;
+#endif
+}
 
-  // Process dependencies
-  for (const auto &dep : node->dependencies)
+bool bld::Remote_cache::get(const std::string &kind, const std::string &hash, std::string &body)
+{
+  int status = 0;
+  if (!ok() || !request("GET", "/" + kind + "/" + hash, "", status, body))
+    return false;
+  if (status != 200 && status != 404)
+    bld::internal_log(Log_type::WARNING, "Remote cache GET /" + kind + "/" + hash + " answered " + std::to_string(status));
+  return status == 200;
+}
+
+bool bld::Remote_cache::put(const std::string &kind, const std::string &hash, const std::string &body)
+{
+  int status = 0;
+  std::string response;
+  if (!ok() || !request("PUT", "/" + kind + "/" + hash, body, status, response))
+    return false;
+  if (status / 100 != 2)
   {
-    if (!prepare_build_graph(dep, ready_targets))
-      return false;
+    bld::internal_log(Log_type::WARNING, "Remote cache PUT /" + kind + "/" + hash + " answered " + std::to_string(status));
+    return false;
+  }
+  return true;
+}
 
-    // Only track node dependencies that actually need rebuilding
-    if (nodes.find(dep) != nodes.end() && needs_rebuild(nodes[dep].get()))
-      node->waiting_on.push_back(dep);
+void bld::Remote_cache::upload(const std::string &kind, const std::string &hash, const std::string &file,
+                               std::vector<std::pair<std::string, std::string>> blobs)
+{
+  if (!ok())
+    return;
+  std::lock_guard<std::mutex> lock(upload_mutex);
+  uploads.push_back({kind, hash, file, std::move(blobs)});
+  if (!uploader.joinable())
+    uploader = std::thread([this] { upload_loop(); });
+  upload_cv.notify_all();
+}
+
+void bld::Remote_cache::flush()
+{
+  std::unique_lock<std::mutex> lock(upload_mutex);
+  upload_cv.wait(lock, [this] { return uploads.empty() && uploading == 0; });
+}
+
+void bld::Remote_cache::upload_loop()
+{
+  std::unique_lock<std::mutex> lock(upload_mutex);
+  while (true)
+  {
+    upload_cv.wait(lock, [this] { return stopping || !uploads.empty(); });
+    if (uploads.empty())
+      return;  // Stopping, and nothing left
+    Upload up = std::move(uploads.front());
+    uploads.pop_front();
+    ++uploading;
+    lock.unlock();
+
+    // An entry whose blobs did not all make it would be a remote hit that cannot be restored
+    bool blobs_ok = true;
+    std::string body;
+    for (const auto &[digest, file] : up.blobs)
+      blobs_ok = blobs_ok && bld::fs::read_file(file, body) && put("cas", digest, body);
+    if (!blobs_ok)
+      bld::internal_log(Log_type::WARNING, "Not uploading " + up.kind + "/" + up.hash + ", a blob it refers to failed to upload");
+    else if (bld::fs::read_file(up.file, body))
+      put(up.kind, up.hash, body);
+
+    lock.lock();
+    --uploading;
+    upload_cv.notify_all();
+  }
+}
+
+bld::Cache_server::Cache_server(std::string dir, uint16_t port, const std::string &host) : root(std::move(dir)), address(host)
+{
+#ifndef _WIN32
+  std::error_code ec;
+  std::filesystem::create_directories(root, ec);
+
+  struct addrinfo hints = {}, *res = nullptr;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || !res)
+  {
+    bld::internal_log(Log_type::ERR, "Cache server: cannot resolve " + host);
+    return;
   }
+  int fd = ::socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  if (fd != -1)
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd == -1 || ::bind(fd, res->ai_addr, res->ai_addrlen) == -1 || ::listen(fd, 64) == -1 || ::pipe2(wake, O_CLOEXEC) == -1)
+  {
+    bld::internal_log(Log_type::ERR, "Cache server: cannot listen on " + host + ":" + std::to_string(port) + ": " + std::string(strerror(errno)));
+    if (fd != -1)
+      ::close(fd);
+    ::freeaddrinfo(res);
+    return;
+  }
+  ::freeaddrinfo(res);
 
-  // Only add to ready queue if NEEDS rebuild and dependencies are met
-  if (node->waiting_on.empty() && needs_rebuild(node))
-    ready_targets.push(target);
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  ::getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+  bound_port = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<struct sockaddr_in6 *>(&addr)->sin6_port
+                                                : reinterpret_cast<struct sockaddr_in *>(&addr)->sin_port);
+  listen_fd = fd;
+  acceptor = std::thread([this] { accept_loop(); });
+  bld::internal_log(Log_type::INFO, "Cache server listening on " + url());
+#else
+  (void)port;
+  bld::internal_log(Log_type::ERR, "Cache server is not supported on Windows.");
+#endif
+}
 
-  return true;
+bld::Cache_server::~Cache_server() { stop(); }
+
+std::string bld::Cache_server::url() const
+{
+  return "http://" + (address.find(':') != std::string::npos ? "[" + address + "]" : address) + ":" + std::to_string(bound_port);
 }
 
-void bld::Dep_graph::process_completed_target(const std::string &target, std::queue<std::string> &ready_targets, std::mutex &queue_mutex,
-                                              std::condition_variable &cv)
+void bld::Cache_server::stop()
 {
-  std::lock_guard<std::mutex> lock(queue_mutex);
-  nodes[target]->checked = true;
-  nodes[target]->in_progress = false;
+#ifndef _WIN32
+  if (listen_fd == -1)
+    return;
+  char c = 0;
+  while (::write(wake[1], &c, 1) == -1 && errno == EINTR) {}
+  acceptor.join();
 
-  // Find all nodes that were waiting on this target
-  for (const auto &node_pair : nodes)
+  std::vector<Client> finishing;
   {
-    auto &node = node_pair.second;
-    if (!node->checked && !node->in_progress)
-    {
-      auto &waiting = node->waiting_on;
-      waiting.erase(std::remove(waiting.begin(), waiting.end(), target), waiting.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &client : clients)
+      if (!*client.done)
+        ::shutdown(client.fd, SHUT_RDWR);  // Unblocks their reads
+    finishing = std::move(clients);
+    clients.clear();
+  }
+  for (auto &client : finishing) client.thread.join();
 
-      // If no more dependencies, add to ready queue
-      if (waiting.empty())
-        ready_targets.push(node_pair.first);
+  ::close(listen_fd);
+  ::close(wake[0]);
+  ::close(wake[1]);
+  listen_fd = -1;
+#endif
+}
+
+void bld::Cache_server::accept_loop()
+{
+#ifndef _WIN32
+  struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+  while (true)
+  {
+    if (::poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
     }
+    if (fds[1].revents)
+      break;
+
+    int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1)
+      continue;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // Forget finished connections so a long running server does not pile up threads
+    for (size_t i = 0; i < clients.size();)
+      if (*clients[i].done)
+      {
+        clients[i].thread.join();
+        clients[i] = std::move(clients.back());
+        clients.pop_back();
+      }
+      else
+        ++i;
+
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    clients.push_back({fd, std::thread([this, fd, done] {
+                         serve(fd);
+                         std::lock_guard<std::mutex> lock(mutex);
+                         ::close(fd);
+                         *done = true;  // Under the lock, so stop() never shuts down a recycled fd number
+                       }),
+                       done});
   }
+#endif
 }
 
-bool bld::Dep_graph::build_all_parallel(size_t thread_count)
+void bld::Cache_server::serve(int fd)
 {
-  std::vector<std::string> root_targets;
-  // Identify nodes that are not dependencies of any other node
-  for (const auto &node : nodes)
+#ifndef _WIN32
+  std::string buf;
+  while (true)
   {
-    bool is_dependency = false;
-    for (const auto &other : nodes)
+    _bld_http_msg req;
+    int got = _bld_http_read(fd, buf, req, false, max_body);
+    if (got == -2)
+    {
+      // The body is still on its way, the connection cannot be reused
+      _bld_send_all(fd, "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+      return;
+    }
+    if (got != 1)
+      return;
+
+    std::istringstream start(req.start);
+    std::string method, target;
+    start >> method >> target;
+
+    // Accept any prefix, the last two segments are kind and name
+    size_t name_at = target.rfind('/');
+    size_t kind_at = name_at == std::string::npos || name_at == 0 ? std::string::npos : target.rfind('/', name_at - 1);
+    std::string kind = kind_at == std::string::npos ? "" : target.substr(kind_at + 1, name_at - kind_at - 1);
+    std::string name = name_at == std::string::npos ? "" : target.substr(name_at + 1);
+
+    int status = 200;
+    std::string body;
+    if ((kind != "ac" && kind != "cas") || !_bld_cache_name(name))
+      status = 400;
+    else
     {
-      if (std::find(other.second->dep.dependencies.begin(), other.second->dep.dependencies.end(), node.first) !=
-          other.second->dep.dependencies.end())
+      // Same fan-out as Artifact_cache, so the directory works as a local cache too
+      const std::string path = root + "/" + kind + "/" + name.substr(0, 2) + "/" + name;
+      if (method == "GET")
       {
-        is_dependency = true;
-        break;
+        if (!bld::fs::read_file(path, body))
+          status = 404;
+      }
+      else if (method == "PUT")
+      {
+        if (kind == "cas" && name.size() == 64 && bld::hash::sha256(req.body) != name)
+          status = 400;  // Not the content it claims to be
+        else if (!_bld_publish(path, req.body, kind == "cas" ? 0444 : 0))
+          status = 500;
       }
+      else
+        status = 405;
     }
-    if (!is_dependency)
-      root_targets.push_back(node.first);
-  }
 
-  if (root_targets.empty() && !nodes.empty()) {
-      // Edge case: Disconnected cycles or weird graph, pick arbitrary or fail
-      // For now, let's just pick the first one to try and unblock
-      root_targets.push_back(nodes.begin()->first);
+    const char *reason = status == 200 ? "OK" : status == 404 ? "Not Found" : status == 405 ? "Method Not Allowed" : status == 400 ? "Bad Request"
+                                                                                                                     : "Internal Server Error";
+    std::string resp = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    if (!_bld_send_all(fd, resp + body))
+      return;
   }
-
-  // Create a temporary master phony target
-  std::string master = "__master_parallel_root__";
-  add_phony(master, root_targets);
-  
-  bool result = build_parallel(master, thread_count);
-
-  nodes.erase(master);
-  return result;
+#else
+  (void)fd;
+#endif
 }
 
 std::string bld::str::trim(const std::string &str)
@@ -4317,11 +12253,11 @@ std::string bld::str::replace_all(const std::string &str, const std::string &fro
 
 std::string read_clean_source(const std::filesystem::path &path)
 {
-  std::ifstream file(path);
+  bld::fs::Mapped_file file(path.string());
   if (!file)
     return "";
 
-  std::string src((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::string_view src = file.view();
   std::string clean;
   clean.reserve(src.size());
 
@@ -4382,31 +12318,27 @@ std::vector<bld::fs::Cpp_module> bld::fs::scan_modules(const std::string& path)
   std::vector<bld::fs::Cpp_module> modules;
 
   bld::fs::walk_directory(path, [&](bld::fs::Walk_fn_opt &opt) -> bool {
-    if (!std::filesystem::is_regular_file(opt.path) || opt.path.extension() != ".cppm")
+    if (opt.type != bld::fs::Path_type::File || opt.path.extension() != ".cppm")
       return true;
 
     std::string content = read_clean_source(opt.path);
     if (content.empty())
       return true;
 
-    // Tokenize
-    std::vector<std::string> tokens;
-    std::string token;
-    for (char c : content)
+    // Tokenize, views into `content`
+    std::vector<std::string_view> tokens;
+    std::string_view text = content;
+    size_t start = 0;
+    for (size_t i = 0; i <= text.size(); ++i)
     {
-      if (std::isspace(c) || c == ';')
+      char c = i < text.size() ? text[i] : ' ';
+      if (std::isspace(static_cast<unsigned char>(c)) || c == ';')
       {
-        if (!token.empty())
-        {
-          tokens.push_back(token);
-          token.clear();
-        }
+        if (i > start)
+          tokens.push_back(text.substr(start, i - start));
         if (c == ';')
-          tokens.push_back(";");
-      }
-      else
-      {
-        token += c;
+          tokens.push_back(text.substr(i, 1));
+        start = i + 1;
       }
     }
 
@@ -4435,7 +12367,7 @@ std::vector<bld::fs::Cpp_module> bld::fs::scan_modules(const std::string& path)
 
         if (i + 1 < tokens.size())
         {
-          std::string dep = tokens[i + 1];
+          std::string dep(tokens[i + 1]);
           // Skip std and empty
           if (!bld::str::starts_with(dep, "std") && dep != ";" && !dep.empty())
           {
@@ -4450,7 +12382,7 @@ std::vector<bld::fs::Cpp_module> bld::fs::scan_modules(const std::string& path)
       }
       else if (tokens[i] == "export" && i + 2 < tokens.size() && tokens[i + 1] == "import")
       {
-        std::string dep = tokens[i + 2];
+        std::string dep(tokens[i + 2]);
         // Skip std and empty
         if (!bld::str::starts_with(dep, "std") && dep != ";" && !dep.empty())
         {
@@ -12,12 +12,13 @@ int main(int argc, char *argv[])
   BLD_REBUILD_YOURSELF_ONCHANGE();
   BLD_HANDLE_ARGS();
 
+  bld::fs::Walk_options walk_opts;
+  walk_opts.ignore_files = {".gitignore", ".bldignore"};  // also skips .git
   bld::fs::walk_directory(".", [](bld::fs::Walk_fn_opt& opt) -> bool {
-    if (bld::starts_with(opt.path.string(),"./.git")) opt.action = bld::fs::Walk_act::Ignore;
-    if (opt.path.string() == "./build.conf") opt.action = bld::fs::Walk_act::Stop;
+    if (opt.path == "./build.conf") opt.action = bld::fs::Walk_act::Stop;
     std::cout << opt.path.string() << std::endl;
     return true; // required
-  });
+  }, walk_opts);
 
   if (cfg["test"])
   {
@@ -1,6 +1,7 @@
 #include <array>
 #include <ostream>
 #include <string>
+#include <set>
 #define BLD_NO_LOGGING
 #define B_LDR_IMPLEMENTATION
 #include "../../b_ldr.hpp"
@@ -60,7 +61,7 @@ int main() {
   return 0;
 })";
 
-const int TOTAL_TESTS = 13;
+const int TOTAL_TESTS = 39;
 int TEST_FAILED = 0;
 std::array<Test, TOTAL_TESTS> tests{};
 int id = 1;
@@ -255,6 +256,155 @@ void test_async_redirect()
   }
 }
 
+void test_stdin_buffer()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "execute_async_redirect stdin from buffer"};
+
+  bld::fs::write_entire_file("./test1.cpp", code_io);
+  if (bld::execute(cmd))
+  {
+    std::string input = "Hello buffer";
+    auto fd_out = bld::open_for_write("./output");
+
+    auto proc = bld::execute_async_redirect({"./test"}, bld::Redirect::in_buffer(input, fd_out, bld::INVALID_FD));
+    auto st = bld::wait_proc(proc);
+
+    std::string o;
+    bld::fs::read_file("./output", o);
+    if (st && o == input)
+      tests[x].pass = 1;
+    else
+      TEST_FAILED++;
+    bld::fs::remove("./output");
+
+    x = ind++;
+    tests[x] = {0, id++, "execute_redirect stdin from generator"};
+
+    int chunks = 0;
+    auto gen = [&chunks]() -> std::string_view {
+      static const std::string_view parts[] = {"Hello ", "from ", "generator"};
+      return chunks < 3 ? parts[chunks++] : std::string_view{};
+    };
+
+    fd_out = bld::open_for_write("./output");
+    st = bld::execute_redirect({"./test"}, bld::Redirect::in_generator(gen, fd_out, bld::INVALID_FD));
+
+    o.clear();
+    bld::fs::read_file("./output", o);
+    if (st && o == "Hello from generator")
+      tests[x].pass = 1;
+    else
+      TEST_FAILED++;
+    bld::fs::remove("./output", "./test1.cpp", "test");
+  }
+}
+
+void test_rsp_file()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "response file for long command line"};
+
+  bld::fs::write_entire_file("./test1.cpp", code);
+  bld::set_rsp_policy("g++", {true, 32 * 1024, "@"});
+
+  bld::Command long_cmd = cmd;
+  for (int i = 0; i < 1500; i++) long_cmd.add_parts("-DBLD_RSP_TEST_DEFINE_" + std::to_string(i) + "=\"a b\"");
+
+  auto e = bld::execute(long_cmd);
+
+  // Response file must be gone once the compiler was reaped
+  bool leftover = false;
+  std::string prefix = "bld-" + std::to_string(getpid()) + "-";
+  for (auto &f : bld::fs::get_all_files_with_extensions(std::filesystem::temp_directory_path().string(), {"rsp"}))
+    if (bld::str::starts_with(bld::fs::get_file_name(f), prefix))
+      leftover = true;
+
+  // A per-tool threshold below the usual command line sizes applies as well
+  bld::set_rsp_policy("echo", {true, 64, "@"});
+  std::string echoed;
+  bld::Command short_cmd = {"echo"};
+  for (int i = 0; i < 20; i++) short_cmd.add_parts("argument" + std::to_string(i));
+  bool low_threshold = bld::read_process_output(short_cmd, echoed) && bld::str::starts_with(echoed, "@");
+  bld::set_rsp_policy("echo", {false});
+
+  std::string out;
+  if (e && !leftover && low_threshold && bld::read_process_output({"./test"}, out) && out == "Test")
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::set_rsp_policy("g++", {});
+  bld::fs::remove("./test1.cpp", "test");
+}
+
+void test_limits()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "process limits: nice, rlimit, affinity"};
+
+  bld::Command c = {"sh", "-c", "nice; ulimit -n; grep Cpus_allowed_list /proc/self/status | cut -f2"};
+  c.limits.niceness(5).rlimit(RLIMIT_NOFILE, 64).pin({0});
+
+  std::string out;
+  std::string expected = std::to_string(std::min(19, getpriority(PRIO_PROCESS, 0) + 5)) + "\n64\n0\n";
+  if (bld::read_process_output(c, out) && out == expected)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+}
+
+void test_usage()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "resource usage in Exit_status and Par_exec_res"};
+
+  bld::fs::write_entire_file("./test1.cpp", code_sleep);
+  auto compile = bld::execute(cmd);
+
+  std::vector<bld::Proc> procs;
+  for (int i = 0; i < 2; i++) procs.push_back(bld::execute_async({"./test"}));
+  auto res = bld::wait_procs(procs, false);
+
+  bool each_ok = res.exit_statuses.size() == 2;
+  for (auto &e : res.exit_statuses) each_ok = each_ok && e.usage.wall_ms >= 90 && e.usage.max_rss_kb > 0;
+
+  if (compile && compile.usage.user_ms > 0 && each_ok && res.total_usage.wall_ms >= 180)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./test1.cpp", "test");
+}
+
+void test_timeout()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "timeout and cancel kill the process group"};
+
+  auto start = std::chrono::steady_clock::now();
+
+  // The grandchild sleep must die with the shell, or wait would block for 5s.
+  bld::Command slow = {"sh", "-c", "sleep 5 & sleep 5; wait"};
+  slow.timeout = std::chrono::milliseconds(200);
+  auto e = bld::execute(slow);
+
+  std::vector<bld::Proc> procs;
+  for (int i = 0; i < 2; i++) procs.push_back(bld::execute_async({"sleep", "5"}));
+  auto res = bld::wait_procs(procs, false, std::chrono::milliseconds(200));
+
+  bld::Proc p = bld::execute_async({"sleep", "5"});
+  auto c = bld::cancel(p);
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  bool batch_ok = res.failed_indices.size() == 2 && res.exit_statuses[0].timed_out && res.exit_statuses[1].timed_out;
+
+  if (!e && e.timed_out && batch_ok && c.cancelled && elapsed < std::chrono::seconds(3))
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+}
+
 void test_execute_threads()
 {
   int x = ind++;
@@ -273,6 +423,836 @@ void test_execute_threads()
   bld::fs::remove("./test1.cpp", "test");
 }
 
+void test_pipeline()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "shell-free pipeline"};
+
+  bool ok;
+  {
+    bld::Redirect r("", "./pipe_out.txt", "");
+    auto res = bld::execute_pipeline({{"printf", "b\\nc\\na\\n"}, {"sort"}, {"head", "-n", "2"}}, r);
+    ok = res.completed == 3 && res.failed_indices.empty();
+  }
+  std::string out;
+  bld::fs::read_file("./pipe_out.txt", out);
+
+  // Failing first stage is reported per stage, the rest still runs
+  auto fail = bld::execute_pipeline({{"false"}, {"cat"}});
+  bool fail_ok = fail.exit_statuses.size() == 2 && fail.failed_indices == std::vector<size_t>{0};
+
+  if (ok && out == "a\nb\n" && fail_ok)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./pipe_out.txt");
+}
+
+void test_env_cwd()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "per-command env and cwd"};
+
+  bld::Command c = {"sh", "-c", "pwd; echo $BLD_TEST_VAR; echo ${HOME:-unset}"};
+  c.env["BLD_TEST_VAR"] = "from-command";
+  c.unset_env = {"HOME"};
+  c.cwd = "/";
+
+  std::string out;
+  bool ok = bld::read_process_output(c, out);
+
+  // Our own environment is untouched
+  if (ok && out == "/\nfrom-command\nunset\n" && !bld::env::exists("BLD_TEST_VAR"))
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+}
+
+void test_jobserver()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "jobserver slots and MAKEFLAGS"};
+
+  auto &js = bld::Jobserver::get();
+  if (js.active())  // Already running under a make jobserver
+  {
+    auto t = js.acquire();
+    if (t)
+      tests[x].pass = 1;
+    else
+      TEST_FAILED++;
+    return;
+  }
+
+  // Children get the jobserver in their environment, ours is left alone
+  auto child_makeflags = [] {
+    std::string out;
+    bld::read_process_output({"sh", "-c", "echo \"$MAKEFLAGS\""}, out);
+    return out;
+  };
+  bool served = js.serve(2);
+  bool exported = child_makeflags().find("--jobserver-auth=fifo:") != std::string::npos &&
+                  bld::env::get("MAKEFLAGS").find("--jobserver-auth") == std::string::npos;
+
+  // An overlapping build shares the running jobserver, its stop() must not end it for the first one
+  bool nested = js.serve(8);
+  js.stop();
+  nested = nested && js.active();
+
+  // Two slots: the implicit one and one token in the fifo. A third acquire must wait for a release.
+  auto a = js.acquire();
+  auto b = js.acquire();
+  std::atomic<bool> got_third{false};
+  std::thread waiter([&] { auto c = js.acquire(); got_third = true; });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  bool blocked = !got_third;
+  b.release();
+  waiter.join();
+  a.release();
+
+  js.stop();
+  bool restored = !js.active() && child_makeflags().find("--jobserver-auth") == std::string::npos;
+
+  if (served && exported && nested && blocked && got_third && restored)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+}
+
+void test_daemon()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "build daemon over unix socket"};
+
+  const std::string sock = "./bld-test.sock";
+  bld::fs::write_entire_file("./daemon_in.txt", "1");
+
+  bld::Dep_graph graph;
+  graph.add_dep({"./daemon_out.txt", {"./daemon_in.txt"}, {"cp", "./daemon_in.txt", "./daemon_out.txt"}});
+  bool served = false;
+  std::thread daemon([&] { served = graph.serve_daemon(sock); });
+
+  int code = -1;
+  bool reached = false;
+  for (int i = 0; i < 200 && !reached; i++)
+  {
+    reached = bld::daemon_build(sock, "./daemon_out.txt", code, 1);
+    if (!reached)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::string first, second;
+  bld::fs::read_file("./daemon_out.txt", first);
+
+  // Edit seen through inotify, no restat needed
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bld::fs::write_entire_file("./daemon_in.txt", "2");
+  int code2 = -1;
+  bld::daemon_build(sock, "./daemon_out.txt", code2, 1);
+  bld::fs::read_file("./daemon_out.txt", second);
+
+  bool stopped = bld::stop_daemon(sock);
+  daemon.join();
+
+  if (reached && code == 0 && first == "1" && code2 == 0 && second == "2" && stopped && served && !std::filesystem::exists(sock))
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./daemon_in.txt", "./daemon_out.txt");
+}
+
+void test_build_changed()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "build_changed rebuilds only the dependent cone"};
+
+  bld::fs::write_entire_file("./bc_a.c", "a");
+  bld::fs::write_entire_file("./bc_b.c", "b");
+  auto step = [](const std::string &name) { return bld::Command("sh", "-c", "echo " + name + " >> bc_log.txt; touch bc_" + name); };
+
+  bld::Dep_graph graph;
+  graph.add_dep({"./bc_a.o", {"./bc_a.c"}, step("a.o")});
+  graph.add_dep({"./bc_b.o", {"./bc_b.c"}, step("b.o")});
+  graph.add_dep({"./bc_app", {"./bc_a.o", "./bc_b.o"}, step("app")});
+
+  bool full = graph.build_parallel("./bc_app", 2);
+  std::string log;
+  bld::fs::read_file("./bc_log.txt", log);
+  bool full_ok = full && log.size() == std::string("a.o\nb.o\napp\n").size();
+
+  bld::fs::remove("./bc_log.txt");
+  bool changed = graph.build_changed({"./bc_a.c"}, 2);
+  bld::fs::read_file("./bc_log.txt", log);
+  bool changed_ok = changed && log == "a.o\napp\n";
+
+  // Spelled like `git diff --name-only` prints it
+  bld::fs::remove("./bc_log.txt");
+  bool unprefixed = graph.build_changed({"bc_b.c"}, 2);
+  bld::fs::read_file("./bc_log.txt", log);
+
+  if (full_ok && changed_ok && unprefixed && log == "b.o\napp\n")
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./bc_a.c", "./bc_b.c", "./bc_a.o", "./bc_b.o", "./bc_app", "./bc_log.txt");
+}
+
+void test_worker_executor()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "worker executor runs actions in sandboxes"};
+
+  bld::fs::write_entire_file("./wk_a.txt", "alpha");
+  bld::fs::write_entire_file("./wk_b.txt", "beta");
+
+  bld::Dep_graph graph;
+  graph.set_executor(std::make_shared<bld::Worker_executor>(2));
+  graph.add_dep({"./wk_a.out", {"./wk_a.txt"}, {"sh", "-c", "tr a-z A-Z < wk_a.txt > wk_a.out"}});
+  graph.add_dep({"./wk_b.out", {"./wk_b.txt"}, {"sh", "-c", "tr a-z A-Z < wk_b.txt > wk_b.out"}});
+  graph.add_dep({"./wk_all.out", {"./wk_a.out", "./wk_b.out"}, {"sh", "-c", "cat wk_a.out wk_b.out > wk_all.out"}});
+  graph.add_dep({"./wk_fail", {}, {"sh", "-c", "exit 3"}});
+
+  bool built = graph.build_parallel("./wk_all.out", 2);
+  std::string all;
+  bld::fs::read_file("./wk_all.out", all);
+  bool failed = !graph.build_parallel("./wk_fail", 1);
+
+  bld::Worker_executor executor(1);
+  bld::Action escape{bld::Command("sh", "-c", "touch wk_escaped"), {}, {}};
+  escape.command.cwd = "..";
+  bool refused = !executor.run(escape).normal && !std::filesystem::exists("../wk_escaped");
+
+  if (built && all == "ALPHABETA" && failed && refused)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./wk_a.txt", "./wk_b.txt", "./wk_a.out", "./wk_b.out", "./wk_all.out");
+}
+
+void test_artifact_cache()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "artifact cache restores outputs"};
+
+  bld::fs::write_entire_file("./ac_in.txt", "one");
+  auto cache = std::make_shared<bld::Artifact_cache>("./ac_cache");
+  auto build = [&]
+  {
+    bld::Dep_graph graph;
+    graph.set_cache(cache);
+    bld::Dep dep("./ac_out.txt", {"./ac_in.txt"}, bld::Command("sh", "-c", "echo run >> ac_log.txt; cat ac_in.txt > ac_out.txt"));
+    dep.cacheable = true;
+    graph.add_dep(dep);
+    std::string out;
+    return graph.build_parallel("./ac_out.txt", 1) && bld::fs::read_file("./ac_out.txt", out) ? out : std::string("<failed>");
+  };
+
+  bool first = build() == "one";
+  bld::fs::remove("./ac_out.txt");
+  bool restored = build() == "one";  // Hit, command not run
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));  // Past the mtime granularity of the restore
+  bld::fs::write_entire_file("./ac_in.txt", "two");
+  bool changed = build() == "two";
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bld::fs::write_entire_file("./ac_in.txt", "one");
+  bool back = build() == "one";  // Earlier entry is still valid
+
+  // A truncated blob is a miss, not a restore
+  std::string digest = bld::hash::sha256(std::string("one"));
+  std::string blob = "./ac_cache/cas/" + digest.substr(0, 2) + "/" + digest;
+  std::filesystem::permissions(blob, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+  bld::fs::write_entire_file(blob, "on");
+  bld::fs::remove("./ac_out.txt");
+  bool truncated = build() == "one";
+
+  // Without reflinks, a linking cache restores by hard link rather than copying
+  bld::Artifact_cache linking("./ac_cache", true);
+  std::string key = bld::hash::sha256(std::string("ac_link"));
+  bld::fs::write_entire_file("./ac_link.txt", "link");
+  bld::fs::Copy_method method = bld::fs::Copy_method::NONE;
+  bld::fs::copy_file_fast("./ac_link.txt", "./ac_probe.txt", {}, &method);
+  bool linked = linking.store(key, {"./ac_link.txt"});
+  bld::fs::remove("./ac_link.txt");
+  linked = linked && linking.restore(key, {"./ac_link.txt"}) &&
+                (method == bld::fs::Copy_method::REFLINK || std::filesystem::hard_link_count("./ac_link.txt") == 2);
+
+  std::string log;
+  bld::fs::read_file("./ac_log.txt", log);
+  if (first && restored && changed && back && truncated && linked && log == "run\nrun\nrun\n" && cache->hits() == 2)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./ac_in.txt", "./ac_out.txt", "./ac_log.txt", "./ac_link.txt", "./ac_probe.txt");
+  bld::fs::remove_dir("./ac_cache");
+}
+
+void test_remote_cache()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "remote cache shares outputs between cache dirs"};
+
+  bld::Cache_server server("./rc_server");
+  bld::fs::write_entire_file("./rc_a.txt", "a");
+  bld::fs::write_entire_file("./rc_b.txt", "b");
+
+  auto build = [&](const std::string &local)
+  {
+    auto cache = std::make_shared<bld::Artifact_cache>(local);
+    cache->set_remote(std::make_shared<bld::Remote_cache>(server.url(), 2));
+    bld::Dep_graph graph;
+    graph.set_cache(cache);
+    for (std::string n : {"a", "b"})
+    {
+      bld::Dep dep("./rc_" + n + ".out", {"./rc_" + n + ".txt"}, bld::Command("sh", "-c", "echo " + n + " >> rc_log.txt; cat rc_" + n + ".txt rc_" + n + ".txt > rc_" + n + ".out"));
+      dep.cacheable = true;
+      graph.add_dep(dep);
+    }
+    graph.add_dep(bld::Dep("all", std::vector<std::string>{"./rc_a.out", "./rc_b.out"}, true));
+    return graph.build_parallel("all", 2) ? cache->hits() : size_t(-1);
+  };  // Destroying the cache waits for its uploads
+
+  size_t cold = build("./rc_local1");
+  bld::fs::remove("./rc_a.out", "./rc_b.out");
+  size_t warm = build("./rc_local2");  // Empty local cache, everything comes from the server
+
+  std::string a, log;
+  bld::fs::read_file("./rc_a.out", a);
+  bld::fs::read_file("./rc_log.txt", log);
+  // An oversized blob is refused, and the entry pointing at it is not uploaded
+  server.max_body = 64;
+  bld::fs::write_entire_file("./rc_big.out", std::string(100, 'x'));
+  auto remote = std::make_shared<bld::Remote_cache>(server.url(), 1);
+  bld::Artifact_cache big_cache("./rc_local3");
+  big_cache.set_remote(remote);
+  std::string key = bld::hash::sha256(std::string("rc_big"));
+  bool stored = big_cache.store(key, {"./rc_big.out"});
+  remote->flush();
+  bool skipped = stored && !std::filesystem::exists("./rc_server/ac/" + key.substr(0, 2) + "/" + key);
+
+  if (server.ok() && cold == 0 && warm == 2 && a == "aa" && log.size() == 4 && skipped)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  server.stop();
+  bld::fs::remove("./rc_a.txt", "./rc_b.txt", "./rc_a.out", "./rc_b.out", "./rc_log.txt", "./rc_big.out");
+  bld::fs::remove_dir("./rc_server");
+  bld::fs::remove_dir("./rc_local1");
+  bld::fs::remove_dir("./rc_local2");
+  bld::fs::remove_dir("./rc_local3");
+}
+
+void test_copy_tree()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "copy_tree copies and skips unchanged files"};
+
+  bld::fs::create_directory("./ct_src/sub/deep");
+  bld::fs::write_entire_file("./ct_src/a.txt", "a");
+  bld::fs::write_entire_file("./ct_src/sub/b.txt", std::string(300 * 1024, 'b'));
+  bld::fs::write_entire_file("./ct_src/sub/deep/run.sh", "#!/bin/sh\n");
+  std::filesystem::permissions("./ct_src/sub/deep/run.sh", std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+  std::filesystem::create_symlink("a.txt", "./ct_src/link");
+
+  bld::fs::Copy_options opts;
+  opts.threads = 3;
+  auto first = bld::fs::copy_tree("./ct_src", "./ct_dst", opts);
+  auto second = bld::fs::copy_tree("./ct_src", "./ct_dst", opts);
+  bld::fs::write_entire_file("./ct_src/a.txt", "A");
+  auto third = bld::fs::copy_tree("./ct_src", "./ct_dst", opts);
+
+  std::string a, b;
+  bld::fs::read_file("./ct_dst/link", a);
+  bld::fs::read_file("./ct_dst/sub/b.txt", b);
+  bool exec = (std::filesystem::status("./ct_dst/sub/deep/run.sh").permissions() & std::filesystem::perms::owner_exec) != std::filesystem::perms::none;
+
+  // procfs reports size 0 for files with content
+  std::string status;
+  bool sized = !std::filesystem::exists("/proc/self/status") ||
+               (bld::fs::copy_file_fast("/proc/self/status", "./ct_dst/status") && bld::fs::read_file("./ct_dst/status", status) && !status.empty());
+
+  if (first && first.copied == 4 && second.skipped == 3 && third.skipped == 2 && a == "A" && b.size() == 300 * 1024 && exec && sized &&
+      std::filesystem::is_symlink("./ct_dst/link"))
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./ct_src");
+  bld::fs::remove_dir("./ct_dst");
+}
+
+void test_mapped_lines()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "mapped file and lazy lines"};
+
+  bld::fs::write_entire_file("./ml.txt", "a\n\nfoo bar foo\nlast");
+  std::vector<std::string_view> got;
+  bld::fs::Mapped_file file("./ml.txt");
+  for (std::string_view line : bld::fs::lines(file.view())) got.push_back(line);
+  bool split = got == std::vector<std::string_view>{"a", "", "foo bar foo", "last"};
+
+  size_t n = 0;
+  for (auto line : bld::fs::lines("x\ny\n")) n += line.size();
+  bool trailing = n == 2 && bld::fs::lines("").begin() == bld::fs::lines("").end();
+  file.close();
+
+  bool replaced = bld::fs::replace_in_file("./ml.txt", "foo", "baz");
+  std::string content, proc;
+  bld::fs::read_file("./ml.txt", content);
+  bool special = bld::fs::read_file("/proc/self/status", proc) && !proc.empty();  // Size 0 in stat, read instead of mapped
+
+  if (file.view().empty() && split && trailing && replaced && content == "a\n\nbaz bar baz\nlast" && special)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./ml.txt");
+}
+
+void test_atomic_write()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "atomic write keeps mtime, mode and links"};
+
+  bld::fs::create_directory("./aw");
+  bld::fs::write_entire_file("./aw/out.sh", "v1");
+  std::filesystem::permissions("./aw/out.sh", std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+  std::filesystem::create_symlink("out.sh", "./aw/link");
+  std::filesystem::create_hard_link("./aw/out.sh", "./aw/hard");
+  auto before = std::filesystem::last_write_time("./aw/out.sh");
+
+  bld::fs::Write_options opts;
+  opts.if_changed = true;
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bool same = bld::fs::write_file_atomic("./aw/out.sh", "v1", opts) && std::filesystem::last_write_time("./aw/out.sh") == before;
+
+  bld::fs::Sync_batch batch;
+  opts.durable = true;
+  opts.batch = &batch;
+  bool changed = bld::fs::write_file_atomic("./aw/link", "v2", opts) && batch.commit();
+
+  std::string content;
+  bld::fs::read_file("./aw/out.sh", content);
+  bool exec = (std::filesystem::status("./aw/out.sh").permissions() & std::filesystem::perms::owner_exec) != std::filesystem::perms::none;
+  std::string linked;
+  bld::fs::read_file("./aw/hard", linked);
+
+  // A FIFO is written to, not replaced by a file
+  bool fifo = true;
+  size_t expected = 3;
+#ifndef _WIN32
+  expected = 4;
+  char got[8] = {};
+  int rd = ::mkfifo("./aw/pipe", 0644) == 0 ? ::open("./aw/pipe", O_RDONLY | O_NONBLOCK) : -1;
+  fifo = rd != -1 && bld::fs::write_file_atomic("./aw/pipe", "v3") && ::read(rd, got, sizeof(got)) == 2 && std::string(got) == "v3" &&
+         std::filesystem::is_fifo("./aw/pipe");
+  if (rd != -1)
+    ::close(rd);
+#endif
+  size_t entries = std::distance(std::filesystem::directory_iterator("./aw"), std::filesystem::directory_iterator());
+
+  if (same && changed && content == "v2" && linked == "v2" && fifo && exec && std::filesystem::is_symlink("./aw/link") &&
+      entries == expected)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./aw");
+}
+
+void test_parallel_walk()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "parallel walk matches sequential walk"};
+
+  for (int i = 0; i < 8; ++i)
+    for (int j = 0; j < 8; ++j)
+    {
+      std::string dir = "./pw/d" + std::to_string(i) + "/s" + std::to_string(j);
+      std::filesystem::create_directories(dir);
+      bld::fs::write_entire_file(dir + "/f.txt", "x");
+    }
+  std::filesystem::create_directories("./pw/skip/deep");
+  bld::fs::write_entire_file("./pw/skip/deep/hidden.txt", "x");
+  std::filesystem::create_directory_symlink("d0", "./pw/link");
+
+  auto prune = [](bld::fs::Walk_fn_opt &opt) {
+    if (opt.path.filename() == "skip")
+      opt.action = bld::fs::Walk_act::Ignore;
+  };
+
+  std::set<std::string> seq, par;
+  bld::fs::walk_directory("./pw", [&](bld::fs::Walk_fn_opt &opt) -> bool {
+    prune(opt);
+    seq.insert(opt.path.string());
+    return true;
+  });
+
+  std::mutex m;
+  bld::fs::Walk_options opts;
+  opts.threads = 4;
+  bool ok = bld::fs::walk_directory_parallel("./pw", [&](bld::fs::Walk_fn_opt &opt) -> bool {
+    prune(opt);
+    std::lock_guard<std::mutex> lock(m);
+    par.insert(opt.path.string());
+    return true;
+  }, opts);
+
+  std::atomic<int> seen{0};
+  bool stopped = bld::fs::walk_directory_parallel("./pw", [&](bld::fs::Walk_fn_opt &opt) -> bool {
+    seen++;
+    opt.action = bld::fs::Walk_act::Stop;
+    return true;
+  }, opts);
+
+  // 8 d*, 64 s*, 64 files, skip, link
+  if (ok && stopped && seq == par && par.size() == 138 && !par.count("./pw/skip/deep") && seen < 138 &&
+      !bld::fs::walk_directory_parallel("./pw/missing", [](bld::fs::Walk_fn_opt &) { return true; }))
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./pw");
+}
+
+void test_lazy_listing()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "lazy listing streams and prunes"};
+
+  std::filesystem::create_directories("./ll/src/sub");
+  std::filesystem::create_directories("./ll/build/obj");
+  bld::fs::write_entire_file("./ll/src/a.cpp", "");
+  bld::fs::write_entire_file("./ll/src/sub/b.CPP", "");
+  bld::fs::write_entire_file("./ll/src/sub/.cpp", "");
+  bld::fs::write_entire_file("./ll/build/obj/a.o", "");
+  bld::fs::write_entire_file("./ll/main.cpp", "");
+
+  std::set<std::string> expected;
+  for (const auto &e : std::filesystem::recursive_directory_iterator("./ll"))
+    if (e.is_regular_file())
+      expected.insert(e.path().string());
+  auto listed = bld::fs::list_files_in_dir("./ll", true);
+  bool same = std::set<std::string>(listed.begin(), listed.end()) == expected && listed.size() == 5;
+
+  // Prune build/, stop at the first file
+  std::vector<std::string> seen;
+  auto entries = bld::fs::Entries("./ll", true);
+  for (const auto &e : entries)
+  {
+    if (e.path == "./ll/build")
+      entries.skip_children();
+    seen.push_back(e.path);
+  }
+  bool pruned = std::find(seen.begin(), seen.end(), "./ll/build/obj") == seen.end() && seen.size() == 7;
+
+  std::string first;
+  for (const auto &e : bld::fs::files("./ll", true))
+  {
+    first = e.path;
+    break;
+  }
+
+  std::vector<std::string> sources;
+  for (const auto &e : bld::fs::files_with_extensions("./ll", {"cpp"}, true, true))
+    sources.push_back(e.path);
+
+  auto mains = bld::fs::get_all_files_with_name("./ll", "main.cpp", true);
+  auto dirs = bld::fs::list_directories("./ll");
+
+  if (same && pruned && expected.count(first) && sources.size() == 3 && mains.size() == 1 && dirs.size() == 2 &&
+      !bld::fs::files("./ll/missing").ok())
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./ll");
+}
+
+void test_glob()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "glob include/exclude and cached re-glob"};
+
+  std::filesystem::create_directories("./gl/src/gen");
+  std::filesystem::create_directories("./gl/src/a/.hidden");
+  std::filesystem::create_directories("./gl/include");
+  for (auto f : {"src/main.cpp", "src/gen/x.cpp", "src/a/b.cc", "src/a/b.h", "src/a/.hidden/c.cpp", "include/d.h", "top.cpp"})
+    bld::fs::write_entire_file(std::string("./gl/") + f, "");
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));  // old enough to be cached
+  auto first = bld::fs::glob("gl/src/**/*.{cpp,cc}", "gl/*.cpp", "!gl/src/gen/**");
+  std::vector<std::string> expected = {"gl/src/a/b.cc", "gl/src/main.cpp", "gl/top.cpp"};
+
+  // The directory changes, the listing cached for it must not be reused
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bld::fs::write_entire_file("./gl/src/a/new.cpp", "");
+  auto second = bld::fs::glob("gl/src/**/*.{cpp,cc}", "gl/*.cpp", "!gl/src/gen/**");
+
+  bld::fs::Glob headers({"gl/**/*.h", "!gl/include"});
+  if (first == expected && second.size() == 4 && second[1] == "gl/src/a/new.cpp" && headers.match("gl/src/a/b.h") &&
+      !headers.match("gl/include/d.h") && headers.files() == std::vector<std::string>{"gl/src/a/b.h"})
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./gl");
+}
+
+void test_ignore_walk()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "walk prunes gitignored subtrees"};
+
+  std::filesystem::create_directories("./iw/.git/objects");
+  std::filesystem::create_directories("./iw/build/deep");
+  std::filesystem::create_directories("./iw/src/gen");
+  std::filesystem::create_directories("./iw/docs/build");
+  bld::fs::write_entire_file("./iw/.gitignore", "# outputs\nbuild/\n*.o\n!keep.o\n/docs/*.tmp\n");
+  bld::fs::write_entire_file("./iw/src/.bldignore", "gen\n*.[ch]pp.orig\n");
+  for (auto f : {"build/deep/a.cpp", "src/a.cpp", "src/a.o", "src/keep.o", "src/b.cpp.orig", "src/gen/g.cpp", "docs/x.tmp",
+                 "docs/build/y.md", "src/x.tmp", ".git/objects/z"})
+    bld::fs::write_entire_file(std::string("./iw/") + f, "");
+
+  bld::fs::Walk_options opts;
+  opts.ignore_files = {".gitignore", ".bldignore"};
+  std::set<std::string> seq, par;
+  bld::fs::walk_directory("./iw", [&](bld::fs::Walk_fn_opt &opt) -> bool {
+    seq.insert(opt.path.string());
+    return true;
+  }, opts);
+
+  std::mutex m;
+  opts.threads = 3;
+  bld::fs::walk_directory_parallel("./iw", [&](bld::fs::Walk_fn_opt &opt) -> bool {
+    std::lock_guard<std::mutex> lock(m);
+    par.insert(opt.path.string());
+    return true;
+  }, opts);
+
+  std::set<std::string> expected = {"./iw/.gitignore", "./iw/src", "./iw/src/.bldignore", "./iw/src/a.cpp", "./iw/src/keep.o",
+                                    "./iw/src/x.tmp", "./iw/docs"};
+  if (seq == expected && par == expected)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./iw");
+}
+
+void test_merkle_tree()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "merkle tree detects changes incrementally"};
+
+  std::filesystem::create_directories("./mt/src/a");
+  std::filesystem::create_directories("./mt/src/b");
+  std::filesystem::create_directories("./mt/build");
+  bld::fs::write_entire_file("./mt/.gitignore", "build/\n");
+  bld::fs::write_entire_file("./mt/src/a/x.cpp", "x");
+  bld::fs::write_entire_file("./mt/src/b/y.cpp", "y");
+
+  bld::fs::Merkle_options opts;
+  opts.ignore_files = {".gitignore"};
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bld::fs::Merkle_tree tree("./mt", "./mt-state/tree", opts);
+  bool first = tree.update();
+  bool noop = !tree.update() && tree.stats().dirs_read == 0 && tree.changed().empty();
+
+  // Build outputs are ignored, an in-place edit is seen when files are stat'ed
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bld::fs::write_entire_file("./mt/build/out.o", "o");
+  bld::fs::append_file("./mt/src/b/y.cpp", "more");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bool edited = tree.update() && tree.changed() == std::vector<std::string>{"src/b"};
+
+  // A fresh instance picks up the saved state, trusting directory mtimes skips file stats
+  opts.trust_dir_mtime = true;
+  bld::fs::Merkle_tree trusted("./mt", "./mt-state/tree", opts);
+  bool reloaded = !trusted.update() && trusted.stats().files_stated == 0 && trusted.hash() == tree.hash();
+  bld::fs::write_entire_file("./mt/src/a/new.cpp", "n");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bool added = trusted.update() && trusted.changed() == std::vector<std::string>{"src/a"} && trusted.stats().dirs_read == 1;
+
+  if (first && noop && edited && reloaded && added)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./mt");
+  bld::fs::remove_dir("./mt-state");
+}
+
+void test_stat_batch()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "batched stats and prefetched dependency checks"};
+
+  bld::fs::write_entire_file("./sb_a.c", "a");
+  bld::fs::write_entire_file("./sb_b.c", "bb");
+  std::vector<std::string> paths = {"./sb_a.c", "./sb_missing.c", "./sb_b.c"};
+
+  auto matches = [&](const std::vector<bld::fs::Stat_result> &res) {
+    if (res.size() != paths.size() || res[1].exists)
+      return false;
+    for (size_t i : {0, 2})
+      if (!res[i].exists || res[i].mtime != std::filesystem::last_write_time(paths[i]) ||
+          res[i].size != std::filesystem::file_size(paths[i]))
+        return false;
+    return true;
+  };
+  bool batched = matches(bld::fs::stat_batch(paths)) && matches(bld::fs::stat_batch(paths, false));
+
+  // The prefetched timestamps must still see outputs written during the build
+  auto step = [](const std::string &name) { return bld::Command("sh", "-c", "echo " + name + " >> sb_log.txt; touch sb_" + name); };
+  bld::Dep_graph graph;
+  graph.add_dep({"./sb_a.o", {"./sb_a.c"}, step("a.o")});
+  graph.add_dep({"./sb_app", {"./sb_a.o", "./sb_b.c"}, step("app")});
+
+  std::string log;
+  bool full = graph.build_parallel("./sb_app", 2) && bld::fs::read_file("./sb_log.txt", log) && log == "a.o\napp\n";
+  bld::fs::remove("./sb_log.txt");
+  bool noop = graph.build_parallel("./sb_app", 2) && !std::filesystem::exists("./sb_log.txt");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  bld::fs::write_entire_file("./sb_b.c", "b2");
+  bool relink = graph.build_parallel("./sb_app", 2) && bld::fs::read_file("./sb_log.txt", log) && log == "app\n";
+
+  if (batched && full && noop && relink)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./sb_a.c", "./sb_b.c", "./sb_a.o", "./sb_app", "./sb_log.txt");
+}
+
+void test_fs_batch()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "batch mkdir, copy, remove and parallel remove_tree"};
+
+  bld::fs::write_entire_file("./fb_file", "f");
+  auto made = bld::fs::create_dirs_batch({"./fb/a/1", "./fb/a/2", "./fb/b", "./fb_file/sub"});
+  bool mkdirs = made.done == 3 && made.failed.size() == 1 && made.failed[0].first == "./fb_file/sub" &&
+                std::filesystem::is_directory("./fb/a/2");
+
+  auto copied = bld::fs::copy_batch({{"./fb_file", "./fb/a/1/x"}, {"./fb_file", "./fb/c/y"}, {"./fb_missing", "./fb/z"}});
+  bool copies = copied.done == 2 && copied.failed.size() == 1 && copied.failed[0].first == "./fb_missing" &&
+                std::filesystem::exists("./fb/c/y");
+
+  // Missing paths are fine, a non-empty directory is not
+  auto removed = bld::fs::remove_batch({"./fb/c/y", "./fb/c", "./fb/gone", "./fb/a"});
+  bool removes = removed.done == 3 && removed.failed.size() == 1 && removed.failed[0].first == "./fb/a" && !std::filesystem::exists("./fb/c");
+
+  // Directories go after their contents, whatever the order they are listed in
+  bld::fs::create_dirs_batch({"./fb/d/e"});
+  bld::fs::write_entire_file("./fb/d/e/f", "f");
+  auto nested = bld::fs::remove_batch({"./fb/d", "./fb/d/e", "./fb/d/e/f"}, false);
+  removes = removes && nested && nested.done == 3 && !std::filesystem::exists("./fb/d");
+
+  // Big enough for helper threads to join in
+  std::vector<std::string> dirs;
+  for (int d = 0; d < 20; d++) dirs.push_back("./fb/b/" + std::to_string(d));
+  bld::fs::create_dirs_batch(dirs);
+  for (const auto &dir : dirs)
+    for (int f = 0; f < 20; f++) bld::fs::write_entire_file(dir + "/" + std::to_string(f), "x");
+
+  // Links are removed, not followed
+  std::filesystem::create_directory_symlink(std::filesystem::absolute("./fb_keep"), "./fb/b/link");
+  std::filesystem::create_directories("./fb_keep");
+  bld::fs::write_entire_file("./fb_keep/k", "k");
+  auto tree = bld::fs::remove_tree("./fb", 4);
+  bool trees = tree && tree.done > 420 && !std::filesystem::exists("./fb") && std::filesystem::exists("./fb_keep/k");
+
+  if (mkdirs && copies && removes && trees)
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove_dir("./fb_keep");
+  bld::fs::remove("./fb_file");
+}
+
+void test_trace()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "chrome trace of builds, jobs and processes"};
+
+  bool idle = !bld::trace::enabled() && !bld::trace::stop();
+
+  bld::trace::start("./tr_trace.json");
+  bld::Dep_graph graph;
+  graph.add_dep({"./tr_a", {}, {"touch", "tr_a"}});
+  graph.add_dep({"./tr_all", {"./tr_a"}, {"touch", "tr_all"}});
+  bool built = graph.build_parallel("./tr_all", 2);
+  auto exec = bld::execute_threads({{"true"}, {"true"}}, 2);
+  std::vector<bld::Proc> procs;
+  procs.push_back(bld::execute_async({"true"}));
+  bld::wait_procs(procs, false);
+  bool written = bld::trace::stop() && !bld::trace::enabled();
+
+  std::string json;
+  bld::fs::read_file("./tr_trace.json", json);
+  bool complete = true;
+  for (const char *want : {"\"traceEvents\"", "\"name\":\"./tr_a\"", "\"name\":\"./tr_all\"", "build worker 0", "stat pass", "cycle check",
+                           "graph prep", "cache lookup", "exec worker 0", "wait_procs 0", "\"ph\":\"X\""})
+    complete = complete && json.find(want) != std::string::npos;
+
+  if (idle && built && exec.failed_indices.empty() && written && complete && json.back() == '\n')
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./tr_a", "./tr_all", "./tr_trace.json");
+}
+
+void test_watch()
+{
+  int x = ind++;
+  tests[x] = {0, id++, "hot reload rebuilds on change"};
+
+  bld::fs::write_entire_file("./watch_in.txt", "1");
+  bld::Dep_graph graph;
+  graph.add_dep({"./watch_out.txt", {"./watch_in.txt"}, {"cp", "./watch_in.txt", "./watch_out.txt"}});
+  graph.add_dep({"./watch_other.txt", {"./watch_in.txt"}, {"cp", "./watch_in.txt", "./watch_other.txt"}});  // Not ours to build
+
+  std::atomic<bool> stop{false};
+  bool watched = false;
+  std::thread watcher([&] { watched = graph.watch("./watch_out.txt", 1, std::chrono::milliseconds(20), &stop); });
+
+  auto content_is = [](const std::string &want)
+  {
+    std::string got;
+    for (int i = 0; i < 200; i++)
+    {
+      if (bld::fs::read_file("./watch_out.txt", got) && got == want)
+        return true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+
+  bool first = content_is("1");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  bld::fs::write_entire_file("./watch_in.txt", "2");
+  bool second = content_is("2");
+
+  stop = true;
+  watcher.join();
+
+  if (first && second && watched && !std::filesystem::exists("./watch_other.txt"))
+    tests[x].pass = 1;
+  else
+    TEST_FAILED++;
+
+  bld::fs::remove("./watch_in.txt", "./watch_out.txt", "./watch_other.txt");
+}
+
 void test_shell()
 {
   int x = ind++;
@@ -321,7 +1301,32 @@ int main(int argc, char *argv[])
   test_wait_and_cleanup();
   test_wait_procs();
   test_async_redirect();
+  test_stdin_buffer();
+  test_rsp_file();
+  test_limits();
+  test_usage();
+  test_timeout();
   test_execute_threads();
+  test_pipeline();
+  test_env_cwd();
+  test_jobserver();
+  test_daemon();
+  test_build_changed();
+  test_worker_executor();
+  test_artifact_cache();
+  test_remote_cache();
+  test_copy_tree();
+  test_mapped_lines();
+  test_atomic_write();
+  test_parallel_walk();
+  test_lazy_listing();
+  test_glob();
+  test_ignore_walk();
+  test_merkle_tree();
+  test_stat_batch();
+  test_fs_batch();
+  test_trace();
+  test_watch();
   test_shell();
   test_read_output();
 